@@ -42,6 +42,7 @@ void DB::initNetwork(nlohmann::json &network)
 	if (!network.count("name")) network["name"] = "";
 	if (!network.count("multicastLimit")) network["multicastLimit"] = (uint64_t)32;
 	if (!network.count("enableBroadcast")) network["enableBroadcast"] = true;
+	if (!network.count("enableNeighborCache")) network["enableNeighborCache"] = false;
 	if (!network.count("v4AssignMode")) network["v4AssignMode"] = {{"zt",false}};
 	if (!network.count("v6AssignMode")) network["v6AssignMode"] = {{"rfc4193",false},{"zt",false},{"6plane",false}};
 	if (!network.count("authTokens")) network["authTokens"] = {{}};
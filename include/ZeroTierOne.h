@@ -123,6 +123,15 @@ extern "C" {
  */
 #define ZT_MAX_PHYSMTU (ZT_MAX_PHYSPAYLOAD + ZT_MAX_HEADROOM)
 
+/**
+ * Flag OR'd into the TTL of a wire packet send to ask that it not be fragmented
+ *
+ * This is set on path MTU probes, which must arrive as one IP datagram or
+ * not at all. Since TTLs above 255 mean "default" a host that does not know
+ * this flag will still send the probe, but discovery may then overestimate.
+ */
+#define ZT_WIRE_PACKET_DONT_FRAGMENT 0x10000
+
 /**
  * Maximum size of a remote trace message's serialized Dictionary
  */
@@ -330,6 +339,8 @@ extern "C" {
 #define ZT_REMOTE_TRACE_FIELD__CREDENTIAL_REVOCATION_TARGET "credRevocationTarget"
 #define ZT_REMOTE_TRACE_FIELD__REASON "reason"
 #define ZT_REMOTE_TRACE_FIELD__NETWORK_CONTROLLER_ID "networkControllerId"
+#define ZT_REMOTE_TRACE_FIELD__OLD_REMOTE_PHYADDR "oldRemotePhyAddr"
+#define ZT_REMOTE_TRACE_FIELD__DETECTION_TIME "detectionTime"
 
 // Event types in remote traces
 #define ZT_REMOTE_TRACE_EVENT__RESETTING_PATHS_IN_SCOPE 0x1000
@@ -339,6 +350,7 @@ extern "C" {
 #define ZT_REMOTE_TRACE_EVENT__PACKET_MAC_FAILURE 0x1004
 #define ZT_REMOTE_TRACE_EVENT__PACKET_INVALID 0x1005
 #define ZT_REMOTE_TRACE_EVENT__DROPPED_HELLO 0x1006
+#define ZT_REMOTE_TRACE_EVENT__PEER_ACTIVE_PATH_CHANGED 0x1007
 #define ZT_REMOTE_TRACE_EVENT__OUTGOING_NETWORK_FRAME_DROPPED 0x2000
 #define ZT_REMOTE_TRACE_EVENT__INCOMING_NETWORK_ACCESS_DENIED 0x2001
 #define ZT_REMOTE_TRACE_EVENT__INCOMING_NETWORK_FRAME_DROPPED 0x2002
@@ -355,6 +367,7 @@ extern "C" {
 #define ZT_REMOTE_TRACE_EVENT__PACKET_MAC_FAILURE_S "1004"
 #define ZT_REMOTE_TRACE_EVENT__PACKET_INVALID_S "1005"
 #define ZT_REMOTE_TRACE_EVENT__DROPPED_HELLO_S "1006"
+#define ZT_REMOTE_TRACE_EVENT__PEER_ACTIVE_PATH_CHANGED_S "1007"
 #define ZT_REMOTE_TRACE_EVENT__OUTGOING_NETWORK_FRAME_DROPPED_S "2000"
 #define ZT_REMOTE_TRACE_EVENT__INCOMING_NETWORK_ACCESS_DENIED_S "2001"
 #define ZT_REMOTE_TRACE_EVENT__INCOMING_NETWORK_FRAME_DROPPED_S "2002"
@@ -455,6 +468,25 @@ enum ZT_MultipathMode
 	 * Will cease sending traffic over links that appear to be stale.
 	 */
 	ZT_MULTIPATH_PROPORTIONALLY_BALANCED = 2,
+
+	/**
+	 * Each transport flow (IP protocol, addresses and ports) is pinned to one path.
+	 *
+	 * New flows go to the alive path with the fewest flows relative to its
+	 * allocation. A flow only moves if its path dies or path allocations change
+	 * significantly, so TCP sessions are not reordered across links.
+	 */
+	ZT_MULTIPATH_FLOW_PINNED = 3,
+
+	/**
+	 * All traffic is sent over the highest ranked path that is answering.
+	 *
+	 * The active path is probed while traffic over it goes unanswered, and traffic
+	 * fails over to the next ranked path once it has been unanswered for the
+	 * configured failover budget. Traffic fails back once the better path has
+	 * been answering again for a while.
+	 */
+	ZT_MULTIPATH_ACTIVE_BACKUP = 4
 };
 
 /**
@@ -653,6 +685,76 @@ typedef struct
 	 * True if some kind of connectivity appears available
 	 */
 	int online;
+
+	/**
+	 * Number of destinations with packets waiting on WHOIS or a path
+	 */
+	unsigned long pendingSendDestinations;
+
+	/**
+	 * Total number of packets waiting on WHOIS or a path
+	 */
+	unsigned long pendingSendPackets;
+
+	/**
+	 * Depth of the deepest per-destination pending send queue
+	 */
+	unsigned long pendingSendMaxDepth;
+
+	/**
+	 * Pending packets dropped because their destination's queue or all queues together were full
+	 */
+	uint64_t pendingSendDropped;
+
+	/**
+	 * Pending packets dropped because no peer or path appeared in time
+	 */
+	uint64_t pendingSendExpired;
+
+	/**
+	 * Number of full peers in memory
+	 */
+	unsigned long peers;
+
+	/**
+	 * Number of idle peers demoted to compact cold form
+	 */
+	unsigned long coldPeers;
+
+	/**
+	 * Approximate memory used by one full peer in bytes
+	 */
+	unsigned long bytesPerPeer;
+
+	/**
+	 * Approximate memory used by one cold peer in bytes
+	 */
+	unsigned long bytesPerColdPeer;
+
+	/**
+	 * Memory budget for full peers in bytes (0 if unlimited)
+	 */
+	uint64_t peerMemoryBudget;
+
+	/**
+	 * Keepalive pings sent to active peers
+	 */
+	uint64_t pingsSent;
+
+	/**
+	 * Due keepalive pings put off to a later run by the ping budget
+	 */
+	uint64_t pingsDeferred;
+
+	/**
+	 * Keepalive pings per second over the last complete measurement window
+	 */
+	unsigned long pingRate;
+
+	/**
+	 * Most keepalive pings sent in one background task run over the last complete measurement window
+	 */
+	unsigned long pingBurst;
 } ZT_NodeStatus;
 
 /**
@@ -1211,6 +1313,71 @@ typedef struct
 		uint64_t mac; /* MAC in lower 48 bits */
 		uint32_t adi; /* Additional distinguishing information, usually zero except for IPv4 ARP groups */
 	} multicastSubscriptions[ZT_MAX_MULTICAST_SUBSCRIPTIONS];
+
+	/**
+	 * Number of per-flow filter decisions currently cached
+	 */
+	unsigned int flowCacheSize;
+
+	/**
+	 * Frames whose filter decision came from the flow cache
+	 */
+	uint64_t flowCacheHits;
+
+	/**
+	 * Frames filtered by evaluating rules and then cached
+	 */
+	uint64_t flowCacheMisses;
+
+	/**
+	 * Frames filtered without the cache because rules or frame type make them uncacheable
+	 */
+	uint64_t flowCacheBypasses;
+
+	/**
+	 * If nonzero, ARP and NDP queries are answered locally when the owner of the IP is known
+	 */
+	int neighborCacheEnabled;
+
+	/**
+	 * Number of IP to MAC mappings in the neighbor cache
+	 */
+	unsigned int neighborCacheSize;
+
+	/**
+	 * ARP and NDP queries answered from the neighbor cache instead of being multicast
+	 */
+	uint64_t neighborCacheAnswered;
+
+	/**
+	 * ARP and NDP queries the neighbor cache could not answer
+	 */
+	uint64_t neighborCacheMisses;
+
+	/**
+	 * Outgoing frames run through the compressor
+	 */
+	uint64_t compressionAttempts;
+
+	/**
+	 * Outgoing frames sent uncompressed without trying because their traffic recently proved incompressible
+	 */
+	uint64_t compressionSkipped;
+
+	/**
+	 * Payload bytes run through the compressor
+	 */
+	uint64_t compressionBytesIn;
+
+	/**
+	 * Payload bytes saved by compression
+	 */
+	uint64_t compressionBytesSaved;
+
+	/**
+	 * Time spent compressing outgoing frames in microseconds
+	 */
+	uint64_t compressionCpuTime;
 } ZT_VirtualNetworkConfig;
 
 /**
@@ -1307,6 +1474,36 @@ typedef struct
 	 */
 	float allocation;
 
+	/**
+	 * Number of transport flows pinned to this path (flow-pinned multipath mode)
+	 */
+	unsigned int flows;
+
+	/**
+	 * Bytes sent since anything was last received via this path
+	 */
+	uint64_t unansweredBytes;
+
+	/**
+	 * Number of times this path has been declared dead
+	 */
+	unsigned int failures;
+
+	/**
+	 * Milliseconds from the first unanswered packet to the last time this path was declared dead
+	 */
+	unsigned int lastDetectionTime;
+
+	/**
+	 * Largest packet sent via this path without fragmenting (discovered or configured)
+	 */
+	unsigned int mtu;
+
+	/**
+	 * Is path currently declared dead?
+	 */
+	int failed;
+
 	/**
 	 * Name of physical interface (for monitoring)
 	 */
@@ -1567,7 +1764,7 @@ typedef int (*ZT_StateGetFunction)(
  *  (4) Remote address
  *  (5) Packet data
  *  (6) Packet length
- *  (7) Desired IP TTL or 0 to use default
+ *  (7) Desired IP TTL or 0 to use default, optionally OR'd with ZT_WIRE_PACKET_DONT_FRAGMENT
  *
  * If there is only one local socket, the local socket can be ignored.
  * If the local socket is -1, the packet should be sent out from all
@@ -1575,7 +1772,9 @@ typedef int (*ZT_StateGetFunction)(
  *
  * If TTL is nonzero, packets should have their IP TTL value set to this
  * value if possible. If this is not possible it is acceptable to ignore
- * this value and send anyway with normal or default TTL.
+ * this value and send anyway with normal or default TTL. The same goes for
+ * ZT_WIRE_PACKET_DONT_FRAGMENT, which asks that the IP don't fragment bit be
+ * set (and the local path MTU cache bypassed) for this packet only.
  *
  * The function must return zero on success and may return any error code
  * on failure. Note that success does not (of course) guarantee packet
@@ -1728,12 +1927,16 @@ ZT_SDK_API void ZT_Node_delete(ZT_Node *node);
 /**
  * Process a packet received from the physical wire
  *
+ * Packets addressed to other nodes are relayed straight out of packetData,
+ * so the buffer must be writable: the hop count of a relayed packet is
+ * incremented in place. Its contents are undefined after this returns.
+ *
  * @param node Node instance
  * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
  * @param now Current clock in milliseconds
  * @param localSocket Local socket (you can use 0 if only one local socket is bound and ignore this)
  * @param remoteAddress Origin of packet
- * @param packetData Packet data
+ * @param packetData Packet data (may be modified, see above)
  * @param packetLength Packet length
  * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
  * @return OK (0) or error code if a fatal error condition has occurred
@@ -1744,7 +1947,7 @@ ZT_SDK_API enum ZT_ResultCode ZT_Node_processWirePacket(
 	int64_t now,
 	int64_t localSocket,
 	const struct sockaddr_storage *remoteAddress,
-	const void *packetData,
+	void *packetData,
 	unsigned int packetLength,
 	volatile int64_t *nextBackgroundTaskDeadline);
 
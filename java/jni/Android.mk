@@ -16,14 +16,17 @@ LOCAL_CFLAGS := -DZT_USE_MINIUPNPC
 # ZeroTierOne SDK source files
 LOCAL_SRC_FILES := \
     $(ZT1)/node/C25519.cpp \
+	$(ZT1)/node/AdaptiveCompression.cpp \
 	$(ZT1)/node/Capability.cpp \
 	$(ZT1)/node/CertificateOfMembership.cpp \
 	$(ZT1)/node/CertificateOfOwnership.cpp \
+	$(ZT1)/node/CompiledRules.cpp \
 	$(ZT1)/node/Identity.cpp \
 	$(ZT1)/node/IncomingPacket.cpp \
 	$(ZT1)/node/InetAddress.cpp \
 	$(ZT1)/node/Membership.cpp \
 	$(ZT1)/node/Multicaster.cpp \
+	$(ZT1)/node/NeighborCache.cpp \
 	$(ZT1)/node/Network.cpp \
 	$(ZT1)/node/NetworkConfig.cpp \
 	$(ZT1)/node/Node.cpp \
@@ -0,0 +1,112 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2019  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include <algorithm>
+#include <chrono>
+
+#include "AdaptiveCompression.hpp"
+#include "Packet.hpp"
+
+namespace ZeroTier {
+
+AdaptiveCompression::AdaptiveCompression() :
+	_entries(64),
+	_attempts(0),
+	_skipped(0),
+	_bytesIn(0),
+	_bytesSaved(0),
+	_cpuTime(0)
+{
+	for(unsigned int i=0;i<ZT_COMPRESSION_BACKOFF_SLOTS;++i) {
+		_backoff[i].tag.store(0,std::memory_order_relaxed);
+		_backoff[i].until.store(0,std::memory_order_relaxed);
+	}
+}
+
+bool AdaptiveCompression::compress(Packet &outp,const Address &peer,const uint32_t trafficClass,const int64_t now)
+{
+	if (outp.size() <= (ZT_PACKET_IDX_PAYLOAD + 64)) // Packet::compress() won't bother either
+		return outp.compress();
+
+	const _Key k(peer,trafficClass);
+	const uint64_t tag = (uint64_t)k.hashCode() | 1ULL;
+	_Backoff &b = _backoffFor(k.hashCode());
+	if ((b.tag.load(std::memory_order_relaxed) == tag)&&(now < b.until.load(std::memory_order_relaxed))) {
+		_skipped.fetch_add(1,std::memory_order_relaxed);
+		return false;
+	}
+
+	const unsigned int before = outp.size() - ZT_PACKET_IDX_PAYLOAD;
+	const std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+	const bool compressed = outp.compress();
+	const uint64_t elapsed = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	const unsigned int saved = (compressed) ? (before - (outp.size() - ZT_PACKET_IDX_PAYLOAD)) : 0;
+
+	Mutex::Lock _l(_lock);
+	++_attempts;
+	_bytesIn += before;
+	_bytesSaved += saved;
+	_cpuTime += elapsed;
+
+	_Entry *e = _entries.get(k);
+	if (!e) {
+		if (_entries.size() >= ZT_COMPRESSION_MAX_ENTRIES)
+			return compressed;
+		e = &(_entries[k]);
+	}
+	e->lastUsed = now;
+	if (saved >= (before >> ZT_COMPRESSION_MIN_SAVINGS_SHIFT)) {
+		e->failures = 0;
+		e->retryAt = 0;
+		if (b.tag.load(std::memory_order_relaxed) == tag)
+			b.tag.store(0,std::memory_order_relaxed);
+	} else if (++e->failures >= ZT_COMPRESSION_FAILURES_BEFORE_BACKOFF) {
+		const unsigned int shift = std::min(e->failures - ZT_COMPRESSION_FAILURES_BEFORE_BACKOFF,(unsigned int)16);
+		e->retryAt = now + std::min((int64_t)ZT_COMPRESSION_BACKOFF_MIN << shift,(int64_t)ZT_COMPRESSION_BACKOFF_MAX);
+		b.until.store(e->retryAt,std::memory_order_relaxed);
+		b.tag.store(tag,std::memory_order_relaxed);
+	}
+	return compressed;
+}
+
+void AdaptiveCompression::clean(const int64_t now)
+{
+	Mutex::Lock _l(_lock);
+	Hashtable<_Key,_Entry>::Iterator i(_entries);
+	_Key *k = (_Key *)0;
+	_Entry *e = (_Entry *)0;
+	while (i.next(k,e)) {
+		// Packets skipped during a back-off don't touch the entry, so keep it until the back-off ends
+		if (((now - e->lastUsed) >= ZT_COMPRESSION_ENTRY_TIMEOUT)&&(now >= e->retryAt)) {
+			_Backoff &b = _backoffFor(k->hashCode());
+			if (b.tag.load(std::memory_order_relaxed) == ((uint64_t)k->hashCode() | 1ULL))
+				b.tag.store(0,std::memory_order_relaxed);
+			_entries.erase(*k);
+		}
+	}
+}
+
+} // namespace ZeroTier
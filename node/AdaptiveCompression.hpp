@@ -0,0 +1,163 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2019  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_ADAPTIVECOMPRESSION_HPP
+#define ZT_ADAPTIVECOMPRESSION_HPP
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "Constants.hpp"
+#include "Hashtable.hpp"
+#include "Address.hpp"
+#include "Mutex.hpp"
+
+namespace ZeroTier {
+
+class Packet;
+
+/**
+ * Decides when compressing outgoing packets is worth the CPU
+ *
+ * Most traffic worth carrying over a VPN today is already encrypted or
+ * compressed (TLS, SSH, video) and LZ4 can't shrink it, but finding that
+ * out costs a full compression pass per packet. This remembers how well
+ * compression worked per destination peer and traffic class. After
+ * ZT_COMPRESSION_FAILURES_BEFORE_BACKOFF attempts in a row that don't save
+ * at least 1/(2^ZT_COMPRESSION_MIN_SAVINGS_SHIFT) of the payload, attempts
+ * are skipped for a back-off period that doubles with every further failure
+ * up to ZT_COMPRESSION_BACKOFF_MAX. The first packet after a back-off period
+ * re-probes, and one success resumes compressing everything.
+ *
+ * Statistics on bytes saved and time spent compressing are kept too.
+ *
+ * This class is thread safe. Checking for a back-off takes no lock, so only
+ * packets that are actually compressed lock once to record the result.
+ */
+class AdaptiveCompression
+{
+public:
+	AdaptiveCompression();
+
+	/**
+	 * Compress a packet unless recent attempts for this destination and traffic class failed
+	 *
+	 * @param outp Packet to compress (must not be armored yet)
+	 * @param peer Destination peer
+	 * @param trafficClass Traffic class, e.g. from CompiledRules::trafficClass()
+	 * @param now Current time
+	 * @return True if packet was compressed
+	 */
+	bool compress(Packet &outp,const Address &peer,const uint32_t trafficClass,const int64_t now);
+
+	/**
+	 * Forget peers and traffic classes not sent to recently
+	 *
+	 * @param now Current time
+	 */
+	void clean(const int64_t now);
+
+	/**
+	 * @return Number of peer and traffic class entries tracked
+	 */
+	inline unsigned long size() const
+	{
+		Mutex::Lock _l(_lock);
+		return _entries.size();
+	}
+
+	/**
+	 * @return Number of compression attempts
+	 */
+	inline uint64_t attempts() const { return _attempts; }
+
+	/**
+	 * @return Number of packets sent uncompressed without trying because their traffic class was backed off
+	 */
+	inline uint64_t skipped() const { return _skipped.load(std::memory_order_relaxed); }
+
+	/**
+	 * @return Total payload bytes run through the compressor
+	 */
+	inline uint64_t bytesIn() const { return _bytesIn; }
+
+	/**
+	 * @return Total payload bytes saved by compression
+	 */
+	inline uint64_t bytesSaved() const { return _bytesSaved; }
+
+	/**
+	 * @return Total time spent compressing in microseconds
+	 */
+	inline uint64_t cpuTime() const { return _cpuTime / 1000; }
+
+private:
+	struct _Key
+	{
+		_Key() : peer(0),trafficClass(0) {}
+		_Key(const Address &p,const uint32_t c) : peer(p.toInt()),trafficClass(c) {}
+
+		inline unsigned long hashCode() const { return (unsigned long)((peer ^ ((uint64_t)trafficClass << 24)) * 0x9e3779b97f4a7c15ULL); }
+		inline bool operator==(const _Key &k) const { return ((peer == k.peer)&&(trafficClass == k.trafficClass)); }
+		inline bool operator!=(const _Key &k) const { return (!(*this == k)); }
+
+		uint64_t peer;
+		uint32_t trafficClass;
+	};
+
+	struct _Entry
+	{
+		_Entry() : retryAt(0),lastUsed(0),failures(0) {}
+
+		int64_t retryAt; // skip compression until this time
+		int64_t lastUsed; // last compression attempt
+		unsigned int failures; // consecutive attempts that didn't save enough
+	};
+
+	// Copy of retryAt for backed-off entries, read lock-free on the send path and
+	// written under _lock; slots are picked by _Key::hashCode() and tagged with it
+	struct _Backoff
+	{
+		std::atomic<uint64_t> tag; // hashCode() | 1, or 0 if unused
+		std::atomic<int64_t> until;
+	};
+
+	inline _Backoff &_backoffFor(const unsigned long h) { return _backoff[h & (ZT_COMPRESSION_BACKOFF_SLOTS - 1)]; }
+
+	Hashtable<_Key,_Entry> _entries;
+	_Backoff _backoff[ZT_COMPRESSION_BACKOFF_SLOTS];
+	volatile uint64_t _attempts;
+	std::atomic<uint64_t> _skipped;
+	volatile uint64_t _bytesIn;
+	volatile uint64_t _bytesSaved;
+	volatile uint64_t _cpuTime; // nanoseconds
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -0,0 +1,1219 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2019  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "Constants.hpp"
+#include "CompiledRules.hpp"
+#include "RuntimeEnvironment.hpp"
+#include "NetworkConfig.hpp"
+#include "Membership.hpp"
+#include "Switch.hpp"
+#include "InetAddress.hpp"
+#include "Node.hpp"
+#include "Utils.hpp"
+
+namespace ZeroTier {
+
+namespace {
+
+// Returns true if packet appears valid; pos and proto will be set
+static bool _ipv6GetPayload(const uint8_t *frameData,unsigned int frameLen,unsigned int &pos,unsigned int &proto)
+{
+	if (frameLen < 40)
+		return false;
+	pos = 40;
+	proto = frameData[6];
+	while (pos <= frameLen) {
+		switch(proto) {
+			case 0: // hop-by-hop options
+			case 43: // routing
+			case 60: // destination options
+			case 135: // mobility options
+				if ((pos + 8) > frameLen)
+					return false; // invalid!
+				proto = frameData[pos];
+				pos += ((unsigned int)frameData[pos + 1] * 8) + 8;
+				break;
+
+			//case 44: // fragment -- we currently can't parse these and they are deprecated in IPv6 anyway
+			//case 50:
+			//case 51: // IPSec ESP and AH -- we have to stop here since this is encrypted stuff
+			default:
+				return true;
+		}
+	}
+	return false; // overflow == invalid
+}
+
+// Evaluates a single MATCH entry, shared by the interpreter and by compiled
+// rules for matches that are not pre-decoded
+static uint8_t _matchRule(
+	const RuntimeEnvironment *RR,
+	const NetworkConfig &nconf,
+	const Membership *membership, // can be NULL
+	const bool inbound,
+	const bool superAccept,
+	const Address &ztSource,
+	const Address &ztDest,
+	const MAC &macSource,
+	const MAC &macDest,
+	const uint8_t *const frameData,
+	const unsigned int frameLen,
+	const unsigned int etherType,
+	const unsigned int vlanId,
+	const ZT_VirtualNetworkRule &rule)
+{
+	const ZT_VirtualNetworkRuleType rt = (ZT_VirtualNetworkRuleType)(rule.t & 0x3f);
+	uint8_t thisRuleMatches = 0;
+	uint64_t ownershipVerificationMask = 1; // this magic value means it hasn't been computed yet -- this is done lazily the first time it's needed
+	switch(rt) {
+		case ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS:
+			thisRuleMatches = (uint8_t)(rule.v.zt == ztSource.toInt());
+			break;
+		case ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS:
+			thisRuleMatches = (uint8_t)(rule.v.zt == ztDest.toInt());
+			break;
+		case ZT_NETWORK_RULE_MATCH_VLAN_ID:
+			thisRuleMatches = (uint8_t)(rule.v.vlanId == (uint16_t)vlanId);
+			break;
+		case ZT_NETWORK_RULE_MATCH_VLAN_PCP:
+			// NOT SUPPORTED YET
+			thisRuleMatches = (uint8_t)(rule.v.vlanPcp == 0);
+			break;
+		case ZT_NETWORK_RULE_MATCH_VLAN_DEI:
+			// NOT SUPPORTED YET
+			thisRuleMatches = (uint8_t)(rule.v.vlanDei == 0);
+			break;
+		case ZT_NETWORK_RULE_MATCH_MAC_SOURCE:
+			thisRuleMatches = (uint8_t)(MAC(rule.v.mac,6) == macSource);
+			break;
+		case ZT_NETWORK_RULE_MATCH_MAC_DEST:
+			thisRuleMatches = (uint8_t)(MAC(rule.v.mac,6) == macDest);
+			break;
+		case ZT_NETWORK_RULE_MATCH_IPV4_SOURCE:
+			if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+				thisRuleMatches = (uint8_t)(InetAddress((const void *)&(rule.v.ipv4.ip),4,rule.v.ipv4.mask).containsAddress(InetAddress((const void *)(frameData + 12),4,0)));
+			} else {
+				thisRuleMatches = 0;
+			}
+			break;
+		case ZT_NETWORK_RULE_MATCH_IPV4_DEST:
+			if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+				thisRuleMatches = (uint8_t)(InetAddress((const void *)&(rule.v.ipv4.ip),4,rule.v.ipv4.mask).containsAddress(InetAddress((const void *)(frameData + 16),4,0)));
+			} else {
+				thisRuleMatches = 0;
+			}
+			break;
+		case ZT_NETWORK_RULE_MATCH_IPV6_SOURCE:
+			if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
+				thisRuleMatches = (uint8_t)(InetAddress((const void *)rule.v.ipv6.ip,16,rule.v.ipv6.mask).containsAddress(InetAddress((const void *)(frameData + 8),16,0)));
+			} else {
+				thisRuleMatches = 0;
+			}
+			break;
+		case ZT_NETWORK_RULE_MATCH_IPV6_DEST:
+			if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
+				thisRuleMatches = (uint8_t)(InetAddress((const void *)rule.v.ipv6.ip,16,rule.v.ipv6.mask).containsAddress(InetAddress((const void *)(frameData + 24),16,0)));
+			} else {
+				thisRuleMatches = 0;
+			}
+			break;
+		case ZT_NETWORK_RULE_MATCH_IP_TOS:
+			if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+				const uint8_t tosMasked = frameData[1] & rule.v.ipTos.mask;
+				thisRuleMatches = (uint8_t)((tosMasked >= rule.v.ipTos.value[0])&&(tosMasked <= rule.v.ipTos.value[1]));
+			} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
+				const uint8_t tosMasked = (((frameData[0] << 4) & 0xf0) | ((frameData[1] >> 4) & 0x0f)) & rule.v.ipTos.mask;
+				thisRuleMatches = (uint8_t)((tosMasked >= rule.v.ipTos.value[0])&&(tosMasked <= rule.v.ipTos.value[1]));
+			} else {
+				thisRuleMatches = 0;
+			}
+			break;
+		case ZT_NETWORK_RULE_MATCH_IP_PROTOCOL:
+			if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+				thisRuleMatches = (uint8_t)(rule.v.ipProtocol == frameData[9]);
+			} else if (etherType == ZT_ETHERTYPE_IPV6) {
+				unsigned int pos = 0,proto = 0;
+				if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
+					thisRuleMatches = (uint8_t)(rule.v.ipProtocol == (uint8_t)proto);
+				} else {
+					thisRuleMatches = 0;
+				}
+			} else {
+				thisRuleMatches = 0;
+			}
+			break;
+		case ZT_NETWORK_RULE_MATCH_ETHERTYPE:
+			thisRuleMatches = (uint8_t)(rule.v.etherType == (uint16_t)etherType);
+			break;
+		case ZT_NETWORK_RULE_MATCH_ICMP:
+			if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+				if (frameData[9] == 0x01) { // IP protocol == ICMP
+					const unsigned int ihl = (frameData[0] & 0xf) * 4;
+					if (frameLen >= (ihl + 2)) {
+						if (rule.v.icmp.type == frameData[ihl]) {
+							if ((rule.v.icmp.flags & 0x01) != 0) {
+								thisRuleMatches = (uint8_t)(frameData[ihl+1] == rule.v.icmp.code);
+							} else {
+								thisRuleMatches = 1;
+							}
+						} else {
+							thisRuleMatches = 0;
+						}
+					} else {
+						thisRuleMatches = 0;
+					}
+				} else {
+					thisRuleMatches = 0;
+				}
+			} else if (etherType == ZT_ETHERTYPE_IPV6) {
+				unsigned int pos = 0,proto = 0;
+				if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
+					if ((proto == 0x3a)&&(frameLen >= (pos+2))) {
+						if (rule.v.icmp.type == frameData[pos]) {
+							if ((rule.v.icmp.flags & 0x01) != 0) {
+								thisRuleMatches = (uint8_t)(frameData[pos+1] == rule.v.icmp.code);
+							} else {
+								thisRuleMatches = 1;
+							}
+						} else {
+							thisRuleMatches = 0;
+						}
+					} else {
+						thisRuleMatches = 0;
+					}
+				} else {
+					thisRuleMatches = 0;
+				}
+			} else {
+				thisRuleMatches = 0;
+			}
+			break;
+		case ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE:
+		case ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE:
+			if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+				const unsigned int headerLen = 4 * (frameData[0] & 0xf);
+				int p = -1;
+				switch(frameData[9]) { // IP protocol number
+					// All these start with 16-bit source and destination port in that order
+					case 0x06: // TCP
+					case 0x11: // UDP
+					case 0x84: // SCTP
+					case 0x88: // UDPLite
+						if (frameLen > (headerLen + 4)) {
+							unsigned int pos = headerLen + ((rt == ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE) ? 2 : 0);
+							p = (int)frameData[pos++] << 8;
+							p |= (int)frameData[pos];
+						}
+						break;
+				}
+
+				thisRuleMatches = (p >= 0) ? (uint8_t)((p >= (int)rule.v.port[0])&&(p <= (int)rule.v.port[1])) : (uint8_t)0;
+			} else if (etherType == ZT_ETHERTYPE_IPV6) {
+				unsigned int pos = 0,proto = 0;
+				if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
+					int p = -1;
+					switch(proto) { // IP protocol number
+						// All these start with 16-bit source and destination port in that order
+						case 0x06: // TCP
+						case 0x11: // UDP
+						case 0x84: // SCTP
+						case 0x88: // UDPLite
+							if (frameLen > (pos + 4)) {
+								if (rt == ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE) pos += 2;
+								p = (int)frameData[pos++] << 8;
+								p |= (int)frameData[pos];
+							}
+							break;
+					}
+					thisRuleMatches = (p > 0) ? (uint8_t)((p >= (int)rule.v.port[0])&&(p <= (int)rule.v.port[1])) : (uint8_t)0;
+				} else {
+					thisRuleMatches = 0;
+				}
+			} else {
+				thisRuleMatches = 0;
+			}
+			break;
+		case ZT_NETWORK_RULE_MATCH_CHARACTERISTICS: {
+			uint64_t cf = (inbound) ? ZT_RULE_PACKET_CHARACTERISTICS_INBOUND : 0ULL;
+			if (macDest.isMulticast()) cf |= ZT_RULE_PACKET_CHARACTERISTICS_MULTICAST;
+			if (macDest.isBroadcast()) cf |= ZT_RULE_PACKET_CHARACTERISTICS_BROADCAST;
+			if (ownershipVerificationMask == 1) {
+				ownershipVerificationMask = 0;
+				InetAddress src;
+				if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+					src.set((const void *)(frameData + 12),4,0);
+				} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
+					// IPv6 NDP requires special handling, since the src and dest IPs in the packet are empty or link-local.
+					if ( (frameLen >= (40 + 8 + 16)) && (frameData[6] == 0x3a) && ((frameData[40] == 0x87)||(frameData[40] == 0x88)) ) {
+						if (frameData[40] == 0x87) {
+							// Neighbor solicitations contain no reliable source address, so we implement a small
+							// hack by considering them authenticated. Otherwise you would pretty much have to do
+							// this manually in the rule set for IPv6 to work at all.
+							ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
+						} else {
+							// Neighbor advertisements on the other hand can absolutely be authenticated.
+							src.set((const void *)(frameData + 40 + 8),16,0);
+						}
+					} else {
+						// Other IPv6 packets can be handled normally
+						src.set((const void *)(frameData + 8),16,0);
+					}
+				} else if ((etherType == ZT_ETHERTYPE_ARP)&&(frameLen >= 28)) {
+					src.set((const void *)(frameData + 14),4,0);
+				}
+				if (inbound) {
+					if (membership) {
+						if ((src)&&(membership->hasCertificateOfOwnershipFor<InetAddress>(nconf,src)))
+							ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
+						if (membership->hasCertificateOfOwnershipFor<MAC>(nconf,macSource))
+							ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_MAC_AUTHENTICATED;
+					}
+				} else {
+					for(unsigned int i=0;i<nconf.certificateOfOwnershipCount;++i) {
+						if ((src)&&(nconf.certificatesOfOwnership[i].owns(src)))
+							ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
+						if (nconf.certificatesOfOwnership[i].owns(macSource))
+							ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_MAC_AUTHENTICATED;
+					}
+				}
+			}
+			cf |= ownershipVerificationMask;
+			if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)&&(frameData[9] == 0x06)) {
+				const unsigned int headerLen = 4 * (frameData[0] & 0xf);
+				cf |= (uint64_t)frameData[headerLen + 13];
+				cf |= (((uint64_t)(frameData[headerLen + 12] & 0x0f)) << 8);
+			} else if (etherType == ZT_ETHERTYPE_IPV6) {
+				unsigned int pos = 0,proto = 0;
+				if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
+					if ((proto == 0x06)&&(frameLen > (pos + 14))) {
+						cf |= (uint64_t)frameData[pos + 13];
+						cf |= (((uint64_t)(frameData[pos + 12] & 0x0f)) << 8);
+					}
+				}
+			}
+			thisRuleMatches = (uint8_t)((cf & rule.v.characteristics) != 0);
+		}	break;
+		case ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE:
+			thisRuleMatches = (uint8_t)((frameLen >= (unsigned int)rule.v.frameSize[0])&&(frameLen <= (unsigned int)rule.v.frameSize[1]));
+			break;
+		case ZT_NETWORK_RULE_MATCH_RANDOM:
+			thisRuleMatches = (uint8_t)((uint32_t)(RR->node->prng() & 0xffffffffULL) <= rule.v.randomProbability);
+			break;
+		case ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE:
+		case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND:
+		case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR:
+		case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR:
+		case ZT_NETWORK_RULE_MATCH_TAGS_EQUAL: {
+			const Tag *const localTag = std::lower_bound(&(nconf.tags[0]),&(nconf.tags[nconf.tagCount]),rule.v.tag.id,Tag::IdComparePredicate());
+			if ((localTag != &(nconf.tags[nconf.tagCount]))&&(localTag->id() == rule.v.tag.id)) {
+				const Tag *const remoteTag = ((membership) ? membership->getTag(nconf,rule.v.tag.id) : (const Tag *)0);
+				if (remoteTag) {
+					const uint32_t ltv = localTag->value();
+					const uint32_t rtv = remoteTag->value();
+					if (rt == ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE) {
+						const uint32_t diff = (ltv > rtv) ? (ltv - rtv) : (rtv - ltv);
+						thisRuleMatches = (uint8_t)(diff <= rule.v.tag.value);
+					} else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND) {
+						thisRuleMatches = (uint8_t)((ltv & rtv) == rule.v.tag.value);
+					} else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR) {
+						thisRuleMatches = (uint8_t)((ltv | rtv) == rule.v.tag.value);
+					} else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR) {
+						thisRuleMatches = (uint8_t)((ltv ^ rtv) == rule.v.tag.value);
+					} else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_EQUAL) {
+						thisRuleMatches = (uint8_t)((ltv == rule.v.tag.value)&&(rtv == rule.v.tag.value));
+					} else { // sanity check, can't really happen
+						thisRuleMatches = 0;
+					}
+				} else {
+					if ((inbound)&&(!superAccept)) {
+						thisRuleMatches = 0;
+					} else {
+						// Outbound side is not strict since if we have to match both tags and
+						// we are sending a first packet to a recipient, we probably do not know
+						// about their tags yet. They will filter on inbound and we will filter
+						// once we get their tag. If we are a tee/redirect target we are also
+						// not strict since we likely do not have these tags.
+						thisRuleMatches = 1;
+					}
+				}
+			} else {
+				thisRuleMatches = 0;
+			}
+		}	break;
+		case ZT_NETWORK_RULE_MATCH_TAG_SENDER:
+		case ZT_NETWORK_RULE_MATCH_TAG_RECEIVER: {
+			if (superAccept) {
+				thisRuleMatches = 1;
+			} else if ( ((rt == ZT_NETWORK_RULE_MATCH_TAG_SENDER)&&(inbound)) || ((rt == ZT_NETWORK_RULE_MATCH_TAG_RECEIVER)&&(!inbound)) ) {
+				const Tag *const remoteTag = ((membership) ? membership->getTag(nconf,rule.v.tag.id) : (const Tag *)0);
+				if (remoteTag) {
+					thisRuleMatches = (uint8_t)(remoteTag->value() == rule.v.tag.value);
+				} else {
+					if (rt == ZT_NETWORK_RULE_MATCH_TAG_RECEIVER) {
+						// If we are checking the receiver and this is an outbound packet, we
+						// can't be strict since we may not yet know the receiver's tag.
+						thisRuleMatches = 1;
+					} else {
+						thisRuleMatches = 0;
+					}
+				}
+			} else { // sender and outbound or receiver and inbound
+				const Tag *const localTag = std::lower_bound(&(nconf.tags[0]),&(nconf.tags[nconf.tagCount]),rule.v.tag.id,Tag::IdComparePredicate());
+				if ((localTag != &(nconf.tags[nconf.tagCount]))&&(localTag->id() == rule.v.tag.id)) {
+					thisRuleMatches = (uint8_t)(localTag->value() == rule.v.tag.value);
+				} else {
+					thisRuleMatches = 0;
+				}
+			}
+		}	break;
+		case ZT_NETWORK_RULE_MATCH_INTEGER_RANGE: {
+			uint64_t integer = 0;
+			const unsigned int bits = (rule.v.intRange.format & 63) + 1;
+			const unsigned int bytes = ((bits + 8 - 1) / 8); // integer ceiling of division by 8
+			if ((rule.v.intRange.format & 0x80) == 0) {
+				// Big-endian
+				unsigned int idx = rule.v.intRange.idx + (8 - bytes);
+				const unsigned int eof = idx + bytes;
+				if (eof <= frameLen) {
+					while (idx < eof) {
+						integer <<= 8;
+						integer |= frameData[idx++];
+					}
+				}
+				integer &= 0xffffffffffffffffULL >> (64 - bits);
+			} else {
+				// Little-endian
+				unsigned int idx = rule.v.intRange.idx;
+				const unsigned int eof = idx + bytes;
+				if (eof <= frameLen) {
+					while (idx < eof) {
+						integer >>= 8;
+						integer |= ((uint64_t)frameData[idx++]) << 56;
+					}
+				}
+				integer >>= (64 - bits);
+			}
+			thisRuleMatches = (uint8_t)((integer >= rule.v.intRange.start)&&(integer <= (rule.v.intRange.start + (uint64_t)rule.v.intRange.end)));
+		}	break;
+
+		// The result of an unsupported MATCH is configurable at the network
+		// level via a flag.
+		default:
+			thisRuleMatches = (uint8_t)((nconf.flags & ZT_NETWORKCONFIG_FLAG_RULES_RESULT_OF_UNSUPPORTED_MATCH) != 0);
+			break;
+	}
+	return thisRuleMatches;
+}
+
+// Fills in the frame fields compiled rules look at, with the same bounds checks as _matchRule()
+static void _decodeFrame(const uint8_t *const frameData,const unsigned int frameLen,const unsigned int etherType,int &ipProtocol,int port[2])
+{
+	ipProtocol = -1;
+	port[0] = -1;
+	port[1] = -1;
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+		ipProtocol = (int)frameData[9];
+		switch(frameData[9]) {
+			case 0x06: // TCP
+			case 0x11: // UDP
+			case 0x84: // SCTP
+			case 0x88: { // UDPLite
+				const unsigned int headerLen = 4 * (frameData[0] & 0xf);
+				if (frameLen > (headerLen + 4)) {
+					port[0] = ((int)frameData[headerLen] << 8) | (int)frameData[headerLen + 1];
+					port[1] = ((int)frameData[headerLen + 2] << 8) | (int)frameData[headerLen + 3];
+				}
+			}	break;
+		}
+	} else if (etherType == ZT_ETHERTYPE_IPV6) {
+		unsigned int pos = 0,proto = 0;
+		if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
+			ipProtocol = (int)proto;
+			switch(proto) {
+				case 0x06: // TCP
+				case 0x11: // UDP
+				case 0x84: // SCTP
+				case 0x88: // UDPLite
+					if (frameLen > (pos + 4)) {
+						port[0] = ((int)frameData[pos] << 8) | (int)frameData[pos + 1];
+						port[1] = ((int)frameData[pos + 2] << 8) | (int)frameData[pos + 3];
+						// The interpreter never matches port 0 on IPv6
+						if (port[0] == 0) port[0] = -1;
+						if (port[1] == 0) port[1] = -1;
+					}
+					break;
+			}
+		}
+	}
+}
+
+} // anonymous namespace
+
+CompiledRules::CompiledRules() :
+	_interpretOnly(false),
+	_cacheable(true),
+	_destinationIndependent(true),
+	_indexed(false),
+	_ipProtocolClassCount(1)
+{
+	memset(_ipProtocolClass,0,sizeof(_ipProtocolClass));
+}
+
+void CompiledRules::compile(const Address &self,const ZT_VirtualNetworkRule *rules,unsigned int ruleCount)
+{
+	_rules.assign(rules,rules + ruleCount);
+	_interpretOnly = false;
+	_cacheable = cacheable(rules,ruleCount);
+	_destinationIndependent = destinationIndependent(rules,ruleCount);
+	_matches.clear();
+	_blocks.clear();
+	_superAcceptCount.clear();
+	_indexed = false;
+	_etherTypes.clear();
+	memset(_ipProtocolClass,0,sizeof(_ipProtocolClass));
+	_ipProtocolClassCount = 1;
+	_lists.clear();
+	_portRuns.clear();
+
+	for(unsigned int rn=0;rn<ruleCount;++rn) {
+		if ((rules[rn].t & 0x3f) == ZT_NETWORK_RULE_MATCH_RANDOM) {
+			_interpretOnly = true;
+			return;
+		}
+	}
+
+	unsigned int blockStart = 0;
+	unsigned int andTail = 0;
+	for(unsigned int rn=0;rn<ruleCount;++rn) {
+		const unsigned int rt = rules[rn].t & 0x3f;
+
+		if (rt <= (unsigned int)ZT_NETWORK_RULE_ACTION__MAX_ID) {
+			switch(rt) {
+				case ZT_NETWORK_RULE_ACTION_DROP:
+				case ZT_NETWORK_RULE_ACTION_ACCEPT:
+				case ZT_NETWORK_RULE_ACTION_TEE:
+				case ZT_NETWORK_RULE_ACTION_WATCH:
+				case ZT_NETWORK_RULE_ACTION_REDIRECT:
+				case ZT_NETWORK_RULE_ACTION_BREAK:
+				case ZT_NETWORK_RULE_ACTION_PRIORITY: {
+					_blocks.push_back(_Block());
+					_Block &b = _blocks.back();
+					b.firstMatch = blockStart;
+					b.matchCount = (unsigned int)_matches.size() - blockStart;
+					b.andTail = andTail;
+					b.action = rules[rn];
+					b.superAcceptIfNotTaken = ( ((rt == ZT_NETWORK_RULE_ACTION_TEE)||(rt == ZT_NETWORK_RULE_ACTION_WATCH)||(rt == ZT_NETWORK_RULE_ACTION_REDIRECT)) && (self == rules[rn].v.fwd.address) );
+					b.etherType = -1;
+					b.ipProtocol = -1;
+					b.portIdx = -1;
+					b.portLo = 0;
+					b.portHi = 0;
+				}	break;
+
+				// Unrecognized ACTIONs are no-ops whether taken or not, and matches have no
+				// side effects here since MATCH_RANDOM is interpreted, so drop them entirely
+				default:
+					_matches.resize(blockStart);
+					break;
+			}
+			blockStart = (unsigned int)_matches.size();
+			andTail = 0;
+			continue;
+		}
+
+		_matches.push_back(_Match());
+		_Match &m = _matches.back();
+		memset(&m,0,sizeof(_Match));
+		m.r = rules[rn];
+		m.type = (uint8_t)rt;
+		m.invert = (uint8_t)((rules[rn].t >> 7) & 1);
+		m.orWith = ((rules[rn].t & 0x40) != 0);
+		if (m.orWith)
+			andTail = (unsigned int)_matches.size() - blockStart;
+
+		switch(rt) {
+			case ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS:
+			case ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS:
+				m.a = rules[rn].v.zt;
+				break;
+			case ZT_NETWORK_RULE_MATCH_VLAN_ID:
+				m.a = rules[rn].v.vlanId;
+				break;
+			case ZT_NETWORK_RULE_MATCH_MAC_SOURCE:
+			case ZT_NETWORK_RULE_MATCH_MAC_DEST:
+				m.a = MAC(rules[rn].v.mac,6).toInt();
+				break;
+			case ZT_NETWORK_RULE_MATCH_IPV4_SOURCE:
+			case ZT_NETWORK_RULE_MATCH_IPV4_DEST:
+				if (rules[rn].v.ipv4.mask <= 32) {
+					m.a = rules[rn].v.ipv4.mask;
+					m.b = (m.a) ? (uint64_t)(Utils::ntoh((uint32_t)rules[rn].v.ipv4.ip) >> (32 - (unsigned int)m.a)) : 0ULL;
+				} else {
+					m.generic = true;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_IPV6_SOURCE:
+			case ZT_NETWORK_RULE_MATCH_IPV6_DEST:
+				if (rules[rn].v.ipv6.mask <= 128) {
+					const InetAddress net((const void *)rules[rn].v.ipv6.ip,16,rules[rn].v.ipv6.mask);
+					const InetAddress mask(net.netmask());
+					memcpy(m.ip6,reinterpret_cast<const struct sockaddr_in6 *>(&net)->sin6_addr.s6_addr,16);
+					memcpy(m.mask6,reinterpret_cast<const struct sockaddr_in6 *>(&mask)->sin6_addr.s6_addr,16);
+				} else {
+					m.generic = true;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_IP_PROTOCOL:
+				m.a = rules[rn].v.ipProtocol;
+				break;
+			case ZT_NETWORK_RULE_MATCH_ETHERTYPE:
+				m.a = rules[rn].v.etherType;
+				break;
+			case ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE:
+			case ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE:
+				m.a = rules[rn].v.port[0];
+				m.b = rules[rn].v.port[1];
+				break;
+			case ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE:
+				m.a = rules[rn].v.frameSize[0];
+				m.b = rules[rn].v.frameSize[1];
+				break;
+			default:
+				m.generic = true;
+				break;
+		}
+	}
+	_matches.resize(blockStart); // trailing matches with no ACTION have no effect
+
+	_superAcceptCount.resize(_blocks.size() + 1);
+	_superAcceptCount[0] = 0;
+	for(unsigned long bi=0;bi<_blocks.size();++bi)
+		_superAcceptCount[bi + 1] = _superAcceptCount[bi] + ((_blocks[bi].superAcceptIfNotTaken) ? 1 : 0);
+
+	_buildIndex();
+}
+
+CompiledRules::Result CompiledRules::filter(
+	const RuntimeEnvironment *RR,
+	const NetworkConfig &nconf,
+	const Membership *membership,
+	const bool inbound,
+	const Address &ztSource,
+	Address &ztDest,
+	const MAC &macSource,
+	const MAC &macDest,
+	const uint8_t *const frameData,
+	const unsigned int frameLen,
+	const unsigned int etherType,
+	const unsigned int vlanId,
+	Address &cc,
+	unsigned int &ccLength,
+	bool &ccWatch,
+	uint8_t &qosBucket) const
+{
+	if (_interpretOnly) {
+		Trace::RuleResultLog rrl;
+		return interpret(RR,rrl,nconf,membership,inbound,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,&(_rules[0]),(unsigned int)_rules.size(),cc,ccLength,ccWatch,qosBucket);
+	}
+
+	_State s;
+	s.RR = RR;
+	s.nconf = &nconf;
+	s.membership = membership;
+	s.inbound = inbound;
+	s.ztSource = &ztSource;
+	s.ztDest = &ztDest;
+	s.macSource = &macSource;
+	s.macDest = &macDest;
+	s.frameData = frameData;
+	s.frameLen = frameLen;
+	s.etherType = etherType;
+	s.vlanId = vlanId;
+	s.cc = &cc;
+	s.ccLength = &ccLength;
+	s.ccWatch = &ccWatch;
+	s.qosBucket = &qosBucket;
+	_decodeFrame(frameData,frameLen,etherType,s.f.ipProtocol,s.f.port);
+	s.superAccept = false;
+	s.nextBlock = 0;
+
+	if (_indexed) {
+		unsigned int ec = 0;
+		std::vector<uint16_t>::const_iterator et(std::lower_bound(_etherTypes.begin(),_etherTypes.end(),(uint16_t)etherType));
+		if ((et != _etherTypes.end())&&(*et == (uint16_t)etherType))
+			ec = (unsigned int)(et - _etherTypes.begin()) + 1;
+		const unsigned int pc = (s.f.ipProtocol >= 0) ? _ipProtocolClass[s.f.ipProtocol] : 0;
+
+		const std::vector<uint32_t> &list = _lists[(ec * _ipProtocolClassCount) + pc];
+		for(std::vector<uint32_t>::const_iterator i(list.begin());i!=list.end();++i) {
+			if ((*i & 0x80000000U) != 0) {
+				const _PortRun &run = _portRuns[*i & 0x7fffffffU];
+				const int p = s.f.port[run.portIdx];
+				if (p < 0)
+					continue;
+				std::vector<unsigned int>::const_iterator bnd(std::upper_bound(run.bounds.begin(),run.bounds.end(),(unsigned int)p));
+				if (bnd == run.bounds.begin())
+					continue;
+				const unsigned long seg = (unsigned long)(bnd - run.bounds.begin()) - 1;
+				for(unsigned int k=run.offsets[seg];k<run.offsets[seg + 1];++k) {
+					const int r = _runBlock(s,run.blocks[k]);
+					if (r >= 0)
+						return (Result)r;
+				}
+			} else {
+				const int r = _runBlock(s,*i);
+				if (r >= 0)
+					return (Result)r;
+			}
+		}
+	} else {
+		for(unsigned int bi=0;bi<(unsigned int)_blocks.size();++bi) {
+			const int r = _runBlock(s,bi);
+			if (r >= 0)
+				return (Result)r;
+		}
+	}
+
+	return FILTER_NO_MATCH;
+}
+
+CompiledRules::Result CompiledRules::interpret(
+	const RuntimeEnvironment *RR,
+	Trace::RuleResultLog &rrl,
+	const NetworkConfig &nconf,
+	const Membership *membership, // can be NULL
+	const bool inbound,
+	const Address &ztSource,
+	Address &ztDest, // MUTABLE -- is changed on REDIRECT actions
+	const MAC &macSource,
+	const MAC &macDest,
+	const uint8_t *const frameData,
+	const unsigned int frameLen,
+	const unsigned int etherType,
+	const unsigned int vlanId,
+	const ZT_VirtualNetworkRule *rules, // cannot be NULL
+	const unsigned int ruleCount,
+	Address &cc, // MUTABLE -- set to TEE destination if TEE action is taken or left alone otherwise
+	unsigned int &ccLength, // MUTABLE -- set to length of packet payload to TEE
+	bool &ccWatch, // MUTABLE -- set to true for WATCH target as opposed to normal TEE
+	uint8_t &qosBucket) // MUTABLE -- set to the value of the argument provided to PRIORITY
+{
+	// Set to true if we are a TEE/REDIRECT/WATCH target
+	bool superAccept = false;
+
+	// The default match state for each set of entries starts as 'true' since an
+	// ACTION with no MATCH entries preceding it is always taken.
+	uint8_t thisSetMatches = 1;
+
+	rrl.clear();
+
+	for(unsigned int rn=0;rn<ruleCount;++rn) {
+		const ZT_VirtualNetworkRuleType rt = (ZT_VirtualNetworkRuleType)(rules[rn].t & 0x3f);
+
+		// First check if this is an ACTION
+		if ((unsigned int)rt <= (unsigned int)ZT_NETWORK_RULE_ACTION__MAX_ID) {
+			if (thisSetMatches) {
+				switch(rt) {
+					case ZT_NETWORK_RULE_ACTION_PRIORITY:
+						qosBucket = (rules[rn].v.qosBucket >= 0 || rules[rn].v.qosBucket <= 8) ? rules[rn].v.qosBucket : 4; // 4 = default bucket (no priority)
+						return FILTER_ACCEPT;
+
+					case ZT_NETWORK_RULE_ACTION_DROP:
+						return FILTER_DROP;
+
+					case ZT_NETWORK_RULE_ACTION_ACCEPT:
+						return (superAccept ? FILTER_SUPER_ACCEPT : FILTER_ACCEPT); // match, accept packet
+
+					// These are initially handled together since preliminary logic is common
+					case ZT_NETWORK_RULE_ACTION_TEE:
+					case ZT_NETWORK_RULE_ACTION_WATCH:
+					case ZT_NETWORK_RULE_ACTION_REDIRECT:	{
+						const Address fwdAddr(rules[rn].v.fwd.address);
+						if (fwdAddr == ztSource) {
+							// Skip as no-op since source is target
+						} else if (fwdAddr == RR->identity.address()) {
+							if (inbound) {
+								return FILTER_SUPER_ACCEPT;
+							} else {
+							}
+						} else if (fwdAddr == ztDest) {
+						} else {
+							if (rt == ZT_NETWORK_RULE_ACTION_REDIRECT) {
+								ztDest = fwdAddr;
+								return FILTER_REDIRECT;
+							} else {
+								cc = fwdAddr;
+								ccLength = (rules[rn].v.fwd.length != 0) ? ((frameLen < (unsigned int)rules[rn].v.fwd.length) ? frameLen : (unsigned int)rules[rn].v.fwd.length) : frameLen;
+								ccWatch = (rt == ZT_NETWORK_RULE_ACTION_WATCH);
+							}
+						}
+					}	continue;
+
+					case ZT_NETWORK_RULE_ACTION_BREAK:
+						return FILTER_NO_MATCH;
+
+					// Unrecognized ACTIONs are ignored as no-ops
+					default:
+						continue;
+				}
+			} else {
+				// If this is an incoming packet and we are a TEE or REDIRECT target, we should
+				// super-accept if we accept at all. This will cause us to accept redirected or
+				// tee'd packets in spite of MAC and ZT addressing checks.
+				if (inbound) {
+					switch(rt) {
+						case ZT_NETWORK_RULE_ACTION_TEE:
+						case ZT_NETWORK_RULE_ACTION_WATCH:
+						case ZT_NETWORK_RULE_ACTION_REDIRECT:
+							if (RR->identity.address() == rules[rn].v.fwd.address)
+								superAccept = true;
+							break;
+						default:
+							break;
+					}
+				}
+
+				thisSetMatches = 1; // reset to default true for next batch of entries
+				continue;
+			}
+		}
+
+		// Circuit breaker: no need to evaluate an AND if the set's match state
+		// is currently false since anything AND false is false.
+		if ((!thisSetMatches)&&(!(rules[rn].t & 0x40))) {
+			rrl.logSkipped(rn,thisSetMatches);
+			continue;
+		}
+
+		// If this was not an ACTION evaluate next MATCH and update thisSetMatches with (AND [result])
+		const uint8_t thisRuleMatches = _matchRule(RR,nconf,membership,inbound,superAccept,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,rules[rn]);
+
+		rrl.log(rn,thisRuleMatches,thisSetMatches);
+
+		if ((rules[rn].t & 0x40))
+			thisSetMatches |= (thisRuleMatches ^ ((rules[rn].t >> 7) & 1));
+		else thisSetMatches &= (thisRuleMatches ^ ((rules[rn].t >> 7) & 1));
+	}
+
+	return FILTER_NO_MATCH;
+}
+
+bool CompiledRules::flowKey(
+	FlowKey &k,
+	const bool inbound,
+	const Address &ztSource,
+	const Address &ztDest,
+	const MAC &macSource,
+	const MAC &macDest,
+	const uint8_t *const frameData,
+	const unsigned int frameLen,
+	const unsigned int etherType,
+	const unsigned int vlanId,
+	const uint8_t qosBucket)
+{
+	if (etherType == ZT_ETHERTYPE_ARP)
+		return false;
+	if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= (40 + 8 + 16))&&(frameData[6] == 0x3a)&&((frameData[40] == 0x87)||(frameData[40] == 0x88)))
+		return false;
+
+	memset(&k,0,sizeof(FlowKey));
+	k.ztSource = ztSource.toInt();
+	k.ztDest = ztDest.toInt();
+	k.macSource = macSource.toInt();
+	k.macDest = macDest.toInt();
+	k.icmp = -1;
+	k.etherType = (uint32_t)etherType;
+	k.vlanId = (uint32_t)vlanId;
+	k.inbound = (inbound) ? 1 : 0;
+	k.qosBucket = qosBucket;
+
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+		k.ipHeader = 1;
+		memcpy(k.ipSource,frameData + 12,4);
+		memcpy(k.ipDest,frameData + 16,4);
+		k.tos = frameData[1];
+		if (frameData[9] == 0x01) { // ICMP
+			const unsigned int ihl = (frameData[0] & 0xf) * 4;
+			if (frameLen >= (ihl + 2))
+				k.icmp = ((int32_t)frameData[ihl] << 8) | (int32_t)frameData[ihl + 1];
+		}
+	} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
+		k.ipHeader = 1;
+		memcpy(k.ipSource,frameData + 8,16);
+		memcpy(k.ipDest,frameData + 24,16);
+		k.tos = (uint8_t)(((frameData[0] << 4) & 0xf0) | ((frameData[1] >> 4) & 0x0f));
+		unsigned int pos = 0,proto = 0;
+		if ((_ipv6GetPayload(frameData,frameLen,pos,proto))&&(proto == 0x3a)&&(frameLen >= (pos + 2)))
+			k.icmp = ((int32_t)frameData[pos] << 8) | (int32_t)frameData[pos + 1];
+	}
+
+	int ipProtocol = -1,port[2];
+	_decodeFrame(frameData,frameLen,etherType,ipProtocol,port);
+	k.ipProtocol = (int32_t)ipProtocol;
+	k.port[0] = (int32_t)port[0];
+	k.port[1] = (int32_t)port[1];
+
+	return true;
+}
+
+int32_t CompiledRules::flowHash(const uint8_t *const frameData,const unsigned int frameLen,const unsigned int etherType)
+{
+	const uint8_t *ips;
+	unsigned int ipsLen;
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
+		ips = frameData + 12;
+		ipsLen = 8;
+	} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
+		ips = frameData + 8;
+		ipsLen = 32;
+	} else {
+		return ZT_MULTIPATH_NO_FLOW;
+	}
+
+	int ipProtocol = -1,port[2];
+	_decodeFrame(frameData,frameLen,etherType,ipProtocol,port);
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(((frameData[6] & 0x3f) | frameData[7]) != 0)) { // MF set or nonzero fragment offset
+		port[0] = -1;
+		port[1] = -1;
+	}
+
+	// FNV-1a over addresses, then protocol and ports
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for(unsigned int i=0;i<ipsLen;++i)
+		h = (h ^ (uint64_t)ips[i]) * 0x100000001b3ULL;
+	h = (h ^ (uint64_t)(uint32_t)ipProtocol) * 0x100000001b3ULL;
+	h = (h ^ (uint64_t)(uint32_t)port[0]) * 0x100000001b3ULL;
+	h = (h ^ (uint64_t)(uint32_t)port[1]) * 0x100000001b3ULL;
+	return (int32_t)((h ^ (h >> 32)) & 0x7fffffffULL);
+}
+
+uint32_t CompiledRules::trafficClass(const uint8_t *const frameData,const unsigned int frameLen,const unsigned int etherType)
+{
+	int ipProtocol = -1,port[2];
+	_decodeFrame(frameData,frameLen,etherType,ipProtocol,port);
+	if (ipProtocol < 0)
+		return etherType;
+	const uint32_t ipClass = ((etherType == ZT_ETHERTYPE_IPV6) ? 0x80000000 : 0x40000000) | ((uint32_t)ipProtocol << 16);
+	if ((etherType == ZT_ETHERTYPE_IPV4)&&(((frameData[6] & 0x3f) | frameData[7]) != 0)) // MF set or nonzero fragment offset
+		return ipClass;
+	const int servicePort = ((port[0] >= 0)&&(port[1] >= 0)) ? std::min(port[0],port[1]) : std::max(port[0],port[1]);
+	return ipClass | (uint32_t)((servicePort >= 0) ? servicePort : 0);
+}
+
+bool CompiledRules::cacheable(const ZT_VirtualNetworkRule *rules,const unsigned int ruleCount)
+{
+	for(unsigned int rn=0;rn<ruleCount;++rn) {
+		switch(rules[rn].t & 0x3f) {
+			case ZT_NETWORK_RULE_MATCH_RANDOM:
+			case ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE:
+			case ZT_NETWORK_RULE_MATCH_INTEGER_RANGE:
+				return false;
+			case ZT_NETWORK_RULE_MATCH_CHARACTERISTICS:
+				if ((rules[rn].v.characteristics & 0x0fffULL) != 0) // TCP flags
+					return false;
+				break;
+			case ZT_NETWORK_RULE_ACTION_TEE:
+			case ZT_NETWORK_RULE_ACTION_WATCH:
+				if (rules[rn].v.fwd.length != 0)
+					return false;
+				break;
+			default:
+				break;
+		}
+	}
+	return true;
+}
+
+bool CompiledRules::destinationIndependent(const ZT_VirtualNetworkRule *rules,const unsigned int ruleCount)
+{
+	for(unsigned int rn=0;rn<ruleCount;++rn) {
+		switch(rules[rn].t & 0x3f) {
+			case ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS:
+			case ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE:
+			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND:
+			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR:
+			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR:
+			case ZT_NETWORK_RULE_MATCH_TAGS_EQUAL:
+			case ZT_NETWORK_RULE_MATCH_TAG_RECEIVER:
+			case ZT_NETWORK_RULE_MATCH_RANDOM:
+			case ZT_NETWORK_RULE_ACTION_REDIRECT:
+				return false;
+			default:
+				break;
+		}
+	}
+	return true;
+}
+
+void CompiledRules::_buildIndex()
+{
+	if (_blocks.size() < ZT_RULES_COMPILER_MIN_INDEXED_BLOCKS)
+		return;
+
+	// A MATCH that is AND-ed after the block's last OR must be true for the
+	// block's ACTION to be taken, so it can be used to skip the block.
+	bool haveIpProtocol[256];
+	memset(haveIpProtocol,0,sizeof(haveIpProtocol));
+	for(std::vector<_Block>::iterator b(_blocks.begin());b!=_blocks.end();++b) {
+		for(unsigned int k=b->andTail;k<b->matchCount;++k) {
+			const _Match &m = _matches[b->firstMatch + k];
+			if ((m.invert)||(m.orWith)||(m.generic))
+				continue;
+			switch(m.type) {
+				case ZT_NETWORK_RULE_MATCH_ETHERTYPE:
+					if (b->etherType < 0)
+						b->etherType = (int)m.a;
+					break;
+				case ZT_NETWORK_RULE_MATCH_IP_PROTOCOL:
+					if (b->ipProtocol < 0)
+						b->ipProtocol = (int)m.a;
+					break;
+				case ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE:
+				case ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE: {
+					const int pi = (m.type == ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE) ? 1 : 0;
+					if ((b->portIdx < 0)||((b->portIdx == 0)&&(pi == 1))) {
+						b->portIdx = pi;
+						b->portLo = (unsigned int)m.a;
+						b->portHi = (unsigned int)m.b;
+					}
+				}	break;
+			}
+		}
+		if (b->etherType >= 0)
+			_etherTypes.push_back((uint16_t)b->etherType);
+		if (b->ipProtocol >= 0)
+			haveIpProtocol[b->ipProtocol] = true;
+	}
+
+	std::sort(_etherTypes.begin(),_etherTypes.end());
+	_etherTypes.erase(std::unique(_etherTypes.begin(),_etherTypes.end()),_etherTypes.end());
+	for(unsigned int p=0;p<256;++p) {
+		if (haveIpProtocol[p])
+			_ipProtocolClass[p] = (uint8_t)(_ipProtocolClassCount++);
+	}
+
+	const unsigned long listCount = ((unsigned long)_etherTypes.size() + 1) * (unsigned long)_ipProtocolClassCount;
+	if ((listCount * (unsigned long)_blocks.size()) > ZT_RULES_COMPILER_MAX_INDEX_ENTRIES)
+		return;
+
+	_lists.resize(listCount);
+	std::vector<unsigned int> blocks;
+	for(unsigned int ec=0;ec<=(unsigned int)_etherTypes.size();++ec) {
+		for(unsigned int pc=0;pc<_ipProtocolClassCount;++pc) {
+			blocks.clear();
+			for(unsigned int bi=0;bi<(unsigned int)_blocks.size();++bi) {
+				const _Block &b = _blocks[bi];
+				if ((b.etherType >= 0)&&((ec == 0)||(b.etherType != (int)_etherTypes[ec - 1])))
+					continue;
+				if ((b.ipProtocol >= 0)&&((pc == 0)||(_ipProtocolClass[b.ipProtocol] != pc)))
+					continue;
+				blocks.push_back(bi);
+			}
+			_addToList(_lists[(ec * _ipProtocolClassCount) + pc],blocks);
+		}
+	}
+
+	_indexed = true;
+}
+
+void CompiledRules::_addToList(std::vector<uint32_t> &list,const std::vector<unsigned int> &blocks)
+{
+	unsigned long i = 0;
+	while (i < blocks.size()) {
+		const int pi = _blocks[blocks[i]].portIdx;
+		unsigned long j = i + 1;
+		if (pi >= 0) {
+			while ((j < blocks.size())&&(_blocks[blocks[j]].portIdx == pi))
+				++j;
+		}
+
+		// Runs of blocks that all require a range of the same port are looked up
+		// by port, visiting in order only blocks whose range contains it.
+		if ((pi >= 0)&&((j - i) >= ZT_RULES_COMPILER_MIN_PORT_RUN)) {
+			_PortRun run;
+			run.portIdx = pi;
+			for(unsigned long k=i;k<j;++k) {
+				const _Block &b = _blocks[blocks[k]];
+				if (b.portLo <= b.portHi) {
+					run.bounds.push_back(b.portLo);
+					run.bounds.push_back(b.portHi + 1);
+				}
+			}
+			std::sort(run.bounds.begin(),run.bounds.end());
+			run.bounds.erase(std::unique(run.bounds.begin(),run.bounds.end()),run.bounds.end());
+			run.offsets.push_back(0);
+			for(std::vector<unsigned int>::const_iterator s(run.bounds.begin());s!=run.bounds.end();++s) {
+				for(unsigned long k=i;k<j;++k) {
+					const _Block &b = _blocks[blocks[k]];
+					if ((b.portLo <= *s)&&(*s <= b.portHi))
+						run.blocks.push_back(blocks[k]);
+				}
+				run.offsets.push_back((unsigned int)run.blocks.size());
+			}
+
+			if (run.blocks.size() <= ((j - i) * ZT_RULES_COMPILER_MAX_PORT_RUN_FANOUT)) {
+				list.push_back(0x80000000U | (uint32_t)_portRuns.size());
+				_portRuns.push_back(run);
+				i = j;
+				continue;
+			}
+		}
+
+		while (i < j)
+			list.push_back((uint32_t)blocks[i++]);
+	}
+}
+
+uint8_t CompiledRules::_match(const _State &s,const _Match &m) const
+{
+	if (m.generic)
+		return _matchRule(s.RR,*s.nconf,s.membership,s.inbound,s.superAccept,*s.ztSource,*s.ztDest,*s.macSource,*s.macDest,s.frameData,s.frameLen,s.etherType,s.vlanId,m.r);
+
+	switch(m.type) {
+		case ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS:
+			return (uint8_t)(m.a == s.ztSource->toInt());
+		case ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS:
+			return (uint8_t)(m.a == s.ztDest->toInt());
+		case ZT_NETWORK_RULE_MATCH_VLAN_ID:
+			return (uint8_t)(m.a == (uint64_t)((uint16_t)s.vlanId));
+		case ZT_NETWORK_RULE_MATCH_MAC_SOURCE:
+			return (uint8_t)(m.a == s.macSource->toInt());
+		case ZT_NETWORK_RULE_MATCH_MAC_DEST:
+			return (uint8_t)(m.a == s.macDest->toInt());
+		case ZT_NETWORK_RULE_MATCH_IPV4_SOURCE:
+		case ZT_NETWORK_RULE_MATCH_IPV4_DEST:
+			if ((s.etherType == ZT_ETHERTYPE_IPV4)&&(s.frameLen >= 20)) {
+				if (!m.a)
+					return 1;
+				const uint8_t *const ip = s.frameData + ((m.type == ZT_NETWORK_RULE_MATCH_IPV4_SOURCE) ? 12 : 16);
+				const uint32_t a = ((uint32_t)ip[0] << 24) | ((uint32_t)ip[1] << 16) | ((uint32_t)ip[2] << 8) | (uint32_t)ip[3];
+				return (uint8_t)((uint64_t)(a >> (32 - (unsigned int)m.a)) == m.b);
+			}
+			return 0;
+		case ZT_NETWORK_RULE_MATCH_IPV6_SOURCE:
+		case ZT_NETWORK_RULE_MATCH_IPV6_DEST:
+			if ((s.etherType == ZT_ETHERTYPE_IPV6)&&(s.frameLen >= 40)) {
+				const uint8_t *const ip = s.frameData + ((m.type == ZT_NETWORK_RULE_MATCH_IPV6_SOURCE) ? 8 : 24);
+				for(unsigned int i=0;i<16;++i) {
+					if ((ip[i] & m.mask6[i]) != m.ip6[i])
+						return 0;
+				}
+				return 1;
+			}
+			return 0;
+		case ZT_NETWORK_RULE_MATCH_IP_PROTOCOL:
+			return (uint8_t)((s.f.ipProtocol >= 0)&&((uint64_t)s.f.ipProtocol == m.a));
+		case ZT_NETWORK_RULE_MATCH_ETHERTYPE:
+			return (uint8_t)(m.a == (uint64_t)((uint16_t)s.etherType));
+		case ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE:
+		case ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE: {
+			const int p = s.f.port[(m.type == ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE) ? 1 : 0];
+			return (uint8_t)((p >= 0)&&((uint64_t)p >= m.a)&&((uint64_t)p <= m.b));
+		}
+		case ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE:
+			return (uint8_t)(((uint64_t)s.frameLen >= m.a)&&((uint64_t)s.frameLen <= m.b));
+		default: // not reached, anything else is generic
+			return _matchRule(s.RR,*s.nconf,s.membership,s.inbound,s.superAccept,*s.ztSource,*s.ztDest,*s.macSource,*s.macDest,s.frameData,s.frameLen,s.etherType,s.vlanId,m.r);
+	}
+}
+
+int CompiledRules::_runBlock(_State &s,const unsigned int bi) const
+{
+	const _Block &b = _blocks[bi];
+
+	// Blocks skipped by the index were not taken, so apply their side effect
+	if ((s.inbound)&&(!s.superAccept)&&(_superAcceptCount[bi] != _superAcceptCount[s.nextBlock]))
+		s.superAccept = true;
+	s.nextBlock = bi + 1;
+
+	uint8_t thisSetMatches = 1;
+	for(unsigned int k=0;k<b.matchCount;++k) {
+		const _Match &m = _matches[b.firstMatch + k];
+		if (!thisSetMatches) {
+			if (k >= b.andTail)
+				break; // only ANDs remain, so this set cannot match any more
+			if (!m.orWith)
+				continue;
+		}
+		if (m.orWith)
+			thisSetMatches |= (_match(s,m) ^ m.invert);
+		else thisSetMatches &= (_match(s,m) ^ m.invert);
+	}
+
+	const ZT_VirtualNetworkRuleType rt = (ZT_VirtualNetworkRuleType)(b.action.t & 0x3f);
+	if (thisSetMatches) {
+		switch(rt) {
+			case ZT_NETWORK_RULE_ACTION_PRIORITY:
+				*s.qosBucket = (b.action.v.qosBucket >= 0 || b.action.v.qosBucket <= 8) ? b.action.v.qosBucket : 4; // 4 = default bucket (no priority)
+				return (int)FILTER_ACCEPT;
+
+			case ZT_NETWORK_RULE_ACTION_DROP:
+				return (int)FILTER_DROP;
+
+			case ZT_NETWORK_RULE_ACTION_ACCEPT:
+				return (int)(s.superAccept ? FILTER_SUPER_ACCEPT : FILTER_ACCEPT);
+
+			case ZT_NETWORK_RULE_ACTION_TEE:
+			case ZT_NETWORK_RULE_ACTION_WATCH:
+			case ZT_NETWORK_RULE_ACTION_REDIRECT: {
+				const Address fwdAddr(b.action.v.fwd.address);
+				if (fwdAddr == *s.ztSource) {
+					// Skip as no-op since source is target
+				} else if (fwdAddr == s.RR->identity.address()) {
+					if (s.inbound)
+						return (int)FILTER_SUPER_ACCEPT;
+				} else if (fwdAddr == *s.ztDest) {
+				} else {
+					if (rt == ZT_NETWORK_RULE_ACTION_REDIRECT) {
+						*s.ztDest = fwdAddr;
+						return (int)FILTER_REDIRECT;
+					} else {
+						*s.cc = fwdAddr;
+						*s.ccLength = (b.action.v.fwd.length != 0) ? ((s.frameLen < (unsigned int)b.action.v.fwd.length) ? s.frameLen : (unsigned int)b.action.v.fwd.length) : s.frameLen;
+						*s.ccWatch = (rt == ZT_NETWORK_RULE_ACTION_WATCH);
+					}
+				}
+			}	return -1;
+
+			case ZT_NETWORK_RULE_ACTION_BREAK:
+				return (int)FILTER_NO_MATCH;
+
+			default:
+				return -1;
+		}
+	} else if ((s.inbound)&&(b.superAcceptIfNotTaken)) {
+		s.superAccept = true;
+	}
+
+	return -1;
+}
+
+} // namespace ZeroTier
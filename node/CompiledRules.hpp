@@ -0,0 +1,375 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2019  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_COMPILEDRULES_HPP
+#define ZT_COMPILEDRULES_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "Constants.hpp"
+#include "../include/ZeroTierOne.h"
+#include "Address.hpp"
+#include "MAC.hpp"
+#include "Trace.hpp"
+
+namespace ZeroTier {
+
+class RuntimeEnvironment;
+class NetworkConfig;
+class Membership;
+
+/**
+ * A network rule set compiled for per-frame evaluation
+ *
+ * A rule set is a sequence of MATCH entries, each run of which ends with an
+ * ACTION. The compiler splits it into blocks of matches plus one action and
+ * pre-decodes each match. It then indexes the blocks by the ethertype, IP
+ * protocol and port range that their AND-ed matches require, so a frame only
+ * visits blocks that could possibly be taken.
+ *
+ * filter() always returns exactly what interpret() would return for the same
+ * rules. interpret() is the reference implementation. It is still used
+ * directly when a rule result log is wanted for tracing, for capabilities
+ * presented by remote peers, and for rule sets that use MATCH_RANDOM, since
+ * skipping such a match would change the PRNG sequence.
+ */
+class CompiledRules
+{
+public:
+	enum Result
+	{
+		FILTER_NO_MATCH,
+		FILTER_DROP,
+		FILTER_REDIRECT,
+		FILTER_ACCEPT,
+		FILTER_SUPER_ACCEPT
+	};
+
+	/**
+	 * Everything about a frame that a cacheable rule set can look at
+	 *
+	 * Two frames with equal keys get the same result, redirect target, TEE
+	 * target and QoS bucket from any rule set for which cacheable() is true,
+	 * given the same network configuration and remote credentials.
+	 */
+	struct FlowKey
+	{
+		uint64_t ztSource;
+		uint64_t ztDest;
+		uint64_t macSource;
+		uint64_t macDest;
+		uint8_t ipSource[16]; // IPv4 uses the first 4 bytes
+		uint8_t ipDest[16];
+		int32_t ipProtocol; // as seen by MATCH_IP_PROTOCOL or -1 if none
+		int32_t port[2]; // as seen by MATCH_IP_*_PORT_RANGE or -1 if none
+		int32_t icmp; // (type << 8) | code as seen by MATCH_ICMP or -1 if none
+		uint32_t etherType;
+		uint32_t vlanId;
+		uint8_t inbound;
+		uint8_t ipHeader; // 1 if the frame is long enough for IP address and TOS matches
+		uint8_t tos;
+		uint8_t qosBucket; // QoS bucket going in, since PRIORITY only changes it if taken
+		uint8_t reserved[4]; // always zero, pads to a multiple of 8 bytes so keys compare with memcmp()
+
+		inline unsigned long hashCode() const
+		{
+			uint64_t w[sizeof(FlowKey) / 8];
+			memcpy(w,this,sizeof(w));
+			uint64_t h = 0;
+			for(unsigned int i=0;i<(sizeof(FlowKey) / 8);++i)
+				h = (h * 0x9e3779b97f4a7c15ULL) ^ w[i];
+			return (unsigned long)(h ^ (h >> 29));
+		}
+
+		inline bool operator==(const FlowKey &k) const { return (memcmp(this,&k,sizeof(FlowKey)) == 0); }
+		inline bool operator!=(const FlowKey &k) const { return (!(*this == k)); }
+	};
+
+	CompiledRules();
+
+	/**
+	 * Compile a rule set, replacing anything compiled before
+	 *
+	 * @param self This node's ZeroTier address (used to pre-compute TEE/REDIRECT target checks)
+	 * @param rules Rules to compile
+	 * @param ruleCount Number of rules
+	 */
+	void compile(const Address &self,const ZT_VirtualNetworkRule *rules,unsigned int ruleCount);
+
+	/**
+	 * Evaluate the compiled rule set against a frame
+	 *
+	 * Arguments and results are as for interpret(), minus the rule result
+	 * log and the rules themselves.
+	 */
+	Result filter(
+		const RuntimeEnvironment *RR,
+		const NetworkConfig &nconf,
+		const Membership *membership,
+		const bool inbound,
+		const Address &ztSource,
+		Address &ztDest,
+		const MAC &macSource,
+		const MAC &macDest,
+		const uint8_t *const frameData,
+		const unsigned int frameLen,
+		const unsigned int etherType,
+		const unsigned int vlanId,
+		Address &cc,
+		unsigned int &ccLength,
+		bool &ccWatch,
+		uint8_t &qosBucket) const;
+
+	/**
+	 * Evaluate a rule set by interpreting it entry by entry
+	 *
+	 * @param RR Runtime environment
+	 * @param rrl Rule result log, filled in for tracing
+	 * @param nconf Network configuration
+	 * @param membership Membership of remote peer or NULL if none
+	 * @param inbound True if frame is inbound
+	 * @param ztSource Source ZeroTier address
+	 * @param ztDest Destination ZeroTier address, changed on REDIRECT
+	 * @param macSource Source MAC
+	 * @param macDest Destination MAC
+	 * @param frameData Frame payload
+	 * @param frameLen Length of frame payload
+	 * @param etherType Ethernet frame type
+	 * @param vlanId VLAN ID or 0 for none
+	 * @param rules Rules to evaluate (cannot be NULL)
+	 * @param ruleCount Number of rules
+	 * @param cc Set to TEE destination if a TEE action is taken, left alone otherwise
+	 * @param ccLength Set to length of frame payload to TEE
+	 * @param ccWatch Set to true for WATCH as opposed to normal TEE
+	 * @param qosBucket Set to the argument of a PRIORITY action if one is taken
+	 * @return Filter result
+	 */
+	static Result interpret(
+		const RuntimeEnvironment *RR,
+		Trace::RuleResultLog &rrl,
+		const NetworkConfig &nconf,
+		const Membership *membership,
+		const bool inbound,
+		const Address &ztSource,
+		Address &ztDest,
+		const MAC &macSource,
+		const MAC &macDest,
+		const uint8_t *const frameData,
+		const unsigned int frameLen,
+		const unsigned int etherType,
+		const unsigned int vlanId,
+		const ZT_VirtualNetworkRule *rules,
+		const unsigned int ruleCount,
+		Address &cc,
+		unsigned int &ccLength,
+		bool &ccWatch,
+		uint8_t &qosBucket);
+
+	/**
+	 * Fill in the flow key for a frame
+	 *
+	 * ARP and IPv6 neighbor discovery frames have no key. Ownership checks
+	 * take their sender address from the payload, so they are never cached.
+	 *
+	 * @return True if key was filled in, false if this frame must not be cached
+	 */
+	static bool flowKey(
+		FlowKey &k,
+		const bool inbound,
+		const Address &ztSource,
+		const Address &ztDest,
+		const MAC &macSource,
+		const MAC &macDest,
+		const uint8_t *const frameData,
+		const unsigned int frameLen,
+		const unsigned int etherType,
+		const unsigned int vlanId,
+		const uint8_t qosBucket);
+
+	/**
+	 * Hash a frame's transport flow (IP protocol, addresses and ports)
+	 *
+	 * All fragments of a fragmented IPv4 datagram hash by addresses and
+	 * protocol only, since only the first one carries ports.
+	 *
+	 * @return Non-negative flow ID or ZT_MULTIPATH_NO_FLOW if this is not an IP frame
+	 */
+	static int32_t flowHash(const uint8_t *const frameData,const unsigned int frameLen,const unsigned int etherType);
+
+	/**
+	 * Classify a frame by the kind of traffic it carries
+	 *
+	 * IP frames are classified by IP version, protocol and the lower of the
+	 * two ports, which is usually the service port (443, 22, ...). Other
+	 * frames are classified by ethertype alone. Unlike flowHash() all flows
+	 * to the same service share a class.
+	 *
+	 * @return Traffic class
+	 */
+	static uint32_t trafficClass(const uint8_t *const frameData,const unsigned int frameLen,const unsigned int etherType);
+
+	/**
+	 * Check whether a rule set's results depend only on a frame's flow key
+	 *
+	 * This is false if the rule set contains MATCH_RANDOM, MATCH_FRAME_SIZE_RANGE,
+	 * MATCH_INTEGER_RANGE, MATCH_CHARACTERISTICS on TCP flags, or a TEE or
+	 * WATCH whose length limit makes the copy's size depend on the frame's.
+	 *
+	 * @param rules Rules to check
+	 * @param ruleCount Number of rules
+	 * @return True if results of these rules may be cached per flow
+	 */
+	static bool cacheable(const ZT_VirtualNetworkRule *rules,const unsigned int ruleCount);
+
+	/**
+	 * @return True if results of this compiled rule set may be cached per flow
+	 */
+	inline bool cacheable() const { return _cacheable; }
+
+	/**
+	 * Check whether a rule set gives every destination the same outbound result
+	 *
+	 * This is false if the rule set matches on the destination's ZeroTier
+	 * address or tags, can REDIRECT (which is skipped if the target is the
+	 * destination), or contains MATCH_RANDOM. TEE and WATCH targets can still
+	 * depend on the destination, so only the result itself is covered.
+	 *
+	 * @param rules Rules to check
+	 * @param ruleCount Number of rules
+	 * @return True if outbound results do not depend on the destination
+	 */
+	static bool destinationIndependent(const ZT_VirtualNetworkRule *rules,const unsigned int ruleCount);
+
+	/**
+	 * @return True if outbound results of this rule set do not depend on the destination
+	 */
+	inline bool destinationIndependent() const { return _destinationIndependent; }
+
+	/**
+	 * @return Number of blocks (matches plus one action) after compilation
+	 */
+	inline unsigned int blockCount() const { return (unsigned int)_blocks.size(); }
+
+	/**
+	 * @return True if blocks are indexed by ethertype, IP protocol and port
+	 */
+	inline bool indexed() const { return _indexed; }
+
+private:
+	// A pre-decoded MATCH entry
+	struct _Match
+	{
+		ZT_VirtualNetworkRule r; // original entry, used for generic evaluation
+		uint8_t type; // rule type without flags
+		uint8_t invert; // 1 if NOT
+		bool orWith; // true if OR-ed with set, otherwise AND-ed
+		bool generic; // true to evaluate with the interpreter's code
+		uint64_t a,b; // pre-decoded operands, meaning depends on type
+		uint8_t ip6[16],mask6[16];
+	};
+
+	// A run of matches and the ACTION that ends it
+	struct _Block
+	{
+		unsigned int firstMatch; // index in _matches
+		unsigned int matchCount;
+		unsigned int andTail; // all matches from this offset on are AND-ed, so a false set can stop here
+		ZT_VirtualNetworkRule action;
+		bool superAcceptIfNotTaken; // inbound TEE/WATCH/REDIRECT to us that sets super-accept when not taken
+		int etherType; // ethertype this block requires or -1
+		int ipProtocol; // IP protocol this block requires or -1
+		int portIdx; // port this block requires a range of: 0 source, 1 dest, -1 none
+		unsigned int portLo,portHi;
+	};
+
+	// Consecutive blocks in an index list that all require a port range
+	struct _PortRun
+	{
+		int portIdx;
+		std::vector<unsigned int> bounds; // sorted starts of elementary port intervals
+		std::vector<unsigned int> offsets; // blocks for interval i are blocks[offsets[i]] to blocks[offsets[i+1]]
+		std::vector<unsigned int> blocks;
+	};
+
+	// Frame fields used by the index and by pre-decoded matches
+	struct _Frame
+	{
+		int ipProtocol; // as seen by MATCH_IP_PROTOCOL or -1 if none
+		int port[2]; // source and destination as seen by MATCH_IP_*_PORT_RANGE or -1 if none
+	};
+
+	struct _State
+	{
+		const RuntimeEnvironment *RR;
+		const NetworkConfig *nconf;
+		const Membership *membership;
+		bool inbound;
+		const Address *ztSource;
+		Address *ztDest;
+		const MAC *macSource;
+		const MAC *macDest;
+		const uint8_t *frameData;
+		unsigned int frameLen;
+		unsigned int etherType;
+		unsigned int vlanId;
+		Address *cc;
+		unsigned int *ccLength;
+		bool *ccWatch;
+		uint8_t *qosBucket;
+		_Frame f;
+		bool superAccept;
+		unsigned int nextBlock;
+	};
+
+	void _buildIndex();
+	void _addToList(std::vector<uint32_t> &list,const std::vector<unsigned int> &blocks);
+	uint8_t _match(const _State &s,const _Match &m) const;
+	int _runBlock(_State &s,const unsigned int bi) const; // returns a Result if one was reached or -1 to continue
+
+	std::vector<ZT_VirtualNetworkRule> _rules; // kept for rule sets that must be interpreted
+	bool _interpretOnly;
+	bool _cacheable;
+	bool _destinationIndependent;
+
+	std::vector<_Match> _matches;
+	std::vector<_Block> _blocks;
+	std::vector<unsigned int> _superAcceptCount; // number of blocks before [i] with superAcceptIfNotTaken set
+
+	bool _indexed;
+	std::vector<uint16_t> _etherTypes; // sorted ethertypes blocks require, index+1 is their class
+	uint8_t _ipProtocolClass[256]; // class of each IP protocol, 0 for protocols no block requires
+	unsigned int _ipProtocolClassCount;
+	std::vector< std::vector<uint32_t> > _lists; // [etherTypeClass * _ipProtocolClassCount + ipProtocolClass], block or (_PortRun | 0x80000000)
+	std::vector<_PortRun> _portRuns;
+};
+
+} // namespace ZeroTier
+
+#endif
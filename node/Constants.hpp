@@ -193,10 +193,23 @@
 #define ZT_RX_QUEUE_SIZE 32
 
 /**
- * Size of TX queue
+ * Maximum number of packets queued for a single destination awaiting WHOIS or a path
  */
 #define ZT_TX_QUEUE_SIZE 32
 
+/**
+ * Maximum number of distinct destinations with packets in the TX queue
+ */
+#define ZT_TX_QUEUE_MAX_DESTINATIONS 1024
+
+/**
+ * Maximum number of packets in all TX queues together
+ *
+ * Each queued packet holds a full Packet buffer, so this bounds the memory
+ * used by packets for peers that never resolve. The oldest are dropped first.
+ */
+#define ZT_TX_QUEUE_MAX_PACKETS 256
+
 /**
  * Length of secret key in bytes -- 256-bit -- do not change
  */
@@ -207,6 +220,11 @@
  */
 #define ZT_CORE_TIMER_TASK_GRANULARITY 500
 
+/**
+ * Tick length of timer wheels used to schedule peer, path and WHOIS tasks
+ */
+#define ZT_CORE_TIMER_WHEEL_GRANULARITY 100
+
 /**
  * How often Topology::clean() and Network::clean() and similar are called, in ms
  */
@@ -217,6 +235,36 @@
  */
 #define ZT_WHOIS_RETRY_DELAY 500
 
+/**
+ * Minimum delay before a WHOIS is also sent to the next best upstream
+ *
+ * The delay is ZT_WHOIS_HEDGE_RTT_MULTIPLIER times the latency of the first
+ * upstream asked, at least this and at most half of ZT_WHOIS_RETRY_DELAY
+ * (also used if its latency is unknown). A slow or lossy root then costs
+ * about one more round trip instead of a whole retry.
+ */
+#define ZT_WHOIS_HEDGE_MIN_DELAY 25
+
+/**
+ * Multiple of the first upstream's latency to wait before hedging a WHOIS
+ */
+#define ZT_WHOIS_HEDGE_RTT_MULTIPLIER 2
+
+/**
+ * Maximum number of addresses asked for in one WHOIS packet
+ *
+ * Lookups for the same upstream are coalesced until the end of the current
+ * processing cycle. The upstream answers with one OK listing every identity
+ * it knows, sent without fragmentation, so this is kept small enough for
+ * that reply (about 71 bytes per identity) to fit in ZT_DEFAULT_PHYSMTU.
+ */
+#define ZT_WHOIS_BATCH_MAX 16
+
+/**
+ * How long a ranking of upstreams by relay quality is reused in ms
+ */
+#define ZT_UPSTREAM_RANKING_TTL 1000
+
 /**
  * Transmit queue entry timeout
  */
@@ -309,6 +357,79 @@
  */
 #define ZT_MULTIPATH_PROPORTION_WIN_SZ 128
 
+/**
+ * Flow ID meaning "not part of a transport flow" (control traffic, non-IP frames)
+ */
+#define ZT_MULTIPATH_NO_FLOW -1
+
+/**
+ * Maximum number of flows pinned to paths per peer in flow-pinned multipath mode
+ *
+ * Flows beyond this are still hashed onto the alive paths, but are not counted
+ * and move if the set of alive paths changes.
+ */
+#define ZT_MULTIPATH_MAX_FLOWS 1024
+
+/**
+ * A pinned flow is forgotten after this long without traffic
+ */
+#define ZT_MULTIPATH_FLOW_EXPIRATION 60000
+
+/**
+ * Change in a path's allocation (out of 255) that causes pinned flows to be rebalanced
+ *
+ * Smaller changes are ignored so that flows are not moved (and reordered) because
+ * of ordinary jitter in path quality measurements.
+ */
+#define ZT_MULTIPATH_FLOW_REBALANCE_THRESHOLD 32
+
+/**
+ * Default time after which unanswered traffic on the active path causes failover (active-backup mode)
+ *
+ * Probes (empty ECHOs) are sent every third of this while traffic goes unanswered.
+ */
+#define ZT_MULTIPATH_AB_FAILOVER_BUDGET 300
+
+/**
+ * How long a recovered path must keep answering before traffic fails back to it (active-backup mode)
+ */
+#define ZT_MULTIPATH_AB_FAILBACK_DELAY 10000
+
+/**
+ * Minimum interval between replies to dead path probes received via one of a peer's confirmed paths
+ *
+ * Probes from any other address get at most one reply per ZT_PEER_GENERAL_RATE_LIMIT per peer.
+ */
+#define ZT_PATH_PROBE_RATE_LIMIT 20
+
+/**
+ * Largest datagram we will probe a path with during path MTU discovery
+ *
+ * This leaves room for the OK(ECHO) header in the reply, which echoes the
+ * probe's payload back over the same path in a single datagram.
+ */
+#define ZT_PATH_MTU_MAX (ZT_PROTO_MAX_PACKET_LENGTH - 16)
+
+/**
+ * Path MTU search stops once the candidate range is narrower than this
+ */
+#define ZT_PATH_MTU_SEARCH_GRANULARITY 32
+
+/**
+ * How long to wait for the reply to a path MTU probe before counting it lost
+ */
+#define ZT_PATH_MTU_PROBE_TIMEOUT 3000
+
+/**
+ * Lost probes of one size before that size is considered too big (RFC 8899 MAX_PROBES)
+ */
+#define ZT_PATH_MTU_PROBE_MAX_ATTEMPTS 3
+
+/**
+ * After a finished search, how long until the current MTU is re-validated and a larger one tried
+ */
+#define ZT_PATH_MTU_RAISE_INTERVAL 600000
+
 /**
  * How often we will sample packet latency. Should be at least greater than ZT_PING_CHECK_INVERVAL
  * since we will record a 0 bit/s measurement if no valid latency measurement was made within this
@@ -333,6 +454,21 @@
  */
 #define ZT_PATH_QUALITY_METRIC_WIN_SZ ZT_PATH_QUALITY_METRIC_REALTIME_CONSIDERATION_WIN_SZ
 
+/**
+ * Weight of each fragmented packet in a path's moving average packet loss ratio
+ */
+#define ZT_PATH_FRAGMENT_LOSS_WEIGHT 0.05f
+
+/**
+ * Minimum interval between fragment loss reports (VERB_FRAGMENT_LOSS) sent over a path
+ */
+#define ZT_PATH_FRAGMENT_LOSS_REPORT_INTERVAL 1000
+
+/**
+ * How long a fragment loss report from the other end of a path is used
+ */
+#define ZT_PATH_FRAGMENT_LOSS_REPORT_TIMEOUT (ZT_PATH_FRAGMENT_LOSS_REPORT_INTERVAL * 10)
+
 /**
  * Maximum acceptable Packet Delay Variance (PDV) over a path
  */
@@ -469,11 +605,68 @@
  */
 #define ZT_MULTIPATH_PEER_PING_PERIOD 5000
 
+/**
+ * Maximum random offset in ms either side of ZT_PATH_HEARTBEAT_PERIOD for each peer's keepalives
+ *
+ * Peers first contacted together, e.g. after a restart, would otherwise
+ * send their keepalives in lockstep forever.
+ */
+#define ZT_PEER_PING_JITTER (ZT_PATH_HEARTBEAT_PERIOD / 8)
+
+/**
+ * Smoothed ping budget as a multiple of one ping per peer per heartbeat period
+ */
+#define ZT_PING_BUDGET_RATE_FACTOR 4
+
+/**
+ * Pings allowed in one background task run beyond the smoothed budget
+ *
+ * Due peers past the budget are pinged in a later run.
+ */
+#define ZT_PING_BUDGET_BURST 64
+
+/**
+ * Window in ms over which ping rate and burst statistics are measured
+ */
+#define ZT_PING_STATS_WINDOW 10000
+
 /**
  * Paths are considered expired if they have not sent us a real packet in this long
  */
 #define ZT_PEER_PATH_EXPIRATION ((ZT_PEER_PING_PERIOD * 4) + 3000)
 
+/**
+ * Maximum age of a peer's published path selection before it is recomputed
+ *
+ * Path choice depends on time (liveness, expiration, measured quality), so
+ * the snapshot that senders and receivers read without locking is rebuilt
+ * at least this often while a peer is in use.
+ */
+#define ZT_PEER_PATH_SNAPSHOT_TTL ZT_PATH_QUALITY_COMPUTE_INTERVAL
+
+/**
+ * How long in ms to remember that a peer is not in the peer cache
+ *
+ * Packets from unknown (or spoofed) addresses would otherwise each cost a
+ * state object lookup.
+ */
+#define ZT_PEER_CACHE_MISS_TTL 60000
+
+/**
+ * Maximum number of remembered peer cache misses
+ */
+#define ZT_PEER_CACHE_MISS_MAX 8192
+
+/**
+ * Maximum number of peer cache loads waiting for background processing
+ */
+#define ZT_PEER_CACHE_MAX_PENDING_LOADS 1024
+
+/**
+ * Maximum number of peer cache loads per background task run
+ */
+#define ZT_PEER_CACHE_LOADS_PER_RUN 64
+
 /**
  * How often to retry expired paths that we're still remembering
  */
@@ -610,6 +803,118 @@
  */
 #define ZT_TRUST_EXPIRATION 600000
 
+/**
+ * Minimum number of rule blocks (matches plus an action) for which compiled rules build an index
+ */
+#define ZT_RULES_COMPILER_MIN_INDEXED_BLOCKS 8
+
+/**
+ * Maximum total size of compiled rule index lists before falling back to a linear scan
+ */
+#define ZT_RULES_COMPILER_MAX_INDEX_ENTRIES 1048576
+
+/**
+ * Minimum number of consecutive port-range blocks looked up by port instead of scanned
+ */
+#define ZT_RULES_COMPILER_MIN_PORT_RUN 4
+
+/**
+ * Maximum average number of port intervals each block in a port run may appear in
+ */
+#define ZT_RULES_COMPILER_MAX_PORT_RUN_FANOUT 16
+
+/**
+ * Maximum number of cached per-flow filter decisions per network
+ *
+ * The cache is simply emptied when it fills up. It is also emptied whenever
+ * the network's config or any member's tags, capabilities, certificates of
+ * ownership or revocations change.
+ */
+#define ZT_NETWORK_FLOW_CACHE_MAX_ENTRIES 4096
+
+/**
+ * Lifetime of a neighbor cache entry learned from an observed ARP or NDP reply
+ */
+#define ZT_NEIGHBOR_CACHE_OBSERVED_TTL 120000
+
+/**
+ * Lifetime of a neighbor cache entry learned from a certificate of ownership
+ *
+ * Members re-push their credentials as they exchange traffic with us, which
+ * refreshes these entries, so this is on the order of peer activity timeout.
+ */
+#define ZT_NEIGHBOR_CACHE_COO_TTL 600000
+
+/**
+ * Maximum number of neighbor cache entries per network
+ */
+#define ZT_NEIGHBOR_CACHE_MAX_ENTRIES 16384
+
+/**
+ * Compression counts as having worked if it saved at least 1/(2^this) of the payload
+ */
+#define ZT_COMPRESSION_MIN_SAVINGS_SHIFT 4
+
+/**
+ * Consecutive failed compression attempts for a peer and traffic class before backing off
+ */
+#define ZT_COMPRESSION_FAILURES_BEFORE_BACKOFF 2
+
+/**
+ * First back-off period after repeated compression failures (doubles with each further failure)
+ */
+#define ZT_COMPRESSION_BACKOFF_MIN 250
+
+/**
+ * Longest back-off period, which is also how often incompressible traffic is re-probed
+ */
+#define ZT_COMPRESSION_BACKOFF_MAX 30000
+
+/**
+ * Forget compression history for a peer and traffic class not sent to for this long
+ */
+#define ZT_COMPRESSION_ENTRY_TIMEOUT 120000
+
+/**
+ * Maximum number of peer and traffic class entries tracked for adaptive compression
+ *
+ * Traffic beyond this is simply always compressed, as it was before.
+ */
+#define ZT_COMPRESSION_MAX_ENTRIES 4096
+
+/**
+ * Slots in the lock-free table of backed-off peer and traffic class entries (power of two)
+ *
+ * Entries that share a slot take turns, so a collision only costs a probe.
+ */
+#define ZT_COMPRESSION_BACKOFF_SLOTS 256
+
+/**
+ * Largest virtual network frame that will be held for aggregation
+ *
+ * Larger frames gain little from sharing a packet header and are sent as
+ * they are, after flushing anything already held for the same peer.
+ */
+#define ZT_FRAME_AGGREGATION_MAX_FRAME 512
+
+/**
+ * Maximum size of a VERB_MULTI_FRAME packet before armoring
+ *
+ * This keeps an aggregate within a single datagram on any path.
+ */
+#define ZT_FRAME_AGGREGATION_MAX_PACKET ZT_MIN_PHYSMTU
+
+/**
+ * Maximum time in ms a frame may be held for aggregation
+ *
+ * Hosts normally flush at the end of each batch of frames read from a
+ * virtual port. For those that do not, Node pulls the next background
+ * task deadline in to this (bypassing ZT_CORE_TIMER_TASK_GRANULARITY)
+ * while frames are held, so the wait is bounded as long as the host runs
+ * processBackgroundTasks() when asked to.
+ */
+#define ZT_FRAME_AGGREGATION_MAX_DELAY 2
+
 /**
  * Enable support for older network configurations from older (pre-1.1.6) controllers
  */
@@ -116,6 +116,8 @@ bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR,void *tPtr)
 				case Packet::VERB_PUSH_DIRECT_PATHS:          r = _doPUSH_DIRECT_PATHS(RR,tPtr,peer); break;
 				case Packet::VERB_USER_MESSAGE:               r = _doUSER_MESSAGE(RR,tPtr,peer); break;
 				case Packet::VERB_REMOTE_TRACE:               r = _doREMOTE_TRACE(RR,tPtr,peer); break;
+				case Packet::VERB_MULTI_FRAME:                r = _doMULTI_FRAME(RR,tPtr,peer); break;
+				case Packet::VERB_FRAGMENT_LOSS:              r = _doFRAGMENT_LOSS(RR,tPtr,peer); break;
 			}
 			if (r) {
 				RR->node->statsLogVerb((unsigned int)v,(unsigned int)size());
@@ -132,6 +134,21 @@ bool IncomingPacket::tryDecode(const RuntimeEnvironment *RR,void *tPtr)
 	}
 }
 
+unsigned int IncomingPacket::whoisReplyIdentities(std::vector<Identity> &ids) const
+{
+	unsigned int n = 0;
+	unsigned int ptr = ZT_PROTO_VERB_WHOIS__OK__IDX_IDENTITY;
+	try {
+		while (ptr < size()) {
+			Identity id;
+			ptr += id.deserialize(*this,ptr);
+			ids.push_back(id);
+			++n;
+		}
+	} catch ( ... ) {} // truncated or invalid trailing identity
+	return n;
+}
+
 bool IncomingPacket::_doERROR(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
 	const Packet::Verb inReVerb = (Packet::Verb)(*this)[ZT_PROTO_VERB_ERROR_IDX_IN_RE_VERB];
@@ -178,7 +195,7 @@ bool IncomingPacket::_doERROR(const RuntimeEnvironment *RR,void *tPtr,const Shar
 			networkId = at<uint64_t>(ZT_PROTO_VERB_ERROR_IDX_PAYLOAD);
 			const SharedPtr<Network> network(RR->node->network(networkId));
 			const int64_t now = RR->node->now();
-			if ((network)&&(network->config().com))
+			if ((network)&&(network->config()->com))
 				network->pushCredentialsNow(tPtr,peer->address(),now);
 		}	break;
 
@@ -379,6 +396,7 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 	}
 
 	std::vector< std::pair<uint64_t,uint64_t> > moonIdsAndTimestamps;
+	uint64_t remoteCapabilities = 0;
 	if (ptr < size()) {
 		// Remainder of packet, if present, is encrypted
 		cryptField(peer->key(),ptr,size() - ptr);
@@ -392,6 +410,9 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 				ptr += 16;
 			}
 		}
+
+		// Get capabilities if present (sent by newer nodes after the moon list)
+		remoteCapabilities = capabilitiesAt(ptr);
 	}
 
 	// Send OK(HELLO) with an echo of the packet's timestamp and some of the same
@@ -456,11 +477,13 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment *RR,void *tPtr,const bool
 		}
 	}
 	outp.setAt<uint16_t>(worldUpdateSizeAt,(uint16_t)(outp.size() - (worldUpdateSizeAt + 2)));
+	outp.append((uint64_t)ZT_PROTO_CAPABILITIES);
 
 	outp.armor(peer->key(),true);
 	_path->send(RR,tPtr,outp.data(),outp.size(),now);
 
 	peer->setRemoteVersion(protoVersion,vMajor,vMinor,vRevision); // important for this to go first so received() knows the version
+	peer->setRemoteCapabilities(remoteCapabilities);
 	peer->received(tPtr,_path,hops(),pid,payloadLength(),Packet::VERB_HELLO,0,Packet::VERB_NOP,false,0);
 
 	return true;
@@ -494,18 +517,21 @@ bool IncomingPacket::_doOK(const RuntimeEnvironment *RR,void *tPtr,const SharedP
 				ptr += externalSurfaceAddress.deserialize(*this,ptr);
 
 			// Handle planet or moon updates if present
+			uint64_t remoteCapabilities = 0;
 			if ((ptr + 2) <= size()) {
 				const unsigned int worldsLen = at<uint16_t>(ptr); ptr += 2;
+				const unsigned int endOfWorlds = ptr + worldsLen;
 				if (RR->topology->shouldAcceptWorldUpdateFrom(peer->address())) {
-					const unsigned int endOfWorlds = ptr + worldsLen;
 					while (ptr < endOfWorlds) {
 						World w;
 						ptr += w.deserialize(*this,ptr);
 						RR->topology->addWorld(tPtr,w,false);
 					}
-				} else {
-					ptr += worldsLen;
 				}
+				ptr = endOfWorlds;
+
+				// Get capabilities if present (sent by newer nodes after world updates)
+				remoteCapabilities = capabilitiesAt(ptr);
 			}
 
 			if (!hops()) {
@@ -513,15 +539,25 @@ bool IncomingPacket::_doOK(const RuntimeEnvironment *RR,void *tPtr,const SharedP
 			}
 
 			peer->setRemoteVersion(vProto,vMajor,vMinor,vRevision);
+			peer->setRemoteCapabilities(remoteCapabilities);
 
 			if ((externalSurfaceAddress)&&(hops() == 0))
 				RR->sa->iam(tPtr,peer->address(),_path->localSocket(),_path->address(),externalSurfaceAddress,RR->topology->isUpstream(peer->identity()),RR->node->now());
 		}	break;
 
+		case Packet::VERB_ECHO:
+			_path->mtuProbeAnswered(inRePacketId);
+			break;
+
 		case Packet::VERB_WHOIS:
 			if (RR->topology->isUpstream(peer->identity())) {
-				const Identity id(*this,ZT_PROTO_VERB_WHOIS__OK__IDX_IDENTITY);
-				RR->sw->doAnythingWaitingForPeer(tPtr,RR->topology->addPeer(tPtr,SharedPtr<Peer>(new Peer(RR,RR->identity,id))));
+				// One OK answers every address in a batched WHOIS that the upstream knows
+				std::vector<Identity> ids;
+				whoisReplyIdentities(ids);
+				for(std::vector<Identity>::const_iterator id(ids.begin());id!=ids.end();++id) {
+					if (id->address() != RR->identity.address())
+						RR->sw->doAnythingWaitingForPeer(tPtr,RR->topology->addPeer(tPtr,SharedPtr<Peer>(new Peer(RR,RR->identity,*id))));
+				}
 			}
 			break;
 
@@ -654,8 +690,10 @@ bool IncomingPacket::_doFRAME(const RuntimeEnvironment *RR,void *tPtr,const Shar
 				const MAC sourceMac(peer->address(),nwid);
 				const unsigned int frameLen = size() - ZT_PROTO_VERB_FRAME_IDX_PAYLOAD;
 				const uint8_t *const frameData = reinterpret_cast<const uint8_t *>(data()) + ZT_PROTO_VERB_FRAME_IDX_PAYLOAD;
-				if (network->filterIncomingPacket(tPtr,peer,RR->identity.address(),sourceMac,network->mac(),frameData,frameLen,etherType,0) > 0)
+				if (network->filterIncomingPacket(tPtr,peer,RR->identity.address(),sourceMac,network->mac(),frameData,frameLen,etherType,0) > 0) {
+					network->learnNeighbors(peer->address(),sourceMac,etherType,frameData,frameLen);
 					RR->node->putFrame(tPtr,nwid,network->userPtr(),sourceMac,network->mac(),etherType,0,(const void *)frameData,frameLen);
+				}
 			}
 		} else {
 			_sendErrorNeedCredentials(RR,tPtr,peer,nwid);
@@ -668,6 +706,35 @@ bool IncomingPacket::_doFRAME(const RuntimeEnvironment *RR,void *tPtr,const Shar
 	return true;
 }
 
+bool IncomingPacket::_doMULTI_FRAME(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
+{
+	const uint64_t nwid = at<uint64_t>(ZT_PROTO_VERB_MULTI_FRAME_IDX_NETWORK_ID);
+	const SharedPtr<Network> network(RR->node->network(nwid));
+	bool trustEstablished = false;
+	if (network) {
+		if (network->gate(tPtr,peer)) {
+			trustEstablished = true;
+			const MAC sourceMac(peer->address(),nwid);
+			unsigned int ptr = ZT_PROTO_VERB_MULTI_FRAME_IDX_FRAMES;
+			unsigned int etherType = 0,frameLen = 0;
+			const uint8_t *frameData = (const uint8_t *)0;
+			while (nextMultiFrame(ptr,etherType,frameData,frameLen)) {
+				if ((frameLen > 0)&&(network->filterIncomingPacket(tPtr,peer,RR->identity.address(),sourceMac,network->mac(),frameData,frameLen,etherType,0) > 0)) {
+					network->learnNeighbors(peer->address(),sourceMac,etherType,frameData,frameLen);
+					RR->node->putFrame(tPtr,nwid,network->userPtr(),sourceMac,network->mac(),etherType,0,(const void *)frameData,frameLen);
+				}
+			}
+		} else {
+			_sendErrorNeedCredentials(RR,tPtr,peer,nwid);
+			return false;
+		}
+	}
+
+	peer->received(tPtr,_path,hops(),packetId(),payloadLength(),Packet::VERB_MULTI_FRAME,0,Packet::VERB_NOP,trustEstablished,nwid);
+
+	return true;
+}
+
 bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
 	const uint64_t nwid = at<uint64_t>(ZT_PROTO_VERB_EXT_FRAME_IDX_NETWORK_ID);
@@ -704,7 +771,7 @@ bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const
 			switch (network->filterIncomingPacket(tPtr,peer,RR->identity.address(),from,to,frameData,frameLen,etherType,0)) {
 				case 1:
 					if (from != MAC(peer->address(),nwid)) {
-						if (network->config().permitsBridging(peer->address())) {
+						if (network->config()->permitsBridging(peer->address())) {
 							network->learnBridgeRoute(from,peer->address());
 						} else {
 							RR->t->incomingNetworkFrameDropped(tPtr,network,_path,packetId(),size(),peer->address(),Packet::VERB_EXT_FRAME,from,to,"bridging not allowed (remote)");
@@ -713,12 +780,12 @@ bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const
 						}
 					} else if (to != network->mac()) {
 						if (to.isMulticast()) {
-							if (network->config().multicastLimit == 0) {
+							if (network->config()->multicastLimit == 0) {
 								RR->t->incomingNetworkFrameDropped(tPtr,network,_path,packetId(),size(),peer->address(),Packet::VERB_EXT_FRAME,from,to,"multicast disabled");
 								peer->received(tPtr,_path,hops(),packetId(),payloadLength(),Packet::VERB_EXT_FRAME,0,Packet::VERB_NOP,true,nwid); // trustEstablished because COM is okay
 								return true;
 							}
-						} else if (!network->config().permitsBridging(RR->identity.address())) {
+						} else if (!network->config()->permitsBridging(RR->identity.address())) {
 							RR->t->incomingNetworkFrameDropped(tPtr,network,_path,packetId(),size(),peer->address(),Packet::VERB_EXT_FRAME,from,to,"bridging not allowed (local)");
 							peer->received(tPtr,_path,hops(),packetId(),payloadLength(),Packet::VERB_EXT_FRAME,0,Packet::VERB_NOP,true,nwid); // trustEstablished because COM is okay
 							return true;
@@ -726,6 +793,7 @@ bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const
 					}
 					// fall through -- 2 means accept regardless of bridging checks or other restrictions
 				case 2:
+					network->learnNeighbors(peer->address(),from,etherType,frameData,frameLen);
 					RR->node->putFrame(tPtr,nwid,network->userPtr(),from,to,etherType,0,(const void *)frameData,frameLen);
 					break;
 			}
@@ -750,8 +818,17 @@ bool IncomingPacket::_doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const
 
 bool IncomingPacket::_doECHO(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
-	if (!peer->rateGateEchoRequest(RR->node->now()))
+	// Empty ECHOs are dead path probes. Those arriving directly via a path the peer
+	// has already confirmed are rate limited per path so that all its paths can be
+	// probed at once. Anything else, e.g. from a new or spoofed source address, falls
+	// under the once a second per peer limit so replies can't be reflected elsewhere.
+	const int64_t now = RR->node->now();
+	if ((size() == ZT_PACKET_IDX_PAYLOAD)&&(hops() == 0)&&(peer->hasActivePathTo(now,_path->address()))) {
+		if (!_path->rateGateProbe(now))
+			return true;
+	} else if (!peer->rateGateEchoRequest(now)) {
 		return true;
+	}
 
 	const uint64_t pid = packetId();
 	Packet outp(peer->address(),RR->identity.address(),Packet::VERB_OK);
@@ -760,7 +837,7 @@ bool IncomingPacket::_doECHO(const RuntimeEnvironment *RR,void *tPtr,const Share
 	if (size() > ZT_PACKET_IDX_PAYLOAD)
 		outp.append(reinterpret_cast<const unsigned char *>(data()) + ZT_PACKET_IDX_PAYLOAD,size() - ZT_PACKET_IDX_PAYLOAD);
 	outp.armor(peer->key(),true);
-	_path->send(RR,tPtr,outp.data(),outp.size(),RR->node->now());
+	_path->send(RR,tPtr,outp.data(),outp.size(),now);
 
 	peer->received(tPtr,_path,hops(),pid,payloadLength(),Packet::VERB_ECHO,0,Packet::VERB_NOP,false,0);
 
@@ -908,6 +985,16 @@ bool IncomingPacket::_doNETWORK_CREDENTIALS(const RuntimeEnvironment *RR,void *t
 				}
 			}
 		}
+
+		// Ask for a full push if we're missing anything in the sender's credential digest
+		if ((p + 10) <= size()) {
+			const uint64_t digestNwid = at<uint64_t>(p); p += 8;
+			const unsigned int numDigests = at<uint16_t>(p); p += 2;
+			if ((!network)||(network->id() != digestNwid))
+				network = RR->node->network(digestNwid);
+			if ((network)&&(network->missingCredentials(peer->address(),reinterpret_cast<const uint8_t *>(field(p,numDigests * 8)),numDigests) > 0))
+				_sendErrorNeedCredentials(RR,tPtr,peer,digestNwid);
+		}
 	}
 
 	peer->received(tPtr,_path,hops(),packetId(),payloadLength(),Packet::VERB_NETWORK_CREDENTIALS,0,Packet::VERB_NOP,trustEstablished,(network) ? network->id() : 0);
@@ -925,6 +1012,12 @@ bool IncomingPacket::_doNETWORK_CONFIG_REQUEST(const RuntimeEnvironment *RR,void
 		const unsigned int metaDataLength = (ZT_PROTO_VERB_NETWORK_CONFIG_REQUEST_IDX_DICT_LEN <= size()) ? at<uint16_t>(ZT_PROTO_VERB_NETWORK_CONFIG_REQUEST_IDX_DICT_LEN) : 0;
 		const char *metaDataBytes = (metaDataLength != 0) ? (const char *)field(ZT_PROTO_VERB_NETWORK_CONFIG_REQUEST_IDX_DICT,metaDataLength) : (const char *)0;
 		const Dictionary<ZT_NETWORKCONFIG_METADATA_DICT_CAPACITY> metaData(metaDataBytes,metaDataLength);
+		const unsigned int haveIdx = ZT_PROTO_VERB_NETWORK_CONFIG_REQUEST_IDX_DICT + metaDataLength;
+		if ((haveIdx + 16) <= size()) {
+			RR->node->ncConfigRequested(nwid,peer->address(),(metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_FLAGS,0) & ZT_NETWORKCONFIG_REQUEST_FLAG_ACCEPTS_DELTA) != 0,at<uint64_t>(haveIdx),(int64_t)at<uint64_t>(haveIdx + 8));
+		} else {
+			RR->node->ncConfigRequested(nwid,peer->address(),false,0,0);
+		}
 		RR->localNetworkController->request(nwid,(hopCount > 0) ? InetAddress() : _path->address(),requestPacketId,peer->identity(),metaData);
 	} else {
 		Packet outp(peer->address(),RR->identity.address(),Packet::VERB_ERROR);
@@ -1051,7 +1144,7 @@ bool IncomingPacket::_doMULTICAST_FRAME(const RuntimeEnvironment *RR,void *tPtr,
 		const unsigned int etherType = at<uint16_t>(offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_ETHERTYPE);
 		const unsigned int frameLen = size() - (offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_FRAME);
 
-		if (network->config().multicastLimit == 0) {
+		if (network->config()->multicastLimit == 0) {
 			RR->t->incomingNetworkFrameDropped(tPtr,network,_path,packetId(),size(),peer->address(),Packet::VERB_MULTICAST_FRAME,from,to.mac(),"multicast disabled");
 			peer->received(tPtr,_path,hops(),packetId(),payloadLength(),Packet::VERB_MULTICAST_FRAME,0,Packet::VERB_NOP,false,nwid);
 			return true;
@@ -1071,11 +1164,11 @@ bool IncomingPacket::_doMULTICAST_FRAME(const RuntimeEnvironment *RR,void *tPtr,
 
 			const uint8_t *const frameData = (const uint8_t *)field(offset + ZT_PROTO_VERB_MULTICAST_FRAME_IDX_FRAME,frameLen);
 
-			if ((flags & 0x08)&&(network->config().isMulticastReplicator(RR->identity.address())))
+			if ((flags & 0x08)&&(network->config()->isMulticastReplicator(RR->identity.address())))
 				RR->mc->send(tPtr,RR->node->now(),network,peer->address(),to,from,etherType,frameData,frameLen);
 
 			if (from != MAC(peer->address(),nwid)) {
-				if (network->config().permitsBridging(peer->address())) {
+				if (network->config()->permitsBridging(peer->address())) {
 					network->learnBridgeRoute(from,peer->address());
 				} else {
 					RR->t->incomingNetworkFrameDropped(tPtr,network,_path,packetId(),size(),peer->address(),Packet::VERB_MULTICAST_FRAME,from,to.mac(),"bridging not allowed (remote)");
@@ -1084,8 +1177,10 @@ bool IncomingPacket::_doMULTICAST_FRAME(const RuntimeEnvironment *RR,void *tPtr,
 				}
 			}
 
-			if (network->filterIncomingPacket(tPtr,peer,RR->identity.address(),from,to.mac(),frameData,frameLen,etherType,0) > 0)
+			if (network->filterIncomingPacket(tPtr,peer,RR->identity.address(),from,to.mac(),frameData,frameLen,etherType,0) > 0) {
+				network->learnNeighbors(peer->address(),from,etherType,frameData,frameLen);
 				RR->node->putFrame(tPtr,nwid,network->userPtr(),from,to.mac(),etherType,0,(const void *)frameData,frameLen);
+			}
 		}
 
 		if (gatherLimit) {
@@ -1191,6 +1286,15 @@ bool IncomingPacket::_doUSER_MESSAGE(const RuntimeEnvironment *RR,void *tPtr,con
 	return true;
 }
 
+bool IncomingPacket::_doFRAGMENT_LOSS(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
+{
+	// Only a direct report describes the path it arrived on
+	if ((!hops())&&(size() >= (ZT_PACKET_IDX_PAYLOAD + 2)))
+		_path->recordFragmentLossReport(at<uint16_t>(ZT_PACKET_IDX_PAYLOAD),RR->node->now());
+	peer->received(tPtr,_path,hops(),packetId(),payloadLength(),Packet::VERB_FRAGMENT_LOSS,0,Packet::VERB_NOP,false,0);
+	return true;
+}
+
 bool IncomingPacket::_doREMOTE_TRACE(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer)
 {
 	ZT_RemoteTrace rt;
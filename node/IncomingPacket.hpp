@@ -28,6 +28,7 @@
 #define ZT_INCOMINGPACKET_HPP
 
 #include <stdexcept>
+#include <vector>
 
 #include "Packet.hpp"
 #include "Path.hpp"
@@ -120,6 +121,17 @@ public:
 	 */
 	inline uint64_t receiveTime() const { return _receiveTime; }
 
+	/**
+	 * Get the identities in an OK(WHOIS) once decoded
+	 *
+	 * An upstream answers a batched WHOIS with every identity it knows in
+	 * one OK. A truncated or invalid trailing identity is ignored.
+	 *
+	 * @param ids Vector to which identities are appended
+	 * @return Number of identities appended
+	 */
+	unsigned int whoisReplyIdentities(std::vector<Identity> &ids) const;
+
 private:
 	// These are called internally to handle packet contents once it has
 	// been authenticated, decrypted, decompressed, and classified.
@@ -131,6 +143,8 @@ private:
 	bool _doWHOIS(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doRENDEZVOUS(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doFRAME(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
+	bool _doMULTI_FRAME(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
+	bool _doFRAGMENT_LOSS(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doEXT_FRAME(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doECHO(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
 	bool _doMULTICAST_LIKE(const RuntimeEnvironment *RR,void *tPtr,const SharedPtr<Peer> &peer);
@@ -48,28 +48,24 @@ Membership::Membership() :
 {
 }
 
-void Membership::pushCredentials(const RuntimeEnvironment *RR,void *tPtr,const int64_t now,const Address &peerAddress,const NetworkConfig &nconf)
+void Membership::pushCredentials(const RuntimeEnvironment *RR,void *tPtr,const int64_t now,const Address &peerAddress,const NetworkConfig &nconf,const bool incremental)
 {
 	const Capability *sendCaps[ZT_MAX_NETWORK_CAPABILITIES];
 	unsigned int sendCapCount = 0;
-	for(unsigned int c=0;c<nconf.capabilityCount;++c)
-		sendCaps[sendCapCount++] = &(nconf.capabilities[c]);
-
 	const Tag *sendTags[ZT_MAX_NETWORK_TAGS];
 	unsigned int sendTagCount = 0;
-	for(unsigned int t=0;t<nconf.tagCount;++t)
-		sendTags[sendTagCount++] = &(nconf.tags[t]);
-
 	const CertificateOfOwnership *sendCoos[ZT_MAX_CERTIFICATES_OF_OWNERSHIP];
 	unsigned int sendCooCount = 0;
-	for(unsigned int c=0;c<nconf.certificateOfOwnershipCount;++c)
-		sendCoos[sendCooCount++] = &(nconf.certificatesOfOwnership[c]);
+	std::vector<uint64_t> digests;
+	selectCredentials(nconf,incremental,sendCaps,sendCapCount,sendTags,sendTagCount,sendCoos,sendCooCount,digests);
 
 	unsigned int capPtr = 0;
 	unsigned int tagPtr = 0;
 	unsigned int cooPtr = 0;
 	bool sendCom = (bool)(nconf.com);
-	while ((capPtr < sendCapCount)||(tagPtr < sendTagCount)||(cooPtr < sendCooCount)||(sendCom)) {
+	bool sendDigests = incremental; // a full push answers a digest, so it doesn't need to carry one
+	const unsigned int digestsSize = 10 + (8 * (unsigned int)digests.size());
+	while ((capPtr < sendCapCount)||(tagPtr < sendTagCount)||(cooPtr < sendCooCount)||(sendCom)||(sendDigests)) {
 		Packet outp(peerAddress,RR->identity.address(),Packet::VERB_NETWORK_CREDENTIALS);
 
 		if (sendCom) {
@@ -108,6 +104,14 @@ void Membership::pushCredentials(const RuntimeEnvironment *RR,void *tPtr,const i
 		}
 		outp.setAt(cooCountAt,(uint16_t)thisPacketCooCount);
 
+		if ((sendDigests)&&(capPtr == sendCapCount)&&(tagPtr == sendTagCount)&&(cooPtr == sendCooCount)&&((outp.size() + digestsSize) < ZT_PROTO_MAX_PACKET_LENGTH)) {
+			sendDigests = false;
+			outp.append(nconf.networkId);
+			outp.append((uint16_t)digests.size());
+			for(std::vector<uint64_t>::const_iterator d(digests.begin());d!=digests.end();++d)
+				outp.append(*d);
+		}
+
 		outp.compress();
 		RR->sw->send(tPtr,outp,true);
 	}
@@ -115,6 +119,76 @@ void Membership::pushCredentials(const RuntimeEnvironment *RR,void *tPtr,const i
 	_lastPushedCredentials = now;
 }
 
+void Membership::selectCredentials(const NetworkConfig &nconf,const bool incremental,const Capability **caps,unsigned int &capCount,const Tag **tags,unsigned int &tagCount,const CertificateOfOwnership **coos,unsigned int &cooCount,std::vector<uint64_t> &digests)
+{
+	digests.clear();
+	digests.reserve(nconf.capabilityCount + nconf.tagCount + nconf.certificateOfOwnershipCount);
+	if (!incremental)
+		_pushedCredentials.clear();
+
+	capCount = 0;
+	for(unsigned int c=0;c<nconf.capabilityCount;++c) {
+		digests.push_back(credentialDigest(Credential::CREDENTIAL_TYPE_CAPABILITY,nconf.capabilities[c].id(),nconf.capabilities[c].timestamp()));
+		if (!std::binary_search(_pushedCredentials.begin(),_pushedCredentials.end(),digests.back()))
+			caps[capCount++] = &(nconf.capabilities[c]);
+	}
+
+	tagCount = 0;
+	for(unsigned int t=0;t<nconf.tagCount;++t) {
+		digests.push_back(credentialDigest(Credential::CREDENTIAL_TYPE_TAG,nconf.tags[t].id(),nconf.tags[t].timestamp()));
+		if (!std::binary_search(_pushedCredentials.begin(),_pushedCredentials.end(),digests.back()))
+			tags[tagCount++] = &(nconf.tags[t]);
+	}
+
+	cooCount = 0;
+	for(unsigned int c=0;c<nconf.certificateOfOwnershipCount;++c) {
+		digests.push_back(credentialDigest(Credential::CREDENTIAL_TYPE_COO,nconf.certificatesOfOwnership[c].id(),nconf.certificatesOfOwnership[c].timestamp()));
+		if (!std::binary_search(_pushedCredentials.begin(),_pushedCredentials.end(),digests.back()))
+			coos[cooCount++] = &(nconf.certificatesOfOwnership[c]);
+	}
+
+	_pushedCredentials = digests;
+	std::sort(_pushedCredentials.begin(),_pushedCredentials.end());
+}
+
+unsigned int Membership::missingCredentials(const uint8_t *digests,const unsigned int count) const
+{
+	std::vector<uint64_t> have;
+	have.reserve(_remoteCaps.size() + _remoteTags.size() + _remoteCoos.size());
+	{
+		Hashtable< uint32_t,Capability >::Iterator i(*(const_cast< Hashtable< uint32_t,Capability > *>(&_remoteCaps)));
+		uint32_t *k = (uint32_t *)0;
+		Capability *v = (Capability *)0;
+		while (i.next(k,v))
+			have.push_back(credentialDigest(Credential::CREDENTIAL_TYPE_CAPABILITY,v->id(),v->timestamp()));
+	}
+	{
+		Hashtable< uint32_t,Tag >::Iterator i(*(const_cast< Hashtable< uint32_t,Tag > *>(&_remoteTags)));
+		uint32_t *k = (uint32_t *)0;
+		Tag *v = (Tag *)0;
+		while (i.next(k,v))
+			have.push_back(credentialDigest(Credential::CREDENTIAL_TYPE_TAG,v->id(),v->timestamp()));
+	}
+	{
+		Hashtable< uint32_t,CertificateOfOwnership >::Iterator i(*(const_cast< Hashtable< uint32_t,CertificateOfOwnership > *>(&_remoteCoos)));
+		uint32_t *k = (uint32_t *)0;
+		CertificateOfOwnership *v = (CertificateOfOwnership *)0;
+		while (i.next(k,v))
+			have.push_back(credentialDigest(Credential::CREDENTIAL_TYPE_COO,v->id(),v->timestamp()));
+	}
+	std::sort(have.begin(),have.end());
+
+	unsigned int missing = 0;
+	for(unsigned int i=0;i<count;++i) {
+		uint64_t d = 0;
+		for(unsigned int b=0;b<8;++b)
+			d = (d << 8) | (uint64_t)digests[(i * 8) + b];
+		if ((!std::binary_search(have.begin(),have.end(),d))&&(!std::binary_search(_rejectedCredentials.begin(),_rejectedCredentials.end(),d)))
+			++missing;
+	}
+	return missing;
+}
+
 Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfMembership &com)
 {
 	const int64_t newts = com.timestamp();
@@ -143,14 +217,28 @@ Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironme
 	}
 }
 
+// Remembers a rejected credential so a digest listing it doesn't ask for it again
+static void _credRejected(std::vector<uint64_t> &rejected,const uint64_t digest)
+{
+	std::vector<uint64_t>::iterator i(std::lower_bound(rejected.begin(),rejected.end(),digest));
+	if ((i != rejected.end())&&(*i == digest))
+		return;
+	if (rejected.size() >= (ZT_MAX_NETWORK_CAPABILITIES + ZT_MAX_NETWORK_TAGS + ZT_MAX_CERTIFICATES_OF_OWNERSHIP)) {
+		rejected.clear();
+		i = rejected.begin();
+	}
+	rejected.insert(i,digest);
+}
+
 // Template out addCredential() for many cred types to avoid copypasta
 template<typename C>
-static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t,C> &remoteCreds,const Hashtable<uint64_t,int64_t> &revocations,const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const C &cred)
+static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t,C> &remoteCreds,const Hashtable<uint64_t,int64_t> &revocations,std::vector<uint64_t> &rejected,const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const C &cred)
 {
 	C *rc = remoteCreds.get(cred.id());
 	if (rc) {
 		if (rc->timestamp() > cred.timestamp()) {
 			RR->t->credentialRejected(tPtr,cred,"old");
+			_credRejected(rejected,Membership::credentialDigest(C::credentialType(),cred.id(),cred.timestamp()));
 			return Membership::ADD_REJECTED;
 		}
 		if (*rc == cred)
@@ -160,12 +248,14 @@ static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t,C> &remot
 	const int64_t *const rt = revocations.get(Membership::credentialKey(C::credentialType(),cred.id()));
 	if ((rt)&&(*rt >= cred.timestamp())) {
 		RR->t->credentialRejected(tPtr,cred,"revoked");
+		_credRejected(rejected,Membership::credentialDigest(C::credentialType(),cred.id(),cred.timestamp()));
 		return Membership::ADD_REJECTED;
 	}
 
 	switch(cred.verify(RR,tPtr)) {
 		default:
 			RR->t->credentialRejected(tPtr,cred,"invalid");
+			_credRejected(rejected,Membership::credentialDigest(C::credentialType(),cred.id(),cred.timestamp()));
 			return Membership::ADD_REJECTED;
 		case 0:
 			if (!rc)
@@ -177,9 +267,9 @@ static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t,C> &remot
 	}
 }
 
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Tag &tag) { return _addCredImpl<Tag>(_remoteTags,_revocations,RR,tPtr,nconf,tag); }
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Capability &cap) { return _addCredImpl<Capability>(_remoteCaps,_revocations,RR,tPtr,nconf,cap); }
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfOwnership &coo) { return _addCredImpl<CertificateOfOwnership>(_remoteCoos,_revocations,RR,tPtr,nconf,coo); }
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Tag &tag) { return _addCredImpl<Tag>(_remoteTags,_revocations,_rejectedCredentials,RR,tPtr,nconf,tag); }
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Capability &cap) { return _addCredImpl<Capability>(_remoteCaps,_revocations,_rejectedCredentials,RR,tPtr,nconf,cap); }
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const CertificateOfOwnership &coo) { return _addCredImpl<CertificateOfOwnership>(_remoteCoos,_revocations,_rejectedCredentials,RR,tPtr,nconf,coo); }
 
 Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment *RR,void *tPtr,const NetworkConfig &nconf,const Revocation &rev)
 {
@@ -29,6 +29,8 @@
 
 #include <stdint.h>
 
+#include <vector>
+
 #include "Constants.hpp"
 #include "../include/ZeroTierOne.h"
 #include "Credential.hpp"
@@ -69,13 +71,48 @@ public:
 	/**
 	 * Send COM and other credentials to this peer
 	 *
+	 * An incremental push sends the COM and only those other credentials not
+	 * already pushed to this peer, followed by a digest of all of them. The
+	 * peer answers with ERROR_NEED_MEMBERSHIP_CERTIFICATE if it's missing
+	 * any, which results in a full push.
+	 *
 	 * @param RR Runtime environment
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param now Current time
 	 * @param peerAddress Address of member peer (the one that this Membership describes)
 	 * @param nconf My network config
+	 * @param incremental If true, do an incremental push (peer must support ZT_PROTO_CAPABILITY_CREDENTIAL_DIGEST)
+	 */
+	void pushCredentials(const RuntimeEnvironment *RR,void *tPtr,const int64_t now,const Address &peerAddress,const NetworkConfig &nconf,const bool incremental);
+
+	/**
+	 * Choose the credentials other than the COM that pushCredentials() sends
+	 *
+	 * All of them are remembered as pushed to this member afterwards.
+	 *
+	 * @param nconf My network config
+	 * @param incremental If true, skip credentials already pushed to this member
+	 * @param caps Filled with capabilities to send (room for ZT_MAX_NETWORK_CAPABILITIES)
+	 * @param capCount Set to number of capabilities to send
+	 * @param tags Filled with tags to send (room for ZT_MAX_NETWORK_TAGS)
+	 * @param tagCount Set to number of tags to send
+	 * @param coos Filled with certificates of ownership to send (room for ZT_MAX_CERTIFICATES_OF_OWNERSHIP)
+	 * @param cooCount Set to number of certificates of ownership to send
+	 * @param digests Set to credentialDigest() of every capability, tag, and certificate of ownership in nconf
+	 */
+	void selectCredentials(const NetworkConfig &nconf,const bool incremental,const Capability **caps,unsigned int &capCount,const Tag **tags,unsigned int &tagCount,const CertificateOfOwnership **coos,unsigned int &cooCount,std::vector<uint64_t> &digests);
+
+	/**
+	 * Count credentials in a digest received from this member that we don't hold
+	 *
+	 * Credentials we rejected (e.g. revoked ones) don't count, since pushing
+	 * them again would not help.
+	 *
+	 * @param digests Array of big-endian credentialDigest() values
+	 * @param count Number of digests
+	 * @return Number of credentials we are missing
 	 */
-	void pushCredentials(const RuntimeEnvironment *RR,void *tPtr,const int64_t now,const Address &peerAddress,const NetworkConfig &nconf);
+	unsigned int missingCredentials(const uint8_t *digests,const unsigned int count) const;
 
 	/**
 	 * @return True if we haven't pushed credentials in a long time (to cause proactive credential push)
@@ -190,6 +227,20 @@ public:
 	 */
 	static uint64_t credentialKey(const Credential::Type &t,const uint32_t i) { return (((uint64_t)t << 32) | (uint64_t)i); }
 
+	/**
+	 * Digest of a credential's type, ID, and timestamp used in incremental credential pushes
+	 */
+	static inline uint64_t credentialDigest(const Credential::Type t,const uint32_t i,const int64_t ts)
+	{
+		uint64_t h = credentialKey(t,i) ^ ((uint64_t)ts * 0x9e3779b97f4a7c15ULL);
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+		return h;
+	}
+
 private:
 	inline bool _isV6NDPEmulated(const NetworkConfig &nconf,const MAC &m) const { return false; }
 	inline bool _isV6NDPEmulated(const NetworkConfig &nconf,const InetAddress &ip) const
@@ -232,6 +283,12 @@ private:
 	// Time we last pushed credentials
 	int64_t _lastPushedCredentials;
 
+	// Digests of credentials other than the COM last pushed to this member (sorted)
+	std::vector<uint64_t> _pushedCredentials;
+
+	// Digests of credentials from this member that we rejected (sorted)
+	std::vector<uint64_t> _rejectedCredentials;
+
 	// Remote member's latest network COM
 	CertificateOfMembership _com;
 
@@ -66,21 +66,15 @@ void Multicaster::remove(uint64_t nwid,const MulticastGroup &mg,const Address &m
 {
 	Mutex::Lock _l(_groups_m);
 	MulticastGroupStatus *s = _groups.get(Multicaster::Key(nwid,mg));
-	if (s) {
-		for(std::vector<MulticastGroupMember>::iterator m(s->members.begin());m!=s->members.end();++m) {
-			if (m->address == member) {
-				s->members.erase(m);
-				break;
-			}
-		}
-	}
+	if (s)
+		s->remove(member);
 }
 
 unsigned int Multicaster::gather(const Address &queryingPeer,uint64_t nwid,const MulticastGroup &mg,Buffer<ZT_PROTO_MAX_PACKET_LENGTH> &appendTo,unsigned int limit) const
 {
 	unsigned char *p;
-	unsigned int added = 0,i,k,rptr,totalKnown = 0;
-	uint64_t a,picked[(ZT_PROTO_MAX_PACKET_LENGTH / 5) + 2];
+	unsigned int added = 0,totalKnown = 0;
+	uint64_t a;
 
 	if (!limit)
 		return 0;
@@ -109,19 +103,9 @@ unsigned int Multicaster::gather(const Address &queryingPeer,uint64_t nwid,const
 
 		// Members are returned in random order so that repeated gather queries
 		// will return different subsets of a large multicast group.
-		k = 0;
-		while ((added < limit)&&(k < s->members.size())&&((appendTo.size() + ZT_ADDRESS_LENGTH) <= ZT_PROTO_MAX_PACKET_LENGTH)) {
-			rptr = (unsigned int)RR->node->prng();
-
-restart_member_scan:
-			a = s->members[rptr % (unsigned int)s->members.size()].address.toInt();
-			for(i=0;i<k;++i) {
-				if (picked[i] == a) {
-					++rptr;
-					goto restart_member_scan;
-				}
-			}
-			picked[k++] = a;
+		_RandomOrder order((uint32_t)s->members.size());
+		while ((added < limit)&&(order.more())&&((appendTo.size() + ZT_ADDRESS_LENGTH) <= ZT_PROTO_MAX_PACKET_LENGTH)) {
+			a = s->members[order.next(RR->node->prng())].address.toInt();
 
 			if (queryingPeer.toInt() != a) { // do not return the peer that is making the request as a result
 				p = (unsigned char *)appendTo.appendField(ZT_ADDRESS_LENGTH);
@@ -148,11 +132,8 @@ std::vector<Address> Multicaster::getMembers(uint64_t nwid,const MulticastGroup
 	const MulticastGroupStatus *s = _groups.get(Multicaster::Key(nwid,mg));
 	if (!s)
 		return ls;
-	for(std::vector<MulticastGroupMember>::const_reverse_iterator m(s->members.rbegin());m!=s->members.rend();++m) {
-		ls.push_back(m->address);
-		if (ls.size() >= limit)
-			break;
-	}
+	for(uint32_t m=s->newest;((m != ZT_MULTICASTER_NIL)&&(ls.size() < limit));m=s->members[m].older)
+		ls.push_back(s->members[m].address);
 	return ls;
 }
 
@@ -167,8 +148,7 @@ void Multicaster::send(
 	const void *data,
 	unsigned int len)
 {
-	unsigned long idxbuf[4096];
-	unsigned long *indexes = idxbuf;
+	const SharedPtr<NetworkConfigSnapshot> nconf(network->config());
 
 	// If we're in hub-and-spoke designated multicast replication mode, see if we
 	// have a multicast replicator active. If so, pick the best and send it
@@ -178,9 +158,9 @@ void Multicaster::send(
 	// the current protocol and could be fixed, but fixing it would add more
 	// complexity than the fix is probably worth. Bridges are generally high
 	// bandwidth nodes.
-	if (!network->config().isActiveBridge(RR->identity.address())) {
+	if (!nconf->isActiveBridge(RR->identity.address())) {
 		Address multicastReplicators[ZT_MAX_NETWORK_SPECIALISTS];
-		const unsigned int multicastReplicatorCount = network->config().multicastReplicators(multicastReplicators);
+		const unsigned int multicastReplicatorCount = nconf->multicastReplicators(multicastReplicators);
 		if (multicastReplicatorCount) {
 			if (std::find(multicastReplicators,multicastReplicators + multicastReplicatorCount,RR->identity.address()) == (multicastReplicators + multicastReplicatorCount)) {
 				SharedPtr<Peer> bestMulticastReplicator;
@@ -206,7 +186,7 @@ void Multicaster::send(
 					outp.append((uint32_t)mg.adi());
 					outp.append((uint16_t)etherType);
 					outp.append(data,len);
-					if (!network->config().disableCompression()) outp.compress();
+					if (!nconf->disableCompression()) outp.compress();
 					outp.armor(bestMulticastReplicator->key(),true);
 					bestMulticastReplicatorPath->send(RR,tPtr,outp.data(),outp.size(),now);
 					return;
@@ -219,25 +199,13 @@ void Multicaster::send(
 		Mutex::Lock _l(_groups_m);
 		MulticastGroupStatus &gs = _groups[Multicaster::Key(network->id(),mg)];
 
-		if (!gs.members.empty()) {
-			// Allocate a memory buffer if group is monstrous
-			if (gs.members.size() > (sizeof(idxbuf) / sizeof(unsigned long)))
-				indexes = new unsigned long[gs.members.size()];
-
-			// Generate a random permutation of member indexes
-			for(unsigned long i=0;i<gs.members.size();++i)
-				indexes[i] = i;
-			for(unsigned long i=(unsigned long)gs.members.size()-1;i>0;--i) {
-				unsigned long j = (unsigned long)RR->node->prng() % (i + 1);
-				unsigned long tmp = indexes[j];
-				indexes[j] = indexes[i];
-				indexes[i] = tmp;
-			}
-		}
+		// Members are visited in random order, but only as many are drawn as
+		// it takes to reach the limit.
+		_RandomOrder order((uint32_t)gs.members.size());
 
 		Address activeBridges[ZT_MAX_NETWORK_SPECIALISTS];
-		const unsigned int activeBridgeCount = network->config().activeBridges(activeBridges);
-		const unsigned int limit = network->config().multicastLimit;
+		const unsigned int activeBridgeCount = nconf->activeBridges(activeBridges);
+		const unsigned int limit = nconf->multicastLimit;
 
 		if (gs.members.size() >= limit) {
 			// Skip queue if we already have enough members to complete the send operation
@@ -247,7 +215,7 @@ void Multicaster::send(
 				RR,
 				now,
 				network->id(),
-				network->config().disableCompression(),
+				nconf->disableCompression(),
 				limit,
 				1, // we'll still gather a little from peers to keep multicast list fresh
 				src,
@@ -266,9 +234,8 @@ void Multicaster::send(
 				}
 			}
 
-			unsigned long idx = 0;
-			while ((count < limit)&&(idx < gs.members.size())) {
-				const Address ma(gs.members[indexes[idx++]].address);
+			while ((count < limit)&&(order.more())) {
+				const Address ma(gs.members[order.next(RR->node->prng())].address);
 				if ((std::find(activeBridges,activeBridges + activeBridgeCount,ma) == (activeBridges + activeBridgeCount))&&(ma != origin)) {
 					out.sendOnly(RR,tPtr,ma); // optimization: don't use dedup log if it's a one-pass send
 					++count;
@@ -295,7 +262,7 @@ void Multicaster::send(
 				explicitGatherPeers[numExplicitGatherPeers++] = network->controller();
 
 				Address ac[ZT_MAX_NETWORK_SPECIALISTS];
-				const unsigned int accnt = network->config().alwaysContactAddresses(ac);
+				const unsigned int accnt = nconf->alwaysContactAddresses(ac);
 				unsigned int shuffled[ZT_MAX_NETWORK_SPECIALISTS];
 				for(unsigned int i=0;i<accnt;++i)
 					shuffled[i] = i;
@@ -313,7 +280,7 @@ void Multicaster::send(
 						break;
 				}
 
-				std::vector<Address> anchors(network->config().anchors());
+				std::vector<Address> anchors(nconf->anchors());
 				for(std::vector<Address>::const_iterator a(anchors.begin());a!=anchors.end();++a) {
 					if (*a != RR->identity.address()) {
 						explicitGatherPeers[numExplicitGatherPeers++] = *a;
@@ -323,7 +290,7 @@ void Multicaster::send(
 				}
 
 				for(unsigned int k=0;k<numExplicitGatherPeers;++k) {
-					const CertificateOfMembership *com = (network) ? ((network->config().com) ? &(network->config().com) : (const CertificateOfMembership *)0) : (const CertificateOfMembership *)0;
+					const CertificateOfMembership *com = (nconf->com) ? &(nconf->com) : (const CertificateOfMembership *)0;
 					Packet outp(explicitGatherPeers[k],RR->identity.address(),Packet::VERB_MULTICAST_GATHER);
 					outp.append(network->id());
 					outp.append((uint8_t)((com) ? 0x01 : 0x00));
@@ -344,7 +311,7 @@ void Multicaster::send(
 				RR,
 				now,
 				network->id(),
-				network->config().disableCompression(),
+				nconf->disableCompression(),
 				limit,
 				gatherLimit,
 				src,
@@ -366,20 +333,15 @@ void Multicaster::send(
 				}
 			}
 
-			unsigned long idx = 0;
-			while ((count < limit)&&(idx < gs.members.size())) {
-				Address ma(gs.members[indexes[idx++]].address);
+			while ((count < limit)&&(order.more())) {
+				const Address ma(gs.members[order.next(RR->node->prng())].address);
 				if (std::find(activeBridges,activeBridges + activeBridgeCount,ma) == (activeBridges + activeBridgeCount)) {
 					out.sendAndLog(RR,tPtr,ma);
 					++count;
 				}
 			}
 		}
-	} catch ( ... ) {} // this is a sanity check to catch any failures and make sure indexes[] still gets deleted
-
-	// Free allocated memory buffer if any
-	if (indexes != idxbuf)
-		delete [] indexes;
+	} catch ( ... ) {} // sanity check: a failed send must not escape into the caller
 }
 
 void Multicaster::clean(int64_t now)
@@ -396,27 +358,10 @@ void Multicaster::clean(int64_t now)
 				else ++tx;
 			}
 
-			unsigned long count = 0;
-			{
-				std::vector<MulticastGroupMember>::iterator reader(s->members.begin());
-				std::vector<MulticastGroupMember>::iterator writer(reader);
-				while (reader != s->members.end()) {
-					if ((now - reader->timestamp) < ZT_MULTICAST_LIKE_EXPIRE) {
-						*writer = *reader;
-						++writer;
-						++count;
-					}
-					++reader;
-				}
-			}
+			s->expire(now);
 
-			if (count) {
-				s->members.resize(count);
-			} else if (s->txQueue.empty()) {
+			if ((s->members.empty())&&(s->txQueue.empty()))
 				_groups.erase(*k);
-			} else {
-				s->members.clear();
-			}
 		}
 	}
 }
@@ -429,16 +374,8 @@ void Multicaster::_add(void *tPtr,int64_t now,uint64_t nwid,const MulticastGroup
 	if (member == RR->identity.address())
 		return;
 
-	std::vector<MulticastGroupMember>::iterator m(std::lower_bound(gs.members.begin(),gs.members.end(),member));
-	if (m != gs.members.end()) {
-		if (m->address == member) {
-			m->timestamp = now;
-			return;
-		}
-		gs.members.insert(m,MulticastGroupMember(member,now));
-	} else {
-		gs.members.push_back(MulticastGroupMember(member,now));
-	}
+	if (!gs.add(member,now))
+		return;
 
 	for(std::list<OutboundMulticast>::iterator tx(gs.txQueue.begin());tx!=gs.txQueue.end();) {
 		if (tx->atLimit())
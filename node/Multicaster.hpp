@@ -44,6 +44,9 @@
 #include "Mutex.hpp"
 #include "SharedPtr.hpp"
 
+// Null link in a multicast group's refresh list
+#define ZT_MULTICASTER_NIL 0xffffffffU
+
 namespace ZeroTier {
 
 class RuntimeEnvironment;
@@ -119,10 +122,11 @@ public:
 	unsigned int gather(const Address &queryingPeer,uint64_t nwid,const MulticastGroup &mg,Buffer<ZT_PROTO_MAX_PACKET_LENGTH> &appendTo,unsigned int limit) const;
 
 	/**
-	 * Get subscribers to a multicast group
+	 * Get subscribers to a multicast group, most recently refreshed first
 	 *
 	 * @param nwid Network ID
 	 * @param mg Multicast group
+	 * @param limit Maximum number of subscribers to return
 	 */
 	std::vector<Address> getMembers(uint64_t nwid,const MulticastGroup &mg,unsigned int limit) const;
 
@@ -151,9 +155,11 @@ public:
 		unsigned int len);
 
 	/**
-	 * Clean up and resort database
+	 * Expire stale members and outbound multicasts
+	 *
+	 * Members expire in refresh order, so this touches only members that are
+	 * actually being removed rather than rescanning every group's membership.
 	 *
-	 * @param RR Runtime environment
 	 * @param now Current time
 	 */
 	void clean(int64_t now);
@@ -172,29 +178,140 @@ private:
 		inline unsigned long hashCode() const { return (mg.hashCode() ^ (unsigned long)(nwid ^ (nwid >> 32))); }
 	};
 
+	/**
+	 * A group member, threaded onto a doubly linked list ordered by last refresh
+	 *
+	 * The links are indexes into the group's member vector so that the whole
+	 * structure stays trivially copyable and needs no per-member allocation.
+	 */
 	struct MulticastGroupMember
 	{
 		MulticastGroupMember() {}
-		MulticastGroupMember(const Address &a,uint64_t ts) : address(a),timestamp(ts) {}
-
-		inline bool operator<(const MulticastGroupMember &a) const { return (address < a.address); }
-		inline bool operator==(const MulticastGroupMember &a) const { return (address == a.address); }
-		inline bool operator!=(const MulticastGroupMember &a) const { return (address != a.address); }
-		inline bool operator<(const Address &a) const { return (address < a); }
-		inline bool operator==(const Address &a) const { return (address == a); }
-		inline bool operator!=(const Address &a) const { return (address != a); }
+		MulticastGroupMember(const Address &a,int64_t ts) : address(a),timestamp(ts),older(ZT_MULTICASTER_NIL),newer(ZT_MULTICASTER_NIL) {}
 
 		Address address;
-		uint64_t timestamp; // time of last notification
+		int64_t timestamp; // time of last notification
+		uint32_t older,newer; // neighbors in refresh order or ZT_MULTICASTER_NIL
 	};
 
+	/**
+	 * Members of one group with O(1) insert, refresh, and removal
+	 *
+	 * Members live unordered in a vector so that they can be drawn at random
+	 * by index. An address index finds a member's slot and removal swaps the
+	 * last member into the hole. The refresh list puts the stalest member at
+	 * its head so that expiration only ever touches members that expire.
+	 */
 	struct MulticastGroupStatus
 	{
-		MulticastGroupStatus() : lastExplicitGather(0) {}
+		MulticastGroupStatus() : lastExplicitGather(0),oldest(ZT_MULTICASTER_NIL),newest(ZT_MULTICASTER_NIL),memberIndex(8) {}
+
+		/**
+		 * @return True if member was not already present
+		 */
+		inline bool add(const Address &a,int64_t now)
+		{
+			const uint32_t *const i = memberIndex.get(a);
+			if (i) {
+				members[*i].timestamp = now;
+				if (*i != newest) {
+					_unlink(*i);
+					_linkNewest(*i);
+				}
+				return false;
+			}
+			const uint32_t ni = (uint32_t)members.size();
+			members.push_back(MulticastGroupMember(a,now));
+			memberIndex.set(a,ni);
+			_linkNewest(ni);
+			return true;
+		}
+
+		inline void remove(const Address &a)
+		{
+			const uint32_t *const ip = memberIndex.get(a);
+			if (!ip)
+				return;
+			const uint32_t i = *ip;
+			memberIndex.erase(a);
+			_unlink(i);
+			const uint32_t last = (uint32_t)members.size() - 1;
+			if (i != last) {
+				MulticastGroupMember &m = members[i];
+				m = members[last];
+				if (m.older != ZT_MULTICASTER_NIL) members[m.older].newer = i; else oldest = i;
+				if (m.newer != ZT_MULTICASTER_NIL) members[m.newer].older = i; else newest = i;
+				memberIndex.set(m.address,i);
+			}
+			members.pop_back();
+		}
+
+		inline void expire(int64_t now)
+		{
+			while ((oldest != ZT_MULTICASTER_NIL)&&((now - members[oldest].timestamp) >= ZT_MULTICAST_LIKE_EXPIRE)) {
+				const Address a(members[oldest].address);
+				remove(a);
+			}
+		}
 
 		uint64_t lastExplicitGather;
 		std::list<OutboundMulticast> txQueue; // pending outbound multicasts
-		std::vector<MulticastGroupMember> members; // members of this group
+		std::vector<MulticastGroupMember> members; // members of this group (unordered)
+		uint32_t oldest,newest; // ends of refresh list
+		Hashtable<Address,uint32_t> memberIndex; // address -> index in members
+
+	private:
+		inline void _unlink(const uint32_t i)
+		{
+			const MulticastGroupMember &m = members[i];
+			if (m.older != ZT_MULTICASTER_NIL) members[m.older].newer = m.newer; else oldest = m.newer;
+			if (m.newer != ZT_MULTICASTER_NIL) members[m.newer].older = m.older; else newest = m.older;
+		}
+
+		inline void _linkNewest(const uint32_t i)
+		{
+			MulticastGroupMember &m = members[i];
+			m.older = newest;
+			m.newer = ZT_MULTICASTER_NIL;
+			if (newest != ZT_MULTICASTER_NIL) members[newest].newer = i; else oldest = i;
+			newest = i;
+		}
+	};
+
+	/**
+	 * Random order over the members of a group, drawn one at a time
+	 *
+	 * This is a Fisher-Yates shuffle that only runs as far as it is asked to.
+	 * Only slots that have been swapped are remembered, so drawing k members
+	 * costs O(k) time and memory no matter how large the group is.
+	 */
+	class _RandomOrder
+	{
+	public:
+		_RandomOrder(const uint32_t n) : _n(n),_i(0),_swapped(16) {}
+
+		inline bool more() const { return (_i < _n); }
+
+		inline uint32_t next(const uint64_t r)
+		{
+			const uint32_t j = _i + (uint32_t)(r % (uint64_t)(_n - _i));
+			const uint32_t picked = _slot(j);
+			if (j != _i)
+				_swapped.set(j,_slot(_i));
+			_swapped.erase(_i++);
+			return picked;
+		}
+
+	private:
+		inline uint32_t _slot(const uint32_t i) const
+		{
+			const uint32_t *const s = _swapped.get(i);
+			return ((s) ? *s : i);
+		}
+
+		const uint32_t _n;
+		uint32_t _i;
+		Hashtable<uint32_t,uint32_t> _swapped;
 	};
 
 	void _add(void *tPtr,int64_t now,uint64_t nwid,const MulticastGroup &mg,MulticastGroupStatus &gs,const Address &member);
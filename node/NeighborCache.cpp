@@ -0,0 +1,277 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2019  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#include <algorithm>
+
+#include "NeighborCache.hpp"
+#include "CertificateOfOwnership.hpp"
+#include "Switch.hpp"
+#include "Utils.hpp"
+
+namespace ZeroTier {
+
+NeighborCache::NeighborCache() :
+	_entries(64),
+	_answered(0),
+	_misses(0)
+{
+}
+
+void NeighborCache::learn(const uint64_t nwid,const CertificateOfOwnership &coo,const int64_t now)
+{
+	MAC mac(coo.issuedTo(),nwid);
+	unsigned int macs = 0;
+	for(unsigned int i=0;i<coo.thingCount();++i) {
+		if (coo.thingType(i) == CertificateOfOwnership::THING_MAC_ADDRESS) {
+			mac.setTo(coo.thingValue(i),6);
+			++macs;
+		}
+	}
+	if (macs > 1)
+		return;
+
+	Mutex::Lock _l(_lock);
+	for(unsigned int i=0;i<coo.thingCount();++i) {
+		switch(coo.thingType(i)) {
+			case CertificateOfOwnership::THING_IPV4_ADDRESS:
+				_learn(_Ip(coo.thingValue(i),4),mac,coo.issuedTo(),true,now);
+				break;
+			case CertificateOfOwnership::THING_IPV6_ADDRESS:
+				_learn(_Ip(coo.thingValue(i),16),mac,coo.issuedTo(),true,now);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+void NeighborCache::learn(const uint64_t nwid,const Address &peer,const bool mayBridge,const bool authorized,const MAC &from,const uint8_t *ip,const unsigned int ipLen,const MAC &mac,const int64_t now)
+{
+	// A member may only speak for its own MAC unless it is a bridge
+	if ((mac != from)||((!mayBridge)&&(mac != MAC(peer,nwid))))
+		return;
+
+	Mutex::Lock _l(_lock);
+	if (authorized) {
+		_learn(_Ip(ip,ipLen),mac,peer,false,now);
+	} else {
+		// Don't keep answering for an IP someone else now claims, but don't learn the claim either
+		const _Ip k(ip,ipLen);
+		const _Entry *const e = _entries.get(k);
+		if ((e)&&(!e->fromCoo)&&((e->owner != peer)||(e->mac != mac)))
+			_entries.erase(k);
+	}
+}
+
+void NeighborCache::forget(const Address &owner)
+{
+	Mutex::Lock _l(_lock);
+	_Ip *k = (_Ip *)0;
+	_Entry *e = (_Entry *)0;
+	Hashtable<_Ip,_Entry>::Iterator i(_entries);
+	while (i.next(k,e)) {
+		if (e->owner == owner)
+			_entries.erase(*k);
+	}
+}
+
+unsigned int NeighborCache::answer(const unsigned int etherType,const void *frame,const unsigned int len,const int64_t now,void *reply,MAC &replyFrom)
+{
+	const uint8_t *const f = reinterpret_cast<const uint8_t *>(frame);
+	uint8_t *const r = reinterpret_cast<uint8_t *>(reply);
+
+	if (etherType == ZT_ETHERTYPE_ARP) {
+		if ((len < 28)||(f[0] != 0x00)||(f[1] != 0x01)||(f[2] != 0x08)||(f[3] != 0x00)||(f[4] != 6)||(f[5] != 4)||(f[6] != 0x00)||(f[7] != 0x01))
+			return 0;
+		if (((f[14] | f[15] | f[16] | f[17]) == 0)||(memcmp(f + 14,f + 24,4) == 0)) // probe or gratuitous
+			return 0;
+
+		{
+			Mutex::Lock _l(_lock);
+			const _Entry *const e = _get(_Ip(f + 24,4),now);
+			if (!e) {
+				++_misses;
+				return 0;
+			}
+			replyFrom = e->mac;
+			++_answered;
+		}
+
+		r[0] = 0x00; r[1] = 0x01; r[2] = 0x08; r[3] = 0x00; r[4] = 6; r[5] = 4; r[6] = 0x00; r[7] = 0x02;
+		replyFrom.copyTo(r + 8,6);
+		memcpy(r + 14,f + 24,4); // sender IP is the IP that was asked about
+		memcpy(r + 18,f + 8,10); // target MAC and IP are those of the asker
+		return 28;
+	} else if (etherType == ZT_ETHERTYPE_IPV6) {
+		if ((len < 64)||(f[6] != 0x3a)||(f[7] != 0xff)||(f[40] != 0x87))
+			return 0;
+		bool unspecified = true;
+		for(unsigned int i=8;i<24;++i) {
+			if (f[i]) {
+				unspecified = false;
+				break;
+			}
+		}
+		if (unspecified) // duplicate address detection
+			return 0;
+
+		{
+			Mutex::Lock _l(_lock);
+			const _Entry *const e = _get(_Ip(f + 48,16),now);
+			if (!e) {
+				++_misses;
+				return 0;
+			}
+			replyFrom = e->mac;
+			++_answered;
+		}
+
+		return neighborAdvertisement(r,f + 48,f + 8,replyFrom);
+	}
+
+	return 0;
+}
+
+void NeighborCache::clean(const int64_t now)
+{
+	Mutex::Lock _l(_lock);
+	_Ip *k = (_Ip *)0;
+	_Entry *e = (_Entry *)0;
+	Hashtable<_Ip,_Entry>::Iterator i(_entries);
+	while (i.next(k,e)) {
+		if ((now - e->timestamp) >= ((e->fromCoo) ? ZT_NEIGHBOR_CACHE_COO_TTL : ZT_NEIGHBOR_CACHE_OBSERVED_TTL))
+			_entries.erase(*k);
+	}
+}
+
+void NeighborCache::clear()
+{
+	Mutex::Lock _l(_lock);
+	_entries.clear();
+}
+
+bool NeighborCache::announcement(const unsigned int etherType,const void *frame,const unsigned int len,const uint8_t *&ip,unsigned int &ipLen,MAC &mac)
+{
+	const uint8_t *const f = reinterpret_cast<const uint8_t *>(frame);
+
+	if (etherType == ZT_ETHERTYPE_ARP) {
+		// IPv4 over Ethernet ARP: <htype 1><ptype 0x0800><hlen 6><plen 4><op><sha><spa><tha><tpa>
+		if ((len < 28)||(f[0] != 0x00)||(f[1] != 0x01)||(f[2] != 0x08)||(f[3] != 0x00)||(f[4] != 6)||(f[5] != 4)||(f[6] != 0x00))
+			return false;
+		if ((f[7] != 0x02)&&((f[7] != 0x01)||(memcmp(f + 14,f + 24,4) != 0))) // replies and gratuitous ARPs only
+			return false;
+		if ((f[14] | f[15] | f[16] | f[17]) == 0)
+			return false;
+		mac.setTo(f + 8,6);
+		ip = f + 14;
+		ipLen = 4;
+		return true;
+	} else if (etherType == ZT_ETHERTYPE_IPV6) {
+		// Neighbor advertisement: <40 byte IPv6 header><type 136><code><checksum><flags><target><options...>
+		if ((len < 64)||(f[6] != 0x3a)||(f[7] != 0xff)||(f[40] != 0x88))
+			return false;
+		const unsigned int end = std::min(len,40U + (((unsigned int)f[4] << 8) | (unsigned int)f[5]));
+		mac.zero();
+		for(unsigned int o=64;(o + 8)<=end;) {
+			const unsigned int ol = (unsigned int)f[o + 1] * 8;
+			if (!ol)
+				return false;
+			if ((f[o] == 2)&&(ol == 8)) { // target link-layer address
+				mac.setTo(f + o + 2,6);
+				break;
+			}
+			o += ol;
+		}
+		if (!mac)
+			return false;
+		ip = f + 48;
+		ipLen = 16;
+		return true;
+	}
+
+	return false;
+}
+
+unsigned int NeighborCache::neighborAdvertisement(uint8_t *adv,const uint8_t *target,const uint8_t *dest,const MAC &mac)
+{
+	adv[0] = 0x60; adv[1] = 0x00; adv[2] = 0x00; adv[3] = 0x00;
+	adv[4] = 0x00; adv[5] = 0x20;
+	adv[6] = 0x3a; adv[7] = 0xff;
+	for(int i=0;i<16;++i) adv[8 + i] = target[i];
+	for(int i=0;i<16;++i) adv[24 + i] = dest[i];
+	adv[40] = 0x88; adv[41] = 0x00;
+	adv[42] = 0x00; adv[43] = 0x00; // future home of checksum
+	adv[44] = 0x60; adv[45] = 0x00; adv[46] = 0x00; adv[47] = 0x00;
+	for(int i=0;i<16;++i) adv[48 + i] = target[i];
+	adv[64] = 0x02; adv[65] = 0x01;
+	adv[66] = mac[0]; adv[67] = mac[1]; adv[68] = mac[2]; adv[69] = mac[3]; adv[70] = mac[4]; adv[71] = mac[5];
+
+	uint16_t pseudo_[36];
+	uint8_t *const pseudo = reinterpret_cast<uint8_t *>(pseudo_);
+	for(int i=0;i<32;++i) pseudo[i] = adv[8 + i];
+	pseudo[32] = 0x00; pseudo[33] = 0x00; pseudo[34] = 0x00; pseudo[35] = 0x20;
+	pseudo[36] = 0x00; pseudo[37] = 0x00; pseudo[38] = 0x00; pseudo[39] = 0x3a;
+	for(int i=0;i<32;++i) pseudo[40 + i] = adv[40 + i];
+	uint32_t checksum = 0;
+	for(int i=0;i<36;++i) checksum += Utils::hton(pseudo_[i]);
+	while ((checksum >> 16)) checksum = (checksum & 0xffff) + (checksum >> 16);
+	checksum = ~checksum;
+	adv[42] = (checksum >> 8) & 0xff;
+	adv[43] = checksum & 0xff;
+
+	return 72;
+}
+
+void NeighborCache::_learn(const _Ip &ip,const MAC &mac,const Address &owner,const bool fromCoo,const int64_t now)
+{
+	// assumes _lock is locked
+	_Entry *e = _entries.get(ip);
+	if (e) {
+		// Observed replies never override a live entry from a certificate of ownership
+		if ((!fromCoo)&&(e->fromCoo)&&((now - e->timestamp) < ZT_NEIGHBOR_CACHE_COO_TTL))
+			return;
+	} else {
+		if (_entries.size() >= ZT_NEIGHBOR_CACHE_MAX_ENTRIES)
+			return;
+		e = &(_entries[ip]);
+	}
+	e->mac = mac;
+	e->owner = owner;
+	e->timestamp = now;
+	e->fromCoo = fromCoo;
+}
+
+const NeighborCache::_Entry *NeighborCache::_get(const _Ip &ip,const int64_t now) const
+{
+	// assumes _lock is locked
+	const _Entry *const e = _entries.get(ip);
+	if ((e)&&((now - e->timestamp) < ((e->fromCoo) ? ZT_NEIGHBOR_CACHE_COO_TTL : ZT_NEIGHBOR_CACHE_OBSERVED_TTL)))
+		return e;
+	return (const _Entry *)0;
+}
+
+} // namespace ZeroTier
@@ -0,0 +1,235 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2019  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_NEIGHBORCACHE_HPP
+#define ZT_NEIGHBORCACHE_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Constants.hpp"
+#include "Hashtable.hpp"
+#include "Address.hpp"
+#include "MAC.hpp"
+#include "Mutex.hpp"
+
+/**
+ * Size of a buffer big enough for any reply generated by NeighborCache
+ *
+ * ARP replies are 28 bytes and NDP neighbor advertisements are 72 bytes.
+ */
+#define ZT_NEIGHBOR_CACHE_REPLY_BUF_LENGTH 72
+
+namespace ZeroTier {
+
+class CertificateOfOwnership;
+
+/**
+ * Proxy ARP and NDP cache for one network
+ *
+ * Broadcast ARP requests and IPv6 neighbor solicitations from the local tap
+ * are normally multicast to up to multicastLimit members. This cache lets a
+ * node answer them itself when it already knows which MAC owns an IP.
+ *
+ * Entries are learned from certificates of ownership that members push to
+ * us and from ARP replies, gratuitous ARPs and neighbor advertisements that
+ * members send us. An observed reply must carry the MAC that the sending
+ * member owns on this network unless that member is allowed to bridge, and
+ * is only learned if the member is authorized for the IP. A reply from a
+ * member that isn't authorized expires any observed entry mapping the IP
+ * elsewhere, so queries for it go back to being multicast to the real owner.
+ * Entries from certificates of ownership take precedence over observed ones
+ * and both kinds expire if not refreshed. All entries owned by a member are
+ * dropped if anything issued to that member is revoked.
+ *
+ * This class is thread safe.
+ */
+class NeighborCache
+{
+public:
+	NeighborCache();
+
+	/**
+	 * Learn IPs from a certificate of ownership that has been accepted
+	 *
+	 * IPs are mapped to the single MAC the certificate lists, or to the
+	 * owner's own MAC on this network if it lists none. Certificates that
+	 * list more than one MAC are ambiguous and are ignored.
+	 *
+	 * @param nwid Network ID
+	 * @param coo Certificate of ownership
+	 * @param now Current time
+	 */
+	void learn(const uint64_t nwid,const CertificateOfOwnership &coo,const int64_t now);
+
+	/**
+	 * Learn from an ARP reply, gratuitous ARP, or neighbor advertisement received from a member
+	 *
+	 * @param nwid Network ID
+	 * @param peer Member that sent this frame
+	 * @param mayBridge True if this member is allowed to bridge other MACs
+	 * @param authorized True if this member owns the IP by certificate of ownership or network assignment
+	 * @param from Source MAC of Ethernet frame
+	 * @param ip IP announced by frame (from announcement())
+	 * @param ipLen Length of IP, 4 or 16
+	 * @param mac MAC announced by frame (from announcement())
+	 * @param now Current time
+	 */
+	void learn(const uint64_t nwid,const Address &peer,const bool mayBridge,const bool authorized,const MAC &from,const uint8_t *ip,const unsigned int ipLen,const MAC &mac,const int64_t now);
+
+	/**
+	 * Forget all entries owned by a member
+	 *
+	 * @param owner Member address
+	 */
+	void forget(const Address &owner);
+
+	/**
+	 * Answer an ARP request or IPv6 neighbor solicitation from the local tap
+	 *
+	 * Address conflict detection probes and gratuitous announcements are
+	 * never answered, since they must reach the real owner of the IP.
+	 *
+	 * @param etherType Ethernet frame type
+	 * @param frame Ethernet frame payload
+	 * @param len Length of frame payload
+	 * @param now Current time
+	 * @param reply Buffer for reply, at least ZT_NEIGHBOR_CACHE_REPLY_BUF_LENGTH bytes
+	 * @param replyFrom Set to the MAC the reply should come from
+	 * @return Length of reply or 0 if this query could not be answered
+	 */
+	unsigned int answer(const unsigned int etherType,const void *frame,const unsigned int len,const int64_t now,void *reply,MAC &replyFrom);
+
+	/**
+	 * Remove expired entries
+	 *
+	 * @param now Current time
+	 */
+	void clean(const int64_t now);
+
+	/**
+	 * Remove all entries
+	 */
+	void clear();
+
+	/**
+	 * @return Number of cached entries
+	 */
+	inline unsigned long size() const
+	{
+		Mutex::Lock _l(_lock);
+		return _entries.size();
+	}
+
+	/**
+	 * @return Number of queries answered from this cache
+	 */
+	inline uint64_t answered() const { return _answered; }
+
+	/**
+	 * @return Number of queries that could not be answered and had to be multicast
+	 */
+	inline uint64_t misses() const { return _misses; }
+
+	/**
+	 * Get the IP and MAC announced by an ARP reply, gratuitous ARP, or neighbor advertisement
+	 *
+	 * Other frames announce nothing, so this can be called for every frame.
+	 *
+	 * @param etherType Ethernet frame type
+	 * @param frame Ethernet frame payload
+	 * @param len Length of frame payload
+	 * @param ip Set to point to the announced IP within frame
+	 * @param ipLen Set to length of IP, 4 or 16
+	 * @param mac Set to the MAC announced for this IP
+	 * @return True if frame is an announcement
+	 */
+	static bool announcement(const unsigned int etherType,const void *frame,const unsigned int len,const uint8_t *&ip,unsigned int &ipLen,MAC &mac);
+
+	/**
+	 * Write an IPv6 neighbor advertisement for a target address
+	 *
+	 * The advertisement is sent from the target address itself, carries
+	 * the solicited and override flags, and includes a target link-layer
+	 * address option.
+	 *
+	 * @param adv Buffer of at least 72 bytes
+	 * @param target 16-byte IPv6 address being advertised
+	 * @param dest 16-byte IPv6 destination
+	 * @param mac MAC that owns target
+	 * @return Length of advertisement (always 72)
+	 */
+	static unsigned int neighborAdvertisement(uint8_t *adv,const uint8_t *target,const uint8_t *dest,const MAC &mac);
+
+private:
+	// IPv4 addresses are stored as IPv4-mapped IPv6 addresses
+	struct _Ip
+	{
+		_Ip() : hi(0),lo(0) {}
+		_Ip(const uint8_t *ip,const unsigned int len)
+		{
+			if (len == 4) {
+				hi = 0;
+				lo = 0x0000ffff00000000ULL | ((uint64_t)ip[0] << 24) | ((uint64_t)ip[1] << 16) | ((uint64_t)ip[2] << 8) | (uint64_t)ip[3];
+			} else {
+				hi = 0; lo = 0;
+				for(unsigned int i=0;i<8;++i) {
+					hi = (hi << 8) | (uint64_t)ip[i];
+					lo = (lo << 8) | (uint64_t)ip[i + 8];
+				}
+			}
+		}
+
+		inline unsigned long hashCode() const { return (unsigned long)((hi ^ lo) * 0x9e3779b97f4a7c15ULL); }
+		inline bool operator==(const _Ip &ip) const { return ((hi == ip.hi)&&(lo == ip.lo)); }
+		inline bool operator!=(const _Ip &ip) const { return ((hi != ip.hi)||(lo != ip.lo)); }
+
+		uint64_t hi,lo;
+	};
+
+	struct _Entry
+	{
+		_Entry() : mac(),owner(),timestamp(0),fromCoo(false) {}
+
+		MAC mac;
+		Address owner;
+		int64_t timestamp;
+		bool fromCoo;
+	};
+
+	void _learn(const _Ip &ip,const MAC &mac,const Address &owner,const bool fromCoo,const int64_t now);
+	const _Entry *_get(const _Ip &ip,const int64_t now) const;
+
+	Hashtable<_Ip,_Entry> _entries;
+	volatile uint64_t _answered;
+	volatile uint64_t _misses;
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
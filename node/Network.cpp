@@ -52,48 +52,13 @@ namespace ZeroTier {
 
 namespace {
 
-// Returns true if packet appears valid; pos and proto will be set
-static bool _ipv6GetPayload(const uint8_t *frameData,unsigned int frameLen,unsigned int &pos,unsigned int &proto)
-{
-	if (frameLen < 40)
-		return false;
-	pos = 40;
-	proto = frameData[6];
-	while (pos <= frameLen) {
-		switch(proto) {
-			case 0: // hop-by-hop options
-			case 43: // routing
-			case 60: // destination options
-			case 135: // mobility options
-				if ((pos + 8) > frameLen)
-					return false; // invalid!
-				proto = frameData[pos];
-				pos += ((unsigned int)frameData[pos + 1] * 8) + 8;
-				break;
-
-			//case 44: // fragment -- we currently can't parse these and they are deprecated in IPv6 anyway
-			//case 50:
-			//case 51: // IPSec ESP and AH -- we have to stop here since this is encrypted stuff
-			default:
-				return true;
-		}
-	}
-	return false; // overflow == invalid
-}
-
-enum _doZtFilterResult
-{
-	DOZTFILTER_NO_MATCH,
-	DOZTFILTER_DROP,
-	DOZTFILTER_REDIRECT,
-	DOZTFILTER_ACCEPT,
-	DOZTFILTER_SUPER_ACCEPT
-};
-
-static _doZtFilterResult _doZtFilter(
+// Evaluates rules in their compiled form, or with the interpreter when a rule
+// result log is wanted for remote tracing or there is no compiled form
+static inline CompiledRules::Result _doZtFilter(
 	const RuntimeEnvironment *RR,
 	Trace::RuleResultLog &rrl,
 	const NetworkConfig &nconf,
+	const CompiledRules *const compiled, // NULL to interpret rules
 	const Membership *membership, // can be NULL
 	const bool inbound,
 	const Address &ztSource,
@@ -111,444 +76,23 @@ static _doZtFilterResult _doZtFilter(
 	bool &ccWatch, // MUTABLE -- set to true for WATCH target as opposed to normal TEE
 	uint8_t &qosBucket) // MUTABLE -- set to the value of the argument provided to PRIORITY
 {
-	// Set to true if we are a TEE/REDIRECT/WATCH target
-	bool superAccept = false;
-
-	// The default match state for each set of entries starts as 'true' since an
-	// ACTION with no MATCH entries preceding it is always taken.
-	uint8_t thisSetMatches = 1;
-
-	rrl.clear();
-
-	for(unsigned int rn=0;rn<ruleCount;++rn) {
-		const ZT_VirtualNetworkRuleType rt = (ZT_VirtualNetworkRuleType)(rules[rn].t & 0x3f);
-
-		// First check if this is an ACTION
-		if ((unsigned int)rt <= (unsigned int)ZT_NETWORK_RULE_ACTION__MAX_ID) {
-			if (thisSetMatches) {
-				switch(rt) {
-					case ZT_NETWORK_RULE_ACTION_PRIORITY:
-						qosBucket = (rules[rn].v.qosBucket >= 0 || rules[rn].v.qosBucket <= 8) ? rules[rn].v.qosBucket : 4; // 4 = default bucket (no priority)
-						return DOZTFILTER_ACCEPT;
-
-					case ZT_NETWORK_RULE_ACTION_DROP:
-						return DOZTFILTER_DROP;
-
-					case ZT_NETWORK_RULE_ACTION_ACCEPT:
-						return (superAccept ? DOZTFILTER_SUPER_ACCEPT : DOZTFILTER_ACCEPT); // match, accept packet
-
-					// These are initially handled together since preliminary logic is common
-					case ZT_NETWORK_RULE_ACTION_TEE:
-					case ZT_NETWORK_RULE_ACTION_WATCH:
-					case ZT_NETWORK_RULE_ACTION_REDIRECT:	{
-						const Address fwdAddr(rules[rn].v.fwd.address);
-						if (fwdAddr == ztSource) {
-							// Skip as no-op since source is target
-						} else if (fwdAddr == RR->identity.address()) {
-							if (inbound) {
-								return DOZTFILTER_SUPER_ACCEPT;
-							} else {
-							}
-						} else if (fwdAddr == ztDest) {
-						} else {
-							if (rt == ZT_NETWORK_RULE_ACTION_REDIRECT) {
-								ztDest = fwdAddr;
-								return DOZTFILTER_REDIRECT;
-							} else {
-								cc = fwdAddr;
-								ccLength = (rules[rn].v.fwd.length != 0) ? ((frameLen < (unsigned int)rules[rn].v.fwd.length) ? frameLen : (unsigned int)rules[rn].v.fwd.length) : frameLen;
-								ccWatch = (rt == ZT_NETWORK_RULE_ACTION_WATCH);
-							}
-						}
-					}	continue;
-
-					case ZT_NETWORK_RULE_ACTION_BREAK:
-						return DOZTFILTER_NO_MATCH;
-
-					// Unrecognized ACTIONs are ignored as no-ops
-					default:
-						continue;
-				}
-			} else {
-				// If this is an incoming packet and we are a TEE or REDIRECT target, we should
-				// super-accept if we accept at all. This will cause us to accept redirected or
-				// tee'd packets in spite of MAC and ZT addressing checks.
-				if (inbound) {
-					switch(rt) {
-						case ZT_NETWORK_RULE_ACTION_TEE:
-						case ZT_NETWORK_RULE_ACTION_WATCH:
-						case ZT_NETWORK_RULE_ACTION_REDIRECT:
-							if (RR->identity.address() == rules[rn].v.fwd.address)
-								superAccept = true;
-							break;
-						default:
-							break;
-					}
-				}
-
-				thisSetMatches = 1; // reset to default true for next batch of entries
-				continue;
-			}
-		}
-
-		// Circuit breaker: no need to evaluate an AND if the set's match state
-		// is currently false since anything AND false is false.
-		if ((!thisSetMatches)&&(!(rules[rn].t & 0x40))) {
-			rrl.logSkipped(rn,thisSetMatches);
-			continue;
-		}
-
-		// If this was not an ACTION evaluate next MATCH and update thisSetMatches with (AND [result])
-		uint8_t thisRuleMatches = 0;
-		uint64_t ownershipVerificationMask = 1; // this magic value means it hasn't been computed yet -- this is done lazily the first time it's needed
-		switch(rt) {
-			case ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS:
-				thisRuleMatches = (uint8_t)(rules[rn].v.zt == ztSource.toInt());
-				break;
-			case ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS:
-				thisRuleMatches = (uint8_t)(rules[rn].v.zt == ztDest.toInt());
-				break;
-			case ZT_NETWORK_RULE_MATCH_VLAN_ID:
-				thisRuleMatches = (uint8_t)(rules[rn].v.vlanId == (uint16_t)vlanId);
-				break;
-			case ZT_NETWORK_RULE_MATCH_VLAN_PCP:
-				// NOT SUPPORTED YET
-				thisRuleMatches = (uint8_t)(rules[rn].v.vlanPcp == 0);
-				break;
-			case ZT_NETWORK_RULE_MATCH_VLAN_DEI:
-				// NOT SUPPORTED YET
-				thisRuleMatches = (uint8_t)(rules[rn].v.vlanDei == 0);
-				break;
-			case ZT_NETWORK_RULE_MATCH_MAC_SOURCE:
-				thisRuleMatches = (uint8_t)(MAC(rules[rn].v.mac,6) == macSource);
-				break;
-			case ZT_NETWORK_RULE_MATCH_MAC_DEST:
-				thisRuleMatches = (uint8_t)(MAC(rules[rn].v.mac,6) == macDest);
-				break;
-			case ZT_NETWORK_RULE_MATCH_IPV4_SOURCE:
-				if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
-					thisRuleMatches = (uint8_t)(InetAddress((const void *)&(rules[rn].v.ipv4.ip),4,rules[rn].v.ipv4.mask).containsAddress(InetAddress((const void *)(frameData + 12),4,0)));
-				} else {
-					thisRuleMatches = 0;
-				}
-				break;
-			case ZT_NETWORK_RULE_MATCH_IPV4_DEST:
-				if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
-					thisRuleMatches = (uint8_t)(InetAddress((const void *)&(rules[rn].v.ipv4.ip),4,rules[rn].v.ipv4.mask).containsAddress(InetAddress((const void *)(frameData + 16),4,0)));
-				} else {
-					thisRuleMatches = 0;
-				}
-				break;
-			case ZT_NETWORK_RULE_MATCH_IPV6_SOURCE:
-				if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
-					thisRuleMatches = (uint8_t)(InetAddress((const void *)rules[rn].v.ipv6.ip,16,rules[rn].v.ipv6.mask).containsAddress(InetAddress((const void *)(frameData + 8),16,0)));
-				} else {
-					thisRuleMatches = 0;
-				}
-				break;
-			case ZT_NETWORK_RULE_MATCH_IPV6_DEST:
-				if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
-					thisRuleMatches = (uint8_t)(InetAddress((const void *)rules[rn].v.ipv6.ip,16,rules[rn].v.ipv6.mask).containsAddress(InetAddress((const void *)(frameData + 24),16,0)));
-				} else {
-					thisRuleMatches = 0;
-				}
-				break;
-			case ZT_NETWORK_RULE_MATCH_IP_TOS:
-				if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
-					const uint8_t tosMasked = frameData[1] & rules[rn].v.ipTos.mask;
-					thisRuleMatches = (uint8_t)((tosMasked >= rules[rn].v.ipTos.value[0])&&(tosMasked <= rules[rn].v.ipTos.value[1]));
-				} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
-					const uint8_t tosMasked = (((frameData[0] << 4) & 0xf0) | ((frameData[1] >> 4) & 0x0f)) & rules[rn].v.ipTos.mask;
-					thisRuleMatches = (uint8_t)((tosMasked >= rules[rn].v.ipTos.value[0])&&(tosMasked <= rules[rn].v.ipTos.value[1]));
-				} else {
-					thisRuleMatches = 0;
-				}
-				break;
-			case ZT_NETWORK_RULE_MATCH_IP_PROTOCOL:
-				if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
-					thisRuleMatches = (uint8_t)(rules[rn].v.ipProtocol == frameData[9]);
-				} else if (etherType == ZT_ETHERTYPE_IPV6) {
-					unsigned int pos = 0,proto = 0;
-					if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
-						thisRuleMatches = (uint8_t)(rules[rn].v.ipProtocol == (uint8_t)proto);
-					} else {
-						thisRuleMatches = 0;
-					}
-				} else {
-					thisRuleMatches = 0;
-				}
-				break;
-			case ZT_NETWORK_RULE_MATCH_ETHERTYPE:
-				thisRuleMatches = (uint8_t)(rules[rn].v.etherType == (uint16_t)etherType);
-				break;
-			case ZT_NETWORK_RULE_MATCH_ICMP:
-				if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
-					if (frameData[9] == 0x01) { // IP protocol == ICMP
-						const unsigned int ihl = (frameData[0] & 0xf) * 4;
-						if (frameLen >= (ihl + 2)) {
-							if (rules[rn].v.icmp.type == frameData[ihl]) {
-								if ((rules[rn].v.icmp.flags & 0x01) != 0) {
-									thisRuleMatches = (uint8_t)(frameData[ihl+1] == rules[rn].v.icmp.code);
-								} else {
-									thisRuleMatches = 1;
-								}
-							} else {
-								thisRuleMatches = 0;
-							}
-						} else {
-							thisRuleMatches = 0;
-						}
-					} else {
-						thisRuleMatches = 0;
-					}
-				} else if (etherType == ZT_ETHERTYPE_IPV6) {
-					unsigned int pos = 0,proto = 0;
-					if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
-						if ((proto == 0x3a)&&(frameLen >= (pos+2))) {
-							if (rules[rn].v.icmp.type == frameData[pos]) {
-								if ((rules[rn].v.icmp.flags & 0x01) != 0) {
-									thisRuleMatches = (uint8_t)(frameData[pos+1] == rules[rn].v.icmp.code);
-								} else {
-									thisRuleMatches = 1;
-								}
-							} else {
-								thisRuleMatches = 0;
-							}
-						} else {
-							thisRuleMatches = 0;
-						}
-					} else {
-						thisRuleMatches = 0;
-					}
-				} else {
-					thisRuleMatches = 0;
-				}
-				break;
-			case ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE:
-			case ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE:
-				if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
-					const unsigned int headerLen = 4 * (frameData[0] & 0xf);
-					int p = -1;
-					switch(frameData[9]) { // IP protocol number
-						// All these start with 16-bit source and destination port in that order
-						case 0x06: // TCP
-						case 0x11: // UDP
-						case 0x84: // SCTP
-						case 0x88: // UDPLite
-							if (frameLen > (headerLen + 4)) {
-								unsigned int pos = headerLen + ((rt == ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE) ? 2 : 0);
-								p = (int)frameData[pos++] << 8;
-								p |= (int)frameData[pos];
-							}
-							break;
-					}
-
-					thisRuleMatches = (p >= 0) ? (uint8_t)((p >= (int)rules[rn].v.port[0])&&(p <= (int)rules[rn].v.port[1])) : (uint8_t)0;
-				} else if (etherType == ZT_ETHERTYPE_IPV6) {
-					unsigned int pos = 0,proto = 0;
-					if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
-						int p = -1;
-						switch(proto) { // IP protocol number
-							// All these start with 16-bit source and destination port in that order
-							case 0x06: // TCP
-							case 0x11: // UDP
-							case 0x84: // SCTP
-							case 0x88: // UDPLite
-								if (frameLen > (pos + 4)) {
-									if (rt == ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE) pos += 2;
-									p = (int)frameData[pos++] << 8;
-									p |= (int)frameData[pos];
-								}
-								break;
-						}
-						thisRuleMatches = (p > 0) ? (uint8_t)((p >= (int)rules[rn].v.port[0])&&(p <= (int)rules[rn].v.port[1])) : (uint8_t)0;
-					} else {
-						thisRuleMatches = 0;
-					}
-				} else {
-					thisRuleMatches = 0;
-				}
-				break;
-			case ZT_NETWORK_RULE_MATCH_CHARACTERISTICS: {
-				uint64_t cf = (inbound) ? ZT_RULE_PACKET_CHARACTERISTICS_INBOUND : 0ULL;
-				if (macDest.isMulticast()) cf |= ZT_RULE_PACKET_CHARACTERISTICS_MULTICAST;
-				if (macDest.isBroadcast()) cf |= ZT_RULE_PACKET_CHARACTERISTICS_BROADCAST;
-				if (ownershipVerificationMask == 1) {
-					ownershipVerificationMask = 0;
-					InetAddress src;
-					if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)) {
-						src.set((const void *)(frameData + 12),4,0);
-					} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(frameLen >= 40)) {
-						// IPv6 NDP requires special handling, since the src and dest IPs in the packet are empty or link-local.
-						if ( (frameLen >= (40 + 8 + 16)) && (frameData[6] == 0x3a) && ((frameData[40] == 0x87)||(frameData[40] == 0x88)) ) {
-							if (frameData[40] == 0x87) {
-								// Neighbor solicitations contain no reliable source address, so we implement a small
-								// hack by considering them authenticated. Otherwise you would pretty much have to do
-								// this manually in the rule set for IPv6 to work at all.
-								ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
-							} else {
-								// Neighbor advertisements on the other hand can absolutely be authenticated.
-								src.set((const void *)(frameData + 40 + 8),16,0);
-							}
-						} else {
-							// Other IPv6 packets can be handled normally
-							src.set((const void *)(frameData + 8),16,0);
-						}
-					} else if ((etherType == ZT_ETHERTYPE_ARP)&&(frameLen >= 28)) {
-						src.set((const void *)(frameData + 14),4,0);
-					}
-					if (inbound) {
-						if (membership) {
-							if ((src)&&(membership->hasCertificateOfOwnershipFor<InetAddress>(nconf,src)))
-								ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
-							if (membership->hasCertificateOfOwnershipFor<MAC>(nconf,macSource))
-								ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_MAC_AUTHENTICATED;
-						}
-					} else {
-						for(unsigned int i=0;i<nconf.certificateOfOwnershipCount;++i) {
-							if ((src)&&(nconf.certificatesOfOwnership[i].owns(src)))
-								ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
-							if (nconf.certificatesOfOwnership[i].owns(macSource))
-								ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_MAC_AUTHENTICATED;
-						}
-					}
-				}
-				cf |= ownershipVerificationMask;
-				if ((etherType == ZT_ETHERTYPE_IPV4)&&(frameLen >= 20)&&(frameData[9] == 0x06)) {
-					const unsigned int headerLen = 4 * (frameData[0] & 0xf);
-					cf |= (uint64_t)frameData[headerLen + 13];
-					cf |= (((uint64_t)(frameData[headerLen + 12] & 0x0f)) << 8);
-				} else if (etherType == ZT_ETHERTYPE_IPV6) {
-					unsigned int pos = 0,proto = 0;
-					if (_ipv6GetPayload(frameData,frameLen,pos,proto)) {
-						if ((proto == 0x06)&&(frameLen > (pos + 14))) {
-							cf |= (uint64_t)frameData[pos + 13];
-							cf |= (((uint64_t)(frameData[pos + 12] & 0x0f)) << 8);
-						}
-					}
-				}
-				thisRuleMatches = (uint8_t)((cf & rules[rn].v.characteristics) != 0);
-			}	break;
-			case ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE:
-				thisRuleMatches = (uint8_t)((frameLen >= (unsigned int)rules[rn].v.frameSize[0])&&(frameLen <= (unsigned int)rules[rn].v.frameSize[1]));
-				break;
-			case ZT_NETWORK_RULE_MATCH_RANDOM:
-				thisRuleMatches = (uint8_t)((uint32_t)(RR->node->prng() & 0xffffffffULL) <= rules[rn].v.randomProbability);
-				break;
-			case ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE:
-			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND:
-			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR:
-			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR:
-			case ZT_NETWORK_RULE_MATCH_TAGS_EQUAL: {
-				const Tag *const localTag = std::lower_bound(&(nconf.tags[0]),&(nconf.tags[nconf.tagCount]),rules[rn].v.tag.id,Tag::IdComparePredicate());
-				if ((localTag != &(nconf.tags[nconf.tagCount]))&&(localTag->id() == rules[rn].v.tag.id)) {
-					const Tag *const remoteTag = ((membership) ? membership->getTag(nconf,rules[rn].v.tag.id) : (const Tag *)0);
-					if (remoteTag) {
-						const uint32_t ltv = localTag->value();
-						const uint32_t rtv = remoteTag->value();
-						if (rt == ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE) {
-							const uint32_t diff = (ltv > rtv) ? (ltv - rtv) : (rtv - ltv);
-							thisRuleMatches = (uint8_t)(diff <= rules[rn].v.tag.value);
-						} else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND) {
-							thisRuleMatches = (uint8_t)((ltv & rtv) == rules[rn].v.tag.value);
-						} else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR) {
-							thisRuleMatches = (uint8_t)((ltv | rtv) == rules[rn].v.tag.value);
-						} else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR) {
-							thisRuleMatches = (uint8_t)((ltv ^ rtv) == rules[rn].v.tag.value);
-						} else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_EQUAL) {
-							thisRuleMatches = (uint8_t)((ltv == rules[rn].v.tag.value)&&(rtv == rules[rn].v.tag.value));
-						} else { // sanity check, can't really happen
-							thisRuleMatches = 0;
-						}
-					} else {
-						if ((inbound)&&(!superAccept)) {
-							thisRuleMatches = 0;
-						} else {
-							// Outbound side is not strict since if we have to match both tags and
-							// we are sending a first packet to a recipient, we probably do not know
-							// about their tags yet. They will filter on inbound and we will filter
-							// once we get their tag. If we are a tee/redirect target we are also
-							// not strict since we likely do not have these tags.
-							thisRuleMatches = 1;
-						}
-					}
-				} else {
-					thisRuleMatches = 0;
-				}
-			}	break;
-			case ZT_NETWORK_RULE_MATCH_TAG_SENDER:
-			case ZT_NETWORK_RULE_MATCH_TAG_RECEIVER: {
-				if (superAccept) {
-					thisRuleMatches = 1;
-				} else if ( ((rt == ZT_NETWORK_RULE_MATCH_TAG_SENDER)&&(inbound)) || ((rt == ZT_NETWORK_RULE_MATCH_TAG_RECEIVER)&&(!inbound)) ) {
-					const Tag *const remoteTag = ((membership) ? membership->getTag(nconf,rules[rn].v.tag.id) : (const Tag *)0);
-					if (remoteTag) {
-						thisRuleMatches = (uint8_t)(remoteTag->value() == rules[rn].v.tag.value);
-					} else {
-						if (rt == ZT_NETWORK_RULE_MATCH_TAG_RECEIVER) {
-							// If we are checking the receiver and this is an outbound packet, we
-							// can't be strict since we may not yet know the receiver's tag.
-							thisRuleMatches = 1;
-						} else {
-							thisRuleMatches = 0;
-						}
-					}
-				} else { // sender and outbound or receiver and inbound
-					const Tag *const localTag = std::lower_bound(&(nconf.tags[0]),&(nconf.tags[nconf.tagCount]),rules[rn].v.tag.id,Tag::IdComparePredicate());
-					if ((localTag != &(nconf.tags[nconf.tagCount]))&&(localTag->id() == rules[rn].v.tag.id)) {
-						thisRuleMatches = (uint8_t)(localTag->value() == rules[rn].v.tag.value);
-					} else {
-						thisRuleMatches = 0;
-					}
-				}
-			}	break;
-			case ZT_NETWORK_RULE_MATCH_INTEGER_RANGE: {
-				uint64_t integer = 0;
-				const unsigned int bits = (rules[rn].v.intRange.format & 63) + 1;
-				const unsigned int bytes = ((bits + 8 - 1) / 8); // integer ceiling of division by 8
-				if ((rules[rn].v.intRange.format & 0x80) == 0) {
-					// Big-endian
-					unsigned int idx = rules[rn].v.intRange.idx + (8 - bytes);
-					const unsigned int eof = idx + bytes;
-					if (eof <= frameLen) {
-						while (idx < eof) {
-							integer <<= 8;
-							integer |= frameData[idx++];
-						}
-					}
-					integer &= 0xffffffffffffffffULL >> (64 - bits);
-				} else {
-					// Little-endian
-					unsigned int idx = rules[rn].v.intRange.idx;
-					const unsigned int eof = idx + bytes;
-					if (eof <= frameLen) {
-						while (idx < eof) {
-							integer >>= 8;
-							integer |= ((uint64_t)frameData[idx++]) << 56;
-						}
-					}
-					integer >>= (64 - bits);
-				}
-				thisRuleMatches = (uint8_t)((integer >= rules[rn].v.intRange.start)&&(integer <= (rules[rn].v.intRange.start + (uint64_t)rules[rn].v.intRange.end)));
-			}	break;
-
-			// The result of an unsupported MATCH is configurable at the network
-			// level via a flag.
-			default:
-				thisRuleMatches = (uint8_t)((nconf.flags & ZT_NETWORKCONFIG_FLAG_RULES_RESULT_OF_UNSUPPORTED_MATCH) != 0);
-				break;
-		}
-
-		rrl.log(rn,thisRuleMatches,thisSetMatches);
-
-		if ((rules[rn].t & 0x40))
-			thisSetMatches |= (thisRuleMatches ^ ((rules[rn].t >> 7) & 1));
-		else thisSetMatches &= (thisRuleMatches ^ ((rules[rn].t >> 7) & 1));
-	}
-
-	return DOZTFILTER_NO_MATCH;
+	if ((compiled)&&(!nconf.remoteTraceTarget))
+		return compiled->filter(RR,nconf,membership,inbound,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,cc,ccLength,ccWatch,qosBucket);
+	return CompiledRules::interpret(RR,rrl,nconf,membership,inbound,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,rules,ruleCount,cc,ccLength,ccWatch,qosBucket);
 }
 
+// Locks a mutex for the current scope if one is given
+class _OptionalLock
+{
+public:
+	_OptionalLock(Mutex *m) : _m(m) { if (_m) _m->lock(); }
+	~_OptionalLock() { if (_m) _m->unlock(); }
+private:
+	_OptionalLock(const _OptionalLock &) : _m((Mutex *)0) {}
+	const _OptionalLock &operator=(const _OptionalLock &) { return *this; }
+	Mutex *const _m;
+};
+
 } // anonymous namespace
 
 const ZeroTier::MulticastGroup Network::BROADCAST(ZeroTier::MAC(0xffffffffffffULL),0);
@@ -560,10 +104,16 @@ Network::Network(const RuntimeEnvironment *renv,void *tPtr,uint64_t nwid,void *u
 	_lastAnnouncedMulticastGroupsUpstream(0),
 	_mac(renv->identity.address(),nwid),
 	_portInitialized(false),
+	_config(new NetworkConfigSnapshot()),
 	_lastConfigUpdate(0),
 	_destroyed(false),
 	_netconfFailure(NETCONF_FAILURE_NONE),
-	_portError(0)
+	_portError(0),
+	_flowsConfig((const NetworkConfigSnapshot *)0),
+	_flowsEpoch(0),
+	_flowHits(0),
+	_flowMisses(0),
+	_flowBypasses(0)
 {
 	for(int i=0;i<ZT_NETWORK_MAX_INCOMING_UPDATES;++i)
 		_incomingConfigChunks[i].ts = 0;
@@ -631,6 +181,34 @@ bool Network::filterOutgoingPacket(
 	const unsigned int vlanId,
 	uint8_t &qosBucket)
 {
+	const SharedPtr<NetworkConfigSnapshot> nconf(config());
+
+	CompiledRules::FlowKey flowKey;
+	uint64_t flowEpoch = 0;
+	const bool cacheFlow = ((nconf->flowCacheable)&&(!nconf->remoteTraceTarget)&&(CompiledRules::flowKey(flowKey,false,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,qosBucket)));
+	_FlowDecision flow;
+	if (cacheFlow) {
+		if (_getFlow(nconf.ptr(),flowKey,flow,flowEpoch)) {
+			qosBucket = flow.qosBucket;
+			if (!flow.accept)
+				return false;
+			if (!noTee) {
+				// Cacheable rules never limit TEE length, so copies are always whole frames
+				if (flow.capabilityCc)
+					_sendFrameCopy(tPtr,flow.capabilityCc,(flow.capabilityCcWatch ? 0x16 : 0x02),macSource,macDest,etherType,frameData,frameLen);
+				if (flow.cc)
+					_sendFrameCopy(tPtr,flow.cc,(flow.ccWatch ? 0x16 : 0x02),macSource,macDest,etherType,frameData,frameLen);
+			}
+			if ((ztDest != flow.ztFinalDest)&&(flow.ztFinalDest)) {
+				_sendFrameCopy(tPtr,flow.ztFinalDest,0x04,macSource,macDest,etherType,frameData,frameLen);
+				return false;
+			}
+			return true;
+		}
+	} else {
+		_bypassFlow();
+	}
+
 	Address ztFinalDest(ztDest);
 	int localCapabilityIndex = -1;
 	int accept = 0;
@@ -639,40 +217,34 @@ bool Network::filterOutgoingPacket(
 	unsigned int ccLength = 0;
 	bool ccWatch = false;
 
-	Mutex::Lock _l(_lock);
+	const SharedPtr<_LockedMembership> lm((ztDest) ? _getMembership(ztDest) : SharedPtr<_LockedMembership>());
+	_OptionalLock _l((lm) ? &(lm->lock) : (Mutex *)0);
+	Membership *const membership = (lm) ? &(lm->m) : (Membership *)0;
 
-	Membership *const membership = (ztDest) ? _memberships.get(ztDest) : (Membership *)0;
+	flow.capabilityCcWatch = false;
+	switch(_doZtFilter(RR,rrl,*nconf,&(nconf->compiledRules),membership,false,ztSource,ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,nconf->rules,nconf->ruleCount,cc,ccLength,ccWatch,qosBucket)) {
 
-	switch(_doZtFilter(RR,rrl,_config,membership,false,ztSource,ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,_config.rules,_config.ruleCount,cc,ccLength,ccWatch,qosBucket)) {
-
-		case DOZTFILTER_NO_MATCH: {
-			for(unsigned int c=0;c<_config.capabilityCount;++c) {
+		case CompiledRules::FILTER_NO_MATCH: {
+			for(unsigned int c=0;c<nconf->capabilityCount;++c) {
 				ztFinalDest = ztDest; // sanity check, shouldn't be possible if there was no match
 				Address cc2;
 				unsigned int ccLength2 = 0;
 				bool ccWatch2 = false;
-				switch (_doZtFilter(RR,crrl,_config,membership,false,ztSource,ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,_config.capabilities[c].rules(),_config.capabilities[c].ruleCount(),cc2,ccLength2,ccWatch2,qosBucket)) {
-					case DOZTFILTER_NO_MATCH:
-					case DOZTFILTER_DROP: // explicit DROP in a capability just terminates its evaluation and is an anti-pattern
+				switch (_doZtFilter(RR,crrl,*nconf,&(nconf->compiledCapabilityRules[c]),membership,false,ztSource,ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,nconf->capabilities[c].rules(),nconf->capabilities[c].ruleCount(),cc2,ccLength2,ccWatch2,qosBucket)) {
+					case CompiledRules::FILTER_NO_MATCH:
+					case CompiledRules::FILTER_DROP: // explicit DROP in a capability just terminates its evaluation and is an anti-pattern
 						break;
 
-					case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
-					case DOZTFILTER_ACCEPT:
-					case DOZTFILTER_SUPER_ACCEPT: // no difference in behavior on outbound side in capabilities
+					case CompiledRules::FILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
+					case CompiledRules::FILTER_ACCEPT:
+					case CompiledRules::FILTER_SUPER_ACCEPT: // no difference in behavior on outbound side in capabilities
 						localCapabilityIndex = (int)c;
 						accept = 1;
 
-						if ((!noTee)&&(cc2)) {
-							Packet outp(cc2,RR->identity.address(),Packet::VERB_EXT_FRAME);
-							outp.append(_id);
-							outp.append((uint8_t)(ccWatch2 ? 0x16 : 0x02));
-							macDest.appendTo(outp);
-							macSource.appendTo(outp);
-							outp.append((uint16_t)etherType);
-							outp.append(frameData,ccLength2);
-							outp.compress();
-							RR->sw->send(tPtr,outp,true);
-						}
+						flow.capabilityCc = cc2;
+						flow.capabilityCcWatch = ccWatch2;
+						if ((!noTee)&&(cc2))
+							_sendFrameCopy(tPtr,cc2,(ccWatch2 ? 0x16 : 0x02),macSource,macDest,etherType,frameData,ccLength2);
 
 						break;
 				}
@@ -681,60 +253,100 @@ bool Network::filterOutgoingPacket(
 			}
 		}	break;
 
-		case DOZTFILTER_DROP:
-			if (_config.remoteTraceTarget)
+		case CompiledRules::FILTER_DROP:
+			if (cacheFlow) {
+				flow.qosBucket = qosBucket;
+				flow.accept = 0;
+				_putFlow(nconf.ptr(),flowKey,flow,flowEpoch);
+			}
+			if (nconf->remoteTraceTarget)
 				RR->t->networkFilter(tPtr,*this,rrl,(Trace::RuleResultLog *)0,(Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,0);
 			return false;
 
-		case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
-		case DOZTFILTER_ACCEPT:
+		case CompiledRules::FILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
+		case CompiledRules::FILTER_ACCEPT:
 			accept = 1;
 			break;
 
-		case DOZTFILTER_SUPER_ACCEPT:
+		case CompiledRules::FILTER_SUPER_ACCEPT:
 			accept = 2;
 			break;
 	}
 
+	if (cacheFlow) {
+		flow.ztFinalDest = ztFinalDest;
+		flow.cc = cc;
+		flow.ccWatch = ccWatch;
+		flow.qosBucket = qosBucket;
+		flow.accept = (uint8_t)accept;
+		_putFlow(nconf.ptr(),flowKey,flow,flowEpoch);
+	}
+
 	if (accept) {
-		if ((!noTee)&&(cc)) {
-			Packet outp(cc,RR->identity.address(),Packet::VERB_EXT_FRAME);
-			outp.append(_id);
-			outp.append((uint8_t)(ccWatch ? 0x16 : 0x02));
-			macDest.appendTo(outp);
-			macSource.appendTo(outp);
-			outp.append((uint16_t)etherType);
-			outp.append(frameData,ccLength);
-			outp.compress();
-			RR->sw->send(tPtr,outp,true);
-		}
+		if ((!noTee)&&(cc))
+			_sendFrameCopy(tPtr,cc,(ccWatch ? 0x16 : 0x02),macSource,macDest,etherType,frameData,ccLength);
 
 		if ((ztDest != ztFinalDest)&&(ztFinalDest)) {
-			Packet outp(ztFinalDest,RR->identity.address(),Packet::VERB_EXT_FRAME);
-			outp.append(_id);
-			outp.append((uint8_t)0x04);
-			macDest.appendTo(outp);
-			macSource.appendTo(outp);
-			outp.append((uint16_t)etherType);
-			outp.append(frameData,frameLen);
-			outp.compress();
-			RR->sw->send(tPtr,outp,true);
-
-			if (_config.remoteTraceTarget)
-				RR->t->networkFilter(tPtr,*this,rrl,(localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(localCapabilityIndex >= 0) ? &(_config.capabilities[localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,0);
+			_sendFrameCopy(tPtr,ztFinalDest,0x04,macSource,macDest,etherType,frameData,frameLen);
+
+			if (nconf->remoteTraceTarget)
+				RR->t->networkFilter(tPtr,*this,rrl,(localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(localCapabilityIndex >= 0) ? &(nconf->capabilities[localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,0);
 			return false; // DROP locally, since we redirected
 		} else {
-			if (_config.remoteTraceTarget)
-				RR->t->networkFilter(tPtr,*this,rrl,(localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(localCapabilityIndex >= 0) ? &(_config.capabilities[localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,1);
+			if (nconf->remoteTraceTarget)
+				RR->t->networkFilter(tPtr,*this,rrl,(localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(localCapabilityIndex >= 0) ? &(nconf->capabilities[localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,1);
 			return true;
 		}
 	} else {
-		if (_config.remoteTraceTarget)
-			RR->t->networkFilter(tPtr,*this,rrl,(localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(localCapabilityIndex >= 0) ? &(_config.capabilities[localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,0);
+		if (nconf->remoteTraceTarget)
+			RR->t->networkFilter(tPtr,*this,rrl,(localCapabilityIndex >= 0) ? &crrl : (Trace::RuleResultLog *)0,(localCapabilityIndex >= 0) ? &(nconf->capabilities[localCapabilityIndex]) : (Capability *)0,ztSource,ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,noTee,false,0);
 		return false;
 	}
 }
 
+int Network::filterOutgoingMulticast(
+	const NetworkConfigSnapshot &nconf,
+	const Address &ztSource,
+	const MAC &macSource,
+	const MAC &macDest,
+	const uint8_t *frameData,
+	const unsigned int frameLen,
+	const unsigned int etherType,
+	const unsigned int vlanId) const
+{
+	if ((!nconf.destinationIndependent)||(nconf.remoteTraceTarget))
+		return -1; // remote tracing wants a rule result log for every recipient
+
+	// These rules never look at the destination or its membership, and TEE
+	// targets go unused since this is the noTee pass
+	Address ztFinalDest;
+	Address cc;
+	unsigned int ccLength = 0;
+	bool ccWatch = false;
+	uint8_t qosBucket = 255;
+	switch(nconf.compiledRules.filter(RR,nconf,(const Membership *)0,false,ztSource,ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,cc,ccLength,ccWatch,qosBucket)) {
+		case CompiledRules::FILTER_NO_MATCH:
+			for(unsigned int c=0;c<nconf.capabilityCount;++c) {
+				switch(nconf.compiledCapabilityRules[c].filter(RR,nconf,(const Membership *)0,false,ztSource,ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,cc,ccLength,ccWatch,qosBucket)) {
+					case CompiledRules::FILTER_NO_MATCH:
+					case CompiledRules::FILTER_DROP:
+						break;
+					case CompiledRules::FILTER_REDIRECT: // can't happen in destination independent rules
+						return -1;
+					default:
+						return 1;
+				}
+			}
+			return 0;
+		case CompiledRules::FILTER_DROP:
+			return 0;
+		case CompiledRules::FILTER_REDIRECT:
+			return -1;
+		default:
+			return 1;
+	}
+}
+
 int Network::filterIncomingPacket(
 	void *tPtr,
 	const SharedPtr<Peer> &sourcePeer,
@@ -746,6 +358,32 @@ int Network::filterIncomingPacket(
 	const unsigned int etherType,
 	const unsigned int vlanId)
 {
+	uint8_t qosBucket = 255; // For incoming packets this is a dummy value
+
+	const SharedPtr<NetworkConfigSnapshot> nconf(config());
+
+	// Capabilities on the inbound side are presented by the sender, so whether
+	// they are cacheable is only known once they have been evaluated below.
+	CompiledRules::FlowKey flowKey;
+	uint64_t flowEpoch = 0;
+	bool cacheFlow = ((nconf->compiledRules.cacheable())&&(!nconf->remoteTraceTarget)&&(CompiledRules::flowKey(flowKey,true,sourcePeer->address(),ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,qosBucket)));
+	_FlowDecision flow;
+	if (cacheFlow) {
+		if (_getFlow(nconf.ptr(),flowKey,flow,flowEpoch)) {
+			if (flow.accept) {
+				if (flow.capabilityCc)
+					_sendFrameCopy(tPtr,flow.capabilityCc,(flow.capabilityCcWatch ? 0x1c : 0x08),macSource,macDest,etherType,frameData,frameLen);
+				if (flow.cc)
+					_sendFrameCopy(tPtr,flow.cc,(flow.ccWatch ? 0x1c : 0x08),macSource,macDest,etherType,frameData,frameLen);
+				if ((ztDest != flow.ztFinalDest)&&(flow.ztFinalDest)) {
+					_sendFrameCopy(tPtr,flow.ztFinalDest,0x0a,macSource,macDest,etherType,frameData,frameLen);
+					return 0;
+				}
+			}
+			return (int)flow.accept;
+		}
+	}
+
 	Address ztFinalDest(ztDest);
 	Trace::RuleResultLog rrl,crrl;
 	int accept = 0;
@@ -754,96 +392,91 @@ int Network::filterIncomingPacket(
 	bool ccWatch = false;
 	const Capability *c = (Capability *)0;
 
-	uint8_t qosBucket = 255; // For incoming packets this is a dummy value
-
-	Mutex::Lock _l(_lock);
+	const SharedPtr<_LockedMembership> lm(_membership(sourcePeer->address()));
+	Mutex::Lock _l(lm->lock);
+	Membership &membership = lm->m;
 
-	Membership &membership = _membership(sourcePeer->address());
+	flow.capabilityCcWatch = false;
+	switch (_doZtFilter(RR,rrl,*nconf,&(nconf->compiledRules),&membership,true,sourcePeer->address(),ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,nconf->rules,nconf->ruleCount,cc,ccLength,ccWatch,qosBucket)) {
 
-	switch (_doZtFilter(RR,rrl,_config,&membership,true,sourcePeer->address(),ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,_config.rules,_config.ruleCount,cc,ccLength,ccWatch,qosBucket)) {
-
-		case DOZTFILTER_NO_MATCH: {
-			Membership::CapabilityIterator mci(membership,_config);
+		case CompiledRules::FILTER_NO_MATCH: {
+			Membership::CapabilityIterator mci(membership,*nconf);
 			while ((c = mci.next())) {
+				if ((cacheFlow)&&(!CompiledRules::cacheable(c->rules(),c->ruleCount())))
+					cacheFlow = false;
 				ztFinalDest = ztDest; // sanity check, should be unmodified if there was no match
 				Address cc2;
 				unsigned int ccLength2 = 0;
 				bool ccWatch2 = false;
-				switch(_doZtFilter(RR,crrl,_config,&membership,true,sourcePeer->address(),ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,c->rules(),c->ruleCount(),cc2,ccLength2,ccWatch2,qosBucket)) {
-					case DOZTFILTER_NO_MATCH:
-					case DOZTFILTER_DROP: // explicit DROP in a capability just terminates its evaluation and is an anti-pattern
+				switch(_doZtFilter(RR,crrl,*nconf,(const CompiledRules *)0,&membership,true,sourcePeer->address(),ztFinalDest,macSource,macDest,frameData,frameLen,etherType,vlanId,c->rules(),c->ruleCount(),cc2,ccLength2,ccWatch2,qosBucket)) {
+					case CompiledRules::FILTER_NO_MATCH:
+					case CompiledRules::FILTER_DROP: // explicit DROP in a capability just terminates its evaluation and is an anti-pattern
 						break;
-					case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztDest will have been changed in _doZtFilter()
-					case DOZTFILTER_ACCEPT:
+					case CompiledRules::FILTER_REDIRECT: // interpreted as ACCEPT but ztDest will have been changed in _doZtFilter()
+					case CompiledRules::FILTER_ACCEPT:
 						accept = 1; // ACCEPT
 						break;
-					case DOZTFILTER_SUPER_ACCEPT:
+					case CompiledRules::FILTER_SUPER_ACCEPT:
 						accept = 2; // super-ACCEPT
 						break;
 				}
 
 				if (accept) {
-					if (cc2) {
-						Packet outp(cc2,RR->identity.address(),Packet::VERB_EXT_FRAME);
-						outp.append(_id);
-						outp.append((uint8_t)(ccWatch2 ? 0x1c : 0x08));
-						macDest.appendTo(outp);
-						macSource.appendTo(outp);
-						outp.append((uint16_t)etherType);
-						outp.append(frameData,ccLength2);
-						outp.compress();
-						RR->sw->send(tPtr,outp,true);
-					}
+					flow.capabilityCc = cc2;
+					flow.capabilityCcWatch = ccWatch2;
+					if (cc2)
+						_sendFrameCopy(tPtr,cc2,(ccWatch2 ? 0x1c : 0x08),macSource,macDest,etherType,frameData,ccLength2);
 					break;
 				}
 			}
 		}	break;
 
-		case DOZTFILTER_DROP:
-			if (_config.remoteTraceTarget)
+		case CompiledRules::FILTER_DROP:
+			if (cacheFlow) {
+				flow.qosBucket = qosBucket;
+				flow.accept = 0;
+				_putFlow(nconf.ptr(),flowKey,flow,flowEpoch);
+			} else {
+				_bypassFlow();
+			}
+			if (nconf->remoteTraceTarget)
 				RR->t->networkFilter(tPtr,*this,rrl,(Trace::RuleResultLog *)0,(Capability *)0,sourcePeer->address(),ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,false,true,0);
 			return 0; // DROP
 
-		case DOZTFILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
-		case DOZTFILTER_ACCEPT:
+		case CompiledRules::FILTER_REDIRECT: // interpreted as ACCEPT but ztFinalDest will have been changed in _doZtFilter()
+		case CompiledRules::FILTER_ACCEPT:
 			accept = 1; // ACCEPT
 			break;
-		case DOZTFILTER_SUPER_ACCEPT:
+		case CompiledRules::FILTER_SUPER_ACCEPT:
 			accept = 2; // super-ACCEPT
 			break;
 	}
 
+	if (cacheFlow) {
+		flow.ztFinalDest = ztFinalDest;
+		flow.cc = cc;
+		flow.ccWatch = ccWatch;
+		flow.qosBucket = qosBucket;
+		flow.accept = (uint8_t)accept;
+		_putFlow(nconf.ptr(),flowKey,flow,flowEpoch);
+	} else {
+		_bypassFlow();
+	}
+
 	if (accept) {
-		if (cc) {
-			Packet outp(cc,RR->identity.address(),Packet::VERB_EXT_FRAME);
-			outp.append(_id);
-			outp.append((uint8_t)(ccWatch ? 0x1c : 0x08));
-			macDest.appendTo(outp);
-			macSource.appendTo(outp);
-			outp.append((uint16_t)etherType);
-			outp.append(frameData,ccLength);
-			outp.compress();
-			RR->sw->send(tPtr,outp,true);
-		}
+		if (cc)
+			_sendFrameCopy(tPtr,cc,(ccWatch ? 0x1c : 0x08),macSource,macDest,etherType,frameData,ccLength);
 
 		if ((ztDest != ztFinalDest)&&(ztFinalDest)) {
-			Packet outp(ztFinalDest,RR->identity.address(),Packet::VERB_EXT_FRAME);
-			outp.append(_id);
-			outp.append((uint8_t)0x0a);
-			macDest.appendTo(outp);
-			macSource.appendTo(outp);
-			outp.append((uint16_t)etherType);
-			outp.append(frameData,frameLen);
-			outp.compress();
-			RR->sw->send(tPtr,outp,true);
-
-			if (_config.remoteTraceTarget)
+			_sendFrameCopy(tPtr,ztFinalDest,0x0a,macSource,macDest,etherType,frameData,frameLen);
+
+			if (nconf->remoteTraceTarget)
 				RR->t->networkFilter(tPtr,*this,rrl,(c) ? &crrl : (Trace::RuleResultLog *)0,c,sourcePeer->address(),ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,false,true,0);
 			return 0; // DROP locally, since we redirected
 		}
 	}
 
-	if (_config.remoteTraceTarget)
+	if (nconf->remoteTraceTarget)
 		RR->t->networkFilter(tPtr,*this,rrl,(c) ? &crrl : (Trace::RuleResultLog *)0,c,sourcePeer->address(),ztDest,macSource,macDest,frameData,frameLen,etherType,vlanId,false,true,accept);
 	return accept;
 }
@@ -888,6 +521,7 @@ uint64_t Network::handleConfigChunk(void *tPtr,const uint64_t packetId,const Add
 
 	NetworkConfig *nc = (NetworkConfig *)0;
 	uint64_t configUpdateId;
+	bool needFullConfig = false;
 	{
 		Mutex::Lock _l(_lock);
 
@@ -935,9 +569,10 @@ uint64_t Network::handleConfigChunk(void *tPtr,const uint64_t packetId,const Add
 
 			// New properly verified chunks can be flooded "virally" through the network
 			if (fastPropagate) {
+				Mutex::Lock _ml(_memberships_m);
 				Address *a = (Address *)0;
-				Membership *m = (Membership *)0;
-				Hashtable<Address,Membership>::Iterator i(_memberships);
+				SharedPtr<_LockedMembership> *m = (SharedPtr<_LockedMembership> *)0;
+				Hashtable< Address,SharedPtr<_LockedMembership> >::Iterator i(_memberships);
 				while (i.next(a,m)) {
 					if ((*a != source)&&(*a != controller())) {
 						Packet outp(*a,RR->identity.address(),Packet::VERB_NETWORK_CONFIG);
@@ -982,9 +617,13 @@ uint64_t Network::handleConfigChunk(void *tPtr,const uint64_t packetId,const Add
 		if (c->haveBytes == totalLength) {
 			c->data.unsafeData()[c->haveBytes] = (char)0; // ensure null terminated
 
+			const SharedPtr<NetworkConfigSnapshot> base(config());
 			nc = new NetworkConfig();
 			try {
-				if (!nc->fromDictionary(c->data)) {
+				if (!nc->fromDictionary(c->data,base.ptr())) {
+					// A delta against a config we don't have: ask for a full one, which the
+					// controller sends since the revision we report won't match its base
+					needFullConfig = ((NetworkConfig::isDelta(c->data))&&(c->data.getUI(ZT_NETWORKCONFIG_DICT_KEY_ISSUED_TO,0) == RR->identity.address().toInt()));
 					delete nc;
 					nc = (NetworkConfig *)0;
 				}
@@ -1000,6 +639,8 @@ uint64_t Network::handleConfigChunk(void *tPtr,const uint64_t packetId,const Add
 		delete nc;
 		return configUpdateId;
 	} else {
+		if (needFullConfig)
+			this->requestConfiguration(tPtr);
 		return 0;
 	}
 
@@ -1015,15 +656,29 @@ int Network::setConfiguration(void *tPtr,const NetworkConfig &nconf,bool saveToD
 	try {
 		if ((nconf.issuedTo != RR->identity.address())||(nconf.networkId != _id))
 			return 0; // invalid config that is not for us or not for this network
-		if (_config == nconf)
+		if (*config() == nconf)
 			return 1; // OK config, but duplicate of what we already have
 
+		// Copy into a new snapshot outside any lock; readers holding the old one are unaffected
+		const SharedPtr<NetworkConfigSnapshot> newConfig(new NetworkConfigSnapshot(nconf,RR->identity.address()));
+
 		ZT_VirtualNetworkConfig ctmp;
 		bool oldPortInitialized;
 		{	// do things that require lock here, but unlock before calling callbacks
 			Mutex::Lock _l(_lock);
 
-			_config = nconf;
+			{
+				Mutex::Lock _cl(_config_m);
+				_config = newConfig;
+			}
+			{
+				Mutex::Lock _fl(_flows_m);
+				_flows.clear();
+				_flowsConfig = newConfig.ptr();
+				++_flowsEpoch;
+			}
+			if (!newConfig->neighborCache())
+				_neighbors.clear();
 			_lastConfigUpdate = RR->node->now();
 			_netconfFailure = NETCONF_FAILURE_NONE;
 
@@ -1201,7 +856,7 @@ void Network::requestConfiguration(void *tPtr)
 	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_NETWORK_CAPABILITIES,(uint64_t)ZT_MAX_NETWORK_CAPABILITIES);
 	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_CAPABILITY_RULES,(uint64_t)ZT_MAX_CAPABILITY_RULES);
 	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_MAX_NETWORK_TAGS,(uint64_t)ZT_MAX_NETWORK_TAGS);
-	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_FLAGS,(uint64_t)0);
+	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_FLAGS,(uint64_t)ZT_NETWORKCONFIG_REQUEST_FLAG_ACCEPTS_DELTA);
 	rmd.add(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV,(uint64_t)ZT_RULES_ENGINE_REVISION);
 
 	RR->t->networkConfigRequestSent(tPtr,*this,ctrl);
@@ -1220,9 +875,10 @@ void Network::requestConfiguration(void *tPtr)
 	const unsigned int rmdSize = rmd.sizeBytes();
 	outp.append((uint16_t)rmdSize);
 	outp.append((const void *)rmd.data(),rmdSize);
-	if (_config) {
-		outp.append((uint64_t)_config.revision);
-		outp.append((uint64_t)_config.timestamp);
+	const SharedPtr<NetworkConfigSnapshot> nconf(config());
+	if (*nconf) {
+		outp.append((uint64_t)nconf->revision);
+		outp.append((uint64_t)nconf->timestamp);
 	} else {
 		outp.append((unsigned char)0,16);
 	}
@@ -1234,14 +890,25 @@ void Network::requestConfiguration(void *tPtr)
 bool Network::gate(void *tPtr,const SharedPtr<Peer> &peer)
 {
 	const int64_t now = RR->node->now();
-	Mutex::Lock _l(_lock);
+	const SharedPtr<NetworkConfigSnapshot> nconf(config());
 	try {
-		if (_config) {
-			Membership *m = _memberships.get(peer->address());
-			if ( (_config.isPublic()) || ((m)&&(m->isAllowedOnNetwork(_config))) ) {
+		if (*nconf) {
+			SharedPtr<_LockedMembership> m(_getMembership(peer->address()));
+			bool allowed = nconf->isPublic();
+			if ((!allowed)&&(m)) {
+				Mutex::Lock _ml(m->lock);
+				allowed = m->m.isAllowedOnNetwork(*nconf);
+			}
+			if (allowed) {
 				if (!m)
-					m = &(_membership(peer->address()));
-				if (m->multicastLikeGate(now)) {
+					m = _membership(peer->address());
+				bool announce;
+				{
+					Mutex::Lock _ml(m->lock);
+					announce = m->m.multicastLikeGate(now);
+				}
+				if (announce) {
+					Mutex::Lock _l(_lock);
 					_announceMulticastGroupsTo(tPtr,peer->address(),_allMulticastGroups());
 				}
 				return true;
@@ -1253,9 +920,11 @@ bool Network::gate(void *tPtr,const SharedPtr<Peer> &peer)
 
 bool Network::recentlyAssociatedWith(const Address &addr)
 {
-	Mutex::Lock _l(_lock);
-	const Membership *m = _memberships.get(addr);
-	return ((m)&&(m->recentlyAssociated(RR->node->now())));
+	const SharedPtr<_LockedMembership> m(_getMembership(addr));
+	if (!m)
+		return false;
+	Mutex::Lock _ml(m->lock);
+	return m->m.recentlyAssociated(RR->node->now());
 }
 
 void Network::clean()
@@ -1276,14 +945,48 @@ void Network::clean()
 		}
 	}
 
+	bool erasedMemberships = false;
 	{
+		const SharedPtr<NetworkConfigSnapshot> nconf(config());
+		Mutex::Lock _ml(_memberships_m);
 		Address *a = (Address *)0;
-		Membership *m = (Membership *)0;
-		Hashtable<Address,Membership>::Iterator i(_memberships);
+		SharedPtr<_LockedMembership> *m = (SharedPtr<_LockedMembership> *)0;
+		Hashtable< Address,SharedPtr<_LockedMembership> >::Iterator i(_memberships);
 		while (i.next(a,m)) {
-			if (!RR->topology->getPeerNoCache(*a))
+			if (!RR->topology->peerInMemory(*a)) {
 				_memberships.erase(*a);
-			else m->clean(now,_config);
+				erasedMemberships = true;
+			} else {
+				Mutex::Lock _l2((*m)->lock);
+				(*m)->m.clean(now,*nconf);
+			}
+		}
+	}
+	if (erasedMemberships)
+		_invalidateFlows(); // cached decisions may rest on the erased members' credentials
+
+	_neighbors.clean(now);
+	_compression.clean(now);
+}
+
+void Network::learnNeighbors(const Address &peer,const MAC &from,const unsigned int etherType,const void *frame,const unsigned int len)
+{
+	const uint8_t *ip = (const uint8_t *)0;
+	unsigned int ipLen = 0;
+	MAC mac;
+	if (NeighborCache::announcement(etherType,frame,len,ip,ipLen,mac)) {
+		const SharedPtr<NetworkConfigSnapshot> nconf(config());
+		if (nconf->neighborCache()) {
+			// Members own their RFC4193 and 6plane addresses and whatever their certificates of ownership list
+			bool authorized = false;
+			if (ipLen == 16)
+				authorized = ((memcmp(ip,InetAddress::makeIpv6rfc4193(_id,peer.toInt()).rawIpData(),16) == 0)||(memcmp(ip,InetAddress::makeIpv66plane(_id,peer.toInt()).rawIpData(),10) == 0));
+			if (!authorized) {
+				const SharedPtr<_LockedMembership> m(_membership(peer));
+				Mutex::Lock _ml(m->lock);
+				authorized = m->m.hasCertificateOfOwnershipFor<InetAddress>(*nconf,InetAddress(ip,ipLen,0));
+			}
+			_neighbors.learn(_id,peer,nconf->permitsBridging(peer),authorized,from,ip,ipLen,mac,RR->node->now());
 		}
 	}
 }
@@ -1338,8 +1041,9 @@ Membership::AddCredentialResult Network::addCredential(void *tPtr,const Certific
 {
 	if (com.networkId() != _id)
 		return Membership::ADD_REJECTED;
-	Mutex::Lock _l(_lock);
-	return _membership(com.issuedTo()).addCredential(RR,tPtr,_config,com);
+	const SharedPtr<_LockedMembership> m(_membership(com.issuedTo()));
+	Mutex::Lock _ml(m->lock);
+	return m->m.addCredential(RR,tPtr,*config(),com);
 }
 
 Membership::AddCredentialResult Network::addCredential(void *tPtr,const Address &sentFrom,const Revocation &rev)
@@ -1347,15 +1051,22 @@ Membership::AddCredentialResult Network::addCredential(void *tPtr,const Address
 	if (rev.networkId() != _id)
 		return Membership::ADD_REJECTED;
 
-	Mutex::Lock _l(_lock);
-	Membership &m = _membership(rev.target());
-
-	const Membership::AddCredentialResult result = m.addCredential(RR,tPtr,_config,rev);
+	Membership::AddCredentialResult result;
+	{
+		const SharedPtr<_LockedMembership> m(_membership(rev.target()));
+		Mutex::Lock _ml(m->lock);
+		result = m->m.addCredential(RR,tPtr,*config(),rev);
+	}
+	if (result == Membership::ADD_ACCEPTED_NEW) {
+		_invalidateFlows();
+		_neighbors.forget(rev.target());
+	}
 
 	if ((result == Membership::ADD_ACCEPTED_NEW)&&(rev.fastPropagate())) {
+		Mutex::Lock _ml(_memberships_m);
 		Address *a = (Address *)0;
-		Membership *m = (Membership *)0;
-		Hashtable<Address,Membership>::Iterator i(_memberships);
+		SharedPtr<_LockedMembership> *m = (SharedPtr<_LockedMembership> *)0;
+		Hashtable< Address,SharedPtr<_LockedMembership> >::Iterator i(_memberships);
 		while (i.next(a,m)) {
 			if ((*a != sentFrom)&&(*a != rev.signer())) {
 				Packet outp(*a,RR->identity.address(),Packet::VERB_NETWORK_CREDENTIALS);
@@ -1373,6 +1084,34 @@ Membership::AddCredentialResult Network::addCredential(void *tPtr,const Address
 	return result;
 }
 
+Membership::AddCredentialResult Network::addCredential(void *tPtr,const CertificateOfOwnership &coo)
+{
+	if (coo.networkId() != _id)
+		return Membership::ADD_REJECTED;
+	const SharedPtr<NetworkConfigSnapshot> nconf(config());
+	Membership::AddCredentialResult r;
+	{
+		const SharedPtr<_LockedMembership> m(_membership(coo.issuedTo()));
+		Mutex::Lock _l(m->lock);
+		r = m->m.addCredential(RR,tPtr,*nconf,coo);
+	}
+	if (r == Membership::ADD_ACCEPTED_NEW)
+		_invalidateFlows();
+	if (((r == Membership::ADD_ACCEPTED_NEW)||(r == Membership::ADD_ACCEPTED_REDUNDANT))&&(nconf->neighborCache())&&(coo.issuedTo() != RR->identity.address()))
+		_neighbors.learn(_id,coo,RR->node->now());
+	return r;
+}
+
+void Network::pushCredentialsIfNeeded(void *tPtr,const Address &to,const int64_t now)
+{
+	const SharedPtr<_LockedMembership> m(_membership(to));
+	Mutex::Lock _l(m->lock);
+	if (m->m.shouldPushCredentials(now)) {
+		const SharedPtr<Peer> peer(RR->topology->getPeerNoCache(to));
+		m->m.pushCredentials(RR,tPtr,now,to,*config(),((peer)&&(peer->hasRemoteCapability(ZT_PROTO_CAPABILITY_CREDENTIAL_DIGEST))));
+	}
+}
+
 void Network::destroy()
 {
 	Mutex::Lock _l(_lock);
@@ -1390,7 +1129,7 @@ ZT_VirtualNetworkStatus Network::_status() const
 		case NETCONF_FAILURE_NOT_FOUND:
 			return ZT_NETWORK_STATUS_NOT_FOUND;
 		case NETCONF_FAILURE_NONE:
-			return ((_config) ? ZT_NETWORK_STATUS_OK : ZT_NETWORK_STATUS_REQUESTING_CONFIGURATION);
+			return ((*config()) ? ZT_NETWORK_STATUS_OK : ZT_NETWORK_STATUS_REQUESTING_CONFIGURATION);
 		default:
 			return ZT_NETWORK_STATUS_PORT_ERROR;
 	}
@@ -1399,25 +1138,45 @@ ZT_VirtualNetworkStatus Network::_status() const
 void Network::_externalConfig(ZT_VirtualNetworkConfig *ec) const
 {
 	// assumes _lock is locked
+	const SharedPtr<NetworkConfigSnapshot> nconf(config());
 	ec->nwid = _id;
 	ec->mac = _mac.toInt();
-	if (_config)
-		Utils::scopy(ec->name,sizeof(ec->name),_config.name);
+	if (*nconf)
+		Utils::scopy(ec->name,sizeof(ec->name),nconf->name);
 	else ec->name[0] = (char)0;
 	ec->status = _status();
-	ec->type = (_config) ? (_config.isPrivate() ? ZT_NETWORK_TYPE_PRIVATE : ZT_NETWORK_TYPE_PUBLIC) : ZT_NETWORK_TYPE_PRIVATE;
-	ec->mtu = (_config) ? _config.mtu : ZT_DEFAULT_MTU;
+	ec->type = (*nconf) ? (nconf->isPrivate() ? ZT_NETWORK_TYPE_PRIVATE : ZT_NETWORK_TYPE_PUBLIC) : ZT_NETWORK_TYPE_PRIVATE;
+	ec->mtu = (*nconf) ? nconf->mtu : ZT_DEFAULT_MTU;
 	ec->dhcp = 0;
-	std::vector<Address> ab(_config.activeBridges());
+	std::vector<Address> ab(nconf->activeBridges());
 	ec->bridge = (std::find(ab.begin(),ab.end(),RR->identity.address()) != ab.end()) ? 1 : 0;
-	ec->broadcastEnabled = (_config) ? (_config.enableBroadcast() ? 1 : 0) : 0;
+	ec->broadcastEnabled = (*nconf) ? (nconf->enableBroadcast() ? 1 : 0) : 0;
 	ec->portError = _portError;
-	ec->netconfRevision = (_config) ? (unsigned long)_config.revision : 0;
+	ec->netconfRevision = (*nconf) ? (unsigned long)nconf->revision : 0;
+
+	{
+		Mutex::Lock _fl(_flows_m);
+		ec->flowCacheSize = (unsigned int)_flows.size();
+		ec->flowCacheHits = _flowHits;
+		ec->flowCacheMisses = _flowMisses;
+		ec->flowCacheBypasses = _flowBypasses;
+	}
+
+	ec->neighborCacheEnabled = (nconf->neighborCache()) ? 1 : 0;
+	ec->neighborCacheSize = (unsigned int)_neighbors.size();
+	ec->neighborCacheAnswered = _neighbors.answered();
+	ec->neighborCacheMisses = _neighbors.misses();
+
+	ec->compressionAttempts = _compression.attempts();
+	ec->compressionSkipped = _compression.skipped();
+	ec->compressionBytesIn = _compression.bytesIn();
+	ec->compressionBytesSaved = _compression.bytesSaved();
+	ec->compressionCpuTime = _compression.cpuTime();
 
 	ec->assignedAddressCount = 0;
 	for(unsigned int i=0;i<ZT_MAX_ZT_ASSIGNED_ADDRESSES;++i) {
-		if (i < _config.staticIpCount) {
-			memcpy(&(ec->assignedAddresses[i]),&(_config.staticIps[i]),sizeof(struct sockaddr_storage));
+		if (i < nconf->staticIpCount) {
+			memcpy(&(ec->assignedAddresses[i]),&(nconf->staticIps[i]),sizeof(struct sockaddr_storage));
 			++ec->assignedAddressCount;
 		} else {
 			memset(&(ec->assignedAddresses[i]),0,sizeof(struct sockaddr_storage));
@@ -1426,8 +1185,8 @@ void Network::_externalConfig(ZT_VirtualNetworkConfig *ec) const
 
 	ec->routeCount = 0;
 	for(unsigned int i=0;i<ZT_MAX_NETWORK_ROUTES;++i) {
-		if (i < _config.routeCount) {
-			memcpy(&(ec->routes[i]),&(_config.routes[i]),sizeof(ZT_VirtualNetworkRoute));
+		if (i < nconf->routeCount) {
+			memcpy(&(ec->routes[i]),&(nconf->routes[i]),sizeof(ZT_VirtualNetworkRoute));
 			++ec->routeCount;
 		} else {
 			memset(&(ec->routes[i]),0,sizeof(ZT_VirtualNetworkRoute));
@@ -1445,6 +1204,7 @@ void Network::_sendUpdatesToMembers(void *tPtr,const MulticastGroup *const newMu
 {
 	// Assumes _lock is locked
 	const int64_t now = RR->node->now();
+	const SharedPtr<NetworkConfigSnapshot> nconf(config());
 
 	std::vector<MulticastGroup> groups;
 	if (newMulticastGroup)
@@ -1457,7 +1217,7 @@ void Network::_sendUpdatesToMembers(void *tPtr,const MulticastGroup *const newMu
 		if (!newMulticastGroup)
 			_lastAnnouncedMulticastGroupsUpstream = now;
 
-		alwaysAnnounceTo = _config.alwaysContactAddresses();
+		alwaysAnnounceTo = nconf->alwaysContactAddresses();
 		if (std::find(alwaysAnnounceTo.begin(),alwaysAnnounceTo.end(),controller()) == alwaysAnnounceTo.end())
 			alwaysAnnounceTo.push_back(controller());
 		const std::vector<Address> upstreams(RR->topology->upstreamAddresses());
@@ -1470,9 +1230,9 @@ void Network::_sendUpdatesToMembers(void *tPtr,const MulticastGroup *const newMu
 		for(std::vector<Address>::const_iterator a(alwaysAnnounceTo.begin());a!=alwaysAnnounceTo.end();++a) {
 			/*
 			// push COM to non-members so they can do multicast request auth
-			if ( (_config.com) && (!_memberships.contains(*a)) && (*a != RR->identity.address()) ) {
+			if ( (nconf->com) && (!_memberships.contains(*a)) && (*a != RR->identity.address()) ) {
 				Packet outp(*a,RR->identity.address(),Packet::VERB_NETWORK_CREDENTIALS);
-				_config.com.serialize(outp);
+				nconf->com.serialize(outp);
 				outp.append((uint8_t)0x00);
 				outp.append((uint16_t)0); // no capabilities
 				outp.append((uint16_t)0); // no tags
@@ -1485,15 +1245,20 @@ void Network::_sendUpdatesToMembers(void *tPtr,const MulticastGroup *const newMu
 		}
 	}
 
+	std::vector<Address> announceTo;
 	{
+		Mutex::Lock _ml(_memberships_m);
 		Address *a = (Address *)0;
-		Membership *m = (Membership *)0;
-		Hashtable<Address,Membership>::Iterator i(_memberships);
+		SharedPtr<_LockedMembership> *m = (SharedPtr<_LockedMembership> *)0;
+		Hashtable< Address,SharedPtr<_LockedMembership> >::Iterator i(_memberships);
 		while (i.next(a,m)) {
-			if ( ( m->multicastLikeGate(now) || (newMulticastGroup) ) && (m->isAllowedOnNetwork(_config)) && (!std::binary_search(alwaysAnnounceTo.begin(),alwaysAnnounceTo.end(),*a)) )
-				_announceMulticastGroupsTo(tPtr,*a,groups);
+			Mutex::Lock _l2((*m)->lock);
+			if ( ( (*m)->m.multicastLikeGate(now) || (newMulticastGroup) ) && ((*m)->m.isAllowedOnNetwork(*nconf)) && (!std::binary_search(alwaysAnnounceTo.begin(),alwaysAnnounceTo.end(),*a)) )
+				announceTo.push_back(*a);
 		}
 	}
+	for(std::vector<Address>::const_iterator a(announceTo.begin());a!=announceTo.end();++a)
+		_announceMulticastGroupsTo(tPtr,*a,groups);
 }
 
 void Network::_announceMulticastGroupsTo(void *tPtr,const Address &peer,const std::vector<MulticastGroup> &allMulticastGroups)
@@ -1529,17 +1294,80 @@ std::vector<MulticastGroup> Network::_allMulticastGroups() const
 	mgs.reserve(_myMulticastGroups.size() + _multicastGroupsBehindMe.size() + 1);
 	mgs.insert(mgs.end(),_myMulticastGroups.begin(),_myMulticastGroups.end());
 	_multicastGroupsBehindMe.appendKeys(mgs);
-	if ((_config)&&(_config.enableBroadcast()))
+	const SharedPtr<NetworkConfigSnapshot> nconf(config());
+	if ((*nconf)&&(nconf->enableBroadcast()))
 		mgs.push_back(Network::BROADCAST);
 	std::sort(mgs.begin(),mgs.end());
 	mgs.erase(std::unique(mgs.begin(),mgs.end()),mgs.end());
 	return mgs;
 }
 
-Membership &Network::_membership(const Address &a)
+SharedPtr<Network::_LockedMembership> Network::_membership(const Address &a)
 {
-	// assumes _lock is locked
-	return _memberships[a];
+	Mutex::Lock _l(_memberships_m);
+	SharedPtr<_LockedMembership> &m = _memberships[a];
+	if (!m)
+		m.set(new _LockedMembership());
+	return m;
+}
+
+SharedPtr<Network::_LockedMembership> Network::_getMembership(const Address &a) const
+{
+	Mutex::Lock _l(_memberships_m);
+	const SharedPtr<_LockedMembership> *const m = _memberships.get(a);
+	return ((m) ? *m : SharedPtr<_LockedMembership>());
+}
+
+void Network::_sendFrameCopy(void *tPtr,const Address &to,const uint8_t flags,const MAC &macSource,const MAC &macDest,const unsigned int etherType,const uint8_t *frameData,const unsigned int len)
+{
+	Packet outp(to,RR->identity.address(),Packet::VERB_EXT_FRAME);
+	outp.append(_id);
+	outp.append(flags);
+	macDest.appendTo(outp);
+	macSource.appendTo(outp);
+	outp.append((uint16_t)etherType);
+	outp.append(frameData,len);
+	_compression.compress(outp,to,CompiledRules::trafficClass(frameData,len,etherType),RR->node->now());
+	RR->sw->send(tPtr,outp,true);
+}
+
+bool Network::_getFlow(const NetworkConfigSnapshot *nconf,const CompiledRules::FlowKey &k,_FlowDecision &d,uint64_t &epoch)
+{
+	Mutex::Lock _l(_flows_m);
+	epoch = _flowsEpoch;
+	if (nconf == _flowsConfig) {
+		const _FlowDecision *const f = _flows.get(k);
+		if (f) {
+			d = *f;
+			++_flowHits;
+			return true;
+		}
+	}
+	return false;
+}
+
+void Network::_putFlow(const NetworkConfigSnapshot *nconf,const CompiledRules::FlowKey &k,const _FlowDecision &d,const uint64_t epoch)
+{
+	Mutex::Lock _l(_flows_m);
+	++_flowMisses;
+	if ((nconf == _flowsConfig)&&(epoch == _flowsEpoch)) {
+		if (_flows.size() >= ZT_NETWORK_FLOW_CACHE_MAX_ENTRIES)
+			_flows.clear();
+		_flows.set(k,d);
+	}
+}
+
+void Network::_bypassFlow()
+{
+	Mutex::Lock _l(_flows_m);
+	++_flowBypasses;
+}
+
+void Network::_invalidateFlows()
+{
+	Mutex::Lock _l(_flows_m);
+	_flows.clear();
+	++_flowsEpoch;
 }
 
 } // namespace ZeroTier
@@ -47,6 +47,8 @@
 #include "MAC.hpp"
 #include "Dictionary.hpp"
 #include "Multicaster.hpp"
+#include "NeighborCache.hpp"
+#include "AdaptiveCompression.hpp"
 #include "Membership.hpp"
 #include "NetworkConfig.hpp"
 #include "CertificateOfMembership.hpp"
@@ -95,11 +97,24 @@ public:
 
 	inline uint64_t id() const { return _id; }
 	inline Address controller() const { return Address(_id >> 24); }
-	inline bool multicastEnabled() const { return (_config.multicastLimit > 0); }
-	inline bool hasConfig() const { return (_config); }
+	inline bool multicastEnabled() const { return (config()->multicastLimit > 0); }
+	inline bool hasConfig() const { return (config()->networkId != 0); }
 	inline uint64_t lastConfigUpdate() const { return _lastConfigUpdate; }
 	inline ZT_VirtualNetworkStatus status() const { Mutex::Lock _l(_lock); return _status(); }
-	inline const NetworkConfig &config() const { return _config; }
+
+	/**
+	 * Get the current network configuration
+	 *
+	 * The returned snapshot stays valid and unchanged for as long as it is
+	 * held, even if a new configuration arrives in the meantime.
+	 *
+	 * @return Current configuration (empty with a zero network ID if not configured yet)
+	 */
+	inline SharedPtr<NetworkConfigSnapshot> config() const
+	{
+		Mutex::Lock _l(_config_m);
+		return _config;
+	}
 	inline const MAC &mac() const { return _mac; }
 
 	/**
@@ -135,6 +150,34 @@ public:
 		const unsigned int vlanId,
 		uint8_t &qosBucket);
 
+	/**
+	 * Apply filters to an outgoing multicast once on behalf of all its recipients
+	 *
+	 * This is the second, TEE-less pass that filterOutgoingPacket() would make
+	 * for each recipient. If the config's rules give every destination the same
+	 * result it is computed here once, otherwise -1 is returned and each
+	 * recipient must still be filtered with filterOutgoingPacket().
+	 *
+	 * @param nconf Config snapshot to filter with
+	 * @param ztSource Source ZeroTier address
+	 * @param macSource Ethernet layer source address
+	 * @param macDest Ethernet layer destination address
+	 * @param frameData Ethernet frame data
+	 * @param frameLen Ethernet frame payload length
+	 * @param etherType 16-bit ethernet type ID
+	 * @param vlanId 16-bit VLAN ID
+	 * @return 1 to send to every recipient, 0 to send to none, -1 to filter each recipient
+	 */
+	int filterOutgoingMulticast(
+		const NetworkConfigSnapshot &nconf,
+		const Address &ztSource,
+		const MAC &macSource,
+		const MAC &macDest,
+		const uint8_t *frameData,
+		const unsigned int frameLen,
+		const unsigned int etherType,
+		const unsigned int vlanId) const;
+
 	/**
 	 * Apply filters to an incoming packet
 	 *
@@ -290,6 +333,27 @@ public:
 		return ((br) ? *br : Address());
 	}
 
+	/**
+	 * @return Proxy ARP/NDP cache for this network
+	 */
+	inline NeighborCache &neighbors() { return _neighbors; }
+
+	/**
+	 * @return Adaptive compression state for frames sent on this network
+	 */
+	inline AdaptiveCompression &compression() { return _compression; }
+
+	/**
+	 * Learn neighbor cache entries from a frame a member sent us (if enabled)
+	 *
+	 * @param peer Member that sent this frame
+	 * @param from Source MAC of Ethernet frame
+	 * @param etherType Ethernet frame type
+	 * @param frame Ethernet frame payload
+	 * @param len Length of frame payload
+	 */
+	void learnNeighbors(const Address &peer,const MAC &from,const unsigned int etherType,const void *frame,const unsigned int len);
+
 	/**
 	 * @return True if QoS is in effect for this network
 	 */
@@ -324,8 +388,12 @@ public:
 	{
 		if (cap.networkId() != _id)
 			return Membership::ADD_REJECTED;
-		Mutex::Lock _l(_lock);
-		return _membership(cap.issuedTo()).addCredential(RR,tPtr,_config,cap);
+		const SharedPtr<_LockedMembership> m(_membership(cap.issuedTo()));
+		Mutex::Lock _l(m->lock);
+		const Membership::AddCredentialResult r = m->m.addCredential(RR,tPtr,*config(),cap);
+		if (r == Membership::ADD_ACCEPTED_NEW)
+			_invalidateFlows();
+		return r;
 	}
 
 	/**
@@ -335,8 +403,12 @@ public:
 	{
 		if (tag.networkId() != _id)
 			return Membership::ADD_REJECTED;
-		Mutex::Lock _l(_lock);
-		return _membership(tag.issuedTo()).addCredential(RR,tPtr,_config,tag);
+		const SharedPtr<_LockedMembership> m(_membership(tag.issuedTo()));
+		Mutex::Lock _l(m->lock);
+		const Membership::AddCredentialResult r = m->m.addCredential(RR,tPtr,*config(),tag);
+		if (r == Membership::ADD_ACCEPTED_NEW)
+			_invalidateFlows();
+		return r;
 	}
 
 	/**
@@ -347,13 +419,7 @@ public:
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
 	 */
-	inline Membership::AddCredentialResult addCredential(void *tPtr,const CertificateOfOwnership &coo)
-	{
-		if (coo.networkId() != _id)
-			return Membership::ADD_REJECTED;
-		Mutex::Lock _l(_lock);
-		return _membership(coo.issuedTo()).addCredential(RR,tPtr,_config,coo);
-	}
+	Membership::AddCredentialResult addCredential(void *tPtr,const CertificateOfOwnership &coo);
 
 	/**
 	 * Force push credentials (COM, etc.) to a peer now
@@ -364,23 +430,37 @@ public:
 	 */
 	inline void pushCredentialsNow(void *tPtr,const Address &to,const int64_t now)
 	{
-		Mutex::Lock _l(_lock);
-		_membership(to).pushCredentials(RR,tPtr,now,to,_config);
+		const SharedPtr<_LockedMembership> m(_membership(to));
+		Mutex::Lock _l(m->lock);
+		m->m.pushCredentials(RR,tPtr,now,to,*config(),false);
 	}
 
 	/**
 	 * Push credentials if we haven't done so in a very long time
 	 *
+	 * If the peer supports it this is an incremental push (see Membership).
+	 *
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param to Destination peer address
 	 * @param now Current time
 	 */
-	inline void pushCredentialsIfNeeded(void *tPtr,const Address &to,const int64_t now)
+	void pushCredentialsIfNeeded(void *tPtr,const Address &to,const int64_t now);
+
+	/**
+	 * Count credentials in a digest pushed by a member that we don't hold
+	 *
+	 * @param from Member that pushed the digest
+	 * @param digests Array of big-endian credential digests
+	 * @param count Number of digests
+	 * @return Number of credentials we are missing
+	 */
+	inline unsigned int missingCredentials(const Address &from,const uint8_t *digests,const unsigned int count) const
 	{
-		Mutex::Lock _l(_lock);
-		Membership &m = _membership(to);
-		if (m.shouldPushCredentials(now))
-			m.pushCredentials(RR,tPtr,now,to,_config);
+		const SharedPtr<_LockedMembership> m(_getMembership(from));
+		if (!m)
+			return count;
+		Mutex::Lock _l(m->lock);
+		return m->m.missingCredentials(digests,count);
 	}
 
 	/**
@@ -414,7 +494,35 @@ private:
 	void _sendUpdatesToMembers(void *tPtr,const MulticastGroup *const newMulticastGroup);
 	void _announceMulticastGroupsTo(void *tPtr,const Address &peer,const std::vector<MulticastGroup> &allMulticastGroups);
 	std::vector<MulticastGroup> _allMulticastGroups() const;
-	Membership &_membership(const Address &a);
+	void _sendFrameCopy(void *tPtr,const Address &to,const uint8_t flags,const MAC &macSource,const MAC &macDest,const unsigned int etherType,const uint8_t *frameData,const unsigned int len);
+
+	// Outcome of filtering a frame, replayed for later frames of the same flow
+	struct _FlowDecision
+	{
+		Address ztFinalDest; // destination after any REDIRECT
+		Address cc; // TEE or WATCH target from network rules
+		Address capabilityCc; // TEE or WATCH target from the capability that accepted
+		bool ccWatch;
+		bool capabilityCcWatch;
+		uint8_t qosBucket;
+		uint8_t accept; // 0 drop, 1 accept, 2 super-accept
+	};
+	bool _getFlow(const NetworkConfigSnapshot *nconf,const CompiledRules::FlowKey &k,_FlowDecision &d,uint64_t &epoch);
+	void _putFlow(const NetworkConfigSnapshot *nconf,const CompiledRules::FlowKey &k,const _FlowDecision &d,const uint64_t epoch);
+	void _bypassFlow();
+	void _invalidateFlows();
+
+	// A Membership and the lock that guards it, so that filtering and credential
+	// updates for different peers neither contend with each other nor take _lock.
+	// Lock order is _lock, then _memberships_m, then an individual membership lock.
+	struct _LockedMembership
+	{
+		Membership m;
+		Mutex lock;
+		AtomicCounter __refCount;
+	};
+	SharedPtr<_LockedMembership> _membership(const Address &a); // get or create
+	SharedPtr<_LockedMembership> _getMembership(const Address &a) const; // NULL if none
 
 	const RuntimeEnvironment *const RR;
 	void *_uPtr;
@@ -427,7 +535,8 @@ private:
 	Hashtable< MulticastGroup,uint64_t > _multicastGroupsBehindMe; // multicast groups that seem to be behind us and when we last saw them (if we are a bridge)
 	Hashtable< MAC,Address > _remoteBridgeRoutes; // remote addresses where given MACs are reachable (for tracking devices behind remote bridges)
 
-	NetworkConfig _config;
+	SharedPtr<NetworkConfigSnapshot> _config; // replaced, never modified, by setConfiguration()
+	Mutex _config_m; // guards only the _config pointer itself
 	uint64_t _lastConfigUpdate;
 
 	struct _IncomingConfigChunk
@@ -452,7 +561,21 @@ private:
 	} _netconfFailure;
 	int _portError; // return value from port config callback
 
-	Hashtable<Address,Membership> _memberships;
+	Hashtable< Address,SharedPtr<_LockedMembership> > _memberships;
+	Mutex _memberships_m;
+
+	// Cached filter decisions, only valid for the config snapshot in _flowsConfig and
+	// only inserted if _flowsEpoch has not changed since the lookup that missed
+	Hashtable< CompiledRules::FlowKey,_FlowDecision > _flows;
+	const NetworkConfigSnapshot *_flowsConfig;
+	uint64_t _flowsEpoch;
+	uint64_t _flowHits;
+	uint64_t _flowMisses;
+	uint64_t _flowBypasses;
+	Mutex _flows_m;
+
+	NeighborCache _neighbors;
+	AdaptiveCompression _compression;
 
 	Mutex _lock;
 
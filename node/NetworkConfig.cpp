@@ -29,10 +29,27 @@
 #include <algorithm>
 
 #include "NetworkConfig.hpp"
+#include "SHA512.hpp"
 
 namespace ZeroTier {
 
-bool NetworkConfig::toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,bool includeLegacy) const
+// Adds one binary section, or leaves it out of a delta if it's the same as in the base
+static bool _addSection(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,const char *key,const Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> &blob,const unsigned int section,NetworkConfig::DeltaBase *thisBase,const NetworkConfig::DeltaBase *against,uint64_t &kept)
+{
+	if ((thisBase)||(against)) {
+		uint64_t digest[8];
+		SHA512::hash(digest,blob.data(),blob.size());
+		if (thisBase)
+			thisBase->sections[section] = digest[0];
+		if ((against)&&(against->sections[section] == digest[0])) {
+			kept |= (1ULL << section);
+			return true;
+		}
+	}
+	return ((blob.size() == 0)||(d.add(key,blob)));
+}
+
+bool NetworkConfig::toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,bool includeLegacy,DeltaBase *thisBase,const DeltaBase *deltaAgainst) const
 {
 	Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *tmp = new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>();
 	char tmp2[128];
@@ -127,41 +144,39 @@ bool NetworkConfig::toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,b
 		}
 #endif // ZT_SUPPORT_OLD_STYLE_NETCONF
 
-		// Then add binary blobs
+		// Then add binary blobs, leaving out those unchanged since the base of a delta
 
-		if (this->com) {
-			tmp->clear();
-			this->com.serialize(*tmp);
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_COM,*tmp)) return false;
+		const DeltaBase *const against = (includeLegacy) ? (const DeltaBase *)0 : deltaAgainst;
+		uint64_t kept = 0;
+		if (thisBase) {
+			thisBase->timestamp = this->timestamp;
+			thisBase->revision = this->revision;
 		}
 
+		tmp->clear();
+		if (this->com)
+			this->com.serialize(*tmp);
+		if (!_addSection(d,ZT_NETWORKCONFIG_DICT_KEY_COM,*tmp,ZT_NETWORKCONFIG_SECTION_COM,thisBase,against,kept)) return false;
+
 		tmp->clear();
 		for(unsigned int i=0;i<this->capabilityCount;++i)
 			this->capabilities[i].serialize(*tmp);
-		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_CAPABILITIES,*tmp)) return false;
-		}
+		if (!_addSection(d,ZT_NETWORKCONFIG_DICT_KEY_CAPABILITIES,*tmp,ZT_NETWORKCONFIG_SECTION_CAPABILITIES,thisBase,against,kept)) return false;
 
 		tmp->clear();
 		for(unsigned int i=0;i<this->tagCount;++i)
 			this->tags[i].serialize(*tmp);
-		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_TAGS,*tmp)) return false;
-		}
+		if (!_addSection(d,ZT_NETWORKCONFIG_DICT_KEY_TAGS,*tmp,ZT_NETWORKCONFIG_SECTION_TAGS,thisBase,against,kept)) return false;
 
 		tmp->clear();
 		for(unsigned int i=0;i<this->certificateOfOwnershipCount;++i)
 			this->certificatesOfOwnership[i].serialize(*tmp);
-		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATES_OF_OWNERSHIP,*tmp)) return false;
-		}
+		if (!_addSection(d,ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATES_OF_OWNERSHIP,*tmp,ZT_NETWORKCONFIG_SECTION_CERTIFICATES_OF_OWNERSHIP,thisBase,against,kept)) return false;
 
 		tmp->clear();
 		for(unsigned int i=0;i<this->specialistCount;++i)
 			tmp->append((uint64_t)this->specialists[i]);
-		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_SPECIALISTS,*tmp)) return false;
-		}
+		if (!_addSection(d,ZT_NETWORKCONFIG_DICT_KEY_SPECIALISTS,*tmp,ZT_NETWORKCONFIG_SECTION_SPECIALISTS,thisBase,against,kept)) return false;
 
 		tmp->clear();
 		for(unsigned int i=0;i<this->routeCount;++i) {
@@ -170,23 +185,22 @@ bool NetworkConfig::toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,b
 			tmp->append((uint16_t)this->routes[i].flags);
 			tmp->append((uint16_t)this->routes[i].metric);
 		}
-		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_ROUTES,*tmp)) return false;
-		}
+		if (!_addSection(d,ZT_NETWORKCONFIG_DICT_KEY_ROUTES,*tmp,ZT_NETWORKCONFIG_SECTION_ROUTES,thisBase,against,kept)) return false;
 
 		tmp->clear();
 		for(unsigned int i=0;i<this->staticIpCount;++i)
 			this->staticIps[i].serialize(*tmp);
-		if (tmp->size()) {
-			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_STATIC_IPS,*tmp)) return false;
-		}
+		if (!_addSection(d,ZT_NETWORKCONFIG_DICT_KEY_STATIC_IPS,*tmp,ZT_NETWORKCONFIG_SECTION_STATIC_IPS,thisBase,against,kept)) return false;
 
-		if (this->ruleCount) {
-			tmp->clear();
+		tmp->clear();
+		if (this->ruleCount)
 			Capability::serializeRules(*tmp,rules,ruleCount);
-			if (tmp->size()) {
-				if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_RULES,*tmp)) return false;
-			}
+		if (!_addSection(d,ZT_NETWORKCONFIG_DICT_KEY_RULES,*tmp,ZT_NETWORKCONFIG_SECTION_RULES,thisBase,against,kept)) return false;
+
+		if (against) {
+			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_DELTA_BASE_TIMESTAMP,(uint64_t)against->timestamp)) return false;
+			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_DELTA_BASE_REVISION,against->revision)) return false;
+			if (!d.add(ZT_NETWORKCONFIG_DICT_KEY_DELTA_KEPT,kept)) return false;
 		}
 
 		delete tmp;
@@ -198,7 +212,7 @@ bool NetworkConfig::toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,b
 	return true;
 }
 
-bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d)
+bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,const NetworkConfig *base)
 {
 	static const NetworkConfig NIL_NC;
 	Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *tmp = new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>();
@@ -220,6 +234,16 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 			delete tmp;
 			return false;
 		}
+
+		// A delta only applies to exactly the config it was made against
+		const int64_t deltaBaseTimestamp = (int64_t)d.getUI(ZT_NETWORKCONFIG_DICT_KEY_DELTA_BASE_TIMESTAMP,0);
+		if (deltaBaseTimestamp) {
+			if ((!base)||(base->timestamp != deltaBaseTimestamp)||(base->revision != d.getUI(ZT_NETWORKCONFIG_DICT_KEY_DELTA_BASE_REVISION,0))||(base->networkId != this->networkId)||(base->issuedTo != this->issuedTo)||(d.getUI(ZT_NETWORKCONFIG_DICT_KEY_VERSION,0) < 6)) {
+				delete tmp;
+				return false;
+			}
+		}
+
 		this->remoteTraceTarget = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_REMOTE_TRACE_TARGET);
 		this->remoteTraceLevel = (Trace::Level)d.getUI(ZT_NETWORKCONFIG_DICT_KEY_REMOTE_TRACE_LEVEL);
 		this->multicastLimit = (unsigned int)d.getUI(ZT_NETWORKCONFIG_DICT_KEY_MULTICAST_LIMIT,0);
@@ -369,6 +393,44 @@ bool NetworkConfig::fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACI
 			}
 		}
 
+		if (deltaBaseTimestamp) {
+			const uint64_t kept = d.getUI(ZT_NETWORKCONFIG_DICT_KEY_DELTA_KEPT,0);
+			if ((kept & (1ULL << ZT_NETWORKCONFIG_SECTION_COM)) != 0)
+				this->com = base->com;
+			if ((kept & (1ULL << ZT_NETWORKCONFIG_SECTION_CAPABILITIES)) != 0) {
+				for(unsigned int i=0;i<base->capabilityCount;++i)
+					this->capabilities[i] = base->capabilities[i];
+				this->capabilityCount = base->capabilityCount;
+			}
+			if ((kept & (1ULL << ZT_NETWORKCONFIG_SECTION_TAGS)) != 0) {
+				for(unsigned int i=0;i<base->tagCount;++i)
+					this->tags[i] = base->tags[i];
+				this->tagCount = base->tagCount;
+			}
+			if ((kept & (1ULL << ZT_NETWORKCONFIG_SECTION_CERTIFICATES_OF_OWNERSHIP)) != 0) {
+				for(unsigned int i=0;i<base->certificateOfOwnershipCount;++i)
+					this->certificatesOfOwnership[i] = base->certificatesOfOwnership[i];
+				this->certificateOfOwnershipCount = base->certificateOfOwnershipCount;
+			}
+			if ((kept & (1ULL << ZT_NETWORKCONFIG_SECTION_SPECIALISTS)) != 0) {
+				memcpy(this->specialists,base->specialists,sizeof(uint64_t) * base->specialistCount);
+				this->specialistCount = base->specialistCount;
+			}
+			if ((kept & (1ULL << ZT_NETWORKCONFIG_SECTION_ROUTES)) != 0) {
+				memcpy(this->routes,base->routes,sizeof(ZT_VirtualNetworkRoute) * base->routeCount);
+				this->routeCount = base->routeCount;
+			}
+			if ((kept & (1ULL << ZT_NETWORKCONFIG_SECTION_STATIC_IPS)) != 0) {
+				for(unsigned int i=0;i<base->staticIpCount;++i)
+					this->staticIps[i] = base->staticIps[i];
+				this->staticIpCount = base->staticIpCount;
+			}
+			if ((kept & (1ULL << ZT_NETWORKCONFIG_SECTION_RULES)) != 0) {
+				memcpy(this->rules,base->rules,sizeof(ZT_VirtualNetworkRule) * base->ruleCount);
+				this->ruleCount = base->ruleCount;
+			}
+		}
+
 		//printf("~~~\n%s\n~~~\n",d.data());
 		//dump();
 		//printf("~~~\n");
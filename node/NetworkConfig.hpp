@@ -51,6 +51,9 @@
 #include "Identity.hpp"
 #include "Utils.hpp"
 #include "Trace.hpp"
+#include "SharedPtr.hpp"
+#include "AtomicCounter.hpp"
+#include "CompiledRules.hpp"
 
 /**
  * Default maximum time delta for COMs, tags, and capabilities
@@ -88,6 +91,11 @@
  */
 #define ZT_NETWORKCONFIG_FLAG_DISABLE_COMPRESSION 0x0000000000000010ULL
 
+/**
+ * Flag: answer ARP and NDP queries from the local neighbor cache when possible
+ */
+#define ZT_NETWORKCONFIG_FLAG_ENABLE_NEIGHBOR_CACHE 0x0000000000000020ULL
+
 /**
  * Device can bridge to other Ethernet networks and gets unknown recipient multicasts
  */
@@ -143,6 +151,9 @@ namespace ZeroTier {
 // Network configuration meta-data flags
 #define ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_FLAGS "f"
 
+// Request flag: node can apply delta configs (see NetworkConfig::DeltaBase)
+#define ZT_NETWORKCONFIG_REQUEST_FLAG_ACCEPTS_DELTA 0x0000000000000001ULL
+
 // These dictionary keys are short so they don't take up much room.
 // By convention we use upper case for binary blobs, but it doesn't really matter.
 
@@ -188,6 +199,12 @@ namespace ZeroTier {
 #define ZT_NETWORKCONFIG_DICT_KEY_TAGS "TAG"
 // tags (binary blobs)
 #define ZT_NETWORKCONFIG_DICT_KEY_CERTIFICATES_OF_OWNERSHIP "COO"
+// timestamp of config this is a delta against (absent in full configs)
+#define ZT_NETWORKCONFIG_DICT_KEY_DELTA_BASE_TIMESTAMP "dbt"
+// revision of config this is a delta against
+#define ZT_NETWORKCONFIG_DICT_KEY_DELTA_BASE_REVISION "dbr"
+// bit mask of sections left out because they are unchanged since the base
+#define ZT_NETWORKCONFIG_DICT_KEY_DELTA_KEPT "dk"
 
 // Legacy fields -- these are obsoleted but are included when older clients query
 
@@ -212,6 +229,17 @@ namespace ZeroTier {
 
 // End legacy fields
 
+// Sections a delta config can leave out (bit indexes of ZT_NETWORKCONFIG_DICT_KEY_DELTA_KEPT)
+#define ZT_NETWORKCONFIG_SECTION_COM 0
+#define ZT_NETWORKCONFIG_SECTION_CAPABILITIES 1
+#define ZT_NETWORKCONFIG_SECTION_TAGS 2
+#define ZT_NETWORKCONFIG_SECTION_CERTIFICATES_OF_OWNERSHIP 3
+#define ZT_NETWORKCONFIG_SECTION_SPECIALISTS 4
+#define ZT_NETWORKCONFIG_SECTION_ROUTES 5
+#define ZT_NETWORKCONFIG_SECTION_STATIC_IPS 6
+#define ZT_NETWORKCONFIG_SECTION_RULES 7
+#define ZT_NETWORKCONFIG_SECTION_COUNT 8
+
 /**
  * Network configuration received from network controller nodes
  *
@@ -244,22 +272,48 @@ public:
 		name[0] = 0;
 	}
 
+	/**
+	 * What a controller remembers about the last config it sent a member
+	 *
+	 * A config for the same member can then be sent as a delta against it:
+	 * the usual dictionary minus any binary section (rules, routes, static
+	 * IPs, credentials, etc.) whose serialized form has not changed. The
+	 * member applies it only if the config it holds has the base's
+	 * timestamp and revision, and otherwise asks for a full config.
+	 */
+	struct DeltaBase
+	{
+		DeltaBase() : timestamp(0),revision(0) { memset(sections,0,sizeof(sections)); }
+		int64_t timestamp; // 0 if there is no base
+		uint64_t revision;
+		uint64_t sections[ZT_NETWORKCONFIG_SECTION_COUNT]; // hash of each section's serialized blob
+	};
+
 	/**
 	 * Write this network config to a dictionary for transport
 	 *
 	 * @param d Dictionary
 	 * @param includeLegacy If true, include legacy fields for old node versions
+	 * @param thisBase If non-NULL, filled with this config's delta base information
+	 * @param deltaAgainst If non-NULL, write a delta against this base (ignored if includeLegacy is true)
 	 * @return True if dictionary was successfully created, false if e.g. overflow
 	 */
-	bool toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,bool includeLegacy) const;
+	bool toDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,bool includeLegacy,DeltaBase *thisBase = (DeltaBase *)0,const DeltaBase *deltaAgainst = (const DeltaBase *)0) const;
 
 	/**
 	 * Read this network config from a dictionary
 	 *
 	 * @param d Dictionary (non-const since it might be modified during parse, should not be used after call)
-	 * @return True if dictionary was valid and network config successfully initialized
+	 * @param base Config currently held, needed to apply a delta (may be NULL)
+	 * @return True if dictionary was valid and network config successfully initialized (false for a delta that does not apply to base)
+	 */
+	bool fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d,const NetworkConfig *base = (const NetworkConfig *)0);
+
+	/**
+	 * @param d Dictionary
+	 * @return True if dictionary is a delta config
 	 */
-	bool fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d);
+	static inline bool isDelta(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> &d) { return (d.getUI(ZT_NETWORKCONFIG_DICT_KEY_DELTA_BASE_TIMESTAMP,0) != 0); }
 
 	/**
 	 * @return True if broadcast (ff:ff:ff:ff:ff:ff) address should work on this network
@@ -271,6 +325,11 @@ public:
 	 */
 	inline bool ndpEmulation() const { return ((this->flags & ZT_NETWORKCONFIG_FLAG_ENABLE_IPV6_NDP_EMULATION) != 0); }
 
+	/**
+	 * @return True if ARP and NDP queries may be answered locally from the neighbor cache
+	 */
+	inline bool neighborCache() const { return ((this->flags & ZT_NETWORKCONFIG_FLAG_ENABLE_NEIGHBOR_CACHE) != 0); }
+
 	/**
 	 * @return True if frames should not be compressed
 	 */
@@ -597,6 +656,63 @@ public:
 	CertificateOfMembership com;
 };
 
+/**
+ * An immutable reference counted network configuration
+ *
+ * Network publishes its current configuration as one of these and replaces
+ * it as a whole when a new one arrives, so readers can hold a consistent
+ * configuration for as long as they need it without locking the network.
+ * A snapshot must not be modified after it has been published.
+ */
+class NetworkConfigSnapshot : public NetworkConfig
+{
+	friend class SharedPtr<NetworkConfigSnapshot>;
+
+public:
+	NetworkConfigSnapshot() : NetworkConfig(),flowCacheable(false),destinationIndependent(false) {}
+
+	/**
+	 * @param nc Configuration to copy
+	 * @param self This node's address, used to compile rules
+	 */
+	NetworkConfigSnapshot(const NetworkConfig &nc,const Address &self) :
+		NetworkConfig(nc),
+		compiledCapabilityRules(nc.capabilityCount)
+	{
+		compiledRules.compile(self,rules,ruleCount);
+		flowCacheable = compiledRules.cacheable();
+		destinationIndependent = compiledRules.destinationIndependent();
+		for(unsigned int c=0;c<capabilityCount;++c) {
+			compiledCapabilityRules[c].compile(self,capabilities[c].rules(),capabilities[c].ruleCount());
+			flowCacheable &= compiledCapabilityRules[c].cacheable();
+			destinationIndependent &= compiledCapabilityRules[c].destinationIndependent();
+		}
+	}
+
+	/**
+	 * Compiled form of rules
+	 */
+	CompiledRules compiledRules;
+
+	/**
+	 * Compiled form of each of our capabilities' rules, in the same order as capabilities
+	 */
+	std::vector<CompiledRules> compiledCapabilityRules;
+
+	/**
+	 * True if outbound filter results for our rules and capabilities may be cached per flow
+	 */
+	bool flowCacheable;
+
+	/**
+	 * True if outbound filter results for our rules and capabilities are the same for every destination
+	 */
+	bool destinationIndependent;
+
+private:
+	AtomicCounter __refCount;
+};
+
 } // namespace ZeroTier
 
 #endif
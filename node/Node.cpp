@@ -66,10 +66,23 @@ Node::Node(void *uptr,void *tptr,const struct ZT_Node_Callbacks *callbacks,int64
 	_uPtr(uptr),
 	_networks(8),
 	_multipathMode(ZT_MULTIPATH_NONE), // TBD: maybe use something better?
+	_multipathFailoverBudget(ZT_MULTIPATH_AB_FAILOVER_BUDGET),
+	_frameAggregation(false),
+	_fecLossThreshold(0.0f),
+	_pathMtuDiscovery(false),
 	_now(now),
 	_lastPingCheck(0),
 	_lastHousekeepingRun(0),
-	_lastMemoizedTraceSettings(0)
+	_lastMemoizedTraceSettings(0),
+	_pingBudget(ZT_PING_BUDGET_BURST),
+	_lastPingBudgetRefill(now),
+	_pingStatsWindowStart(now),
+	_pingsInWindow(0),
+	_pingBurstInWindow(0),
+	_pingRate(0),
+	_pingBurst(0),
+	_pingsSent(0),
+	_pingsDeferred(0)
 {
 	if (callbacks->version != 0)
 		throw ZT_EXCEPTION_INVALID_ARGUMENT;
@@ -170,12 +183,15 @@ ZT_ResultCode Node::processWirePacket(
 	int64_t now,
 	int64_t localSocket,
 	const struct sockaddr_storage *remoteAddress,
-	const void *packetData,
+	void *packetData,
 	unsigned int packetLength,
 	volatile int64_t *nextBackgroundTaskDeadline)
 {
 	_now = now;
 	RR->sw->onRemotePacket(tptr,localSocket,*(reinterpret_cast<const InetAddress *>(remoteAddress)),packetData,packetLength);
+	RR->sw->flushWhois(tptr);
+	if (RR->topology->peerLoadsPending())
+		*nextBackgroundTaskDeadline = now; // load queued peers from the cache on the next background run
 	return ZT_RESULT_OK;
 }
 
@@ -195,11 +211,23 @@ ZT_ResultCode Node::processVirtualNetworkFrame(
 	SharedPtr<Network> nw(this->network(nwid));
 	if (nw) {
 		RR->sw->onLocalEthernet(tptr,nw,MAC(sourceMac),MAC(destMac),etherType,vlanId,frameData,frameLength);
+		RR->sw->flushWhois(tptr);
+		if (RR->topology->peerLoadsPending()) {
+			*nextBackgroundTaskDeadline = now;
+		} else if ((RR->sw->aggregatesPending())&&(*nextBackgroundTaskDeadline > (now + ZT_FRAME_AGGREGATION_MAX_DELAY))) {
+			*nextBackgroundTaskDeadline = now + ZT_FRAME_AGGREGATION_MAX_DELAY;
+		}
 		return ZT_RESULT_OK;
 	} else return ZT_RESULT_ERROR_NETWORK_NOT_FOUND;
 }
 
-// Closure used to ping upstream and active/online peers
+void Node::flushVirtualNetworkFrames(void *tptr,uint64_t nwid)
+{
+	RR->sw->flushAggregates(tptr,nwid,0x7fffffffffffffffLL);
+}
+
+// Closure used to ping upstreams and other peers we should always contact (other
+// active peers are pinged when their deadline comes up in the Topology timer wheel)
 class _PingPeersThatNeedPing
 {
 public:
@@ -248,8 +276,6 @@ public:
 			}
 
 			_alwaysContact.erase(p->address()); // after this we'll WHOIS all upstreams that remain
-		} else if (p->isActive(_now)) {
-			p->doPingAndKeepalive(_tPtr,_now);
 		}
 	}
 
@@ -266,6 +292,13 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,int64_t now,volatile int64
 	_now = now;
 	Mutex::Lock bl(_backgroundTasksLock);
 
+	bool peerLoadsPending;
+	try {
+		peerLoadsPending = RR->topology->loadPendingPeers(tptr,now);
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+
 	unsigned long timeUntilNextPingCheck =
           OT0_parameter_ping_check_interval ? OT0_parameter_ping_check_interval : ZT_PING_CHECK_INVERVAL;
 	const int64_t timeSinceLastPingCheck = now - _lastPingCheck;
@@ -311,6 +344,16 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,int64_t now,volatile int64
 				}
 				_localControllerAuthorizations_m.unlock();
 			}
+			{
+				Mutex::Lock _l(_sentConfigs_m);
+				Hashtable< _LocalControllerAuth,_SentConfig >::Iterator i(_sentConfigs);
+				_LocalControllerAuth *k = (_LocalControllerAuth *)0;
+				_SentConfig *v = (_SentConfig *)0;
+				while (i.next(k,v)) {
+					if ((now - v->lastRequest) > (ZT_NETWORK_AUTOCONF_DELAY * 3))
+						_sentConfigs.erase(*k);
+				}
+			}
 
 			// Get peers we should stay connected to according to network configs
 			// Also get networks and whether they need config so we only have to do one pass over networks
@@ -321,14 +364,21 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,int64_t now,volatile int64
 				uint64_t *nwid = (uint64_t *)0;
 				SharedPtr<Network> *network = (SharedPtr<Network> *)0;
 				while (i.next(nwid,network)) {
-					(*network)->config().alwaysContactAddresses(alwaysContact);
+					(*network)->config()->alwaysContactAddresses(alwaysContact);
 					networkConfigNeeded.push_back( std::pair< SharedPtr<Network>,bool >(*network,(((now - (*network)->lastConfigUpdate()) >= ZT_NETWORK_AUTOCONF_DELAY)||(!(*network)->hasConfig()))) );
 				}
 			}
 
-			// Ping active peers, upstreams, and others that we should always contact
-			_PingPeersThatNeedPing pfunc(RR,tptr,alwaysContact,now);
-			RR->topology->eachPeer<_PingPeersThatNeedPing &>(pfunc);
+			// Ping upstreams and others that we should always contact
+			{
+				_PingPeersThatNeedPing pfunc(RR,tptr,alwaysContact,now);
+				const std::vector<Address> ac(alwaysContact.keys());
+				for(std::vector<Address>::const_iterator a(ac.begin());a!=ac.end();++a) {
+					const SharedPtr<Peer> p(RR->topology->getPeerNoCache(*a));
+					if (p)
+						pfunc(*RR->topology,p);
+				}
+			}
 
 			// Run WHOIS to create Peer for alwaysContact addresses that could not be contacted
 			{
@@ -369,13 +419,63 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,int64_t now,volatile int64
 			RR->topology->doPeriodicTasks(tptr,now);
 			RR->sa->clean(now);
 			RR->mc->clean(now);
+			_userMessageCompression.clean(now);
 		} catch ( ... ) {
 			return ZT_RESULT_FATAL_ERROR_INTERNAL;
 		}
 	}
 
+	// Ping active peers and expire their paths as their deadlines come up.
+	// The budget refills at a few times the rate needed to keep every peer
+	// alive, so steady state traffic is never held back but a pile of peers
+	// coming due at once is spread over several runs.
 	try {
-		*nextBackgroundTaskDeadline = now + (int64_t)std::max(std::min(timeUntilNextPingCheck,RR->sw->doTimerTasks(tptr,now)),(unsigned long)ZT_CORE_TIMER_TASK_GRANULARITY);
+		const double budgetRate = (double)(std::max(RR->topology->countPeers(),1UL) * ZT_PING_BUDGET_RATE_FACTOR) / (double)ZT_PATH_HEARTBEAT_PERIOD; // per ms
+		_pingBudget = std::min(_pingBudget + ((double)std::max(now - _lastPingBudgetRefill,(int64_t)0) * budgetRate),(double)ZT_PING_BUDGET_BURST + (budgetRate * (double)ZT_CORE_TIMER_TASK_GRANULARITY));
+		_lastPingBudgetRefill = now;
+
+		unsigned long pinged = 0;
+		std::vector< SharedPtr<Peer> > duePeers;
+		RR->topology->getPeersWithDueTasks(now,duePeers);
+		for(std::vector< SharedPtr<Peer> >::const_iterator p(duePeers.begin());p!=duePeers.end();++p) {
+			if ((*p)->isActive(now)) {
+				if (_pingBudget < 1.0) {
+					RR->topology->schedulePeerTasks((*p)->address(),now + ZT_CORE_TIMER_TASK_GRANULARITY);
+					++_pingsDeferred;
+					continue;
+				}
+				_pingBudget -= 1.0;
+				pinged += Utils::countBits((uint32_t)(*p)->doPingAndKeepalive(tptr,now)); // one bit per address family pinged
+				RR->topology->schedulePeerTasks((*p)->address(),(*p)->nextPingDeadline(now));
+			}
+		}
+
+		_pingsSent += pinged;
+		_pingsInWindow += pinged;
+		_pingBurstInWindow = std::max(_pingBurstInWindow,pinged);
+		if ((now - _pingStatsWindowStart) >= ZT_PING_STATS_WINDOW) {
+			_pingRate = (unsigned long)(((uint64_t)_pingsInWindow * 1000ULL) / (uint64_t)(now - _pingStatsWindowStart));
+			_pingBurst = _pingBurstInWindow;
+			_pingStatsWindowStart = now;
+			_pingsInWindow = 0;
+			_pingBurstInWindow = 0;
+		}
+	} catch ( ... ) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
+	}
+
+	try {
+		unsigned long timeUntilNextTimerTask = std::min(timeUntilNextPingCheck,RR->sw->doTimerTasks(tptr,now));
+		const int64_t nextPeerTasks = RR->topology->nextPeerTasksDeadline(now);
+		if (nextPeerTasks >= 0)
+			timeUntilNextTimerTask = std::min(timeUntilNextTimerTask,(unsigned long)std::max(nextPeerTasks - now,(int64_t)0));
+		RR->sw->flushWhois(tptr); // lookups wanted by anything above, e.g. network config requests
+		*nextBackgroundTaskDeadline = (peerLoadsPending) ? now : (now + (int64_t)std::max(timeUntilNextTimerTask,(unsigned long)ZT_CORE_TIMER_TASK_GRANULARITY));
+		if ((RR->sw->aggregatesPending())&&(*nextBackgroundTaskDeadline > (now + ZT_FRAME_AGGREGATION_MAX_DELAY))) // held frames are not subject to timer granularity
+			*nextBackgroundTaskDeadline = now + ZT_FRAME_AGGREGATION_MAX_DELAY;
+		const int64_t hedgeAt = RR->sw->nextWhoisHedge();
+		if ((hedgeAt >= 0)&&(*nextBackgroundTaskDeadline > hedgeAt)) // nor are hedged WHOIS requests
+			*nextBackgroundTaskDeadline = std::max(hedgeAt,now);
 	} catch ( ... ) {
 		return ZT_RESULT_FATAL_ERROR_INTERNAL;
 	}
@@ -385,10 +485,13 @@ ZT_ResultCode Node::processBackgroundTasks(void *tptr,int64_t now,volatile int64
 
 ZT_ResultCode Node::join(uint64_t nwid,void *uptr,void *tptr)
 {
-	Mutex::Lock _l(_networks_m);
-	SharedPtr<Network> &nw = _networks[nwid];
-	if (!nw)
-		nw = SharedPtr<Network>(new Network(RR,tptr,nwid,uptr,(const NetworkConfig *)0));
+	{
+		Mutex::Lock _l(_networks_m);
+		SharedPtr<Network> &nw = _networks[nwid];
+		if (!nw)
+			nw = SharedPtr<Network>(new Network(RR,tptr,nwid,uptr,(const NetworkConfig *)0));
+	}
+	RR->sw->flushWhois(tptr); // e.g. for the controller, if the config request needs one
 	return ZT_RESULT_OK;
 }
 
@@ -429,6 +532,7 @@ ZT_ResultCode Node::multicastSubscribe(void *tptr,uint64_t nwid,uint64_t multica
 	SharedPtr<Network> nw(this->network(nwid));
 	if (nw) {
 		nw->multicastSubscribe(tptr,MulticastGroup(MAC(multicastGroup),(uint32_t)(multicastAdi & 0xffffffff)));
+		RR->sw->flushWhois(tptr);
 		return ZT_RESULT_OK;
 	} else return ZT_RESULT_ERROR_NETWORK_NOT_FOUND;
 }
@@ -502,6 +606,17 @@ void Node::status(ZT_NodeStatus *status) const
 	status->publicIdentity = RR->publicIdentityStr;
 	status->secretIdentity = RR->secretIdentityStr;
 	status->online = _online ? 1 : 0;
+	RR->sw->pendingSendStats(status->pendingSendDestinations,status->pendingSendPackets,status->pendingSendMaxDepth,status->pendingSendDropped,status->pendingSendExpired);
+	RR->topology->peerTableStats(status->peers,status->coldPeers,status->bytesPerPeer,status->bytesPerColdPeer,status->peerMemoryBudget);
+	status->pingsSent = _pingsSent;
+	status->pingsDeferred = _pingsDeferred;
+	status->pingRate = _pingRate;
+	status->pingBurst = _pingBurst;
+}
+
+void Node::setPeerMemoryBudget(const uint64_t bytes)
+{
+	RR->topology->setPeerMemoryBudget(bytes);
 }
 
 ZT_PeerList *Node::peers() const
@@ -554,6 +669,12 @@ ZT_PeerList *Node::peers() const
 			p->paths[p->pathCount].throughput = (*path)->meanThroughput();
 			p->paths[p->pathCount].maxThroughput = (*path)->maxLifetimeThroughput();
 			p->paths[p->pathCount].allocation = (float)(*path)->allocation() / (float)255;
+			p->paths[p->pathCount].flows = pi->second->pinnedFlows(*path);
+			p->paths[p->pathCount].unansweredBytes = (*path)->unansweredBytes();
+			p->paths[p->pathCount].failures = (*path)->failures();
+			p->paths[p->pathCount].lastDetectionTime = (*path)->lastDetectionTime();
+			p->paths[p->pathCount].mtu = (*path)->mtu(RR->topology->getOutboundPathMtu((*path)->address()));
+			p->paths[p->pathCount].failed = ((*path)->failed()) ? 1 : 0;
 			p->paths[p->pathCount].ifname = (*path)->getName();
 
 			++p->pathCount;
@@ -626,8 +747,9 @@ int Node::sendUserMessage(void *tptr,uint64_t dest,uint64_t typeId,const void *d
 			Packet outp(Address(dest),RR->identity.address(),Packet::VERB_USER_MESSAGE);
 			outp.append(typeId);
 			outp.append(data,len);
-			outp.compress();
+			_userMessageCompression.compress(outp,Address(dest),(uint32_t)typeId,_now);
 			RR->sw->send(tptr,outp,true);
+			RR->sw->flushWhois(tptr);
 			return 1;
 		}
 	} catch ( ... ) {}
@@ -660,9 +782,10 @@ bool shouldUsePathForZeroTierTraffic(void *tPtr,const Address &ztaddr,const int6
 		uint64_t *k = (uint64_t *)0;
 		SharedPtr<Network> *v = (SharedPtr<Network> *)0;
 		while (i.next(k,v)) {
-			if ((*v)->hasConfig()) {
-				for(unsigned int k=0;k<(*v)->config().staticIpCount;++k) {
-					if ((*v)->config().staticIps[k].containsAddress(remoteAddress))
+			const SharedPtr<NetworkConfigSnapshot> nconf((*v)->config());
+			if (*nconf) {
+				for(unsigned int k=0;k<nconf->staticIpCount;++k) {
+					if (nconf->staticIps[k].containsAddress(remoteAddress))
 						return false;
 				}
 			}
@@ -690,9 +813,10 @@ bool Node::shouldUsePathForZeroTierTraffic(void *tPtr,const Address &ztaddr,cons
 		uint64_t *k = (uint64_t *)0;
 		SharedPtr<Network> *v = (SharedPtr<Network> *)0;
 		while (i.next(k,v)) {
-			if ((*v)->hasConfig()) {
-				for(unsigned int k=0;k<(*v)->config().staticIpCount;++k) {
-					if ((*v)->config().staticIps[k].containsAddress(remoteAddress))
+			const SharedPtr<NetworkConfigSnapshot> nconf((*v)->config());
+			if (*nconf) {
+				for(unsigned int k=0;k<nconf->staticIpCount;++k) {
+					if (nconf->staticIps[k].containsAddress(remoteAddress))
 						result = false;
 				}
 			}
@@ -750,9 +874,21 @@ void Node::ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &de
 		if (!n) return;
 		n->setConfiguration((void *)0,nc,true);
 	} else {
+		// Send only what changed if the member holds the config we last sent it
+		NetworkConfig::DeltaBase against,sent;
+		bool delta = false;
+		if (!sendLegacyFormatConfig) {
+			Mutex::Lock _l(_sentConfigs_m);
+			const _SentConfig *const s = _sentConfigs.get(_LocalControllerAuth(nwid,destination));
+			if ((s)&&(s->acceptsDelta)&&(s->base.timestamp)) {
+				against = s->base;
+				delta = true;
+			}
+		}
+
 		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *dconf = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
 		try {
-			if (nc.toDictionary(*dconf,sendLegacyFormatConfig)) {
+			if (nc.toDictionary(*dconf,sendLegacyFormatConfig,&sent,(delta) ? &against : (const NetworkConfig::DeltaBase *)0)) {
 				uint64_t configUpdateId = prng();
 				if (!configUpdateId) ++configUpdateId;
 
@@ -785,6 +921,12 @@ void Node::ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &de
 					RR->sw->send((void *)0,outp,true);
 					chunkIndex += chunkLen;
 				}
+				RR->sw->flushWhois((void *)0);
+
+				Mutex::Lock _l(_sentConfigs_m);
+				_SentConfig *const s = _sentConfigs.get(_LocalControllerAuth(nwid,destination));
+				if (s)
+					s->base = sent;
 			}
 			delete dconf;
 		} catch ( ... ) {
@@ -794,6 +936,16 @@ void Node::ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &de
 	}
 }
 
+void Node::ncConfigRequested(const uint64_t nwid,const Address &member,const bool acceptsDelta,const uint64_t revision,const int64_t timestamp)
+{
+	Mutex::Lock _l(_sentConfigs_m);
+	_SentConfig &s = _sentConfigs[_LocalControllerAuth(nwid,member)];
+	s.lastRequest = now();
+	s.acceptsDelta = acceptsDelta;
+	if ((s.base.timestamp != timestamp)||(s.base.revision != revision))
+		s.base = NetworkConfig::DeltaBase();
+}
+
 void Node::ncSendRevocation(const Address &destination,const Revocation &rev)
 {
 	if (destination == RR->identity.address()) {
@@ -809,6 +961,7 @@ void Node::ncSendRevocation(const Address &destination,const Revocation &rev)
 		rev.serialize(outp);
 		outp.append((uint16_t)0);
 		RR->sw->send((void *)0,outp,true);
+		RR->sw->flushWhois((void *)0);
 	}
 }
 
@@ -844,6 +997,7 @@ void Node::ncSendError(uint64_t nwid,uint64_t requestPacketId,const Address &des
 		}
 		outp.append(nwid);
 		RR->sw->send((void *)0,outp,true);
+		RR->sw->flushWhois((void *)0);
 	} // else we can't send an ERROR() in response to nothing, so discard
 }
 
@@ -883,7 +1037,7 @@ enum ZT_ResultCode ZT_Node_processWirePacket(
 	int64_t now,
 	int64_t localSocket,
 	const struct sockaddr_storage *remoteAddress,
-	const void *packetData,
+	void *packetData,
 	unsigned int packetLength,
 	volatile int64_t *nextBackgroundTaskDeadline)
 {
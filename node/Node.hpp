@@ -80,7 +80,7 @@ public:
 		int64_t now,
 		int64_t localSocket,
 		const struct sockaddr_storage *remoteAddress,
-		const void *packetData,
+		void *packetData,
 		unsigned int packetLength,
 		volatile int64_t *nextBackgroundTaskDeadline);
 	ZT_ResultCode processVirtualNetworkFrame(
@@ -256,6 +256,19 @@ public:
 		return false;
 	}
 
+	/**
+	 * Note what config a member holds when it asks the local controller for one
+	 *
+	 * If it's not the one last sent, the next config sent to it is a full one.
+	 *
+	 * @param nwid Network ID
+	 * @param member Requesting member
+	 * @param acceptsDelta True if member can apply delta configs
+	 * @param revision Revision of config member holds
+	 * @param timestamp Timestamp of config member holds
+	 */
+	void ncConfigRequested(const uint64_t nwid,const Address &member,const bool acceptsDelta,const uint64_t revision,const int64_t timestamp);
+
 	virtual void ncSendConfig(uint64_t nwid,uint64_t requestPacketId,const Address &destination,const NetworkConfig &nc,bool sendLegacyFormatConfig);
 	virtual void ncSendRevocation(const Address &destination,const Revocation &rev);
 	virtual void ncSendError(uint64_t nwid,uint64_t requestPacketId,const Address &destination,NetworkController::ErrorCode errorCode);
@@ -265,6 +278,57 @@ public:
 
 	inline void setMultipathMode(uint8_t mode) { _multipathMode = mode; }
 	inline uint8_t getMultipathMode() { return _multipathMode; }
+	inline void setMultipathFailoverBudget(unsigned int ms) { _multipathFailoverBudget = (ms) ? ms : ZT_MULTIPATH_AB_FAILOVER_BUDGET; }
+	inline unsigned int getMultipathFailoverBudget() const { return _multipathFailoverBudget; }
+
+	/**
+	 * Enable or disable packing of small frames into VERB_MULTI_FRAME packets
+	 *
+	 * Hosts should call flushVirtualNetworkFrames() at the end of each batch
+	 * of frames they read from a virtual network port. Otherwise held frames
+	 * wait for the next background task deadline, which is at most
+	 * ZT_FRAME_AGGREGATION_MAX_DELAY away while anything is held.
+	 */
+	inline void setFrameAggregation(bool enabled) { _frameAggregation = enabled; }
+	inline bool frameAggregation() const { return _frameAggregation; }
+
+	/**
+	 * Set the path loss ratio above which fragmented packets get a parity fragment
+	 *
+	 * Loss is what the receiving peer reports (VERB_FRAGMENT_LOSS) for
+	 * fragments we send over the path.
+	 *
+	 * @param ratio Loss ratio (0.0 - 1.0) or 0 to never send parity fragments
+	 */
+	inline void setFecLossThreshold(float ratio) { _fecLossThreshold = ratio; }
+	inline float fecLossThreshold() const { return _fecLossThreshold; }
+
+	/**
+	 * Enable or disable searching for path MTUs above the configured or default one
+	 *
+	 * Only enable this if the wire packet send function honors
+	 * ZT_WIRE_PACKET_DONT_FRAGMENT. Otherwise probes get through by IP
+	 * fragmentation and every path MTU climbs to ZT_PATH_MTU_MAX. With it
+	 * off paths are still checked at their base MTU and fall back to
+	 * ZT_MIN_PHYSMTU if that is black-holed.
+	 */
+	inline void setPathMtuDiscovery(bool enabled) { _pathMtuDiscovery = enabled; }
+	inline bool pathMtuDiscovery() const { return _pathMtuDiscovery; }
+
+	/**
+	 * Set memory budget for full peers, beyond which idle peers are demoted (see Topology)
+	 *
+	 * @param bytes Budget in bytes or 0 for no limit
+	 */
+	void setPeerMemoryBudget(const uint64_t bytes);
+
+	/**
+	 * Send any frames held for aggregation on a network
+	 *
+	 * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+	 * @param nwid Network ID or 0 for all networks
+	 */
+	void flushVirtualNetworkFrames(void *tptr,uint64_t nwid);
 
 	inline bool localControllerHasAuthorized(const int64_t now,const uint64_t nwid,const Address &addr) const
 	{
@@ -311,24 +375,53 @@ private:
 	Hashtable< _LocalControllerAuth,int64_t > _localControllerAuthorizations;
 	Mutex _localControllerAuthorizations_m;
 
+	// What the local controller last sent each member, so it can send deltas
+	struct _SentConfig
+	{
+		_SentConfig() : lastRequest(0),acceptsDelta(false),base() {}
+		int64_t lastRequest;
+		bool acceptsDelta;
+		NetworkConfig::DeltaBase base;
+	};
+	Hashtable< _LocalControllerAuth,_SentConfig > _sentConfigs;
+	Mutex _sentConfigs_m;
+
 	Hashtable< uint64_t,SharedPtr<Network> > _networks;
 	Mutex _networks_m;
 
 	std::vector<InetAddress> _directPaths;
 	Mutex _directPaths_m;
 
+	AdaptiveCompression _userMessageCompression; // traffic class is the message type ID
+
 	Mutex _backgroundTasksLock;
 
 	Address _remoteTraceTarget;
 	enum Trace::Level _remoteTraceLevel;
 
 	uint8_t _multipathMode;
+	volatile unsigned int _multipathFailoverBudget;
+	volatile bool _frameAggregation;
+	volatile float _fecLossThreshold;
+	volatile bool _pathMtuDiscovery;
 
 	volatile int64_t _now;
 	int64_t _lastPingCheck;
 	int64_t _lastHousekeepingRun;
 	int64_t _lastMemoizedTraceSettings;
 	volatile int64_t _prngState[2];
+
+	// Keepalive ping budget and statistics (see processBackgroundTasks())
+	double _pingBudget;
+	int64_t _lastPingBudgetRefill;
+	int64_t _pingStatsWindowStart;
+	unsigned long _pingsInWindow;
+	unsigned long _pingBurstInWindow;
+	volatile unsigned long _pingRate;
+	volatile unsigned long _pingBurst;
+	volatile uint64_t _pingsSent;
+	volatile uint64_t _pingsDeferred;
+
 	bool _online;
 };
 
@@ -84,14 +84,29 @@ void OutboundMulticast::init(
 void OutboundMulticast::sendOnly(const RuntimeEnvironment *RR,void *tPtr,const Address &toAddr)
 {
 	const SharedPtr<Network> nw(RR->node->network(_nwid));
-	uint8_t QoSBucket = 255; // Dummy value
-	if ((nw)&&(nw->filterOutgoingPacket(tPtr,true,RR->identity.address(),toAddr,_macSrc,_macDest,_frameData,_frameLen,_etherType,0,QoSBucket))) {
+	if (!nw)
+		return;
+
+	const SharedPtr<NetworkConfigSnapshot> nconf(nw->config());
+	if (nconf != _filteredWith) {
+		_filteredWith = nconf;
+		_filterResult = nw->filterOutgoingMulticast(*nconf,RR->identity.address(),_macSrc,_macDest,_frameData,_frameLen,_etherType,0);
+	}
+
+	bool send;
+	if (_filterResult < 0) {
+		uint8_t QoSBucket = 255; // Dummy value
+		send = nw->filterOutgoingPacket(tPtr,true,RR->identity.address(),toAddr,_macSrc,_macDest,_frameData,_frameLen,_etherType,0,QoSBucket);
+	} else {
+		send = (_filterResult != 0);
+	}
+
+	if (send) {
 		nw->pushCredentialsIfNeeded(tPtr,toAddr,RR->node->now());
-		_packet.newInitializationVector();
-		_packet.setDestination(toAddr);
-		RR->node->expectReplyTo(_packet.packetId());
-		_tmp = _packet;
-		RR->sw->send(tPtr,_tmp,true);
+		uint64_t packetId;
+		Utils::getSecureRandom(&packetId,sizeof(packetId));
+		RR->node->expectReplyTo(packetId);
+		RR->sw->sendCopy(tPtr,_packet,toAddr,packetId,true);
 	}
 }
 
@@ -37,6 +37,8 @@
 #include "MulticastGroup.hpp"
 #include "Address.hpp"
 #include "Packet.hpp"
+#include "SharedPtr.hpp"
+#include "NetworkConfig.hpp"
 
 namespace ZeroTier {
 
@@ -56,7 +58,7 @@ public:
 	 *
 	 * It must be initialized with init().
 	 */
-	OutboundMulticast() {}
+	OutboundMulticast() : _filterResult(-1) {}
 
 	/**
 	 * Initialize outbound multicast
@@ -106,6 +108,9 @@ public:
 	/**
 	 * Just send without checking log
 	 *
+	 * Filtering is done once for all recipients if the network's rules allow,
+	 * and every recipient's copy is armored straight from the one prototype.
+	 *
 	 * @param RR Runtime environment
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param toAddr Destination address
@@ -161,8 +166,10 @@ private:
 	unsigned int _limit;
 	unsigned int _frameLen;
 	unsigned int _etherType;
-	Packet _packet,_tmp;
+	Packet _packet; // prototype for every recipient, never armored itself
 	std::vector<Address> _alreadySentTo;
+	SharedPtr<NetworkConfigSnapshot> _filteredWith; // config _filterResult was computed with
+	int _filterResult; // from Network::filterOutgoingMulticast()
 	uint8_t _frameData[ZT_MAX_MTU];
 };
 
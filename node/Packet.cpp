@@ -925,6 +925,46 @@ void Packet::armor(const void *key,bool encryptPayload)
 	}
 }
 
+void Packet::armorFrom(const Packet &source,const void *key,bool encryptPayload)
+{
+	uint8_t mangledKey[32];
+	setSize(source.size());
+	uint8_t *const data = reinterpret_cast<uint8_t *>(unsafeData());
+	const uint8_t *const sourcePayload = reinterpret_cast<const uint8_t *>(source.data()) + ZT_PACKET_IDX_VERB;
+	uint8_t *const payload = data + ZT_PACKET_IDX_VERB;
+	const unsigned int payloadLen = size() - ZT_PACKET_IDX_VERB;
+
+	// Set flag now, since it affects key mangle function
+	setCipher(encryptPayload ? ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_SALSA2012 : ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE);
+
+	_salsa20MangleKey((const unsigned char *)key,mangledKey);
+
+	if (ZT_HAS_FAST_CRYPTO()) {
+		const unsigned int encryptLen = (encryptPayload) ? payloadLen : 0;
+		uint64_t keyStream[(ZT_PROTO_MAX_PACKET_LENGTH + 64 + 8) / 8];
+		ZT_FAST_SINGLE_PASS_SALSA2012(keyStream,encryptLen + 64,(data + ZT_PACKET_IDX_IV),mangledKey);
+		memcpy(payload,sourcePayload,payloadLen);
+		Salsa20::memxor(payload,reinterpret_cast<const uint8_t *>(keyStream + 8),encryptLen);
+		uint64_t mac[2];
+		Poly1305::compute(mac,payload,payloadLen,keyStream);
+#ifdef ZT_NO_TYPE_PUNNING
+		memcpy(data + ZT_PACKET_IDX_MAC,mac,8);
+#else
+		(*reinterpret_cast<uint64_t *>(data + ZT_PACKET_IDX_MAC)) = mac[0];
+#endif
+	} else {
+		Salsa20 s20(mangledKey,data + ZT_PACKET_IDX_IV);
+		uint64_t macKey[4];
+		s20.crypt12(ZERO_KEY,macKey,sizeof(macKey));
+		if (encryptPayload)
+			s20.crypt12(sourcePayload,payload,payloadLen);
+		else memcpy(payload,sourcePayload,payloadLen);
+		uint64_t mac[2];
+		Poly1305::compute(mac,payload,payloadLen,macKey);
+		memcpy(data + ZT_PACKET_IDX_MAC,mac,8);
+	}
+}
+
 bool Packet::dearmor(const void *key)
 {
 	uint8_t mangledKey[32];
@@ -141,6 +141,26 @@
  */
 #define ZT_PROTO_VERB_FLAG_COMPRESSED 0x80
 
+/**
+ * HELLO capability: peer understands VERB_MULTI_FRAME
+ */
+#define ZT_PROTO_CAPABILITY_MULTI_FRAME 0x0000000000000001ULL
+
+/**
+ * HELLO capability: peer checks credential digests in VERB_NETWORK_CREDENTIALS
+ */
+#define ZT_PROTO_CAPABILITY_CREDENTIAL_DIGEST 0x0000000000000002ULL
+
+/**
+ * HELLO capability: peer can repair fragmented packets from a parity fragment
+ */
+#define ZT_PROTO_CAPABILITY_FEC 0x0000000000000004ULL
+
+/**
+ * HELLO capabilities of this node
+ */
+#define ZT_PROTO_CAPABILITIES (ZT_PROTO_CAPABILITY_MULTI_FRAME | ZT_PROTO_CAPABILITY_CREDENTIAL_DIGEST | ZT_PROTO_CAPABILITY_FEC)
+
 /**
  * Rounds used for Salsa20 encryption in ZT
  *
@@ -251,6 +271,16 @@
  */
 #define ZT_PROTO_MIN_FRAGMENT_LENGTH ZT_PACKET_FRAGMENT_IDX_PAYLOAD
 
+/**
+ * Fragment number of a parity fragment
+ */
+#define ZT_PACKET_FRAGMENT_PARITY_NO 0xf
+
+/**
+ * Bytes a parity fragment adds to the largest unit it covers
+ */
+#define ZT_PACKET_FRAGMENT_PARITY_OVERHEAD (ZT_PROTO_MIN_FRAGMENT_LENGTH + 2)
+
 // Field indices for parsing verbs -------------------------------------------
 
 // Some verbs have variable-length fields. Those aren't fully defined here
@@ -285,6 +315,10 @@
 #define ZT_PROTO_VERB_FRAME_IDX_ETHERTYPE (ZT_PROTO_VERB_FRAME_IDX_NETWORK_ID + 8)
 #define ZT_PROTO_VERB_FRAME_IDX_PAYLOAD (ZT_PROTO_VERB_FRAME_IDX_ETHERTYPE + 2)
 
+#define ZT_PROTO_VERB_MULTI_FRAME_IDX_NETWORK_ID (ZT_PACKET_IDX_PAYLOAD)
+#define ZT_PROTO_VERB_MULTI_FRAME_IDX_FLAGS (ZT_PROTO_VERB_MULTI_FRAME_IDX_NETWORK_ID + 8)
+#define ZT_PROTO_VERB_MULTI_FRAME_IDX_FRAMES (ZT_PROTO_VERB_MULTI_FRAME_IDX_FLAGS + 1)
+
 #define ZT_PROTO_VERB_EXT_FRAME_IDX_NETWORK_ID (ZT_PACKET_IDX_PAYLOAD)
 #define ZT_PROTO_VERB_EXT_FRAME_LEN_NETWORK_ID 8
 #define ZT_PROTO_VERB_EXT_FRAME_IDX_FLAGS (ZT_PROTO_VERB_EXT_FRAME_IDX_NETWORK_ID + ZT_PROTO_VERB_EXT_FRAME_LEN_NETWORK_ID)
@@ -410,6 +444,19 @@ public:
 	 * loss; there is no retransmission mechanism. The receiver must wait for full
 	 * receipt to authenticate and decrypt; there is no per-fragment MAC. (But if
 	 * fragments are corrupt, the MAC will fail for the whole assembled packet.)
+	 *
+	 * On paths where peers announcing ZT_PROTO_CAPABILITY_FEC report loss
+	 * with VERB_FRAGMENT_LOSS a parity
+	 * fragment may follow the others. It has fragment number 0xf, the same
+	 * total as the others (which does not count the parity fragment), and
+	 * this payload:
+	 *   <[2] length of the whole packet>
+	 *   <[...] XOR of the head and all fragment payloads>
+	 *
+	 * Units shorter than the head are zero padded and the head's hop count
+	 * bits are XORed as zero. A receiver missing exactly one unit can rebuild
+	 * it from the others and the parity. Older nodes drop parity fragments
+	 * as invalid, so they are harmless if sent to one by mistake.
 	 */
 	class Fragment : public Buffer<ZT_PROTO_MAX_PACKET_LENGTH>
 	{
@@ -469,6 +516,36 @@ public:
 			memcpy(field(ZT_PACKET_FRAGMENT_IDX_PAYLOAD,fragLen),p.field(fragStart,fragLen),fragLen);
 		}
 
+		/**
+		 * Initialize as the parity fragment of a packet
+		 *
+		 * @param p Original assembled packet
+		 * @param unitLength Length of the head and of all but the last fragment's payload
+		 * @param fragTotal Total number of fragments (including 0 but not parity)
+		 */
+		inline void initParity(const Packet &p,unsigned int unitLength,unsigned int fragTotal)
+		{
+			if ((p.size() <= unitLength)||((unitLength * fragTotal) < p.size()))
+				throw ZT_EXCEPTION_OUT_OF_BOUNDS;
+			setSize(unitLength + ZT_PACKET_FRAGMENT_PARITY_OVERHEAD);
+
+			memcpy(field(ZT_PACKET_FRAGMENT_IDX_PACKET_ID,13),p.field(ZT_PACKET_IDX_IV,13),13);
+			(*this)[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_INDICATOR] = ZT_PACKET_FRAGMENT_INDICATOR;
+			(*this)[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_NO] = (char)(((fragTotal & 0xf) << 4) | ZT_PACKET_FRAGMENT_PARITY_NO);
+			(*this)[ZT_PACKET_FRAGMENT_IDX_HOPS] = 0;
+			setAt<uint16_t>(ZT_PACKET_FRAGMENT_IDX_PAYLOAD,(uint16_t)p.size());
+
+			uint8_t *const x = reinterpret_cast<uint8_t *>(unsafeData()) + ZT_PACKET_FRAGMENT_IDX_PAYLOAD + 2;
+			const uint8_t *const d = reinterpret_cast<const uint8_t *>(p.data());
+			memcpy(x,d,unitLength);
+			x[ZT_PACKET_IDX_FLAGS] &= 0xf8; // hops may change in transit
+			for(unsigned int s=unitLength;s<p.size();s+=unitLength) {
+				const unsigned int l = std::min(unitLength,p.size() - s);
+				for(unsigned int i=0;i<l;++i)
+					x[i] ^= d[s + i];
+			}
+		}
+
 		/**
 		 * Get this fragment's destination
 		 *
@@ -550,6 +627,7 @@ public:
 		 *   [<[8] 64-bit world ID of moon>]
 		 *   [<[8] 64-bit timestamp of moon>]
 		 *   [... additional moon type/ID/timestamp tuples ...]
+		 *   [<[8] 64-bit capabilities bit field>]
 		 *
 		 * HELLO is sent in the clear as it is how peers share their identity
 		 * public keys. A few additional fields are sent in the clear too, but
@@ -571,6 +649,11 @@ public:
 		 *   <[...] physical destination address of packet>
 		 *   <[2] 16-bit length of world update(s) or 0 if none>
 		 *   [[...] updates to planets and/or moons]
+		 *   [<[8] 64-bit capabilities bit field>]
+		 *
+		 * The capabilities field (ZT_PROTO_CAPABILITY_*) announces optional
+		 * protocol features the sender can receive. Older nodes neither send
+		 * it nor look at it, so a missing field means no capabilities.
 		 *
 		 * With the exception of the timestamp, the other fields pertain to the
 		 * respondent who is sending OK and are not echoes.
@@ -730,6 +813,9 @@ public:
 		 *   <[...] one or more serialized Revocations>
 		 *   <[2] 16-bit number of certificates of ownership>
 		 *   <[...] one or more serialized CertificateOfOwnership>
+		 *   [<[8] 64-bit network ID of credential digest>]
+		 *   [<[2] 16-bit number of credential digests>]
+		 *   [<[...] 64-bit digests of sender's capabilities, tags, and COOs>]
 		 *
 		 * This can be sent by anyone at any time to push network credentials.
 		 * These will of course only be accepted if they are properly signed.
@@ -738,6 +824,12 @@ public:
 		 * The use of a zero byte to terminate the COM section is for legacy
 		 * backward compatibility. Newer fields are prefixed with a length.
 		 *
+		 * To peers announcing ZT_PROTO_CAPABILITY_CREDENTIAL_DIGEST, periodic
+		 * pushes only include credentials not pushed before, followed by a
+		 * digest (see Membership::credentialDigest()) of every credential the
+		 * sender holds. A receiver missing any of them replies with
+		 * ERROR_NEED_MEMBERSHIP_CERTIFICATE, which results in a full push.
+		 *
 		 * OK/ERROR are not generated.
 		 */
 		VERB_NETWORK_CREDENTIALS = 0x0a,
@@ -784,6 +876,12 @@ public:
 		 * fields. This is to support older controllers that don't include
 		 * these fields and may be removed in the future.
 		 *
+		 * If the request meta-data flags include the accepts-delta flag and the
+		 * revision and timestamp sent match the config the controller last sent,
+		 * the response (or a later push) may be a delta config that leaves out
+		 * unchanged sections. A node that cannot apply one simply requests again,
+		 * and gets a full config since its revision and timestamp won't match.
+		 *
 		 * ERROR response payload:
 		 *   <[8] 64-bit network ID>
 		 */
@@ -1009,7 +1107,40 @@ public:
 		 * node on startup. This is helpful in identifying traces from different
 		 * members of a cluster.
 		 */
-		VERB_REMOTE_TRACE = 0x15
+		VERB_REMOTE_TRACE = 0x15,
+
+		/**
+		 * Several ZT-to-ZT unicast ethernet frames in one packet:
+		 *   <[8] 64-bit network ID>
+		 *   <[1] flags (unused, currently 0)>
+		 *   <[2] 16-bit ethertype>
+		 *   <[2] 16-bit length of ethernet payload>
+		 *   <[...] ethernet payload>
+		 *   [... additional ethertype/length/payload tuples ...]
+		 *
+		 * Each frame is handled exactly as if it had arrived in its own
+		 * VERB_FRAME. This is only sent to peers that announced
+		 * ZT_PROTO_CAPABILITY_MULTI_FRAME in HELLO or OK(HELLO), and only
+		 * when the sender has frame aggregation enabled.
+		 *
+		 * ERROR may be generated if a membership certificate is needed for a
+		 * closed network. Payload will be network ID.
+		 */
+		VERB_MULTI_FRAME = 0x16,
+
+		/**
+		 * Loss of fragments received over the path this is sent on:
+		 *   <[2] 16-bit fragments lost per 65535>
+		 *
+		 * A sender can't see how many of its fragments are lost, so the
+		 * receiver reports it, at most once per second while it sees loss
+		 * and once more when loss falls to zero. The sender uses it to decide
+		 * whether to add parity fragments. This is only sent to peers that
+		 * announced ZT_PROTO_CAPABILITY_FEC, and only directly (zero hops).
+		 *
+		 * OK and ERROR are not generated.
+		 */
+		VERB_FRAGMENT_LOSS = 0x17
 	};
 
 	/**
@@ -1275,6 +1406,52 @@ public:
 	 */
 	inline const unsigned char *payload() const { return field(ZT_PACKET_IDX_PAYLOAD,size() - ZT_PACKET_IDX_PAYLOAD); }
 
+	/**
+	 * Append a frame to a VERB_MULTI_FRAME packet
+	 *
+	 * @param etherType Ethernet frame type
+	 * @param data Frame payload
+	 * @param len Length of frame payload
+	 */
+	inline void appendMultiFrame(const unsigned int etherType,const void *data,const unsigned int len)
+	{
+		append((uint16_t)etherType);
+		append((uint16_t)len);
+		append(data,len);
+	}
+
+	/**
+	 * Get the next frame in a VERB_MULTI_FRAME packet
+	 *
+	 * Parsing stops at the first frame whose length runs past the end of
+	 * the packet, so a truncated or malformed tail is never returned.
+	 *
+	 * @param ptr Index of next frame, start at ZT_PROTO_VERB_MULTI_FRAME_IDX_FRAMES (advanced past returned frame)
+	 * @param etherType Set to frame's ethernet type
+	 * @param frameData Set to frame payload
+	 * @param frameLen Set to length of frame payload
+	 * @return True if a frame was returned, false at end of packet
+	 */
+	inline bool nextMultiFrame(unsigned int &ptr,unsigned int &etherType,const uint8_t *&frameData,unsigned int &frameLen) const
+	{
+		if ((ptr + 4) > size())
+			return false;
+		const unsigned int l = at<uint16_t>(ptr + 2);
+		if ((ptr + 4 + l) > size())
+			return false;
+		etherType = at<uint16_t>(ptr);
+		frameLen = l;
+		frameData = reinterpret_cast<const uint8_t *>(data()) + ptr + 4;
+		ptr += 4 + l;
+		return true;
+	}
+
+	/**
+	 * @param ptr Index of the optional capabilities field at the end of HELLO or OK(HELLO)
+	 * @return Capability bits (ZT_PROTO_CAPABILITY_*) or 0 if the field is absent
+	 */
+	inline uint64_t capabilitiesAt(const unsigned int ptr) const { return (((ptr + 8) <= size()) ? at<uint64_t>(ptr) : 0ULL); }
+
 	/**
 	 * Armor packet for transport
 	 *
@@ -1283,6 +1460,21 @@ public:
 	 */
 	void armor(const void *key,bool encryptPayload);
 
+	/**
+	 * Take another packet's verb and payload and armor them for transport
+	 *
+	 * This packet's header (IV, addresses and flags) must already be filled in.
+	 * The result is the same as copying the source and calling armor() on the
+	 * copy, but only the payload is copied and it is armored in place. This
+	 * lets one prototype be sent to many destinations without copying the
+	 * whole packet buffer for each of them.
+	 *
+	 * @param source Packet to take verb and payload from (not modified)
+	 * @param key 32-byte key
+	 * @param encryptPayload If true, encrypt packet payload, else just MAC
+	 */
+	void armorFrom(const Packet &source,const void *key,bool encryptPayload);
+
 	/**
 	 * Verify and (if encrypted) decrypt packet
 	 *
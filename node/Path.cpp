@@ -33,6 +33,18 @@ namespace ZeroTier {
 bool Path::send(const RuntimeEnvironment *RR,void *tPtr,const void *data,unsigned int len,int64_t now)
 {
 	if (RR->node->putPacket(tPtr,_localSocket,_addr,data,len)) {
+		_lastOut = now;
+		if (!_unansweredSince)
+			_unansweredSince = now;
+		_unansweredBytes += len;
+		return true;
+	}
+	return false;
+}
+
+bool Path::sendMtuProbe(const RuntimeEnvironment *RR,void *tPtr,const void *data,unsigned int len,int64_t now)
+{
+	if (RR->node->putPacket(tPtr,_localSocket,_addr,data,len,ZT_WIRE_PACKET_DONT_FRAGMENT)) {
 		_lastOut = now;
 		return true;
 	}
@@ -118,10 +118,35 @@ public:
 		_lastComputedPacketDelayVariance(0.0),
 		_lastComputedPacketErrorRatio(0.0),
 		_lastComputedPacketLossRatio(0),
+		_lastFragmentLossReport(0),
+		_reportedFragmentLoss(0),
+		_remoteFragmentLossRatio(0),
+		_remoteFragmentLossReceived(0),
 		_lastComputedStability(0.0),
 		_lastComputedRelativeQuality(0),
 		_lastComputedThroughputDistCoeff(0.0),
-		_lastAllocation(0)
+		_lastAllocation(0),
+		_unansweredSince(0),
+		_unansweredBytes(0),
+		_lastProbe(0),
+		_lastProbeReceived(0),
+		_failedAt(0),
+		_recoveredAt(0),
+		_lastDetectionTime(0),
+		_lastValidPackets(0),
+		_lastInvalidPackets(0),
+		_mtuBase(0),
+		_mtuCeiling(0),
+		_mtu(0),
+		_mtuLow(0),
+		_mtuHigh(ZT_PATH_MTU_MAX),
+		_mtuProbe(0),
+		_mtuProbeAttempts(0),
+		_mtuProbeId(0),
+		_mtuProbeSent(0),
+		_mtuNextProbe(0),
+		_mtuSearchDone(0),
+		_mtuNextCheck(0)
 	{
 		memset(_ifname, 0, 16);
 		memset(_addrString, 0, sizeof(_addrString));
@@ -151,10 +176,35 @@ public:
 		_lastComputedPacketDelayVariance(0.0),
 		_lastComputedPacketErrorRatio(0.0),
 		_lastComputedPacketLossRatio(0),
+		_lastFragmentLossReport(0),
+		_reportedFragmentLoss(0),
+		_remoteFragmentLossRatio(0),
+		_remoteFragmentLossReceived(0),
 		_lastComputedStability(0.0),
 		_lastComputedRelativeQuality(0),
 		_lastComputedThroughputDistCoeff(0.0),
-		_lastAllocation(0)
+		_lastAllocation(0),
+		_unansweredSince(0),
+		_unansweredBytes(0),
+		_lastProbe(0),
+		_lastProbeReceived(0),
+		_failedAt(0),
+		_recoveredAt(0),
+		_lastDetectionTime(0),
+		_lastValidPackets(0),
+		_lastInvalidPackets(0),
+		_mtuBase(0),
+		_mtuCeiling(0),
+		_mtu(0),
+		_mtuLow(0),
+		_mtuHigh(ZT_PATH_MTU_MAX),
+		_mtuProbe(0),
+		_mtuProbeAttempts(0),
+		_mtuProbeId(0),
+		_mtuProbeSent(0),
+		_mtuNextProbe(0),
+		_mtuSearchDone(0),
+		_mtuNextCheck(0)
 	{
 		memset(_ifname, 0, 16);
 		memset(_addrString, 0, sizeof(_addrString));
@@ -168,7 +218,18 @@ public:
 	 *
 	 * @param t Time of receive
 	 */
-	inline void received(const uint64_t t) { _lastIn = t; }
+	inline void received(const uint64_t t)
+	{
+		_lastIn = t;
+		if (_unansweredSince) {
+			_unansweredSince = 0;
+			_unansweredBytes = 0;
+		}
+		if (_failedAt) {
+			_failedAt = 0;
+			_recoveredAt = t;
+		}
+	}
 
 	/**
 	 * Set time last trusted packet was received (done in Peer::received())
@@ -187,12 +248,32 @@ public:
 	 */
 	bool send(const RuntimeEnvironment *RR,void *tPtr,const void *data,unsigned int len,int64_t now);
 
+	/**
+	 * Send a path MTU probe via this path, asking that it not be fragmented
+	 *
+	 * Unlike send() this is not counted as unanswered traffic, so a probe that
+	 * is too big to arrive can't make the path look dead.
+	 *
+	 * @param RR Runtime environment
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param data Packet data
+	 * @param len Packet length
+	 * @param now Current time
+	 * @return True if transport reported success
+	 */
+	bool sendMtuProbe(const RuntimeEnvironment *RR,void *tPtr,const void *data,unsigned int len,int64_t now);
+
 	/**
 	 * Manually update last sent time
 	 *
 	 * @param t Time of send
 	 */
-	inline void sent(const int64_t t) { _lastOut = t; }
+	inline void sent(const int64_t t)
+	{
+		_lastOut = t;
+		if (!_unansweredSince)
+			_unansweredSince = t;
+	}
 
 	/**
 	 * Update path latency with a new measurement
@@ -299,6 +380,9 @@ public:
 	/**
 	 * Record statistics on outgoing packets. Used later to estimate QoS metrics.
 	 *
+	 * Only one in ZT_PATH_QOS_ACK_PROTOCOL_DIVISOR packets is sampled; all others
+	 * return without taking any lock.
+	 *
 	 * @param now Current time
 	 * @param packetId ID of packet
 	 * @param payloadLength Length of payload
@@ -306,9 +390,9 @@ public:
 	 */
 	inline void recordOutgoingPacket(int64_t now, int64_t packetId, uint16_t payloadLength, Packet::Verb verb)
 	{
-		Mutex::Lock _l(_statistics_m);
 		if (verb != Packet::VERB_ACK && verb != Packet::VERB_QOS_MEASUREMENT) {
 			if ((packetId & (ZT_PATH_QOS_ACK_PROTOCOL_DIVISOR - 1)) == 0) {
+				Mutex::Lock _l(_statistics_m);
 				_unackedBytes += payloadLength;
 				// Take note that we're expecting a VERB_ACK on this path as of a specific time
 				_expectingAckAsOf = ackAge(now) > ZT_PATH_ACK_INTERVAL ? _expectingAckAsOf : now;
@@ -322,6 +406,9 @@ public:
 	/**
 	 * Record statistics on incoming packets. Used later to estimate QoS metrics.
 	 *
+	 * Every packet bumps a lock-free validity counter; only sampled packets
+	 * take the lock to update the ACK and QoS records.
+	 *
 	 * @param now Current time
 	 * @param packetId ID of packet
 	 * @param payloadLength Length of payload
@@ -329,15 +416,15 @@ public:
 	 */
 	inline void recordIncomingPacket(int64_t now, int64_t packetId, uint16_t payloadLength, Packet::Verb verb)
 	{
-		Mutex::Lock _l(_statistics_m);
 		if (verb != Packet::VERB_ACK && verb != Packet::VERB_QOS_MEASUREMENT) {
+			++_validPackets;
 			if ((packetId & (ZT_PATH_QOS_ACK_PROTOCOL_DIVISOR - 1)) == 0) {
+				Mutex::Lock _l(_statistics_m);
 				_inACKRecords[packetId] = payloadLength;
 				_packetsReceivedSinceLastAck++;
 				_inQoSRecords[packetId] = now;
 				_packetsReceivedSinceLastQoS++;
 			}
-			_packetValiditySamples.push(true);
 		}
 	}
 
@@ -547,6 +634,69 @@ public:
 	 */
 	inline float packetLossRatio() { return _lastComputedPacketLossRatio; }
 
+	/**
+	 * Record how many fragments of a fragmented packet arrived over this path
+	 *
+	 * This is loss in the direction we receive. The other end learns it from
+	 * VERB_FRAGMENT_LOSS reports (see fragmentLossReportDue()).
+	 *
+	 * @param received Fragments received including the head
+	 * @param total Total fragments in packet
+	 */
+	inline void recordFragments(const unsigned int received,const unsigned int total)
+	{
+		if ((!total)||(received > total))
+			return;
+		Mutex::Lock _l(_statistics_m);
+		_lastComputedPacketLossRatio += ((((float)(total - received) / (float)total) - _lastComputedPacketLossRatio) * ZT_PATH_FRAGMENT_LOSS_WEIGHT);
+	}
+
+	/**
+	 * Check whether the other end should be told how many of its fragments we lose
+	 *
+	 * A report is due at most once per ZT_PATH_FRAGMENT_LOSS_REPORT_INTERVAL
+	 * while there is loss, and once more when it falls to zero.
+	 *
+	 * @param now Current time
+	 * @param loss Set to fragments lost per 65535 if a report is due
+	 * @return True if a report is due
+	 */
+	inline bool fragmentLossReportDue(const int64_t now,unsigned int &loss)
+	{
+		Mutex::Lock _l(_statistics_m);
+		if ((now - _lastFragmentLossReport) < ZT_PATH_FRAGMENT_LOSS_REPORT_INTERVAL)
+			return false;
+		loss = (unsigned int)(_lastComputedPacketLossRatio * 65535.0f);
+		if ((!loss)&&(!_reportedFragmentLoss))
+			return false;
+		_lastFragmentLossReport = now;
+		_reportedFragmentLoss = loss;
+		return true;
+	}
+
+	/**
+	 * Record a fragment loss report from the other end of this path
+	 *
+	 * @param loss Fragments we sent over this path that were lost, per 65535
+	 * @param now Current time
+	 */
+	inline void recordFragmentLossReport(const unsigned int loss,const int64_t now)
+	{
+		Mutex::Lock _l(_statistics_m);
+		_remoteFragmentLossRatio = (float)std::min(loss,65535U) / 65535.0f;
+		_remoteFragmentLossReceived = now;
+	}
+
+	/**
+	 * @param now Current time
+	 * @return Loss ratio of fragments we send over this path as last reported by the other end, or 0 if it has not reported within ZT_PATH_FRAGMENT_LOSS_REPORT_TIMEOUT
+	 */
+	inline float outboundLossRatio(const int64_t now)
+	{
+		Mutex::Lock _l(_statistics_m);
+		return (((now - _remoteFragmentLossReceived) < ZT_PATH_FRAGMENT_LOSS_REPORT_TIMEOUT) ? _remoteFragmentLossRatio : 0.0f);
+	}
+
 	/**
 	 * @return Packet error ratio (PER)
 	 */
@@ -556,7 +706,7 @@ public:
 	 * Record an invalid incoming packet. This packet failed MAC/compression/cipher checks and will now
 	 * contribute to a Packet Error Ratio (PER).
 	 */
-	inline void recordInvalidPacket() { _packetValiditySamples.push(false); }
+	inline void recordInvalidPacket() { ++_invalidPackets; }
 
 	/**
 	 * @return A pointer to a cached copy of the address string for this Path (For debugging only)
@@ -584,8 +734,22 @@ public:
 			_lastComputedPacketDelayVariance = _latencySamples.stddev(); // Similar to "jitter" (SEE: RFC 3393, RFC 4689)
 			_lastComputedMeanThroughput = (uint64_t)_throughputSamples.mean();
 
+			// Fold the packet validity counters accumulated since the last computation into the window
+			const unsigned int validCount = (unsigned int)_validPackets.load();
+			const unsigned int invalidCount = (unsigned int)_invalidPackets.load();
+			const uint32_t validDelta = (uint32_t)(validCount - _lastValidPackets);
+			const uint32_t invalidDelta = (uint32_t)(invalidCount - _lastInvalidPackets);
+			_lastValidPackets = validCount;
+			_lastInvalidPackets = invalidCount;
+			if ((validDelta + invalidDelta) > 0) {
+				_validPacketSamples.push(validDelta);
+				_invalidPacketSamples.push(invalidDelta);
+			}
+
 			// If no packet validity samples, assume PER==0
-			_lastComputedPacketErrorRatio = 1 - (_packetValiditySamples.count() ? _packetValiditySamples.mean() : 1);
+			const double invalidTotal = _invalidPacketSamples.sum();
+			const double packetTotal = _validPacketSamples.sum() + invalidTotal;
+			_lastComputedPacketErrorRatio = (packetTotal > 0.0) ? (float)(invalidTotal / packetTotal) : 0.0f;
 
 			// Compute path stability
 			// Normalize measurements with wildly different ranges into a reasonable range
@@ -630,7 +794,7 @@ public:
 	/**
 	 * @return True if this path needs a heartbeat
 	 */
-	inline bool needsHeartbeat(const int64_t now) const { return ((now - _lastOut) >= ZT_PATH_HEARTBEAT_PERIOD); }
+	inline bool needsHeartbeat(const int64_t now,const int64_t period = ZT_PATH_HEARTBEAT_PERIOD) const { return ((now - _lastOut) >= period); }
 
 	/**
 	 * @return Last time we sent something
@@ -642,13 +806,268 @@ public:
 	 */
 	inline int64_t lastIn() const { return _lastIn; }
 
+	/**
+	 * @return Time since the first packet sent after the last packet received, or 0 if nothing sent since
+	 */
+	inline int64_t unansweredFor(const int64_t now) const
+	{
+		const int64_t us = _unansweredSince;
+		return (us) ? (now - us) : 0;
+	}
+
+	/**
+	 * @return Bytes sent since the last packet was received via this path
+	 */
+	inline uint64_t unansweredBytes() const { return _unansweredBytes; }
+
+	/**
+	 * Check whether a dead path probe should be sent now, and if so note that one is being sent
+	 *
+	 * @param now Current time
+	 * @param interval Probe interval
+	 * @return True if traffic has been unanswered for at least interval and no probe was sent within interval
+	 */
+	inline bool needsProbe(const int64_t now,const int64_t interval)
+	{
+		if ((unansweredFor(now) >= interval)&&((now - _lastProbe) >= interval)) {
+			_lastProbe = now;
+			return true;
+		}
+		return false;
+	}
+
+	/**
+	 * Rate limit replies to dead path probes (empty ECHOs) received via this path
+	 *
+	 * This is only used once the path is known to belong to the peer.
+	 *
+	 * @param now Current time
+	 * @return True if a reply may be sent
+	 */
+	inline bool rateGateProbe(const int64_t now)
+	{
+		if ((now - _lastProbeReceived) >= ZT_PATH_PROBE_RATE_LIMIT) {
+			_lastProbeReceived = now;
+			return true;
+		}
+		return false;
+	}
+
+	/**
+	 * Declare this path dead until anything is received via it again
+	 *
+	 * @param now Current time
+	 * @return True if the path was not already marked dead
+	 */
+	inline bool fail(const int64_t now)
+	{
+		Mutex::Lock _l(_statistics_m);
+		if (_failedAt)
+			return false;
+		_failedAt = now;
+		_recoveredAt = 0;
+		_lastDetectionTime = (unsigned int)unansweredFor(now);
+		++_failures;
+		return true;
+	}
+
+	/**
+	 * @param now Current time
+	 * @param budget Time after which unanswered traffic means the path is dead
+	 * @return True if this path has been declared dead or has gone unanswered for the budget
+	 */
+	inline bool failed(const int64_t now,const int64_t budget) const { return ((_failedAt != 0)||(unansweredFor(now) >= budget)); }
+
+	/**
+	 * @return True if this path has been declared dead and nothing has been received since
+	 */
+	inline bool failed() const { return (_failedAt != 0); }
+
+	/**
+	 * @return Time this path has been answering since it last recovered from being dead (a large value if it never was)
+	 */
+	inline int64_t upFor(const int64_t now) const
+	{
+		const int64_t r = _recoveredAt;
+		return (r) ? (now - r) : 0x7fffffffffffffffLL;
+	}
+
+	/**
+	 * @return Number of times this path has been declared dead
+	 */
+	inline unsigned int failures() const { return (unsigned int)_failures.load(); }
+
+	/**
+	 * @return Time between the first unanswered packet and the last time this path was declared dead
+	 */
+	inline unsigned int lastDetectionTime() const { return _lastDetectionTime; }
+
+	/**
+	 * @param base MTU configured for this path's address (or the default)
+	 * @return Largest packet to send via this path without fragmenting it
+	 */
+	inline unsigned int mtu(const unsigned int base) const
+	{
+		const unsigned int m = _mtu;
+		return (m) ? m : base;
+	}
+
+	/**
+	 * @param now Current time
+	 * @return True if nextMtuProbe() may have something to do (cheap enough to check on every send)
+	 */
+	inline bool mtuProbeDue(const int64_t now) const { return (now >= _mtuNextCheck); }
+
+	/**
+	 * Decide whether a path MTU probe should be sent via this path now
+	 *
+	 * Each search first re-validates the MTU in use, falling back to the base
+	 * and then to ZT_MIN_PHYSMTU if probes of that size are lost, and then
+	 * binary searches upward toward the ceiling. A size is given up on
+	 * after ZT_PATH_MTU_PROBE_MAX_ATTEMPTS lost probes sent with exponential
+	 * backoff. Finished searches are repeated every ZT_PATH_MTU_RAISE_INTERVAL.
+	 *
+	 * If this returns nonzero a probe of that size is considered in flight
+	 * and mtuProbeSent() should be called with its packet ID.
+	 *
+	 * @param now Current time
+	 * @param base MTU configured for this path's address (or the default)
+	 * @param ceiling Largest MTU to search for (the base if the host can't send with don't fragment)
+	 * @return Size of probe to send or 0 if none is due
+	 */
+	inline unsigned int nextMtuProbe(const int64_t now,const unsigned int base,const unsigned int ceiling)
+	{
+		Mutex::Lock _l(_mtu_m);
+		if ((base != _mtuBase)||(ceiling != _mtuCeiling)) {
+			_mtuBase = base;
+			_mtuCeiling = ceiling;
+			_mtu = 0;
+			_mtuLow = 0;
+			_mtuHigh = ceiling;
+			_mtuProbe = 0;
+			_mtuProbeAttempts = 0;
+			_mtuNextProbe = 0;
+			_mtuSearchDone = 0;
+		}
+
+		unsigned int size = 0;
+		if ((_mtuProbe)&&((now - _mtuProbeSent) >= ZT_PATH_MTU_PROBE_TIMEOUT))
+			_mtuProbeLost(now);
+		if (!_mtuProbe) {
+			if ((_mtuSearchDone)&&((now - _mtuSearchDone) >= ZT_PATH_MTU_RAISE_INTERVAL)) {
+				_mtuSearchDone = 0;
+				_mtuLow = 0;
+				_mtuHigh = _mtuCeiling;
+			}
+			if ((!_mtuSearchDone)&&(now >= _mtuNextProbe)) {
+				if ((_mtuLow)&&((_mtuHigh <= _mtuLow)||((_mtuHigh - _mtuLow) < ZT_PATH_MTU_SEARCH_GRANULARITY))) {
+					_mtuSearchDone = now;
+				} else {
+					size = (_mtuLow) ? (_mtuLow + ((_mtuHigh - _mtuLow) + 1) / 2) : std::min((_mtu) ? _mtu : base,_mtuHigh);
+					_mtuProbe = size;
+					_mtuProbeId = 0;
+					_mtuProbeSent = now;
+				}
+			}
+		}
+		_mtuReschedule();
+		return size;
+	}
+
+	/**
+	 * @param packetId Packet ID of the probe requested by nextMtuProbe()
+	 */
+	inline void mtuProbeSent(const uint64_t packetId)
+	{
+		Mutex::Lock _l(_mtu_m);
+		_mtuProbeId = packetId;
+	}
+
+	/**
+	 * Count the probe requested by nextMtuProbe() as lost without waiting for it to time out
+	 *
+	 * This is used when the local stack refuses to send it, which usually means
+	 * it exceeds the MTU of the local interface.
+	 *
+	 * @param now Current time
+	 */
+	inline void mtuProbeFailed(const int64_t now)
+	{
+		Mutex::Lock _l(_mtu_m);
+		if (_mtuProbe) {
+			_mtuProbeAttempts = ZT_PATH_MTU_PROBE_MAX_ATTEMPTS - 1;
+			_mtuProbeLost(now);
+			_mtuReschedule();
+		}
+	}
+
+	/**
+	 * Handle OK(ECHO) received via this path, which may answer a path MTU probe
+	 *
+	 * @param packetId Packet ID of the ECHO being answered
+	 * @return True if this answered the path MTU probe in flight
+	 */
+	inline bool mtuProbeAnswered(const uint64_t packetId)
+	{
+		Mutex::Lock _l(_mtu_m);
+		if ((!_mtuProbe)||(packetId != _mtuProbeId))
+			return false;
+		_mtuLow = _mtuProbe;
+		if (_mtuHigh < _mtuLow)
+			_mtuHigh = _mtuLow;
+		_mtu = _mtuProbe;
+		_mtuProbe = 0;
+		_mtuProbeAttempts = 0;
+		_mtuNextProbe = 0;
+		_mtuReschedule();
+		return true;
+	}
+
 	/**
 	 * @return Time last trust-established packet was received
 	 */
 	inline int64_t lastTrustEstablishedPacketReceived() const { return _lastTrustEstablishedPacketReceived; }
 
 private:
+	// Called with _mtu_m locked when the probe in flight is lost
+	inline void _mtuProbeLost(const int64_t now)
+	{
+		const unsigned int size = _mtuProbe;
+		_mtuProbe = 0;
+		if (++_mtuProbeAttempts < ZT_PATH_MTU_PROBE_MAX_ATTEMPTS) {
+			_mtuNextProbe = now + ((int64_t)ZT_PATH_MTU_PROBE_TIMEOUT << _mtuProbeAttempts);
+			return;
+		}
+		_mtuProbeAttempts = 0;
+		_mtuNextProbe = 0;
+		if (_mtuLow) {
+			_mtuHigh = size - 1;
+		} else if (size > _mtuBase) {
+			// A previously discovered MTU stopped working, fall back to the base and validate that
+			_mtu = 0;
+			_mtuHigh = size - 1;
+		} else if (size > ZT_MIN_PHYSMTU) {
+			// Even the base is black-holed (tunnels, odd PPPoE setups), so use the smallest allowed MTU
+			_mtu = ZT_MIN_PHYSMTU;
+			_mtuLow = ZT_MIN_PHYSMTU;
+			_mtuHigh = size - 1;
+		} else {
+			_mtuLow = size;
+		}
+	}
+
+	// Called with _mtu_m locked whenever discovery state changes
+	inline void _mtuReschedule()
+	{
+		if (_mtuProbe)
+			_mtuNextCheck = _mtuProbeSent + ZT_PATH_MTU_PROBE_TIMEOUT;
+		else if (_mtuSearchDone)
+			_mtuNextCheck = _mtuSearchDone + ZT_PATH_MTU_RAISE_INTERVAL;
+		else _mtuNextCheck = _mtuNextProbe;
+	}
+
 	Mutex _statistics_m;
+	Mutex _mtu_m;
 
 	volatile int64_t _lastOut;
 	volatile int64_t _lastIn;
@@ -684,19 +1103,56 @@ private:
 	float _lastComputedPacketErrorRatio;
 	float _lastComputedPacketLossRatio;
 
+	// fragment loss reports sent to and received from the other end, guarded by _statistics_m
+	int64_t _lastFragmentLossReport;
+	unsigned int _reportedFragmentLoss;
+	float _remoteFragmentLossRatio;
+	int64_t _remoteFragmentLossReceived;
+
 	// cached estimates
 	float _lastComputedStability;
 	float _lastComputedRelativeQuality;
 	float _lastComputedThroughputDistCoeff;
 	unsigned char _lastAllocation;
 
+	// dead path detection for active-backup multipath
+	volatile int64_t _unansweredSince;
+	volatile uint64_t _unansweredBytes;
+	volatile int64_t _lastProbe;
+	volatile int64_t _lastProbeReceived;
+	volatile int64_t _failedAt;
+	volatile int64_t _recoveredAt;
+	volatile unsigned int _lastDetectionTime;
+	AtomicCounter _failures;
+
+	// packet validity, counted lock-free per packet and folded into the windows below once per compute interval
+	AtomicCounter _validPackets;
+	AtomicCounter _invalidPackets;
+	unsigned int _lastValidPackets;
+	unsigned int _lastInvalidPackets;
+
+	// path MTU discovery state, guarded by _mtu_m (except _mtu which is read lock-free)
+	unsigned int _mtuBase; // base MTU the current search started from
+	unsigned int _mtuCeiling; // largest MTU the current search may find
+	volatile unsigned int _mtu; // confirmed MTU or 0 to use the base
+	unsigned int _mtuLow; // largest size confirmed in the current search or 0 if not yet validated
+	unsigned int _mtuHigh; // largest size not yet ruled out
+	unsigned int _mtuProbe; // size of probe in flight or 0 if none
+	unsigned int _mtuProbeAttempts;
+	uint64_t _mtuProbeId;
+	int64_t _mtuProbeSent;
+	int64_t _mtuNextProbe;
+	int64_t _mtuSearchDone;
+	volatile int64_t _mtuNextCheck; // read lock-free by mtuProbeDue()
+
 	// cached human-readable strings for tracing purposes
 	char _ifname[16];
 	char _addrString[256];
 
 	RingBuffer<uint64_t,ZT_PATH_QUALITY_METRIC_WIN_SZ> _throughputSamples;
 	RingBuffer<uint32_t,ZT_PATH_QUALITY_METRIC_WIN_SZ> _latencySamples;
-	RingBuffer<bool,ZT_PATH_QUALITY_METRIC_WIN_SZ> _packetValiditySamples;
+	RingBuffer<uint32_t,ZT_PATH_QUALITY_METRIC_WIN_SZ> _validPacketSamples; // per compute interval
+	RingBuffer<uint32_t,ZT_PATH_QUALITY_METRIC_WIN_SZ> _invalidPacketSamples; // per compute interval
 	RingBuffer<float,ZT_PATH_QUALITY_METRIC_WIN_SZ> _throughputDisturbanceSamples;
 };
 
@@ -34,14 +34,18 @@
 #include "Packet.hpp"
 #include "Trace.hpp"
 #include "InetAddress.hpp"
-#include "RingBuffer.hpp"
 #include "Utils.hpp"
 
 namespace ZeroTier {
 
 static unsigned char s_freeRandomByteCounter = 0;
 
-Peer::Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity) :
+static inline int64_t _jitteredHeartbeatPeriod(const RuntimeEnvironment *RR)
+{
+	return (ZT_PATH_HEARTBEAT_PERIOD - ZT_PEER_PING_JITTER) + (int64_t)(RR->node->prng() % ((ZT_PEER_PING_JITTER * 2) + 1));
+}
+
+Peer::Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity,const uint8_t *key) :
 	RR(renv),
 	_lastReceive(0),
 	_lastNontrivialReceive(0),
@@ -54,6 +58,7 @@ Peer::Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Ident
 	_lastCredentialsReceived(0),
 	_lastTrustEstablishedPacketReceived(0),
 	_lastSentFullHello(0),
+	_heartbeatPeriod(_jitteredHeartbeatPeriod(renv)),
 	_lastACKWindowReset(0),
 	_lastQoSWindowReset(0),
 	_lastMultipathCompatibilityCheck(0),
@@ -66,6 +71,7 @@ Peer::Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Ident
 	_vMajor(0),
 	_vMinor(0),
 	_vRevision(0),
+	_remoteCapabilities(0),
 	_id(peerIdentity),
 	_directPathPushCutoffCount(0),
 	_credentialsCutoffCount(0),
@@ -75,8 +81,12 @@ Peer::Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Ident
 	_lastAggregateStatsReport(0),
 	_lastAggregateAllocation(0)
 {
-	if (!myIdentity.agree(peerIdentity,_key,ZT_PEER_SECRET_KEY_LENGTH))
+	if (key)
+		memcpy(_key,key,ZT_PEER_SECRET_KEY_LENGTH);
+	else if (!myIdentity.agree(peerIdentity,_key,ZT_PEER_SECRET_KEY_LENGTH))
 		throw ZT_EXCEPTION_INVALID_ARGUMENT;
+	memset(_recentChoiceCounts,0,sizeof(_recentChoiceCounts));
+	_activePathPtr = (Path *)0;
 }
 
 void Peer::received(
@@ -97,9 +107,12 @@ void Peer::received(
 	switch (verb) {
 		case Packet::VERB_FRAME:
 		case Packet::VERB_EXT_FRAME:
+		case Packet::VERB_MULTI_FRAME:
 		case Packet::VERB_NETWORK_CONFIG_REQUEST:
 		case Packet::VERB_NETWORK_CONFIG:
 		case Packet::VERB_MULTICAST_FRAME:
+			if ((now - _lastNontrivialReceive) >= ZT_PEER_ACTIVITY_TIMEOUT)
+				RR->topology->schedulePeerTasks(_id.address(),now); // peer is becoming active, so start pinging it
 			_lastNontrivialReceive = now;
 			break;
 		default:
@@ -111,28 +124,31 @@ void Peer::received(
 		path->trustedPacketReceived(now);
 	}
 
-	{
-		Mutex::Lock _l(_paths_m);
-
-		recordIncomingPacket(tPtr, path, packetId, payloadLength, verb, now);
-
-		if (_canUseMultipath) {
-			if (path->needsToSendQoS(now)) {
-				sendQOS_MEASUREMENT(tPtr, path, path->localSocket(), path->address(), now);
-			}
-			for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
-				if (_paths[i].p) {
-					_paths[i].p->processBackgroundPathMeasurements(now);
-				}
-			}
-		}
-	}
+	recordIncomingPacket(tPtr, path, packetId, payloadLength, verb, now);
+	if ((_canUseMultipath)&&(path->needsToSendQoS(now)))
+		sendQOS_MEASUREMENT(tPtr, path, path->localSocket(), path->address(), now);
 
 	if (hops == 0) {
-		// If this is a direct packet (no hops), update existing paths or learn new ones
+		// If this is a direct packet (no hops), update existing paths or learn new ones. A
+		// known path only needs its last receive time refreshed (under lock) once the
+		// published snapshot's copy of it is more than ZT_PEER_PATH_SNAPSHOT_TTL old.
 		bool havePath = false;
+		bool refresh = true;
 		{
+			Published<_PathSnapshot>::Reader s(_pathSnapshot);
+			if (s) {
+				for(unsigned int i=0;i<s->count;++i) {
+					if (s->paths[i] == path) {
+						havePath = true;
+						refresh = (((now - s->lr[i]) >= ZT_PEER_PATH_SNAPSHOT_TTL)||(now >= s->expires));
+						break;
+					}
+				}
+			}
+		}
+		if (refresh) {
 			Mutex::Lock _l(_paths_m);
+			havePath = false;
 			for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
 				if (_paths[i].p) {
 					if (_paths[i].p == path) {
@@ -142,6 +158,8 @@ void Peer::received(
 					}
 				} else break;
 			}
+			if (havePath)
+				_publishPaths(now);
 		}
 
 		bool attemptToContact = false;
@@ -190,6 +208,7 @@ void Peer::received(
 					_paths[replacePath].lr = now;
 					_paths[replacePath].p = path;
 					_paths[replacePath].priority = 1;
+					_publishPaths(now);
 				} else {
 					attemptToContact = true;
 				}
@@ -253,12 +272,78 @@ void Peer::received(
 	}
 }
 
-void Peer::recordOutgoingPacket(const SharedPtr<Path> &path, const uint64_t packetId,
+void Peer::recordOutgoingPacket(void *tPtr, const SharedPtr<Path> &path, const uint64_t packetId,
 	uint16_t payloadLength, const Packet::Verb verb, int64_t now)
 {
 	_freeRandomByte += (unsigned char)(packetId >> 8); // grab entropy to use in path selection logic for multipath
 	if (_canUseMultipath) {
 		path->recordOutgoingPacket(now, packetId, payloadLength, verb);
+		if (RR->node->getMultipathMode() == ZT_MULTIPATH_ACTIVE_BACKUP)
+			_activeBackupSent(tPtr,path,now);
+	}
+}
+
+void Peer::probePathMtu(void *tPtr,const SharedPtr<Path> &path,const unsigned int base,const int64_t now)
+{
+	if (_vProto < 5) // older nodes can't answer ECHO
+		return;
+	{
+		Published<_PathSnapshot>::Reader s(_pathSnapshot);
+		if (!s)
+			return;
+		unsigned int i = 0;
+		while ((i < s->count)&&(s->paths[i] != path))
+			++i;
+		if (i == s->count)
+			return;
+	}
+
+	const unsigned int size = path->nextMtuProbe(now,base,(RR->node->pathMtuDiscovery()) ? (unsigned int)ZT_PATH_MTU_MAX : base);
+	if (!size)
+		return;
+
+	Packet outp(_id.address(),RR->identity.address(),Packet::VERB_ECHO);
+	outp.zeroUnused();
+	outp.setSize(size); // the reply echoes the padding back over the same path
+	RR->node->expectReplyTo(outp.packetId());
+	path->mtuProbeSent(outp.packetId());
+	outp.armor(_key,true);
+	if (!path->sendMtuProbe(RR,tPtr,outp.data(),outp.size(),now))
+		path->mtuProbeFailed(now);
+}
+
+void Peer::sendFragmentLoss(void *tPtr,const SharedPtr<Path> &path,const unsigned int loss,const int64_t now)
+{
+	Packet outp(_id.address(),RR->identity.address(),Packet::VERB_FRAGMENT_LOSS);
+	outp.append((uint16_t)loss);
+	outp.armor(_key,true);
+	path->send(RR,tPtr,outp.data(),outp.size(),now);
+}
+
+void Peer::_activeBackupSent(void *tPtr,const SharedPtr<Path> &path,const int64_t now)
+{
+	const int64_t budget = (int64_t)RR->node->getMultipathFailoverBudget();
+	if (path->unansweredFor(now) >= budget) {
+		path->fail(now); // getAppropriatePath() will now skip this path until it answers again
+	} else if (path->needsProbe(now,budget / 3)) {
+		// Probe with an empty ECHO so that one-way traffic does not look like a dead path
+		Packet outp(_id.address(),RR->identity.address(),Packet::VERB_ECHO);
+		RR->node->expectReplyTo(outp.packetId());
+		outp.armor(_key,true);
+		path->send(RR,tPtr,outp.data(),outp.size(),now);
+	}
+
+	if (path.ptr() != _activePathPtr) {
+		Mutex::Lock _l(_activePath_m);
+		if (_activePath != path) {
+			if (_activePath) {
+				if (_activePath->failed(now,budget))
+					_activePath->fail(now);
+				RR->t->peerActivePathChanged(tPtr,*this,_activePath,path);
+			}
+			_activePath = path;
+			_activePathPtr = path.ptr();
+		}
 	}
 }
 
@@ -373,99 +458,312 @@ int Peer::aggregateLinkLogicalPathCount()
 	return pathCount;
 }
 
-SharedPtr<Path> Peer::getAppropriatePath(int64_t now, bool includeExpired)
+SharedPtr<Path> Peer::getAppropriatePath(int64_t now, bool includeExpired, int32_t flowId)
 {
+	{
+		Published<_PathSnapshot>::Reader s(_pathSnapshot);
+		if ((s)&&(now < s->expires))
+			return _choosePath(*s,includeExpired,flowId,now);
+	}
+
 	Mutex::Lock _l(_paths_m);
-	unsigned int bestPath = ZT_MAX_PEER_NETWORK_PATHS;
-
-	/**
-	 * Send traffic across the highest quality path only. This algorithm will still
-	 * use the old path quality metric from protocol version 9.
-	 */
-	if (!_canUseMultipath) {
-		long bestPathQuality = 2147483647;
-		for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
-			if (_paths[i].p) {
-				if ((includeExpired)||((now - _paths[i].lr) < ZT_PEER_PATH_EXPIRATION)) {
-					const long q = _paths[i].p->quality(now) / _paths[i].priority;
-					if (q <= bestPathQuality) {
-						bestPathQuality = q;
-						bestPath = i;
-					}
+	{
+		Published<_PathSnapshot>::Reader s(_pathSnapshot);
+		if ((s)&&(now < s->expires)) // another thread refreshed it while we waited
+			return _choosePath(*s,includeExpired,flowId,now);
+	}
+	_publishPaths(now);
+	Published<_PathSnapshot>::Reader s(_pathSnapshot);
+	return _choosePath(*s,includeExpired,flowId,now);
+}
+
+unsigned int Peer::pinnedFlows(const SharedPtr<Path> &p)
+{
+	Mutex::Lock _l(_flows_m);
+	return _flowCount(p);
+}
+
+SharedPtr<Path> Peer::_choosePath(const _PathSnapshot &s,const bool includeExpired,const int32_t flowId,const int64_t now)
+{
+	switch(s.mode) {
+		/**
+		 * Send traffic across the highest quality path only. This algorithm will still
+		 * use the old path quality metric from protocol version 9.
+		 */
+		case -1: {
+			const int bp = (includeExpired) ? s.bestIncludingExpired : s.best;
+			if (bp >= 0)
+				return s.paths[bp];
+		}	break;
+
+		/**
+		 * Randomly distribute traffic across all paths
+		 */
+		case ZT_MULTIPATH_RANDOM: {
+			const unsigned int r = _freeRandomByte;
+			if (s.numAlive > 0) {
+				return s.paths[s.alive[r % s.numAlive]];
+			} else if (s.numStale > 0) {
+				// Resort to trying any non-expired path
+				return s.paths[s.stale[r % s.numStale]];
+			}
+		}	break;
+
+		/**
+		 * Proportionally allocate traffic according to dynamic path quality measurements
+		 */
+		case ZT_MULTIPATH_PROPORTIONALLY_BALANCED: {
+			// Randomly choose path according to their allocations
+			float rf = _freeRandomByte;
+			for(unsigned int i=0;i<s.count;++i) {
+				if (rf < (float)s.allocation[i]) {
+					++s.chosen[i]; // Record which path we chose
+					return s.paths[i];
 				}
-			} else break;
+				rf -= (float)s.allocation[i];
+			}
+		}	break;
+
+		/**
+		 * Keep each transport flow on one path, other traffic goes over the best path
+		 */
+		case ZT_MULTIPATH_FLOW_PINNED: {
+			if ((flowId != ZT_MULTIPATH_NO_FLOW)&&(s.numAlive > 0))
+				return _pinFlow(s,flowId,now);
+			const int bp = (includeExpired) ? s.bestIncludingExpired : s.best;
+			if (bp >= 0)
+				return s.paths[bp];
+		}	break;
+
+		/**
+		 * Use the highest ranked path that is answering, but only fail back to a path
+		 * that was dead once it has kept answering for ZT_MULTIPATH_AB_FAILBACK_DELAY
+		 */
+		case ZT_MULTIPATH_ACTIVE_BACKUP: {
+			int up = -1;
+			for(int k=0;k<s.numRanked;++k) {
+				const SharedPtr<Path> &p = s.paths[s.ranked[k]];
+				if (p->failed(now,s.failoverBudget))
+					continue;
+				if (p->upFor(now) >= ZT_MULTIPATH_AB_FAILBACK_DELAY)
+					return p;
+				if (up < 0)
+					up = s.ranked[k];
+			}
+			if (up >= 0)
+				return s.paths[up];
+			const int bp = (includeExpired) ? s.bestIncludingExpired : s.best;
+			if (bp >= 0)
+				return s.paths[bp];
+		}	break;
+	}
+	return SharedPtr<Path>();
+}
+
+SharedPtr<Path> Peer::_pinFlow(const _PathSnapshot &s,const int32_t flowId,const int64_t now)
+{
+	Mutex::Lock _l(_flows_m);
+
+	_Flow *f = _flows.get(flowId);
+	int current = -1;
+	if (f) {
+		f->lastSend = now;
+		for(int k=0;k<s.numAlive;++k) {
+			if (s.paths[s.alive[k]] == f->path) {
+				current = s.alive[k];
+				break;
+			}
 		}
-		if (bestPath != ZT_MAX_PEER_NETWORK_PATHS) {
-			return _paths[bestPath].p;
+		// A flow on a live path only moves when allocations have changed since it was placed
+		if ((current >= 0)&&(f->epoch == s.flowEpoch))
+			return f->path;
+	} else if (_flows.size() >= ZT_MULTIPATH_MAX_FLOWS) {
+		return s.paths[s.alive[(unsigned int)flowId % (unsigned int)s.numAlive]];
+	}
+
+	// Place the flow on the alive path with the fewest flows per unit of allocation. The
+	// current path wins ties, and the search starts at a hashed offset so that equally
+	// loaded paths are not always filled in the same order.
+	int best = current;
+	unsigned long bestFlows = 0,bestAllocation = 1;
+	if (current >= 0) {
+		bestFlows = _flowCount(s.paths[current]);
+		bestAllocation = (unsigned long)s.allocation[current] + 1;
+	}
+	for(int k=0;k<s.numAlive;++k) {
+		const int i = s.alive[((unsigned int)flowId + (unsigned int)k) % (unsigned int)s.numAlive];
+		if (i == current)
+			continue;
+		const unsigned long fl = (unsigned long)_flowCount(s.paths[i]) + 1;
+		const unsigned long al = (unsigned long)s.allocation[i] + 1;
+		if ((best < 0)||((fl * bestAllocation) < (bestFlows * al))) {
+			best = i;
+			bestFlows = fl;
+			bestAllocation = al;
 		}
-		return SharedPtr<Path>();
 	}
 
+	if (!f) {
+		f = &(_flows[flowId]);
+		f->lastSend = now;
+	}
+	if (best != current) {
+		if (f->path)
+			_countFlow(f->path,-1);
+		f->path = s.paths[best];
+		_countFlow(f->path,1);
+	}
+	f->epoch = s.flowEpoch;
+	return f->path;
+}
+
+void Peer::_expireFlows(const int64_t now)
+{
+	Mutex::Lock _l(_flows_m);
+	Hashtable< int32_t,_Flow >::Iterator i(_flows);
+	int32_t *k = (int32_t *)0;
+	_Flow *f = (_Flow *)0;
+	while (i.next(k,f)) {
+		if ((now - f->lastSend) > ZT_MULTIPATH_FLOW_EXPIRATION) {
+			_countFlow(f->path,-1);
+			_flows.erase(*k);
+		}
+	}
+}
+
+unsigned int Peer::_flowCount(const SharedPtr<Path> &p) const
+{
+	for(std::vector< std::pair< SharedPtr<Path>,unsigned int > >::const_iterator c(_flowCounts.begin());c!=_flowCounts.end();++c) {
+		if (c->first == p)
+			return c->second;
+	}
+	return 0;
+}
+
+void Peer::_countFlow(const SharedPtr<Path> &p,const int delta)
+{
+	for(std::vector< std::pair< SharedPtr<Path>,unsigned int > >::iterator c(_flowCounts.begin());c!=_flowCounts.end();++c) {
+		if (c->first == p) {
+			c->second += delta;
+			if (!c->second)
+				_flowCounts.erase(c);
+			return;
+		}
+	}
+	if (delta > 0)
+		_flowCounts.push_back(std::pair< SharedPtr<Path>,unsigned int >(p,(unsigned int)delta));
+}
+
+void Peer::_publishPaths(const int64_t now)
+{
+	_PathSnapshot *const s = new _PathSnapshot();
+	s->expires = now + ZT_PEER_PATH_SNAPSHOT_TTL;
+
+	long bestPathQuality = 2147483647,bestPathQualityIncludingExpired = 2147483647;
 	for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
-		if (_paths[i].p) {
-			_paths[i].p->processBackgroundPathMeasurements(now);
+		if (!_paths[i].p)
+			break;
+		s->paths[i] = _paths[i].p;
+		s->lr[i] = _paths[i].lr;
+		const long q = _paths[i].p->quality(now) / _paths[i].priority;
+		if (q <= bestPathQualityIncludingExpired) {
+			bestPathQualityIncludingExpired = q;
+			s->bestIncludingExpired = (int)i;
+		}
+		if (((now - _paths[i].lr) < ZT_PEER_PATH_EXPIRATION)&&(q <= bestPathQuality)) {
+			bestPathQuality = q;
+			s->best = (int)i;
 		}
+		++s->count;
 	}
 
-	/**
-	 * Randomly distribute traffic across all paths
-	 */
-	int numAlivePaths = 0;
-	int numStalePaths = 0;
-	if (RR->node->getMultipathMode() == ZT_MULTIPATH_RANDOM) {
-		int alivePaths[ZT_MAX_PEER_NETWORK_PATHS];
-		int stalePaths[ZT_MAX_PEER_NETWORK_PATHS];
-		memset(&alivePaths, -1, sizeof(alivePaths));
-		memset(&stalePaths, -1, sizeof(stalePaths));
-		for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
-			if (_paths[i].p) {
-				if (_paths[i].p->alive(now)) {
-					alivePaths[numAlivePaths] = i;
-					numAlivePaths++;
-				}
-				else {
-					stalePaths[numStalePaths] = i;
-					numStalePaths++;
-				}
+	if (_canUseMultipath) {
+		s->mode = RR->node->getMultipathMode();
+		for(unsigned int i=0;i<s->count;++i)
+			s->paths[i]->processBackgroundPathMeasurements(now);
+		if ((s->mode == ZT_MULTIPATH_RANDOM)||(s->mode == ZT_MULTIPATH_FLOW_PINNED)) {
+			for(unsigned int i=0;i<s->count;++i) {
+				if (s->paths[i]->alive(now))
+					s->alive[s->numAlive++] = (int)i;
+				else s->stale[s->numStale++] = (int)i;
 			}
 		}
-		unsigned int r = _freeRandomByte;
-		if (numAlivePaths > 0) {
-			int rf = r % numAlivePaths;
-			return _paths[alivePaths[rf]].p;
+		if (s->mode == ZT_MULTIPATH_ACTIVE_BACKUP) {
+			// Rank by priority, then by address preference, then by the order paths were learned
+			s->failoverBudget = (int64_t)RR->node->getMultipathFailoverBudget();
+			for(unsigned int i=0;i<s->count;++i) {
+				if ((now - s->lr[i]) >= ZT_PEER_PATH_EXPIRATION)
+					continue;
+				const long pri = _paths[i].priority;
+				const unsigned int pref = s->paths[i]->preferenceRank();
+				int k = s->numRanked++;
+				while ((k > 0)&&((pri > _paths[s->ranked[k-1]].priority)||((pri == _paths[s->ranked[k-1]].priority)&&(pref > s->paths[s->ranked[k-1]]->preferenceRank())))) {
+					s->ranked[k] = s->ranked[k-1];
+					--k;
+				}
+				s->ranked[k] = (int)i;
+			}
 		}
-		else if(numStalePaths > 0) {
-			// Resort to trying any non-expired path
-			int rf = r % numStalePaths;
-			return _paths[stalePaths[rf]].p;
+		if ((s->mode == ZT_MULTIPATH_PROPORTIONALLY_BALANCED)||(s->mode == ZT_MULTIPATH_FLOW_PINNED)) {
+			if ((now - _lastAggregateAllocation) >= ZT_PATH_QUALITY_COMPUTE_INTERVAL) {
+				_lastAggregateAllocation = now;
+				computeAggregateProportionalAllocation(now);
+			}
+			for(unsigned int i=0;i<s->count;++i)
+				s->allocation[i] = s->paths[i]->allocation();
 		}
+	} else {
+		s->mode = -1;
 	}
 
-	/**
-	 * Proportionally allocate traffic according to dynamic path quality measurements
-	 */
-	if (RR->node->getMultipathMode() == ZT_MULTIPATH_PROPORTIONALLY_BALANCED) {
-		if ((now - _lastAggregateAllocation) >= ZT_PATH_QUALITY_COMPUTE_INTERVAL) {
-			_lastAggregateAllocation = now;
-			computeAggregateProportionalAllocation(now);
-		}
-		// Randomly choose path according to their allocations
-		float rf = _freeRandomByte;
-		for(int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
-			if (_paths[i].p) {
-				if (rf < _paths[i].p->allocation()) {
-					bestPath = i;
-					_pathChoiceHist.push(bestPath); // Record which path we chose
-					break;
+	{
+		Published<_PathSnapshot>::Reader old(_pathSnapshot);
+
+		if (s->mode == ZT_MULTIPATH_FLOW_PINNED) {
+			// Pinned flows are placed using the allocations as of the last rebalance, which
+			// only happens once some path's allocation has moved past the threshold or a
+			// path has been added.
+			bool rebalance = ((!old)||(old->mode != ZT_MULTIPATH_FLOW_PINNED));
+			unsigned char kept[ZT_MAX_PEER_NETWORK_PATHS];
+			for(unsigned int i=0;((i<s->count)&&(!rebalance));++i) {
+				rebalance = true;
+				for(unsigned int j=0;j<old->count;++j) {
+					if (old->paths[j] == s->paths[i]) {
+						const int d = (int)s->allocation[i] - (int)old->allocation[j];
+						rebalance = ((d > ZT_MULTIPATH_FLOW_REBALANCE_THRESHOLD)||(d < -ZT_MULTIPATH_FLOW_REBALANCE_THRESHOLD));
+						kept[i] = old->allocation[j];
+						break;
+					}
 				}
-				rf -= _paths[i].p->allocation();
+			}
+			if (rebalance) {
+				s->flowEpoch = ((old) ? old->flowEpoch : 0) + 1;
+			} else {
+				s->flowEpoch = old->flowEpoch;
+				memcpy(s->allocation,kept,s->count);
 			}
 		}
-		if (bestPath < ZT_MAX_PEER_NETWORK_PATHS) {
-			return _paths[bestPath].p;
+
+		// Keep the retiring snapshot's path choices for interfaceListStr()
+		if (old) {
+			int total = 0;
+			for(unsigned int i=0;i<old->count;++i)
+				total += old->chosen[i].load();
+			if (total) {
+				for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+					if (i < old->count) {
+						_recentChoicePaths[i] = old->paths[i];
+						_recentChoiceCounts[i] = old->chosen[i].load();
+					} else {
+						_recentChoicePaths[i].zero();
+						_recentChoiceCounts[i] = 0;
+					}
+				}
+			}
 		}
 	}
-	return SharedPtr<Path>();
+
+	_pathSnapshot.publish(s);
 }
 
 char *Peer::interfaceListStr()
@@ -484,7 +782,13 @@ char *Peer::interfaceListStr()
 			float targetAllocation = 1.0f / (float)alivePathCount;
 			float currentAllocation = 1.0f;
 			if (alivePathCount > 1) {
-				currentAllocation = (float)_pathChoiceHist.countValue(i) / (float)_pathChoiceHist.count();
+				int chosen = 0,total = 0;
+				for(unsigned int k=0;k<ZT_MAX_PEER_NETWORK_PATHS;++k) {
+					if (_recentChoicePaths[k] == _paths[i].p)
+						chosen += _recentChoiceCounts[k];
+					total += _recentChoiceCounts[k];
+				}
+				currentAllocation = (total) ? ((float)chosen / (float)total) : 0.0f;
 				if (fabs(targetAllocation - currentAllocation) > ZT_PATH_IMBALANCE_THRESHOLD) {
 					imbalanced = true;
 				}
@@ -667,6 +971,8 @@ inline void Peer::processBackgroundPeerTasks(const int64_t now)
 		// If both peers support multipath and more than one path exist, we can use multipath logic
 		_canUseMultipath = _localMultipathSupported && _remoteMultipathSupported && (_uniqueAlivePathCount > 1);
 	}
+
+	_expireFlows(now);
 }
 
 void Peer::sendACK(void *tPtr,const SharedPtr<Path> &path,const int64_t localSocket,const InetAddress &atAddress,int64_t now)
@@ -699,6 +1005,18 @@ void Peer::sendQOS_MEASUREMENT(void *tPtr,const SharedPtr<Path> &path,const int6
 	path->sentQoS(now);
 }
 
+void Peer::restorePath(const SharedPtr<Path> &path,const int64_t lastReceive,const int64_t now)
+{
+	Mutex::Lock _l(_paths_m);
+	if (_paths[0].p)
+		return;
+	_paths[0].lr = lastReceive;
+	_paths[0].p = path;
+	_paths[0].priority = 1;
+	_lastReceive = lastReceive;
+	_publishPaths(now);
+}
+
 void Peer::sendHELLO(void *tPtr,const int64_t localSocket,const InetAddress &atAddress,int64_t now)
 {
 	Packet outp(_id.address(),RR->identity.address(),Packet::VERB_HELLO);
@@ -729,6 +1047,7 @@ void Peer::sendHELLO(void *tPtr,const int64_t localSocket,const InetAddress &atA
 		outp.append(*m);
 		outp.append((uint64_t)0);
 	}
+	outp.append((uint64_t)ZT_PROTO_CAPABILITIES);
 
 	outp.cryptField(_key,startCryptedPortionAt,outp.size() - startCryptedPortionAt);
 
@@ -807,7 +1126,8 @@ unsigned int Peer::doPingAndKeepalive(void *tPtr,int64_t now)
 		if (_paths[i].p) {
 			// Clean expired and reduced priority paths
 			if ( ((now - _paths[i].lr) < ZT_PEER_PATH_EXPIRATION) && (_paths[i].priority == maxPriority) ) {
-				if ((sendFullHello)||(_paths[i].p->needsHeartbeat(now))) {
+				// Dead paths are pinged at every check in active-backup mode so that failback notices them recovering
+				if ((sendFullHello)||(_paths[i].p->needsHeartbeat(now,_heartbeatPeriod))||((_paths[i].p->failed())&&(RR->node->getMultipathMode() == ZT_MULTIPATH_ACTIVE_BACKUP))) {
 					attemptToContactAt(tPtr,_paths[i].p->localSocket(),_paths[i].p->address(),now,sendFullHello);
 					_paths[i].p->sent(now);
 					sent |= (_paths[i].p->address().ss_family == AF_INET) ? 0x1 : 0x2;
@@ -826,9 +1146,41 @@ unsigned int Peer::doPingAndKeepalive(void *tPtr,int64_t now)
 			++j;
 		}
 	}
+	_publishPaths(now);
+
+	// Keepalives from peers first contacted together drift apart from here on
+	if (sent)
+		_heartbeatPeriod = _jitteredHeartbeatPeriod(RR);
+
 	return sent;
 }
 
+int64_t Peer::nextPingDeadline(const int64_t now)
+{
+	Mutex::Lock _l(_paths_m);
+
+	int64_t deadline = _lastSentFullHello + ZT_PEER_PING_PERIOD;
+
+	long maxPriority = 0;
+	for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+		if (_paths[i].p)
+			maxPriority = std::max(_paths[i].priority,maxPriority);
+		else break;
+	}
+	for(unsigned int i=0;i<ZT_MAX_PEER_NETWORK_PATHS;++i) {
+		if (_paths[i].p) {
+			deadline = std::min(deadline,_paths[i].lr + ZT_PEER_PATH_EXPIRATION);
+			if (_paths[i].priority == maxPriority)
+				deadline = std::min(deadline,_paths[i].p->lastOut() + _heartbeatPeriod);
+		} else break;
+	}
+
+	if ((_canUseMultipath)||(RR->node->getMultipathMode() != ZT_MULTIPATH_NONE))
+		deadline = std::min(deadline,now + ZT_PING_CHECK_INVERVAL);
+
+	return std::max(deadline,now + ZT_CORE_TIMER_TASK_GRANULARITY);
+}
+
 void Peer::clusterRedirect(void *tPtr,const SharedPtr<Path> &originatingPath,const InetAddress &remoteAddress,const int64_t now)
 {
 	SharedPtr<Path> np(RR->topology->getPath(originatingPath->localSocket(),remoteAddress));
@@ -875,6 +1227,7 @@ void Peer::clusterRedirect(void *tPtr,const SharedPtr<Path> &originatingPath,con
 				++j;
 			}
 		}
+		_publishPaths(now);
 	}
 }
 
@@ -890,6 +1243,7 @@ void Peer::resetWithinScope(void *tPtr,InetAddress::IpScope scope,int inetAddres
 			}
 		} else break;
 	}
+	_publishPaths(now);
 }
 
 } // namespace ZeroTier
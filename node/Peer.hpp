@@ -44,6 +44,7 @@
 #include "AtomicCounter.hpp"
 #include "Hashtable.hpp"
 #include "Mutex.hpp"
+#include "Published.hpp"
 
 #define ZT_PEER_MAX_SERIALIZED_STATE_SIZE (sizeof(Peer) + 32 + (sizeof(Path) * 2))
 
@@ -68,9 +69,10 @@ public:
 	 * @param renv Runtime environment
 	 * @param myIdentity Identity of THIS node (for key agreement)
 	 * @param peerIdentity Identity of peer
+	 * @param key If non-NULL, previously agreed key with this peer (skips key agreement)
 	 * @throws std::runtime_error Key agreement with peer's identity failed
 	 */
-	Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity);
+	Peer(const RuntimeEnvironment *renv,const Identity &myIdentity,const Identity &peerIdentity,const uint8_t *key = (const uint8_t *)0);
 
 	/**
 	 * @return This peer's ZT address (short for identity().address())
@@ -150,13 +152,41 @@ public:
 	/**
 	 * Record statistics on outgoing packets
 	 *
+	 * In active-backup multipath mode this also probes the path if traffic
+	 * over it is going unanswered.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param path Path over which packet was sent
 	 * @param id Packet ID
 	 * @param len Length of packet payload
 	 * @param verb Packet verb
 	 * @param now Current time
 	 */
-	void recordOutgoingPacket(const SharedPtr<Path> &path, const uint64_t packetId, uint16_t payloadLength, const Packet::Verb verb, int64_t now);
+	void recordOutgoingPacket(void *tPtr, const SharedPtr<Path> &path, const uint64_t packetId, uint16_t payloadLength, const Packet::Verb verb, int64_t now);
+
+	/**
+	 * Send a path MTU probe (a padded ECHO) via one of this peer's paths if one is due
+	 *
+	 * This is called from the send path when Path::mtuProbeDue() says so, which
+	 * means only paths that carry traffic are probed. Paths that aren't this
+	 * peer's own (e.g. relays) are ignored.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param path Path to probe
+	 * @param base MTU configured for this path's address (or the default)
+	 * @param now Current time
+	 */
+	void probePathMtu(void *tPtr,const SharedPtr<Path> &path,const unsigned int base,const int64_t now);
+
+	/**
+	 * Tell this peer how many of its fragments we lose over a path
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param path Path fragments were received over
+	 * @param loss Fragments lost per 65535
+	 * @param now Current time
+	 */
+	void sendFragmentLoss(void *tPtr,const SharedPtr<Path> &path,const unsigned int loss,const int64_t now);
 
 	/**
 	 * Record statistics on incoming packets
@@ -219,11 +249,22 @@ public:
 	/**
 	 * Get the most appropriate direct path based on current multipath and QoS configuration
 	 *
+	 * This reads a published snapshot of the path selection without locking
+	 * and only recomputes it, under lock, once it is older than
+	 * ZT_PEER_PATH_SNAPSHOT_TTL.
+	 *
 	 * @param now Current time
 	 * @param includeExpired If true, include even expired paths
+	 * @param flowId Transport flow being sent (used in flow-pinned multipath mode) or ZT_MULTIPATH_NO_FLOW
 	 * @return Best current path or NULL if none
 	 */
-	SharedPtr<Path> getAppropriatePath(int64_t now, bool includeExpired);
+	SharedPtr<Path> getAppropriatePath(int64_t now, bool includeExpired, int32_t flowId = ZT_MULTIPATH_NO_FLOW);
+
+	/**
+	 * @param p Path to check
+	 * @return Number of flows to this peer pinned to this path in flow-pinned multipath mode
+	 */
+	unsigned int pinnedFlows(const SharedPtr<Path> &p);
 
 	/**
 	 * Generate a human-readable string of interface names making up the aggregate link, also include
@@ -283,6 +324,20 @@ public:
 	 */
 	unsigned int doPingAndKeepalive(void *tPtr,int64_t now);
 
+	/**
+	 * Get the next time doPingAndKeepalive() will have something to do
+	 *
+	 * This is the earliest of the next full HELLO, the next heartbeat or
+	 * expiration of any live path, and (if multipath is in use) the next
+	 * background peer task run. Only heartbeats are jittered, by up to
+	 * ZT_PEER_PING_JITTER either way. It's used to schedule this peer in the
+	 * Topology timer wheel after each ping.
+	 *
+	 * @param now Current time
+	 * @return Time of next ping check for this peer (always at least ZT_CORE_TIMER_TASK_GRANULARITY in the future)
+	 */
+	int64_t nextPingDeadline(const int64_t now);
+
 	/**
 	 * Clear paths whose localSocket(s) are in a CLOSED state or have an otherwise INVALID state.
 	 * This should be called frequently so that we can detect and remove unproductive or invalid paths.
@@ -390,6 +445,17 @@ public:
 	 */
 	inline const unsigned char *key() const { return _key; }
 
+	/**
+	 * Restore a path last known to work, e.g. when rebuilding a demoted peer
+	 *
+	 * This does nothing if the peer already has paths.
+	 *
+	 * @param path Path
+	 * @param lastReceive Time of last packet received via path
+	 * @param now Current time
+	 */
+	void restorePath(const SharedPtr<Path> &path,const int64_t lastReceive,const int64_t now);
+
 	/**
 	 * Set the currently known remote version of this peer's client
 	 *
@@ -413,6 +479,17 @@ public:
 
 	inline bool remoteVersionKnown() const { return ((_vMajor > 0)||(_vMinor > 0)||(_vRevision > 0)); }
 
+	/**
+	 * @param caps Capability bits (ZT_PROTO_CAPABILITY_*) announced by this peer in HELLO or OK(HELLO)
+	 */
+	inline void setRemoteCapabilities(const uint64_t caps) { _remoteCapabilities = caps; }
+
+	/**
+	 * @param cap Capability bit (ZT_PROTO_CAPABILITY_*)
+	 * @return True if this peer has announced this capability
+	 */
+	inline bool hasRemoteCapability(const uint64_t cap) const { return ((_remoteCapabilities & cap) != 0); }
+
 	/**
 	 * Periodically update known multipath activation constraints. This is done so that we know when and when
 	 * not to use multipath logic. Doing this once every few seconds is sufficient.
@@ -625,6 +702,47 @@ private:
 		long priority; // >= 1, higher is better
 	};
 
+	/**
+	 * Immutable path selection published to senders and receivers
+	 */
+	struct _PathSnapshot
+	{
+		_PathSnapshot() : count(0),best(-1),bestIncludingExpired(-1),numAlive(0),numStale(0),numRanked(0),mode(-1),flowEpoch(0),failoverBudget(ZT_MULTIPATH_AB_FAILOVER_BUDGET),expires(0) {}
+
+		SharedPtr<Path> paths[ZT_MAX_PEER_NETWORK_PATHS];
+		int64_t lr[ZT_MAX_PEER_NETWORK_PATHS]; // _PeerPath::lr at time of snapshot
+		unsigned char allocation[ZT_MAX_PEER_NETWORK_PATHS]; // proportional allocation out of 255
+		mutable AtomicCounter chosen[ZT_MAX_PEER_NETWORK_PATHS]; // proportional choices made from this snapshot
+		unsigned int count;
+		int best,bestIncludingExpired; // single path choice or -1 if none
+		int alive[ZT_MAX_PEER_NETWORK_PATHS],stale[ZT_MAX_PEER_NETWORK_PATHS]; // random and flow-pinned multipath choices
+		int numAlive,numStale;
+		int ranked[ZT_MAX_PEER_NETWORK_PATHS]; // active-backup order of unexpired paths
+		int numRanked;
+		int mode; // multipath mode or -1 to use the single best path
+		uint64_t flowEpoch; // incremented when allocations change enough to rebalance pinned flows
+		int64_t failoverBudget; // active-backup dead path detection budget
+		int64_t expires;
+	};
+
+	void _publishPaths(const int64_t now); // assumes _paths_m is locked
+	SharedPtr<Path> _choosePath(const _PathSnapshot &s,const bool includeExpired,const int32_t flowId,const int64_t now);
+
+	// A transport flow pinned to a path in flow-pinned multipath mode
+	struct _Flow
+	{
+		_Flow() : path(),lastSend(0),epoch(0) {}
+		SharedPtr<Path> path;
+		int64_t lastSend;
+		uint64_t epoch; // _PathSnapshot::flowEpoch when the flow was last placed
+	};
+
+	SharedPtr<Path> _pinFlow(const _PathSnapshot &s,const int32_t flowId,const int64_t now);
+	void _activeBackupSent(void *tPtr,const SharedPtr<Path> &path,const int64_t now);
+	void _expireFlows(const int64_t now);
+	unsigned int _flowCount(const SharedPtr<Path> &p) const; // assumes _flows_m is locked
+	void _countFlow(const SharedPtr<Path> &p,const int delta); // assumes _flows_m is locked
+
 	uint8_t _key[ZT_PEER_SECRET_KEY_LENGTH];
 
 	const RuntimeEnvironment *RR;
@@ -640,6 +758,7 @@ private:
 	int64_t _lastCredentialsReceived;
 	int64_t _lastTrustEstablishedPacketReceived;
 	int64_t _lastSentFullHello;
+	int64_t _heartbeatPeriod; // ZT_PATH_HEARTBEAT_PERIOD with jitter, drawn again after each ping
 	int64_t _lastPathPrune;
 	int64_t _lastACKWindowReset;
 	int64_t _lastQoSWindowReset;
@@ -657,10 +776,22 @@ private:
 	uint16_t _vMajor;
 	uint16_t _vMinor;
 	uint16_t _vRevision;
+	volatile uint64_t _remoteCapabilities;
 
 	_PeerPath _paths[ZT_MAX_PEER_NETWORK_PATHS];
 	Mutex _paths_m;
 
+	Published<_PathSnapshot> _pathSnapshot;
+
+	// Last path used in active-backup mode, for failover traces (pointer compared without lock)
+	SharedPtr<Path> _activePath;
+	Path *volatile _activePathPtr;
+	Mutex _activePath_m;
+
+	Hashtable< int32_t,_Flow > _flows;
+	std::vector< std::pair< SharedPtr<Path>,unsigned int > > _flowCounts; // pinned flows per path
+	Mutex _flows_m;
+
 	Identity _id;
 
 	unsigned int _directPathPushCutoffCount;
@@ -670,7 +801,9 @@ private:
 
 	AtomicCounter __refCount;
 
-	RingBuffer<int,ZT_MULTIPATH_PROPORTION_WIN_SZ> _pathChoiceHist;
+	// Proportional path choices counted in the last retired path snapshot
+	SharedPtr<Path> _recentChoicePaths[ZT_MAX_PEER_NETWORK_PATHS];
+	int _recentChoiceCounts[ZT_MAX_PEER_NETWORK_PATHS];
 
 	bool _linkIsBalanced;
 	bool _linkIsRedundant;
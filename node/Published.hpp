@@ -0,0 +1,174 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2019  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+
+#ifndef ZT_PUBLISHED_HPP
+#define ZT_PUBLISHED_HPP
+
+#include "Constants.hpp"
+#include "AtomicCounter.hpp"
+
+#include <thread>
+
+#ifndef __GNUC__
+#include <atomic>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/**
+ * Writers waiting for readers to drain spin this many times, then yield between checks
+ */
+#define ZT_PUBLISHED_SPINS_BEFORE_YIELD 64
+
+namespace ZeroTier {
+
+/**
+ * An immutable object published for lock-free readers
+ *
+ * Readers pin the current object with a Reader, which costs one atomic
+ * increment and one decrement and never blocks. Writers must be serialized
+ * by the caller. publish() swaps in a new object, then waits until no
+ * reader can still be looking at the old one before it deletes it.
+ *
+ * Readers are tracked in two counters. A writer flips readers over to the
+ * other counter and waits for the first to drain, twice. After that no
+ * reader that could have seen the old object can still be pinned. Readers
+ * should therefore only hold a Reader long enough to copy what they need.
+ */
+template<typename T>
+class Published
+{
+public:
+	/**
+	 * Pins the currently published object for as long as it exists
+	 */
+	class Reader
+	{
+	public:
+		Reader(const Published &p) :
+			_c(const_cast<Published *>(&p)->_readers[p._epochLoad() & 1])
+		{
+			++_c;
+			_p = p._load();
+		}
+
+		~Reader() { --_c; }
+
+		inline operator bool() const { return (_p != (T *)0); }
+		inline const T *operator->() const { return _p; }
+		inline const T &operator*() const { return *_p; }
+		inline const T *ptr() const { return _p; }
+
+	private:
+		Reader(const Reader &r) : _c(r._c) {}
+		const Reader &operator=(const Reader &) { return *this; }
+
+		AtomicCounter &_c;
+		const T *_p;
+	};
+
+	Published() :
+		_p((T *)0),
+		_epoch(0)
+	{
+	}
+
+	~Published() { delete _load(); }
+
+	/**
+	 * Publish a new object, taking ownership of it, and delete the old one
+	 *
+	 * Writers must be serialized by the caller.
+	 *
+	 * @param n New object or NULL
+	 */
+	inline void publish(T *n)
+	{
+		T *const old = _swap(n);
+		if (old) {
+			_synchronize();
+			_synchronize();
+			delete old;
+		}
+	}
+
+private:
+	Published(const Published &) {}
+	const Published &operator=(const Published &) { return *this; }
+
+	inline void _synchronize()
+	{
+		const unsigned int e = _epochFlip();
+		for(unsigned int spins=0;_readers[e & 1].load() != 0;++spins) {
+			if (spins < ZT_PUBLISHED_SPINS_BEFORE_YIELD)
+				_pause();
+			else std::this_thread::yield(); // a reader may be preempted, so don't burn its CPU
+		}
+	}
+
+	static inline void _pause()
+	{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64) || defined(_M_IX86))
+		_mm_pause();
+#elif defined(__GNUC__) && (defined(__amd64__) || defined(__x86_64__) || defined(__i386__))
+		__builtin_ia32_pause();
+#elif defined(__GNUC__) && (defined(__aarch64__) || (defined(__arm__) && (__ARM_ARCH >= 7)))
+		__asm__ __volatile__("yield");
+#endif
+	}
+
+#ifdef __GNUC__
+	inline T *_load() const { return __sync_fetch_and_add(const_cast<T **>(&_p),0); }
+	inline T *_swap(T *n)
+	{
+		T *o;
+		do { o = _p; } while (!__sync_bool_compare_and_swap(&_p,o,n));
+		return o;
+	}
+	inline unsigned int _epochLoad() const { return __sync_fetch_and_add(const_cast<unsigned int *>(&_epoch),0); }
+	inline unsigned int _epochFlip() { return __sync_fetch_and_add(&_epoch,1); } // returns epoch being retired
+
+	T *_p;
+	unsigned int _epoch;
+#else
+	inline T *_load() const { return _p.load(); }
+	inline T *_swap(T *n) { return _p.exchange(n); }
+	inline unsigned int _epochLoad() const { return _epoch.load(); }
+	inline unsigned int _epochFlip() { return _epoch.fetch_add(1); }
+
+	std::atomic<T *> _p;
+	std::atomic<unsigned int> _epoch;
+#endif
+
+	AtomicCounter _readers[2];
+};
+
+} // namespace ZeroTier
+
+#endif
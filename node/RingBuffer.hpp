@@ -45,6 +45,10 @@ namespace ZeroTier {
  *
  * Some basic statistical functionality is implemented here in an attempt
  * to reduce the complexity of code needed to interact with this type of buffer.
+ * Mean, variance and the number of zeros are kept up to date as values enter
+ * and leave the window (Welford's method), so reading them is O(1). To bound
+ * floating point drift they are recomputed from the window once every S
+ * removals, which keeps the amortized cost per element constant.
  */
 
 template <class T,size_t S>
@@ -56,11 +60,83 @@ private:
 	size_t end;
 	bool wrap;
 
+	// Running aggregates over the elements between begin and end
+	size_t _n;
+	double _mean;
+	double _m2; // sum of squared deviations from _mean
+	size_t _zeros;
+	size_t _removals; // since the aggregates were last recomputed
+	bool _dirty; // contents changed behind our back (produce()), recompute before use
+
+	inline void _add(const T value)
+	{
+		const double x = (double)value;
+		const double d = x - _mean;
+		_mean += d / (double)(++_n);
+		_m2 += d * (x - _mean);
+		if (value == 0)
+			++_zeros;
+	}
+
+	inline void _remove(const T value)
+	{
+		if (_n <= 1) {
+			_n = 0;
+			_mean = 0.0;
+			_m2 = 0.0;
+			_zeros = 0;
+			return;
+		}
+		const double x = (double)value;
+		const double d = x - _mean;
+		_mean -= d / (double)(--_n);
+		_m2 -= d * (x - _mean);
+		if (_m2 < 0.0)
+			_m2 = 0.0;
+		if (value == 0)
+			--_zeros;
+		if (++_removals >= S)
+			_dirty = true;
+	}
+
+	// Remove the n oldest elements from the aggregates, before begin moves past them
+	inline void _removeOldest(size_t n)
+	{
+		if (_dirty)
+			return;
+		size_t i = begin;
+		while (n--) {
+			_remove(buf[i]);
+			i = (i + 1) % S;
+		}
+	}
+
+	inline void _recompute()
+	{
+		_n = 0;
+		_mean = 0.0;
+		_m2 = 0.0;
+		_zeros = 0;
+		_removals = 0;
+		_dirty = false;
+		size_t i = begin;
+		for(size_t c=count();c>0;--c) {
+			_add(buf[i]);
+			i = (i + 1) % S;
+		}
+	}
+
 public:
 	RingBuffer() :
 		begin(0),
 		end(0),
-		wrap(false)
+		wrap(false),
+		_n(0),
+		_mean(0.0),
+		_m2(0.0),
+		_zeros(0),
+		_removals(0),
+		_dirty(false)
 	{
 		memset(buf,0,sizeof(T)*S);
 	}
@@ -93,6 +169,7 @@ public:
 		if (begin == end) {
 			wrap = true;
 		}
+		_dirty = true;
 		return n;
 	}
 
@@ -100,7 +177,17 @@ public:
 	 * Fast erase, O(1).
 	 * Merely reset the buffer pointer, doesn't erase contents
 	 */
-	inline void reset() { consume(count()); }
+	inline void reset()
+	{
+		begin = end;
+		wrap = false;
+		_n = 0;
+		_mean = 0.0;
+		_m2 = 0.0;
+		_zeros = 0;
+		_removals = 0;
+		_dirty = false;
+	}
 
 	/**
 	 * adjust buffer index pointer as if we copied data out
@@ -113,6 +200,7 @@ public:
 		if (n == 0) {
 			return n;
 		}
+		_removeOldest(n);
 		if (wrap) {
 			wrap = false;
 		}
@@ -146,6 +234,10 @@ public:
 		if (begin == end) {
 			wrap = true;
 		}
+		if (!_dirty) {
+			for(size_t i=0;i<n;++i)
+				_add(data[i]);
+		}
 		return n;
 	}
 
@@ -165,12 +257,14 @@ public:
 		if (begin == end) {
 			wrap = true;
 		}
+		if (!_dirty)
+			_add(value);
 	}
 
 	/**
 	 * @return The most recently pushed element on the buffer
 	 */
-	inline T get_most_recent() { return *(buf + end); }
+	inline T get_most_recent() { return *(buf + ((end + S - 1) % S)); }
 
 	/**
 	 * @param dest Destination buffer
@@ -183,6 +277,7 @@ public:
 		if (n == 0) {
 			return n;
 		}
+		_removeOldest(n);
 		if (wrap) {
 			wrap = false;
 		}
@@ -221,18 +316,23 @@ public:
 	inline size_t getFree() { return S - count(); }
 
 	/**
-	 * @return The arithmetic mean of the contents of the buffer
+	 * @return The sum of the contents of the buffer, O(1)
+	 */
+	inline double sum()
+	{
+		if (_dirty)
+			_recompute();
+		return _mean * (double)_n;
+	}
+
+	/**
+	 * @return The arithmetic mean of the contents of the buffer, O(1)
 	 */
 	inline float mean()
 	{
-		size_t iterator = begin;
-		float subtotal = 0;
-		size_t curr_cnt = count();
-		for (size_t i=0; i<curr_cnt; i++) {
-			iterator = (iterator + S - 1) % curr_cnt;
-			subtotal += (float)*(buf + iterator);
-		}
-		return curr_cnt ? subtotal / (float)curr_cnt : 0;
+		if (_dirty)
+			_recompute();
+		return (float)_mean;
 	}
 
 	/**
@@ -240,55 +340,41 @@ public:
 	 */
 	inline float mean(size_t n)
 	{
-		n = n < S ? n : S;
-		size_t iterator = begin;
-		float subtotal = 0;
-		size_t curr_cnt = count();
+		n = std::min(n, count());
+		if (n == 0)
+			return 0;
+		size_t iterator = end;
+		double subtotal = 0;
 		for (size_t i=0; i<n; i++) {
-			iterator = (iterator + S - 1) % curr_cnt;
-			subtotal += (float)*(buf + iterator);
+			iterator = (iterator + S - 1) % S;
+			subtotal += (double)*(buf + iterator);
 		}
-		return curr_cnt ? subtotal / (float)curr_cnt : 0;
+		return (float)(subtotal / (double)n);
 	}
 
 	/**
-	 * @return The sample standard deviation of element values
+	 * @return The sample standard deviation of element values, O(1)
 	 */
 	inline float stddev() { return sqrt(variance()); }
 
 	/**
-	 * @return The variance of element values
+	 * @return The sample variance of element values, O(1)
 	 */
 	inline float variance()
 	{
-		size_t iterator = begin;
-		float cached_mean = mean();
-		size_t curr_cnt = count();
-		T sum_of_squared_deviations = 0;
-		for (size_t i=0; i<curr_cnt; i++) {
-			iterator = (iterator + S - 1) % curr_cnt;
-			float deviation = (buf[i] - cached_mean);
-			sum_of_squared_deviations += (T)(deviation*deviation);
-		}
-		float variance = (float)sum_of_squared_deviations / (float)(S - 1);
-		return variance;
+		if (_dirty)
+			_recompute();
+		return (_n > 1) ? (float)(_m2 / (double)(_n - 1)) : 0.0f;
 	}
 
 	/**
-	 * @return The number of elements of zero value
+	 * @return The number of elements of zero value, O(1)
 	 */
 	inline size_t zeroCount()
 	{
-		size_t iterator = begin;
-		size_t zeros = 0;
-		size_t curr_cnt = count();
-		for (size_t i=0; i<curr_cnt; i++) {
-			iterator = (iterator + S - 1) % curr_cnt;
-			if (*(buf + iterator) == 0) {
-				zeros++;
-			}
-		}
-		return zeros;
+		if (_dirty)
+			_recompute();
+		return _zeros;
 	}
 
 	/**
@@ -299,12 +385,11 @@ public:
 	{
 		size_t iterator = begin;
 		size_t cnt = 0;
-		size_t curr_cnt = count();
-		for (size_t i=0; i<curr_cnt; i++) {
-			iterator = (iterator + S - 1) % curr_cnt;
+		for (size_t c=count(); c>0; --c) {
 			if (*(buf + iterator) == value) {
 				cnt++;
 			}
+			iterator = (iterator + 1) % S;
 		}
 		return cnt;
 	}
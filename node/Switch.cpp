@@ -51,11 +51,16 @@ Switch::Switch(const RuntimeEnvironment *renv) :
 	RR(renv),
 	_lastBeaconResponse(0),
 	_lastCheckedQueues(0),
+	_whoisBatched(0),
+	_timers(ZT_CORE_TIMER_WHEEL_GRANULARITY),
+	_txQueueDepth(0),
+	_txQueueDropped(0),
+	_txQueueExpired(0),
 	_lastUniteAttempt(8) // only really used on root servers and upstreams, and it'll grow there just fine
 {
 }
 
-void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddress &fromAddr,const void *data,unsigned int len)
+void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddress &fromAddr,void *data,unsigned int len)
 {
 	try {
 		const int64_t now = RR->node->now();
@@ -88,28 +93,13 @@ void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddre
 			if (reinterpret_cast<const uint8_t *>(data)[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_INDICATOR] == ZT_PACKET_FRAGMENT_INDICATOR) {
 				// Handle fragment ----------------------------------------------------
 
-				Packet::Fragment fragment(data,len);
-				const Address destination(fragment.destination());
+				const Address destination(reinterpret_cast<const uint8_t *>(data) + 8,ZT_ADDRESS_LENGTH);
 
 				if (destination != RR->identity.address()) {
-					if ( (!RR->topology->amUpstream()) && (!path->trustEstablished(now)) )
-						return;
-
-					if (fragment.hops() < ZT_RELAY_MAX_HOPS) {
-						fragment.incrementHops();
-
-						// Note: we don't bother initiating NAT-t for fragments, since heads will set that off.
-						// It wouldn't hurt anything, just redundant and unnecessary.
-						SharedPtr<Peer> relayTo = RR->topology->getPeer(tPtr,destination);
-						if ((!relayTo)||(!relayTo->sendDirect(tPtr,fragment.data(),fragment.size(),now,false))) {
-							// Don't know peer or no direct path -- so relay via someone upstream
-							relayTo = RR->topology->getUpstreamPeer();
-							if (relayTo)
-								relayTo->sendDirect(tPtr,fragment.data(),fragment.size(),now,true);
-						}
-					}
+					_relay(tPtr,path,reinterpret_cast<uint8_t *>(data),len,destination,now);
 				} else {
 					// Fragment looks like ours
+					const Packet::Fragment fragment(data,len);
 					const uint64_t fragmentPacketId = fragment.packetId();
 					const unsigned int fragmentNumber = fragment.fragmentNumber();
 					const unsigned int totalFragments = fragment.totalFragments();
@@ -125,31 +115,47 @@ void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddre
 						if (rq->packetId != fragmentPacketId) {
 							// No packet found, so we received a fragment without its head.
 
+							_rxAbandon(rq);
 							rq->timestamp = now;
 							rq->packetId = fragmentPacketId;
 							rq->frags[fragmentNumber - 1] = fragment;
+							rq->path = path;
 							rq->totalFragments = totalFragments; // total fragment count is known
 							rq->haveFragments = 1 << fragmentNumber; // we have only this fragment
+							rq->haveParity = false;
 							rq->complete = false;
-						} else if (!(rq->haveFragments & (1 << fragmentNumber))) {
+							rq->decoded = false;
+						} else if ((!(rq->haveFragments & (1 << fragmentNumber)))&&(!rq->complete)) {
 							// We have other fragments and maybe the head, so add this one and check
 
 							rq->frags[fragmentNumber - 1] = fragment;
 							rq->totalFragments = totalFragments;
-
-							if (Utils::countBits(rq->haveFragments |= (1 << fragmentNumber)) == totalFragments) {
-								// We have all fragments -- assemble and process full Packet
-
-								for(unsigned int f=1;f<totalFragments;++f)
-									rq->frag0.append(rq->frags[f - 1].payload(),rq->frags[f - 1].payloadLength());
-
-								if (rq->frag0.tryDecode(RR,tPtr)) {
-									rq->timestamp = 0; // packet decoded, free entry
-								} else {
-									rq->complete = true; // set complete flag but leave entry since it probably needs WHOIS or something
-								}
-							}
+							rq->haveFragments |= (1 << fragmentNumber);
+							_rxTryComplete(tPtr,rq,now);
 						} // else this is a duplicate fragment, ignore
+					} else if ((fragmentNumber == ZT_PACKET_FRAGMENT_PARITY_NO)&&(totalFragments <= ZT_MAX_PACKET_FRAGMENTS)&&(totalFragments > 1)) {
+						// Parity fragment, which can stand in for any one missing fragment or head
+
+						RXQueueEntry *const rq = _findRXQueueEntry(fragmentPacketId);
+						Mutex::Lock rql(rq->lock);
+						if (rq->packetId != fragmentPacketId) {
+							_rxAbandon(rq);
+							rq->timestamp = now;
+							rq->packetId = fragmentPacketId;
+							rq->parity = fragment;
+							rq->path = path;
+							rq->totalFragments = totalFragments;
+							rq->haveFragments = 0;
+							rq->haveParity = true;
+							rq->complete = false;
+							rq->decoded = false;
+						} else if ((!rq->haveParity)&&(!rq->complete)) {
+							rq->parity = fragment;
+							rq->haveParity = true;
+							if (!rq->totalFragments)
+								rq->totalFragments = totalFragments;
+							_rxTryComplete(tPtr,rq,now);
+						}
 					}
 				}
 
@@ -164,31 +170,7 @@ void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddre
 					return;
 
 				if (destination != RR->identity.address()) {
-					if ( (!RR->topology->amUpstream()) && (!path->trustEstablished(now)) && (source != RR->identity.address()) )
-						return;
-
-					Packet packet(data,len);
-
-					if (packet.hops() < ZT_RELAY_MAX_HOPS) {
-						packet.incrementHops();
-						SharedPtr<Peer> relayTo = RR->topology->getPeer(tPtr,destination);
-						if ((relayTo)&&(relayTo->sendDirect(tPtr,packet.data(),packet.size(),now,false))) {
-							if ((source != RR->identity.address())&&(_shouldUnite(now,source,destination))) {
-								const SharedPtr<Peer> sourcePeer(RR->topology->getPeer(tPtr,source));
-								if (sourcePeer)
-									relayTo->introduce(tPtr,now,sourcePeer);
-							}
-						} else {
-							relayTo = RR->topology->getUpstreamPeer();
-							if ((relayTo)&&(relayTo->address() != source)) {
-								if (relayTo->sendDirect(tPtr,packet.data(),packet.size(),now,true)) {
-									const SharedPtr<Peer> sourcePeer(RR->topology->getPeer(tPtr,source));
-									if (sourcePeer)
-										relayTo->introduce(tPtr,now,sourcePeer);
-								}
-							}
-						}
-					}
+					_relay(tPtr,path,reinterpret_cast<uint8_t *>(data),len,destination,now);
 				} else if ((reinterpret_cast<const uint8_t *>(data)[ZT_PACKET_IDX_FLAGS] & ZT_PROTO_FLAG_FRAGMENTED) != 0) {
 					// Packet is the head of a fragmented packet series
 
@@ -208,31 +190,22 @@ void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddre
 					if (rq->packetId != packetId) {
 						// If we have no other fragments yet, create an entry and save the head
 
+						_rxAbandon(rq);
 						rq->timestamp = now;
 						rq->packetId = packetId;
 						rq->frag0.init(data,len,path,now);
+						rq->path = path;
 						rq->totalFragments = 0;
 						rq->haveFragments = 1;
+						rq->haveParity = false;
 						rq->complete = false;
-					} else if (!(rq->haveFragments & 1)) {
+						rq->decoded = false;
+					} else if ((!(rq->haveFragments & 1))&&(!rq->complete)) {
 						// If we have other fragments but no head, see if we are complete with the head
 
-						if ((rq->totalFragments > 1)&&(Utils::countBits(rq->haveFragments |= 1) == rq->totalFragments)) {
-							// We have all fragments -- assemble and process full Packet
-
-							rq->frag0.init(data,len,path,now);
-							for(unsigned int f=1;f<rq->totalFragments;++f)
-								rq->frag0.append(rq->frags[f - 1].payload(),rq->frags[f - 1].payloadLength());
-
-							if (rq->frag0.tryDecode(RR,tPtr)) {
-								rq->timestamp = 0; // packet decoded, free entry
-							} else {
-								rq->complete = true; // set complete flag but leave entry since it probably needs WHOIS or something
-							}
-						} else {
-							// Still waiting on more fragments, but keep the head
-							rq->frag0.init(data,len,path,now);
-						}
+						rq->frag0.init(data,len,path,now);
+						rq->haveFragments |= 1;
+						_rxTryComplete(tPtr,rq,now);
 					} // else this is a duplicate head, ignore
 				} else {
 					// Packet is unfragmented, so just process it
@@ -240,12 +213,16 @@ void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddre
 					if (!packet.tryDecode(RR,tPtr)) {
 						RXQueueEntry *const rq = _nextRXQueueEntry();
 						Mutex::Lock rql(rq->lock);
+						_rxAbandon(rq);
 						rq->timestamp = now;
 						rq->packetId = packet.packetId();
 						rq->frag0 = packet;
+						rq->path = path;
 						rq->totalFragments = 1;
 						rq->haveFragments = 1;
+						rq->haveParity = false;
 						rq->complete = true;
+						rq->decoded = false;
 					}
 				}
 
@@ -257,13 +234,14 @@ void Switch::onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddre
 
 void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 {
-	if (!network->hasConfig())
+	const SharedPtr<NetworkConfigSnapshot> nconf(network->config());
+	if (!*nconf)
 		return;
 
 	// Check if this packet is from someone other than the tap -- i.e. bridged in
 	bool fromBridged;
 	if ((fromBridged = (from != network->mac()))) {
-		if (!network->config().permitsBridging(RR->identity.address())) {
+		if (!nconf->permitsBridging(RR->identity.address())) {
 			RR->t->outgoingNetworkFrameDropped(tPtr,network,from,to,etherType,vlanId,len,"not a bridge");
 			return;
 		}
@@ -271,6 +249,9 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 
 	uint8_t qosBucket = ZT_QOS_DEFAULT_BUCKET;
 
+	// Unicast frames of one transport flow stay on one physical path in flow-pinned multipath mode
+	const int32_t flowId = (RR->node->getMultipathMode() == ZT_MULTIPATH_FLOW_PINNED) ? CompiledRules::flowHash((const uint8_t *)data,len,etherType) : ZT_MULTIPATH_NO_FLOW;
+
 	if (to.isMulticast()) {
 		MulticastGroup multicastGroup(to,0);
 
@@ -286,14 +267,14 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 				 * the 32-bit ADI field. In practice this uses our multicast pub/sub
 				 * system to implement a kind of extended/distributed ARP table. */
 				multicastGroup = MulticastGroup::deriveMulticastGroupForAddressResolution(InetAddress(((const unsigned char *)data) + 24,4,0));
-			} else if (!network->config().enableBroadcast()) {
+			} else if (!nconf->enableBroadcast()) {
 				// Don't transmit broadcasts if this network doesn't want them
 				RR->t->outgoingNetworkFrameDropped(tPtr,network,from,to,etherType,vlanId,len,"broadcast disabled");
 				return;
 			}
 		} else if ((etherType == ZT_ETHERTYPE_IPV6)&&(len >= (40 + 8 + 16))) {
 			// IPv6 NDP emulation for certain very special patterns of private IPv6 addresses -- if enabled
-			if ((network->config().ndpEmulation())&&(reinterpret_cast<const uint8_t *>(data)[6] == 0x3a)&&(reinterpret_cast<const uint8_t *>(data)[40] == 0x87)) { // ICMPv6 neighbor solicitation
+			if ((nconf->ndpEmulation())&&(reinterpret_cast<const uint8_t *>(data)[6] == 0x3a)&&(reinterpret_cast<const uint8_t *>(data)[40] == 0x87)) { // ICMPv6 neighbor solicitation
 				Address v6EmbeddedAddress;
 				const uint8_t *const pkt6 = reinterpret_cast<const uint8_t *>(data) + 40 + 8;
 				const uint8_t *my6 = (const uint8_t *)0;
@@ -305,8 +286,8 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 
 				// For these to work, we must have a ZT-managed address assigned in one of the
 				// above formats, and the query must match its prefix.
-				for(unsigned int sipk=0;sipk<network->config().staticIpCount;++sipk) {
-					const InetAddress *const sip = &(network->config().staticIps[sipk]);
+				for(unsigned int sipk=0;sipk<nconf->staticIpCount;++sipk) {
+					const InetAddress *const sip = &(nconf->staticIps[sipk]);
 					if (sip->ss_family == AF_INET6) {
 						my6 = reinterpret_cast<const uint8_t *>(reinterpret_cast<const struct sockaddr_in6 *>(&(*sip))->sin6_addr.s6_addr);
 						const unsigned int sipNetmaskBits = Utils::ntoh((uint16_t)reinterpret_cast<const struct sockaddr_in6 *>(&(*sip))->sin6_port);
@@ -343,30 +324,7 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 					const MAC peerMac(v6EmbeddedAddress,network->id());
 
 					uint8_t adv[72];
-					adv[0] = 0x60; adv[1] = 0x00; adv[2] = 0x00; adv[3] = 0x00;
-					adv[4] = 0x00; adv[5] = 0x20;
-					adv[6] = 0x3a; adv[7] = 0xff;
-					for(int i=0;i<16;++i) adv[8 + i] = pkt6[i];
-					for(int i=0;i<16;++i) adv[24 + i] = my6[i];
-					adv[40] = 0x88; adv[41] = 0x00;
-					adv[42] = 0x00; adv[43] = 0x00; // future home of checksum
-					adv[44] = 0x60; adv[45] = 0x00; adv[46] = 0x00; adv[47] = 0x00;
-					for(int i=0;i<16;++i) adv[48 + i] = pkt6[i];
-					adv[64] = 0x02; adv[65] = 0x01;
-					adv[66] = peerMac[0]; adv[67] = peerMac[1]; adv[68] = peerMac[2]; adv[69] = peerMac[3]; adv[70] = peerMac[4]; adv[71] = peerMac[5];
-
-					uint16_t pseudo_[36];
-					uint8_t *const pseudo = reinterpret_cast<uint8_t *>(pseudo_);
-					for(int i=0;i<32;++i) pseudo[i] = adv[8 + i];
-					pseudo[32] = 0x00; pseudo[33] = 0x00; pseudo[34] = 0x00; pseudo[35] = 0x20;
-					pseudo[36] = 0x00; pseudo[37] = 0x00; pseudo[38] = 0x00; pseudo[39] = 0x3a;
-					for(int i=0;i<32;++i) pseudo[40 + i] = adv[40 + i];
-					uint32_t checksum = 0;
-					for(int i=0;i<36;++i) checksum += Utils::hton(pseudo_[i]);
-					while ((checksum >> 16)) checksum = (checksum & 0xffff) + (checksum >> 16);
-					checksum = ~checksum;
-					adv[42] = (checksum >> 8) & 0xff;
-					adv[43] = checksum & 0xff;
+					NeighborCache::neighborAdvertisement(adv,pkt6,my6,peerMac);
 
 					RR->node->putFrame(tPtr,network->id(),network->userPtr(),peerMac,from,ZT_ETHERTYPE_IPV6,0,adv,72);
 					return; // NDP emulation done. We have forged a "fake" reply, so no need to send actual NDP query.
@@ -375,7 +333,7 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 		}
 
 		// Check this after NDP emulation, since that has to be allowed in exactly this case
-		if (network->config().multicastLimit == 0) {
+		if (nconf->multicastLimit == 0) {
 			RR->t->outgoingNetworkFrameDropped(tPtr,network,from,to,etherType,vlanId,len,"multicast disabled");
 			return;
 		}
@@ -393,6 +351,17 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 			return;
 		}
 
+		// Answer ARP and NDP queries locally if we already know who owns the IP
+		if (nconf->neighborCache()) {
+			uint8_t reply[ZT_NEIGHBOR_CACHE_REPLY_BUF_LENGTH];
+			MAC replyFrom;
+			const unsigned int replyLen = network->neighbors().answer(etherType,data,len,RR->node->now(),reply,replyFrom);
+			if (replyLen) {
+				RR->node->putFrame(tPtr,network->id(),network->userPtr(),replyFrom,from,etherType,vlanId,reply,replyLen);
+				return;
+			}
+		}
+
 		RR->mc->send(
 			tPtr,
 			RR->node->now(),
@@ -419,6 +388,14 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 
 		network->pushCredentialsIfNeeded(tPtr,toZT,RR->node->now());
 
+		const bool aggregate = ((RR->node->frameAggregation())&&(toPeer)&&(toPeer->hasRemoteCapability(ZT_PROTO_CAPABILITY_MULTI_FRAME))&&(!network->qosEnabled())&&(RR->node->getMultipathMode() == ZT_MULTIPATH_NONE));
+		if ((aggregate)&&(!fromBridged)&&(len <= ZT_FRAME_AGGREGATION_MAX_FRAME)) {
+			_aggregate(tPtr,network,toZT,etherType,data,len,RR->node->now());
+			return;
+		}
+		if (aggregate)
+			_flushAggregate(tPtr,network->id(),toZT); // keep frames to this peer in order
+
 		if (fromBridged) {
 			Packet outp(toZT,RR->identity.address(),Packet::VERB_EXT_FRAME);
 			outp.append(network->id());
@@ -427,17 +404,17 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 			from.appendTo(outp);
 			outp.append((uint16_t)etherType);
 			outp.append(data,len);
-			if (!network->config().disableCompression())
-				outp.compress();
-			aqm_enqueue(tPtr,network,outp,true,qosBucket);
+			if (!nconf->disableCompression())
+				network->compression().compress(outp,toZT,CompiledRules::trafficClass((const uint8_t *)data,len,etherType),RR->node->now());
+			aqm_enqueue(tPtr,network,outp,true,qosBucket,flowId);
 		} else {
 			Packet outp(toZT,RR->identity.address(),Packet::VERB_FRAME);
 			outp.append(network->id());
 			outp.append((uint16_t)etherType);
 			outp.append(data,len);
-			if (!network->config().disableCompression())
-				outp.compress();
-			aqm_enqueue(tPtr,network,outp,true,qosBucket);
+			if (!nconf->disableCompression())
+				network->compression().compress(outp,toZT,CompiledRules::trafficClass((const uint8_t *)data,len,etherType),RR->node->now());
+			aqm_enqueue(tPtr,network,outp,true,qosBucket,flowId);
 		}
 	} else {
 		// Destination is bridged behind a remote peer
@@ -455,8 +432,8 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 
 		/* Create an array of up to ZT_MAX_BRIDGE_SPAM recipients for this bridged frame. */
 		bridges[0] = network->findBridgeTo(to);
-		std::vector<Address> activeBridges(network->config().activeBridges());
-		if ((bridges[0])&&(bridges[0] != RR->identity.address())&&(network->config().permitsBridging(bridges[0]))) {
+		std::vector<Address> activeBridges(nconf->activeBridges());
+		if ((bridges[0])&&(bridges[0] != RR->identity.address())&&(nconf->permitsBridging(bridges[0]))) {
 			/* We have a known bridge route for this MAC, send it there. */
 			++numBridges;
 		} else if (!activeBridges.empty()) {
@@ -491,9 +468,9 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 				from.appendTo(outp);
 				outp.append((uint16_t)etherType);
 				outp.append(data,len);
-				if (!network->config().disableCompression())
-					outp.compress();
-				aqm_enqueue(tPtr,network,outp,true,qosBucket);
+				if (!nconf->disableCompression())
+					network->compression().compress(outp,bridges[b],CompiledRules::trafficClass((const uint8_t *)data,len,etherType),RR->node->now());
+				aqm_enqueue(tPtr,network,outp,true,qosBucket,flowId);
 			} else {
 				RR->t->outgoingNetworkFrameDropped(tPtr,network,from,to,etherType,vlanId,len,"filter blocked (bridge replication)");
 			}
@@ -501,10 +478,10 @@ void Switch::onLocalEthernet(void *tPtr,const SharedPtr<Network> &network,const
 	}
 }
 
-void Switch::aqm_enqueue(void *tPtr, const SharedPtr<Network> &network, Packet &packet,bool encrypt,int qosBucket)
+void Switch::aqm_enqueue(void *tPtr, const SharedPtr<Network> &network, Packet &packet,bool encrypt,int qosBucket,int32_t flowId)
 {
 	if(!network->qosEnabled()) {
-		send(tPtr, packet, encrypt);
+		send(tPtr, packet, encrypt, flowId);
 		return;
 	}
 	NetworkQoSControlBlock *nqcb = _netQueueControlBlock[network->id()];
@@ -522,7 +499,7 @@ void Switch::aqm_enqueue(void *tPtr, const SharedPtr<Network> &network, Packet &
 	if (packet.verb() != Packet::VERB_FRAME && packet.verb() != Packet::VERB_EXT_FRAME) {
 		// DEBUG_INFO("skipping, no QoS for this packet, verb=%x", packet.verb());
 		// just send packet normally, no QoS for ZT protocol traffic
-		send(tPtr, packet, encrypt);
+		send(tPtr, packet, encrypt, flowId);
 	}
 
 	_aqm_m.lock();
@@ -530,7 +507,7 @@ void Switch::aqm_enqueue(void *tPtr, const SharedPtr<Network> &network, Packet &
 	// Enqueue packet and move queue to appropriate list
 
 	const Address dest(packet.destination());
-	TXQueueEntry *txEntry = new TXQueueEntry(dest,RR->node->now(),packet,encrypt);
+	TXQueueEntry *txEntry = new TXQueueEntry(dest,RR->node->now(),packet,encrypt,flowId);
 
 	ManagedQueue *selectedQueue = nullptr;
 	for (size_t i=0; i<ZT_QOS_NUM_BUCKETS; i++) {
@@ -702,7 +679,7 @@ void Switch::aqm_dequeue(void *tPtr)
 					queueAtFrontOfList->byteCredit -= len;
 					// Send the packet!
 					queueAtFrontOfList->q.pop_front();
-					send(tPtr, entryToEmit->packet, entryToEmit->encrypt);
+					send(tPtr, entryToEmit->packet, entryToEmit->encrypt, entryToEmit->flowId);
 					(*nqcb).second->_currEnqueuedPackets--;
 				}
 				if (queueAtFrontOfList) {
@@ -734,7 +711,7 @@ void Switch::aqm_dequeue(void *tPtr)
 					queueAtFrontOfList->byteLength -= len;
 					queueAtFrontOfList->byteCredit -= len;
 					queueAtFrontOfList->q.pop_front();
-					send(tPtr, entryToEmit->packet, entryToEmit->encrypt);
+					send(tPtr, entryToEmit->packet, entryToEmit->encrypt, entryToEmit->flowId);
 					(*nqcb).second->_currEnqueuedPackets--;
 				}
 				if (queueAtFrontOfList) {
@@ -758,21 +735,39 @@ void Switch::removeNetworkQoSControlBlock(uint64_t nwid)
 	}
 }
 
-void Switch::send(void *tPtr,Packet &packet,bool encrypt)
+void Switch::send(void *tPtr,Packet &packet,bool encrypt,int32_t flowId)
 {
 	const Address dest(packet.destination());
 	if (dest == RR->identity.address())
 		return;
-	if (!_trySend(tPtr,packet,encrypt)) {
+	if (!_trySend(tPtr,packet,encrypt,flowId)) {
+		const int64_t now = RR->node->now();
 		{
 			Mutex::Lock _l(_txQueue_m);
-			if (_txQueue.size() >= ZT_TX_QUEUE_SIZE) {
-				_txQueue.pop_front();
+			_PendingSendQueue *pq = _txQueue.get(dest);
+			if ((pq)&&(pq->q.size() >= ZT_TX_QUEUE_SIZE)) {
+				pq->q.pop_front();
+				--_txQueueDepth;
+				++_txQueueDropped;
+			} else if (_txQueueDepth >= ZT_TX_QUEUE_MAX_PACKETS) {
+				_dropOldestQueued();
+				pq = _txQueue.get(dest); // may have been emptied and removed
+			}
+			if ((!pq)&&(_txQueue.size() < ZT_TX_QUEUE_MAX_DESTINATIONS))
+				pq = &(_txQueue[dest]);
+			if (pq) {
+				pq->q.push_back(TXQueueEntry(dest,now,packet,encrypt,flowId));
+				++_txQueueDepth;
+			} else {
+				++_txQueueDropped;
 			}
-			_txQueue.push_back(TXQueueEntry(dest,RR->node->now(),packet,encrypt));
 		}
 		if (!RR->topology->getPeer(tPtr,dest))
-			requestWhois(tPtr,RR->node->now(),dest);
+			requestWhois(tPtr,now,dest);
+		{
+			Mutex::Lock _l(_timers_m);
+			_timers.schedule(dest,now + ZT_WHOIS_RETRY_DELAY,true);
+		}
 	}
 }
 
@@ -781,21 +776,43 @@ void Switch::requestWhois(void *tPtr,const int64_t now,const Address &addr)
 	if (addr == RR->identity.address())
 		return;
 
+	// A peer being loaded from the peer cache is only looked up upstream if that misses
+	if (RR->topology->deferWhois(addr))
+		return;
+
 	{
 		Mutex::Lock _l(_lastSentWhoisRequest_m);
-		int64_t &last = _lastSentWhoisRequest[addr];
-		if ((now - last) < ZT_WHOIS_RETRY_DELAY)
+		_WhoisRequest &r = _lastSentWhoisRequest[addr];
+		if ((now - r.sent) < ZT_WHOIS_RETRY_DELAY)
 			return;
-		else last = now;
+		r.sent = now;
+		r.hedgeAt = 0;
 	}
 
-	const SharedPtr<Peer> upstream(RR->topology->getUpstreamPeer());
-	if (upstream) {
-		Packet outp(upstream->address(),RR->identity.address(),Packet::VERB_WHOIS);
-		addr.appendTo(outp);
-		RR->node->expectReplyTo(outp.packetId());
-		send(tPtr,outp,true);
+	// If no reply comes from the best upstream within a couple of its round
+	// trips, the same WHOIS is also sent to the next best (see _hedgeWhois)
+	const SharedPtr<Peer> upstream(RR->topology->getUpstreamPeer(0));
+	int64_t hedgeAt = 0;
+	if ((upstream)&&(RR->topology->getUpstreamPeer(1))) {
+		const unsigned int latency = upstream->latency(now);
+		int64_t delay = ZT_WHOIS_RETRY_DELAY / 2;
+		if ((latency > 0)&&(latency < 0xffff))
+			delay = std::max(std::min((int64_t)latency * ZT_WHOIS_HEDGE_RTT_MULTIPLIER,delay),(int64_t)ZT_WHOIS_HEDGE_MIN_DELAY);
+		hedgeAt = now + delay;
+		Mutex::Lock _l(_lastSentWhoisRequest_m);
+		_WhoisRequest *const r = _lastSentWhoisRequest.get(addr);
+		if (r) {
+			r->hedgeAt = hedgeAt;
+			r->upstream = upstream->address();
+		}
+	}
+	{
+		Mutex::Lock _l(_timers_m);
+		_timers.schedule(addr,now + ZT_WHOIS_RETRY_DELAY,true);
 	}
+
+	if (upstream)
+		_sendWhois(tPtr,upstream,addr);
 }
 
 void Switch::doAnythingWaitingForPeer(void *tPtr,const SharedPtr<Peer> &peer)
@@ -809,69 +826,90 @@ void Switch::doAnythingWaitingForPeer(void *tPtr,const SharedPtr<Peer> &peer)
 	for(unsigned int ptr=0;ptr<ZT_RX_QUEUE_SIZE;++ptr) {
 		RXQueueEntry *const rq = &(_rxQueue[ptr]);
 		Mutex::Lock rql(rq->lock);
-		if ((rq->timestamp)&&(rq->complete)) {
+		if ((rq->timestamp)&&(rq->complete)&&(!rq->decoded)) {
 			if ((rq->frag0.tryDecode(RR,tPtr))||((now - rq->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT))
 				rq->timestamp = 0;
 		}
 	}
 
+	bool stillQueued = false;
 	{
 		Mutex::Lock _l(_txQueue_m);
-		for(std::list< TXQueueEntry >::iterator txi(_txQueue.begin());txi!=_txQueue.end();) {
-			if (txi->dest == peer->address()) {
-				if (_trySend(tPtr,txi->packet,txi->encrypt)) {
-					_txQueue.erase(txi++);
+		_PendingSendQueue *const pq = _txQueue.get(peer->address());
+		if (pq) {
+			for(std::list< TXQueueEntry >::iterator txi(pq->q.begin());txi!=pq->q.end();) {
+				if (_trySend(tPtr,txi->packet,txi->encrypt,txi->flowId)) {
+					pq->q.erase(txi++);
+					--_txQueueDepth;
 				} else {
 					++txi;
 				}
-			} else {
-				++txi;
 			}
+			if (pq->q.empty())
+				_txQueue.erase(peer->address());
+			else stillQueued = true;
 		}
 	}
+
+	{
+		Mutex::Lock _l(_timers_m);
+		if (stillQueued)
+			_timers.schedule(peer->address(),now + ZT_WHOIS_RETRY_DELAY);
+		else _timers.cancel(peer->address());
+	}
 }
 
-unsigned long Switch::doTimerTasks(void *tPtr,int64_t now)
+void Switch::flushAggregates(void *tPtr,const uint64_t nwid,const int64_t startedBefore)
 {
-	const uint64_t timeSinceLastCheck = now - _lastCheckedQueues;
-	if (timeSinceLastCheck < ZT_WHOIS_RETRY_DELAY)
-		return (unsigned long)(ZT_WHOIS_RETRY_DELAY - timeSinceLastCheck);
-	_lastCheckedQueues = now;
-
-	std::vector<Address> needWhois;
+	std::vector<_Aggregate> ready;
 	{
-		Mutex::Lock _l(_txQueue_m);
-
-		for(std::list< TXQueueEntry >::iterator txi(_txQueue.begin());txi!=_txQueue.end();) {
-			if (_trySend(tPtr,txi->packet,txi->encrypt)) {
-				_txQueue.erase(txi++);
-			} else if ((now - txi->creationTime) > ZT_TRANSMIT_QUEUE_TIMEOUT) {
-				_txQueue.erase(txi++);
-			} else {
-				if (!RR->topology->getPeer(tPtr,txi->dest))
-					needWhois.push_back(txi->dest);
-				++txi;
+		Mutex::Lock _l(_aggregates_m);
+		Hashtable< _AggregateKey,_Aggregate >::Iterator i(_aggregates);
+		_AggregateKey *k = (_AggregateKey *)0;
+		_Aggregate *a = (_Aggregate *)0;
+		while (i.next(k,a)) {
+			if (((!nwid)||(k->nwid == nwid))&&(a->started <= startedBefore)) {
+				ready.push_back(*a);
+				_aggregates.erase(*k);
 			}
 		}
 	}
-	for(std::vector<Address>::const_iterator i(needWhois.begin());i!=needWhois.end();++i)
-		requestWhois(tPtr,now,*i);
+	for(std::vector<_Aggregate>::iterator a(ready.begin());a!=ready.end();++a)
+		_sendAggregate(tPtr,*a);
+}
 
-	for(unsigned int ptr=0;ptr<ZT_RX_QUEUE_SIZE;++ptr) {
-		RXQueueEntry *const rq = &(_rxQueue[ptr]);
-		Mutex::Lock rql(rq->lock);
-		if ((rq->timestamp)&&(rq->complete)) {
-			if ((rq->frag0.tryDecode(RR,tPtr))||((now - rq->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT)) {
-				rq->timestamp = 0;
-			} else {
-				const Address src(rq->frag0.source());
-				if (!RR->topology->getPeer(tPtr,src))
-					requestWhois(tPtr,now,src);
+unsigned long Switch::doTimerTasks(void *tPtr,int64_t now)
+{
+	_hedgeWhois(tPtr,now);
+
+	std::vector<Address> due;
+	{
+		Mutex::Lock _l(_timers_m);
+		_timers.expire(now,due);
+	}
+
+	if (!due.empty()) {
+		for(std::vector<Address>::const_iterator a(due.begin());a!=due.end();++a)
+			_doTimerTasksFor(tPtr,now,*a);
+
+		// Packets in the RX queue are waiting on WHOIS, so retry them whenever a WHOIS timer fires
+		for(unsigned int ptr=0;ptr<ZT_RX_QUEUE_SIZE;++ptr) {
+			RXQueueEntry *const rq = &(_rxQueue[ptr]);
+			Mutex::Lock rql(rq->lock);
+			if ((rq->timestamp)&&(rq->complete)&&(!rq->decoded)) {
+				if ((rq->frag0.tryDecode(RR,tPtr))||((now - rq->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT)) {
+					rq->timestamp = 0;
+				} else {
+					const Address src(rq->frag0.source());
+					if (!RR->topology->getPeer(tPtr,src))
+						requestWhois(tPtr,now,src);
+				}
 			}
 		}
 	}
 
-	{
+	if ((now - _lastCheckedQueues) >= ZT_MIN_UNITE_INTERVAL) {
+		_lastCheckedQueues = now;
 		Mutex::Lock _l(_lastUniteAttempt_m);
 		Hashtable< _LastUniteKey,uint64_t >::Iterator i(_lastUniteAttempt);
 		_LastUniteKey *k = (_LastUniteKey *)0;
@@ -882,18 +920,265 @@ unsigned long Switch::doTimerTasks(void *tPtr,int64_t now)
 		}
 	}
 
+	// Backstop for hosts that do not flush aggregates at the end of each batch,
+	// which Node runs within ZT_FRAME_AGGREGATION_MAX_DELAY while frames are held
+	flushAggregates(tPtr,0,now - ZT_FRAME_AGGREGATION_MAX_DELAY);
+
+	int64_t next = _lastCheckedQueues + ZT_MIN_UNITE_INTERVAL;
+	{
+		Mutex::Lock _l(_timers_m);
+		const int64_t t = _timers.nextDeadline(now);
+		if ((t >= 0)&&(t < next))
+			next = t;
+	}
+	{
+		Mutex::Lock _l(_aggregates_m);
+		if ((_aggregates.size() > 0)&&((now + ZT_FRAME_AGGREGATION_MAX_DELAY) < next))
+			next = now + ZT_FRAME_AGGREGATION_MAX_DELAY;
+	}
+	const int64_t hedgeAt = nextWhoisHedge();
+	if ((hedgeAt >= 0)&&(hedgeAt < next))
+		next = hedgeAt;
+	return (unsigned long)std::max(next - now,(int64_t)0);
+}
+
+int64_t Switch::nextWhoisHedge()
+{
+	int64_t next = -1;
+	Mutex::Lock _l(_lastSentWhoisRequest_m);
+	Hashtable< Address,_WhoisRequest >::Iterator i(_lastSentWhoisRequest);
+	Address *a = (Address *)0;
+	_WhoisRequest *r = (_WhoisRequest *)0;
+	while (i.next(a,r)) {
+		if ((r->hedgeAt)&&((next < 0)||(r->hedgeAt < next)))
+			next = r->hedgeAt;
+	}
+	return next;
+}
+
+void Switch::pendingSendStats(unsigned long &destinations,unsigned long &packets,unsigned long &maxDepth,uint64_t &dropped,uint64_t &expired)
+{
+	Mutex::Lock _l(_txQueue_m);
+	destinations = _txQueue.size();
+	packets = _txQueueDepth;
+	maxDepth = 0;
+	Hashtable< Address,_PendingSendQueue >::Iterator i(_txQueue);
+	Address *dest = (Address *)0;
+	_PendingSendQueue *pq = (_PendingSendQueue *)0;
+	while (i.next(dest,pq)) {
+		const unsigned long d = (unsigned long)pq->q.size();
+		if (d > maxDepth)
+			maxDepth = d;
+	}
+	dropped = _txQueueDropped;
+	expired = _txQueueExpired;
+}
+
+void Switch::_dropOldestQueued()
+{
+	// assumes _txQueue_m is locked
+	Address oldestDest;
+	uint64_t oldest = 0;
+	Hashtable< Address,_PendingSendQueue >::Iterator i(_txQueue);
+	Address *dest = (Address *)0;
+	_PendingSendQueue *pq = (_PendingSendQueue *)0;
+	while (i.next(dest,pq)) {
+		if ((!pq->q.empty())&&((!oldestDest)||(pq->q.front().creationTime < oldest))) {
+			oldestDest = *dest;
+			oldest = pq->q.front().creationTime;
+		}
+	}
+	if (oldestDest) {
+		pq = _txQueue.get(oldestDest);
+		pq->q.pop_front();
+		--_txQueueDepth;
+		++_txQueueDropped;
+		if (pq->q.empty())
+			_txQueue.erase(oldestDest);
+	}
+}
+
+void Switch::_hedgeWhois(void *tPtr,const int64_t now)
+{
+	std::vector< std::pair<Address,Address> > due; // address, upstream asked first
 	{
 		Mutex::Lock _l(_lastSentWhoisRequest_m);
-		Hashtable< Address,int64_t >::Iterator i(_lastSentWhoisRequest);
+		Hashtable< Address,_WhoisRequest >::Iterator i(_lastSentWhoisRequest);
 		Address *a = (Address *)0;
-		int64_t *ts = (int64_t *)0;
-		while (i.next(a,ts)) {
-			if ((now - *ts) > (ZT_WHOIS_RETRY_DELAY * 2))
-				_lastSentWhoisRequest.erase(*a);
+		_WhoisRequest *r = (_WhoisRequest *)0;
+		while (i.next(a,r)) {
+			if ((r->hedgeAt)&&(now >= r->hedgeAt)) {
+				r->hedgeAt = 0;
+				due.push_back(std::pair<Address,Address>(*a,r->upstream));
+			}
 		}
 	}
+	for(std::vector< std::pair<Address,Address> >::const_iterator d(due.begin());d!=due.end();++d) {
+		// Still no reply, so also ask the best upstream not yet asked
+		SharedPtr<Peer> upstream(RR->topology->getUpstreamPeer(0));
+		if ((upstream)&&(upstream->address() == d->second))
+			upstream = RR->topology->getUpstreamPeer(1);
+		if (upstream)
+			_sendWhois(tPtr,upstream,d->first);
+	}
+}
 
-	return ZT_WHOIS_RETRY_DELAY;
+void Switch::_doTimerTasksFor(void *tPtr,const int64_t now,const Address &addr)
+{
+	bool stillQueued = false;
+	bool needWhois = false;
+	{
+		Mutex::Lock _l(_txQueue_m);
+		_PendingSendQueue *const pq = _txQueue.get(addr);
+		if (pq) {
+			for(std::list< TXQueueEntry >::iterator txi(pq->q.begin());txi!=pq->q.end();) {
+				if (_trySend(tPtr,txi->packet,txi->encrypt,txi->flowId)) {
+					pq->q.erase(txi++);
+					--_txQueueDepth;
+				} else if ((now - txi->creationTime) > ZT_TRANSMIT_QUEUE_TIMEOUT) {
+					pq->q.erase(txi++);
+					--_txQueueDepth;
+					++_txQueueExpired;
+				} else {
+					++txi;
+				}
+			}
+			if (pq->q.empty()) {
+				_txQueue.erase(addr);
+			} else {
+				stillQueued = true;
+				needWhois = !RR->topology->getPeer(tPtr,addr);
+			}
+		}
+	}
+	if (needWhois)
+		requestWhois(tPtr,now,addr);
+
+	int64_t next = (stillQueued) ? (now + ZT_WHOIS_RETRY_DELAY) : -1;
+	{
+		Mutex::Lock _l(_lastSentWhoisRequest_m);
+		const _WhoisRequest *const r = _lastSentWhoisRequest.get(addr);
+		if (r) {
+			if ((now - r->sent) > (ZT_WHOIS_RETRY_DELAY * 2)) {
+				_lastSentWhoisRequest.erase(addr);
+			} else {
+				if (next < 0)
+					next = r->sent + (ZT_WHOIS_RETRY_DELAY * 2) + 1;
+			}
+		}
+	}
+	if (next >= 0) {
+		Mutex::Lock _l(_timers_m);
+		_timers.schedule(addr,next,true);
+	}
+}
+
+void Switch::_relay(void *tPtr,const SharedPtr<Path> &path,uint8_t *const data,const unsigned int len,const Address &destination,const int64_t now)
+{
+	// Relaying only needs the destination and the hop count, so both are read
+	// and the hop count incremented directly in the receive buffer. Nothing
+	// is copied into a Packet and the buffer is sent as is.
+
+	if (data[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_INDICATOR] == ZT_PACKET_FRAGMENT_INDICATOR) {
+		if ( (!RR->topology->amUpstream()) && (!path->trustEstablished(now)) )
+			return;
+
+		const unsigned int hops = data[ZT_PACKET_FRAGMENT_IDX_HOPS];
+		if (hops >= ZT_RELAY_MAX_HOPS)
+			return;
+		data[ZT_PACKET_FRAGMENT_IDX_HOPS] = (uint8_t)((hops + 1) & ZT_PROTO_MAX_HOPS);
+
+		// Note: we don't bother initiating NAT-t for fragments, since heads will set that off.
+		// It wouldn't hurt anything, just redundant and unnecessary.
+		SharedPtr<Peer> relayTo = RR->topology->getPeer(tPtr,destination);
+		if ((!relayTo)||(!relayTo->sendDirect(tPtr,data,len,now,false))) {
+			// Don't know peer or no direct path -- so relay via someone upstream
+			relayTo = RR->topology->getUpstreamPeer();
+			if (relayTo)
+				relayTo->sendDirect(tPtr,data,len,now,true);
+		}
+	} else {
+		const Address source(data + ZT_PACKET_IDX_SOURCE,ZT_ADDRESS_LENGTH);
+		if ( (!RR->topology->amUpstream()) && (!path->trustEstablished(now)) && (source != RR->identity.address()) )
+			return;
+
+		const unsigned int flags = data[ZT_PACKET_IDX_FLAGS];
+		if ((flags & 0x07) >= ZT_RELAY_MAX_HOPS)
+			return;
+		data[ZT_PACKET_IDX_FLAGS] = (uint8_t)((flags & 0xf8) | ((flags + 1) & 0x07));
+
+		SharedPtr<Peer> relayTo = RR->topology->getPeer(tPtr,destination);
+		if ((relayTo)&&(relayTo->sendDirect(tPtr,data,len,now,false))) {
+			if ((source != RR->identity.address())&&(_shouldUnite(now,source,destination))) {
+				const SharedPtr<Peer> sourcePeer(RR->topology->getPeer(tPtr,source));
+				if (sourcePeer)
+					relayTo->introduce(tPtr,now,sourcePeer);
+			}
+		} else {
+			relayTo = RR->topology->getUpstreamPeer();
+			if ((relayTo)&&(relayTo->address() != source)) {
+				if (relayTo->sendDirect(tPtr,data,len,now,true)) {
+					const SharedPtr<Peer> sourcePeer(RR->topology->getPeer(tPtr,source));
+					if (sourcePeer)
+						relayTo->introduce(tPtr,now,sourcePeer);
+				}
+			}
+		}
+	}
+}
+
+void Switch::_sendWhois(void *tPtr,const SharedPtr<Peer> &upstream,const Address &addr)
+{
+	std::vector<Address> full;
+	{
+		Mutex::Lock _l(_whoisBatches_m);
+		_WhoisBatch &b = _whoisBatches[upstream->address()];
+		if (std::find(b.addrs.begin(),b.addrs.end(),addr) != b.addrs.end())
+			return;
+		if (!b.upstream)
+			b.upstream = upstream;
+		b.addrs.push_back(addr);
+		++_whoisBatched;
+		if (b.addrs.size() >= ZT_WHOIS_BATCH_MAX) {
+			full.swap(b.addrs);
+			_whoisBatched -= (unsigned long)full.size();
+			_whoisBatches.erase(upstream->address());
+		}
+	}
+	if (!full.empty())
+		_sendWhoisBatch(tPtr,upstream,full);
+}
+
+void Switch::_sendWhoisBatch(void *tPtr,const SharedPtr<Peer> &upstream,const std::vector<Address> &addrs)
+{
+	Packet outp(upstream->address(),RR->identity.address(),Packet::VERB_WHOIS);
+	for(std::vector<Address>::const_iterator a(addrs.begin());a!=addrs.end();++a)
+		a->appendTo(outp);
+	RR->node->expectReplyTo(outp.packetId());
+	send(tPtr,outp,true);
+}
+
+void Switch::_flushWhois(void *tPtr)
+{
+	std::vector<_WhoisBatch> ready;
+	{
+		Mutex::Lock _l(_whoisBatches_m);
+		ready.reserve(_whoisBatches.size());
+		Hashtable< Address,_WhoisBatch >::Iterator i(_whoisBatches);
+		Address *k = (Address *)0;
+		_WhoisBatch *b = (_WhoisBatch *)0;
+		while (i.next(k,b)) {
+			ready.push_back(_WhoisBatch());
+			ready.back().upstream.swap(b->upstream);
+			ready.back().addrs.swap(b->addrs);
+		}
+		_whoisBatches.clear();
+		_whoisBatched = 0;
+	}
+	for(std::vector<_WhoisBatch>::const_iterator b(ready.begin());b!=ready.end();++b) {
+		if (!b->addrs.empty())
+			_sendWhoisBatch(tPtr,b->upstream,b->addrs);
+	}
 }
 
 bool Switch::_shouldUnite(const int64_t now,const Address &source,const Address &destination)
@@ -907,42 +1192,212 @@ bool Switch::_shouldUnite(const int64_t now,const Address &source,const Address
 	return false;
 }
 
-bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt)
+bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt,int32_t flowId)
 {
+	const int64_t now = RR->node->now();
 	SharedPtr<Path> viaPath;
+	const SharedPtr<Peer> peer(_pathTo(tPtr,packet.destination(),now,viaPath,flowId));
+	if (!peer)
+		return false;
+
+	unsigned int mtu = ZT_DEFAULT_PHYSMTU;
+	uint64_t trustedPathId = 0;
+	RR->topology->getOutboundPathInfo(viaPath->address(),mtu,trustedPathId);
+	if (viaPath->mtuProbeDue(now))
+		peer->probePathMtu(tPtr,viaPath,mtu,now);
+	mtu = viaPath->mtu(mtu);
+
+	packet.setFragmented(packet.size() > mtu);
+
+	peer->recordOutgoingPacket(tPtr, viaPath, packet.packetId(), packet.payloadLength(), packet.verb(), now);
+
+	if (trustedPathId) {
+		packet.setTrusted(trustedPathId);
+	} else {
+		packet.armor(peer->key(),encrypt);
+	}
+
+	_transmit(tPtr,viaPath,packet,mtu,now,_sendParity(peer,viaPath,packet.size(),mtu,now));
+
+	return true;
+}
+
+void Switch::sendCopy(void *tPtr,const Packet &prototype,const Address &dest,const uint64_t packetId,bool encrypt)
+{
+	if (dest == RR->identity.address())
+		return;
+
 	const int64_t now = RR->node->now();
-	const Address destination(packet.destination());
+	SharedPtr<Path> viaPath;
+	const SharedPtr<Peer> peer(_pathTo(tPtr,dest,now,viaPath));
+	if (!peer) {
+		// Not reachable yet, so it gets queued and a full copy is needed anyway
+		Packet outp(prototype,dest);
+		outp.setAt<uint64_t>(ZT_PACKET_IDX_IV,packetId);
+		send(tPtr,outp,encrypt);
+		return;
+	}
+
+	unsigned int mtu = ZT_DEFAULT_PHYSMTU;
+	uint64_t trustedPathId = 0;
+	RR->topology->getOutboundPathInfo(viaPath->address(),mtu,trustedPathId);
+	if (viaPath->mtuProbeDue(now))
+		peer->probePathMtu(tPtr,viaPath,mtu,now);
+	mtu = viaPath->mtu(mtu);
+
+	Packet outp(prototype.data(),ZT_PACKET_IDX_VERB); // header only, payload comes in with armoring
+	outp.setAt<uint64_t>(ZT_PACKET_IDX_IV,packetId);
+	outp.setDestination(dest);
+	outp.setFragmented(prototype.size() > mtu);
+
+	peer->recordOutgoingPacket(tPtr, viaPath, packetId, prototype.payloadLength(), prototype.verb(), now);
+
+	if (trustedPathId) {
+		outp.append(prototype.field(ZT_PACKET_IDX_VERB,prototype.size() - ZT_PACKET_IDX_VERB),prototype.size() - ZT_PACKET_IDX_VERB);
+		outp.setTrusted(trustedPathId);
+	} else {
+		outp.armorFrom(prototype,peer->key(),encrypt);
+	}
+
+	_transmit(tPtr,viaPath,outp,mtu,now,_sendParity(peer,viaPath,outp.size(),mtu,now));
+}
+
+void Switch::_rxTryComplete(void *tPtr,RXQueueEntry *const rq,const int64_t now)
+{
+	const unsigned int totalFragments = rq->totalFragments;
+	if (totalFragments < 2)
+		return;
+	const unsigned int received = Utils::countBits(rq->haveFragments);
+	if (received < totalFragments) {
+		if ((!rq->haveParity)||(received != (totalFragments - 1))||(!_rxRepair(rq,now)))
+			return;
+	}
+
+	// We have all fragments -- assemble and process full Packet
+
+	if (rq->path)
+		rq->path->recordFragments(received,totalFragments);
+
+	for(unsigned int f=1;f<totalFragments;++f)
+		rq->frag0.append(rq->frags[f - 1].payload(),rq->frags[f - 1].payloadLength());
 
+	if (rq->frag0.tryDecode(RR,tPtr)) {
+		// Packet decoded, but keep the entry so that a late fragment or parity
+		// fragment is recognized as a duplicate instead of taking a new entry
+		// and later being counted as fragment loss
+		rq->complete = true;
+		rq->decoded = true;
+
+		// Tell the sender how many fragments it loses on this path, since it can't see that itself
+		unsigned int loss = 0;
+		if ((rq->path)&&(!rq->frag0.hops())&&(rq->path->fragmentLossReportDue(now,loss))) {
+			const SharedPtr<Peer> peer(RR->topology->getPeer(tPtr,rq->frag0.source()));
+			if ((peer)&&(peer->hasRemoteCapability(ZT_PROTO_CAPABILITY_FEC)))
+				peer->sendFragmentLoss(tPtr,rq->path,loss,now);
+		}
+	} else {
+		rq->complete = true; // set complete flag but leave entry since it probably needs WHOIS or something
+	}
+}
+
+bool Switch::_rxRepair(RXQueueEntry *const rq,const int64_t now)
+{
+	const unsigned int parityLength = rq->parity.payloadLength();
+	if (parityLength <= 2)
+		return false;
+	const unsigned int packetLength = rq->parity.at<uint16_t>(ZT_PACKET_FRAGMENT_IDX_PAYLOAD);
+	const unsigned int unitLength = parityLength - 2;
+
+	uint8_t unit[ZT_PROTO_MAX_PACKET_LENGTH];
+	memcpy(unit,rq->parity.payload() + 2,unitLength);
+
+	// XOR out everything we have, leaving the one missing unit
+	unsigned int missing = 0;
+	unsigned int haveLength = 0;
+	for(unsigned int f=0;f<rq->totalFragments;++f) {
+		if (!(rq->haveFragments & (1 << f))) {
+			missing = f;
+			continue;
+		}
+		const uint8_t *const d = (f) ? rq->frags[f - 1].payload() : reinterpret_cast<const uint8_t *>(rq->frag0.data());
+		const unsigned int l = (f) ? rq->frags[f - 1].payloadLength() : rq->frag0.size();
+		if (l > unitLength)
+			return false;
+		for(unsigned int i=0;i<l;++i)
+			unit[i] ^= d[i];
+		if (!f)
+			unit[ZT_PACKET_IDX_FLAGS] ^= d[ZT_PACKET_IDX_FLAGS] & 0x07; // parity covers the head with zero hops
+		haveLength += l;
+	}
+
+	if (packetLength <= haveLength)
+		return false;
+	const unsigned int missingLength = packetLength - haveLength;
+	if (missingLength > unitLength)
+		return false;
+
+	if (missing) {
+		Packet::Fragment &frag = rq->frags[missing - 1];
+		frag.setSize(ZT_PACKET_FRAGMENT_IDX_PAYLOAD + missingLength);
+		memcpy(frag.field(ZT_PACKET_FRAGMENT_IDX_PAYLOAD,missingLength),unit,missingLength);
+	} else {
+		if (missingLength < ZT_PROTO_MIN_PACKET_LENGTH)
+			return false;
+		rq->frag0.init(unit,missingLength,rq->path,now);
+	}
+	rq->haveFragments |= (1 << missing);
+
+	return true;
+}
+
+SharedPtr<Peer> Switch::_pathTo(void *tPtr,const Address &destination,const int64_t now,SharedPtr<Path> &viaPath,const int32_t flowId)
+{
 	const SharedPtr<Peer> peer(RR->topology->getPeer(tPtr,destination));
 	if (peer) {
-		viaPath = peer->getAppropriatePath(now,false);
+		viaPath = peer->getAppropriatePath(now,false,flowId);
 		if (!viaPath) {
 			peer->tryMemorizedPath(tPtr,now); // periodically attempt memorized or statically defined paths, if any are known
 			const SharedPtr<Peer> relay(RR->topology->getUpstreamPeer());
 			if ( (!relay) || (!(viaPath = relay->getAppropriatePath(now,false))) ) {
 				if (!(viaPath = peer->getAppropriatePath(now,true)))
-					return false;
+					return SharedPtr<Peer>();
 			}
 		}
-	} else {
-		return false;
 	}
+	return peer;
+}
 
-	unsigned int mtu = ZT_DEFAULT_PHYSMTU;
-	uint64_t trustedPathId = 0;
-	RR->topology->getOutboundPathInfo(viaPath->address(),mtu,trustedPathId);
-
-	unsigned int chunkSize = std::min(packet.size(),mtu);
-	packet.setFragmented(chunkSize < packet.size());
-
-	peer->recordOutgoingPacket(viaPath, packet.packetId(), packet.payloadLength(), packet.verb(), now);
+bool Switch::_sendParity(const SharedPtr<Peer> &peer,const SharedPtr<Path> &viaPath,const unsigned int size,const unsigned int mtu,const int64_t now) const
+{
+	if (size <= mtu)
+		return false;
+	const float threshold = RR->node->fecLossThreshold();
+	if ((threshold <= 0.0f)||(viaPath->outboundLossRatio(now) < threshold)||(!peer->hasRemoteCapability(ZT_PROTO_CAPABILITY_FEC)))
+		return false;
+	const unsigned int unitLength = mtu - ZT_PACKET_FRAGMENT_PARITY_OVERHEAD;
+	return (((size + unitLength - 1) / unitLength) <= ZT_MAX_PACKET_FRAGMENTS);
+}
 
-	if (trustedPathId) {
-		packet.setTrusted(trustedPathId);
-	} else {
-		packet.armor(peer->key(),encrypt);
+void Switch::_transmit(void *tPtr,const SharedPtr<Path> &viaPath,Packet &packet,const unsigned int mtu,const int64_t now,const bool parity)
+{
+	if (parity) {
+		// Units are shortened so that the parity fragment still fits in the MTU
+		const unsigned int unitLength = mtu - ZT_PACKET_FRAGMENT_PARITY_OVERHEAD;
+		const unsigned int totalFragments = (packet.size() + unitLength - 1) / unitLength;
+		if (viaPath->send(RR,tPtr,packet.data(),unitLength,now)) {
+			for(unsigned int fno=1;fno<totalFragments;++fno) {
+				const unsigned int fragStart = fno * unitLength;
+				Packet::Fragment frag(packet,fragStart,std::min(unitLength,packet.size() - fragStart),fno,totalFragments);
+				viaPath->send(RR,tPtr,frag.data(),frag.size(),now);
+			}
+			Packet::Fragment frag;
+			frag.initParity(packet,unitLength,totalFragments);
+			viaPath->send(RR,tPtr,frag.data(),frag.size(),now);
+		}
+		return;
 	}
 
+	unsigned int chunkSize = std::min(packet.size(),mtu);
 	if (viaPath->send(RR,tPtr,packet.data(),chunkSize,now)) {
 		if (chunkSize < packet.size()) {
 			// Too big for one packet, fragment the rest
@@ -962,8 +1417,68 @@ bool Switch::_trySend(void *tPtr,Packet &packet,bool encrypt)
 			}
 		}
 	}
+}
 
-	return true;
+void Switch::_aggregate(void *tPtr,const SharedPtr<Network> &network,const Address &dest,const unsigned int etherType,const void *data,const unsigned int len,const int64_t now)
+{
+	_Aggregate full;
+	{
+		Mutex::Lock _l(_aggregates_m);
+		_Aggregate &a = _aggregates[_AggregateKey(network->id(),dest)];
+		if ((a.frames)&&(((a.packet.size() + 4 + len) > ZT_FRAME_AGGREGATION_MAX_PACKET)||((now - a.started) >= ZT_FRAME_AGGREGATION_MAX_DELAY))) {
+			full = a;
+			a.frames = 0;
+		}
+		if (!a.frames) {
+			a.packet.reset(dest,RR->identity.address(),Packet::VERB_MULTI_FRAME);
+			a.packet.append(network->id());
+			a.packet.append((uint8_t)0);
+			a.started = now;
+			a.trafficClass = CompiledRules::trafficClass(reinterpret_cast<const uint8_t *>(data),len,etherType);
+		}
+		a.packet.appendMultiFrame(etherType,data,len);
+		++a.frames;
+	}
+	if (full.frames)
+		_sendAggregate(tPtr,full);
+}
+
+void Switch::_flushAggregate(void *tPtr,const uint64_t nwid,const Address &dest)
+{
+	_Aggregate a;
+	{
+		Mutex::Lock _l(_aggregates_m);
+		const _AggregateKey k(nwid,dest);
+		_Aggregate *const pending = _aggregates.get(k);
+		if (!pending)
+			return;
+		a = *pending;
+		_aggregates.erase(k);
+	}
+	_sendAggregate(tPtr,a);
+}
+
+void Switch::_sendAggregate(void *tPtr,_Aggregate &a)
+{
+	const uint64_t nwid = a.packet.at<uint64_t>(ZT_PROTO_VERB_MULTI_FRAME_IDX_NETWORK_ID);
+	const SharedPtr<Network> network(RR->node->network(nwid));
+	if ((!network)||(!a.frames))
+		return;
+
+	if (a.frames == 1) {
+		// Nothing joined the first frame before the flush, so send it as a plain FRAME
+		const unsigned int etherType = a.packet.at<uint16_t>(ZT_PROTO_VERB_MULTI_FRAME_IDX_FRAMES);
+		const unsigned int len = a.packet.at<uint16_t>(ZT_PROTO_VERB_MULTI_FRAME_IDX_FRAMES + 2);
+		Packet outp(a.packet.destination(),RR->identity.address(),Packet::VERB_FRAME);
+		outp.append(nwid);
+		outp.append((uint16_t)etherType);
+		outp.append(a.packet.field(ZT_PROTO_VERB_MULTI_FRAME_IDX_FRAMES + 4,len),len);
+		a.packet = outp;
+	}
+
+	if (!network->config()->disableCompression())
+		network->compression().compress(a.packet,a.packet.destination(),a.trafficClass,RR->node->now());
+	send(tPtr,a.packet,true);
 }
 
 } // namespace ZeroTier
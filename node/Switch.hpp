@@ -43,6 +43,7 @@
 #include "SharedPtr.hpp"
 #include "IncomingPacket.hpp"
 #include "Hashtable.hpp"
+#include "TimerWheel.hpp"
 
 /* Ethernet frame types that might be relevant to us */
 #define ZT_ETHERTYPE_IPV4 0x0800
@@ -83,13 +84,17 @@ public:
 	/**
 	 * Called when a packet is received from the real network
 	 *
+	 * Packets and fragments addressed to someone else are relayed directly
+	 * out of data without being copied into a Packet, so data is modified
+	 * in place (its hop count is incremented).
+	 *
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param localSocket Local I/O socket as supplied by external code
 	 * @param fromAddr Internet IP address of origin
-	 * @param data Packet data
+	 * @param data Packet data (may be modified)
 	 * @param len Packet length
 	 */
-	void onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddress &fromAddr,const void *data,unsigned int len);
+	void onRemotePacket(void *tPtr,const int64_t localSocket,const InetAddress &fromAddr,void *data,unsigned int len);
 
 	/**
 	 * Called when a packet comes from a local Ethernet tap
@@ -130,8 +135,9 @@ public:
 	 * @param packet Packet to be sent
 	 * @param encrypt Encrypt packet payload? (always true except for HELLO)
 	 * @param qosBucket Which bucket the rule-system determined this packet should fall into
+	 * @param flowId Transport flow of the frame being sent or ZT_MULTIPATH_NO_FLOW
 	 */
-	void aqm_enqueue(void *tPtr, const SharedPtr<Network> &network, Packet &packet,bool encrypt,int qosBucket);
+	void aqm_enqueue(void *tPtr, const SharedPtr<Network> &network, Packet &packet,bool encrypt,int qosBucket,int32_t flowId = ZT_MULTIPATH_NO_FLOW);
 
 	/**
 	 * Performs a single AQM cycle and dequeues and transmits all eligible packets on all networks
@@ -176,8 +182,25 @@ public:
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param packet Packet to send (buffer may be modified)
 	 * @param encrypt Encrypt packet payload? (always true except for HELLO)
+	 * @param flowId Transport flow used to pin the packet to a path in flow-pinned multipath mode, or ZT_MULTIPATH_NO_FLOW
 	 */
-	void send(void *tPtr,Packet &packet,bool encrypt);
+	void send(void *tPtr,Packet &packet,bool encrypt,int32_t flowId = ZT_MULTIPATH_NO_FLOW);
+
+	/**
+	 * Send a copy of a prototype packet to another ZeroTier address
+	 *
+	 * This is equivalent to copying the prototype, setting its destination and
+	 * packet ID, and calling send(). If the destination can be reached now, only
+	 * its header is copied and the payload is armored straight from the
+	 * prototype into the outgoing packet. This is used to fan out multicasts.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param prototype Composed but unencrypted packet to send a copy of (not modified)
+	 * @param dest Destination of this copy
+	 * @param packetId Packet ID (IV) for this copy
+	 * @param encrypt Encrypt packet payload? (always true except for HELLO)
+	 */
+	void sendCopy(void *tPtr,const Packet &prototype,const Address &dest,const uint64_t packetId,bool encrypt);
 
 	/**
 	 * Request WHOIS on a given address
@@ -210,18 +233,108 @@ public:
 	 */
 	unsigned long doTimerTasks(void *tPtr,int64_t now);
 
+	/**
+	 * @return Time a WHOIS is next due to be hedged to another upstream or -1 if none
+	 */
+	int64_t nextWhoisHedge();
+
+	/**
+	 * Send frames held for aggregation into VERB_MULTI_FRAME packets
+	 *
+	 * Hosts call this through Node at the end of each batch of frames read
+	 * from a virtual network port, so aggregation never holds a frame past
+	 * the batch it arrived in.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param nwid Network ID or 0 for all networks
+	 * @param startedBefore Only flush aggregates whose first frame was held at or before this time
+	 */
+	void flushAggregates(void *tPtr,const uint64_t nwid,const int64_t startedBefore);
+
+	/**
+	 * @return True if any frames are held for aggregation
+	 */
+	inline bool aggregatesPending() const
+	{
+		Mutex::Lock _l(_aggregates_m);
+		return (_aggregates.size() > 0);
+	}
+
+	/**
+	 * Send coalesced WHOIS lookups, one packet per upstream
+	 *
+	 * Node calls this at the end of every entry point that can look up a
+	 * peer: processWirePacket(), processVirtualNetworkFrame(),
+	 * processBackgroundTasks(), join(), multicastSubscribe(),
+	 * sendUserMessage(), and the local controller's ncSend*() replies. Code
+	 * that calls send() or requestWhois() from anywhere else must flush too.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 */
+	inline void flushWhois(void *tPtr)
+	{
+		if (_whoisBatched)
+			_flushWhois(tPtr);
+	}
+
+	/**
+	 * Get statistics for packets waiting on WHOIS or a path to their destination
+	 *
+	 * @param destinations Set to number of destinations with at least one queued packet
+	 * @param packets Set to total number of queued packets
+	 * @param maxDepth Set to depth of the deepest per-destination queue
+	 * @param dropped Set to number of packets dropped because a queue (or the queue table, or all queues together) was full
+	 * @param expired Set to number of packets dropped after ZT_TRANSMIT_QUEUE_TIMEOUT
+	 */
+	void pendingSendStats(unsigned long &destinations,unsigned long &packets,unsigned long &maxDepth,uint64_t &dropped,uint64_t &expired);
+
 private:
+	void _relay(void *tPtr,const SharedPtr<Path> &path,uint8_t *const data,const unsigned int len,const Address &destination,const int64_t now);
 	bool _shouldUnite(const int64_t now,const Address &source,const Address &destination);
-	bool _trySend(void *tPtr,Packet &packet,bool encrypt); // packet is modified if return is true
+	void _sendWhois(void *tPtr,const SharedPtr<Peer> &upstream,const Address &addr);
+	void _sendWhoisBatch(void *tPtr,const SharedPtr<Peer> &upstream,const std::vector<Address> &addrs);
+	void _flushWhois(void *tPtr);
+	void _hedgeWhois(void *tPtr,const int64_t now);
+	void _dropOldestQueued(); // assumes _txQueue_m is locked
+	void _doTimerTasksFor(void *tPtr,const int64_t now,const Address &addr);
+	bool _trySend(void *tPtr,Packet &packet,bool encrypt,int32_t flowId); // packet is modified if return is true
+	SharedPtr<Peer> _pathTo(void *tPtr,const Address &destination,const int64_t now,SharedPtr<Path> &viaPath,const int32_t flowId = ZT_MULTIPATH_NO_FLOW); // NULL if no peer or path
+	bool _sendParity(const SharedPtr<Peer> &peer,const SharedPtr<Path> &viaPath,const unsigned int size,const unsigned int mtu,const int64_t now) const;
+	void _transmit(void *tPtr,const SharedPtr<Path> &viaPath,Packet &packet,const unsigned int mtu,const int64_t now,const bool parity); // packet must be armored
+	void _aggregate(void *tPtr,const SharedPtr<Network> &network,const Address &dest,const unsigned int etherType,const void *data,const unsigned int len,const int64_t now);
+	void _flushAggregate(void *tPtr,const uint64_t nwid,const Address &dest);
 
 	const RuntimeEnvironment *const RR;
 	int64_t _lastBeaconResponse;
 	volatile int64_t _lastCheckedQueues;
 
-	// Time we last sent a WHOIS request for each address
-	Hashtable< Address,int64_t > _lastSentWhoisRequest;
+	// WHOIS requests in flight: when one was last sent to the best upstream
+	// and when (if not yet answered) to also ask the next best
+	struct _WhoisRequest
+	{
+		_WhoisRequest() : sent(0),hedgeAt(0),upstream() {}
+		int64_t sent;
+		int64_t hedgeAt; // 0 if already hedged or there is no other upstream
+		Address upstream; // upstream asked first
+	};
+	Hashtable< Address,_WhoisRequest > _lastSentWhoisRequest;
 	Mutex _lastSentWhoisRequest_m;
 
+	// Addresses waiting to be asked for in one WHOIS per upstream
+	struct _WhoisBatch
+	{
+		SharedPtr<Peer> upstream;
+		std::vector<Address> addrs;
+	};
+	Hashtable< Address,_WhoisBatch > _whoisBatches;
+	volatile unsigned long _whoisBatched; // total addresses in _whoisBatches
+	Mutex _whoisBatches_m;
+
+	// Next time something needs to be done for an address: retry queued
+	// packets, retry WHOIS, or forget that we sent a WHOIS
+	TimerWheel< Address > _timers;
+	Mutex _timers_m;
+
 	// Packets waiting for WHOIS replies or other decode info or missing fragments
 	struct RXQueueEntry
 	{
@@ -230,9 +343,13 @@ private:
 		volatile uint64_t packetId;
 		IncomingPacket frag0; // head of packet
 		Packet::Fragment frags[ZT_MAX_PACKET_FRAGMENTS - 1]; // later fragments (if any)
+		Packet::Fragment parity; // parity fragment (if any)
+		SharedPtr<Path> path; // path the first part of this packet arrived on
 		unsigned int totalFragments; // 0 if only frag0 received, waiting for frags
 		uint32_t haveFragments; // bit mask, LSB to MSB
+		bool haveParity;
 		volatile bool complete; // if true, packet is complete
+		volatile bool decoded; // if true, packet was decoded and entry is kept only to drop late fragments
 		Mutex lock;
 	};
 	RXQueueEntry _rxQueue[ZT_RX_QUEUE_SIZE];
@@ -257,22 +374,47 @@ private:
 		return &(_rxQueue[static_cast<unsigned int>((++_rxQueuePtr) - 1) % ZT_RX_QUEUE_SIZE]);
 	}
 
+	// Counts fragments never received for an entry about to be reused toward its path's loss ratio
+	inline void _rxAbandon(RXQueueEntry *const rq)
+	{
+		if ((rq->timestamp)&&(!rq->complete)&&(rq->totalFragments > 1)&&(rq->haveFragments)&&(rq->path))
+			rq->path->recordFragments(Utils::countBits(rq->haveFragments),rq->totalFragments);
+	}
+
+	void _rxTryComplete(void *tPtr,RXQueueEntry *const rq,const int64_t now);
+	bool _rxRepair(RXQueueEntry *const rq,const int64_t now);
+
 	// ZeroTier-layer TX queue entry
 	struct TXQueueEntry
 	{
 		TXQueueEntry() {}
-		TXQueueEntry(Address d,uint64_t ct,const Packet &p,bool enc) :
+		TXQueueEntry(Address d,uint64_t ct,const Packet &p,bool enc,int32_t fid) :
 			dest(d),
 			creationTime(ct),
 			packet(p),
-			encrypt(enc) {}
+			encrypt(enc),
+			flowId(fid) {}
 
 		Address dest;
 		uint64_t creationTime;
 		Packet packet; // unencrypted/unMAC'd packet -- this is done at send time
 		bool encrypt;
+		int32_t flowId;
 	};
-	std::list< TXQueueEntry > _txQueue;
+
+	// Packets waiting for WHOIS or a path, queued per destination so that one
+	// chatty unknown peer cannot push another peer's packets out of the queue.
+	// Each queue is bounded by ZT_TX_QUEUE_SIZE, the table by
+	// ZT_TX_QUEUE_MAX_DESTINATIONS, and all queues together by
+	// ZT_TX_QUEUE_MAX_PACKETS.
+	struct _PendingSendQueue
+	{
+		std::list< TXQueueEntry > q;
+	};
+	Hashtable< Address,_PendingSendQueue > _txQueue;
+	unsigned long _txQueueDepth; // total packets in all queues
+	uint64_t _txQueueDropped;
+	uint64_t _txQueueExpired;
 	Mutex _txQueue_m;
 	Mutex _aqm_m;
 
@@ -297,6 +439,28 @@ private:
 	Hashtable< _LastUniteKey,uint64_t > _lastUniteAttempt; // key is always sorted in ascending order, for set-like behavior
 	Mutex _lastUniteAttempt_m;
 
+	// Small frames held per network and destination until they fill a
+	// VERB_MULTI_FRAME packet or the host flushes them
+	struct _AggregateKey
+	{
+		_AggregateKey() : nwid(0),dest(0) {}
+		_AggregateKey(const uint64_t n,const Address &d) : nwid(n),dest(d.toInt()) {}
+		inline unsigned long hashCode() const { return ((unsigned long)nwid ^ (unsigned long)dest); }
+		inline bool operator==(const _AggregateKey &k) const { return ((nwid == k.nwid)&&(dest == k.dest)); }
+		uint64_t nwid,dest;
+	};
+	struct _Aggregate
+	{
+		_Aggregate() : frames(0),started(0),trafficClass(0) {}
+		Packet packet;
+		unsigned int frames;
+		int64_t started;
+		uint32_t trafficClass; // class of first frame, used for adaptive compression
+	};
+	void _sendAggregate(void *tPtr,_Aggregate &a);
+	Hashtable< _AggregateKey,_Aggregate > _aggregates;
+	Mutex _aggregates_m;
+
 	// Queue with additional flow state variables
 	struct ManagedQueue
 	{
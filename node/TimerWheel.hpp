@@ -0,0 +1,277 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2019  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_TIMERWHEEL_HPP
+#define ZT_TIMERWHEEL_HPP
+
+#include <stdint.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "Constants.hpp"
+#include "Hashtable.hpp"
+
+/**
+ * Slots per wheel level are 2^ZT_TIMERWHEEL_SLOT_BITS
+ */
+#define ZT_TIMERWHEEL_SLOT_BITS 6
+
+/**
+ * Number of wheel levels (range is granularity * 2^(ZT_TIMERWHEEL_SLOT_BITS * ZT_TIMERWHEEL_LEVELS))
+ */
+#define ZT_TIMERWHEEL_LEVELS 4
+
+namespace ZeroTier {
+
+/**
+ * Hierarchical timer wheel mapping keys to deadlines
+ *
+ * Each key has at most one pending deadline. Scheduling a key again
+ * supersedes its earlier deadline; superseded and cancelled entries stay in
+ * the wheel and are discarded when their slot comes up. Advancing the wheel
+ * only touches slots whose time has come, so the cost of expire() is
+ * proportional to the number of entries that are due (plus occasional
+ * cascades from higher levels) rather than to the number of keys. Runs of
+ * ticks with nothing in them are skipped, up to the next occupied lowest
+ * level slot or the next cascade of an occupied level.
+ *
+ * Deadlines are rounded up to the wheel's granularity, so keys may expire
+ * up to one granularity late but never early.
+ *
+ * This class is not thread safe.
+ */
+template<typename K>
+class TimerWheel
+{
+private:
+	struct _Entry
+	{
+		_Entry() {}
+		_Entry(const K &k,const int64_t d) : key(k),deadline(d) {}
+		K key;
+		int64_t deadline;
+	};
+
+public:
+	/**
+	 * @param granularity Length of one tick of the lowest level in milliseconds
+	 */
+	TimerWheel(const int64_t granularity) :
+		_deadlines(),
+		_granularity(granularity),
+		_tick(-1),
+		_entries(0)
+	{
+		for(unsigned int l=0;l<=ZT_TIMERWHEEL_LEVELS;++l)
+			_levelEntries[l] = 0;
+	}
+
+	/**
+	 * Schedule (or reschedule) a key
+	 *
+	 * @param k Key
+	 * @param deadline Time at which key should expire
+	 * @param onlyIfEarlier If true, leave an existing earlier deadline for this key alone
+	 */
+	inline void schedule(const K &k,const int64_t deadline,const bool onlyIfEarlier = false)
+	{
+		int64_t *const d = _deadlines.get(k);
+		if (d) {
+			if ((*d == deadline)||((onlyIfEarlier)&&(*d < deadline)))
+				return;
+			*d = deadline;
+		} else {
+			_deadlines.set(k,deadline);
+		}
+		_insert(_Entry(k,deadline));
+	}
+
+	/**
+	 * Cancel any pending deadline for a key
+	 *
+	 * @param k Key
+	 */
+	inline void cancel(const K &k) { _deadlines.erase(k); }
+
+	/**
+	 * @param k Key
+	 * @return Pending deadline for key or -1 if none
+	 */
+	inline int64_t deadline(const K &k) const
+	{
+		const int64_t *const d = _deadlines.get(k);
+		return ((d) ? *d : -1);
+	}
+
+	/**
+	 * Advance the wheel and collect keys whose deadline has passed
+	 *
+	 * Expired keys are removed and must be rescheduled if they are still of
+	 * interest.
+	 *
+	 * @param now Current time
+	 * @param expired Vector to which expired keys are appended
+	 */
+	inline void expire(const int64_t now,std::vector<K> &expired)
+	{
+		const int64_t nowTick = now / _granularity;
+		if ((_tick < 0)||(_entries == 0)) {
+			_tick = std::max(_tick,nowTick);
+		} else {
+			while (_tick < nowTick) {
+				// Jump to the next tick with work: an occupied lowest level slot in this
+				// rotation, or else the next cascade of the lowest level holding entries.
+				int64_t next = _tick + 1;
+				if (_levelEntries[0]) {
+					const int64_t rotationEnd = ((_tick >> ZT_TIMERWHEEL_SLOT_BITS) + 1) << ZT_TIMERWHEEL_SLOT_BITS;
+					while ((next < rotationEnd)&&(_slots[0][next & ((1 << ZT_TIMERWHEEL_SLOT_BITS) - 1)].empty()))
+						++next;
+				} else {
+					unsigned int l = 1;
+					while ((l < ZT_TIMERWHEEL_LEVELS)&&(!_levelEntries[l]))
+						++l;
+					next = ((_tick >> (ZT_TIMERWHEEL_SLOT_BITS * l)) + 1) << (ZT_TIMERWHEEL_SLOT_BITS * l);
+				}
+				_tick = std::min(next,nowTick);
+
+				if ((_tick & ((1LL << (ZT_TIMERWHEEL_SLOT_BITS * ZT_TIMERWHEEL_LEVELS)) - 1)) == 0)
+					_reinsert(_overflow,ZT_TIMERWHEEL_LEVELS);
+				for(int l=ZT_TIMERWHEEL_LEVELS-1;l>0;--l) {
+					if ((_tick & ((1LL << (ZT_TIMERWHEEL_SLOT_BITS * l)) - 1)) == 0)
+						_reinsert(_slots[l][(_tick >> (ZT_TIMERWHEEL_SLOT_BITS * l)) & ((1 << ZT_TIMERWHEEL_SLOT_BITS) - 1)],l);
+				}
+				std::vector<_Entry> &s = _slots[0][_tick & ((1 << ZT_TIMERWHEEL_SLOT_BITS) - 1)];
+				if (!s.empty()) {
+					_levelEntries[0] -= (unsigned long)s.size();
+					_due.insert(_due.end(),s.begin(),s.end());
+					s.clear();
+				}
+			}
+		}
+
+		if (_due.empty())
+			return;
+		std::vector<_Entry> due;
+		due.swap(_due);
+		_entries -= (unsigned long)due.size();
+		for(typename std::vector<_Entry>::const_iterator e(due.begin());e!=due.end();++e) {
+			const int64_t *const d = _deadlines.get(e->key);
+			if ((d)&&(*d == e->deadline)) { // otherwise stale (cancelled or rescheduled)
+				if (e->deadline <= now) {
+					_deadlines.erase(e->key);
+					expired.push_back(e->key);
+				} else {
+					_insert(*e); // only happens for entries scheduled before the wheel was first advanced
+				}
+			}
+		}
+	}
+
+	/**
+	 * Get the next time expire() might have something to do
+	 *
+	 * This can be early if the earliest entry has been superseded or
+	 * cancelled, or if a higher level must be cascaded, but it is never late.
+	 *
+	 * @param now Current time
+	 * @return Next time to call expire() or -1 if nothing is scheduled
+	 */
+	inline int64_t nextDeadline(const int64_t now) const
+	{
+		if (_deadlines.empty())
+			return -1;
+		if ((_tick < 0)||(!_due.empty()))
+			return now;
+		for(int l=0;l<ZT_TIMERWHEEL_LEVELS;++l) {
+			const unsigned int shift = ZT_TIMERWHEEL_SLOT_BITS * l;
+			for(int64_t s=((_tick >> shift) & ((1 << ZT_TIMERWHEEL_SLOT_BITS) - 1))+1;s<(1 << ZT_TIMERWHEEL_SLOT_BITS);++s) {
+				if (!_slots[l][s].empty())
+					return ((((_tick >> (shift + ZT_TIMERWHEEL_SLOT_BITS)) << ZT_TIMERWHEEL_SLOT_BITS) | s) << shift) * _granularity;
+			}
+		}
+		return (((_tick >> (ZT_TIMERWHEEL_SLOT_BITS * ZT_TIMERWHEEL_LEVELS)) + 1) << (ZT_TIMERWHEEL_SLOT_BITS * ZT_TIMERWHEEL_LEVELS)) * _granularity;
+	}
+
+	/**
+	 * @return Number of keys with a pending deadline
+	 */
+	inline unsigned long size() const { return _deadlines.size(); }
+
+	/**
+	 * @return True if no keys have a pending deadline
+	 */
+	inline bool empty() const { return _deadlines.empty(); }
+
+private:
+	inline void _insert(const _Entry &e)
+	{
+		++_entries;
+		const int64_t t = (e.deadline + _granularity - 1) / _granularity;
+		if ((_tick < 0)||(t <= _tick)) {
+			_due.push_back(e);
+			return;
+		}
+		for(unsigned int l=0;l<ZT_TIMERWHEEL_LEVELS;++l) {
+			const unsigned int shift = ZT_TIMERWHEEL_SLOT_BITS * l;
+			if ((t >> (shift + ZT_TIMERWHEEL_SLOT_BITS)) == (_tick >> (shift + ZT_TIMERWHEEL_SLOT_BITS))) {
+				_slots[l][(t >> shift) & ((1 << ZT_TIMERWHEEL_SLOT_BITS) - 1)].push_back(e);
+				++_levelEntries[l];
+				return;
+			}
+		}
+		_overflow.push_back(e);
+		++_levelEntries[ZT_TIMERWHEEL_LEVELS];
+	}
+
+	inline void _reinsert(std::vector<_Entry> &s,const unsigned int level)
+	{
+		if (s.empty())
+			return;
+		std::vector<_Entry> tmp;
+		tmp.swap(s);
+		_entries -= (unsigned long)tmp.size();
+		_levelEntries[level] -= (unsigned long)tmp.size();
+		for(typename std::vector<_Entry>::const_iterator e(tmp.begin());e!=tmp.end();++e) {
+			const int64_t *const d = _deadlines.get(e->key);
+			if ((d)&&(*d == e->deadline))
+				_insert(*e);
+		}
+	}
+
+	Hashtable< K,int64_t > _deadlines;
+	std::vector<_Entry> _slots[ZT_TIMERWHEEL_LEVELS][1 << ZT_TIMERWHEEL_SLOT_BITS];
+	std::vector<_Entry> _overflow;
+	std::vector<_Entry> _due;
+	const int64_t _granularity;
+	int64_t _tick;
+	unsigned long _entries; // including stale entries
+	unsigned long _levelEntries[ZT_TIMERWHEEL_LEVELS + 1]; // entries in each level's slots and then in overflow
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -63,9 +63,18 @@ namespace ZeroTier {
 #define ZT_DEFAULT_WORLD_LENGTH 634
 static const unsigned char ZT_DEFAULT_WORLD[ZT_DEFAULT_WORLD_LENGTH] = {0x01,0x00,0x00,0x00,0x00,0x08,0xea,0xc9,0x0a,0x00,0x00,0x01,0x64,0xd3,0x71,0xf0,0x58,0xb8,0xb3,0x88,0xa4,0x69,0x22,0x14,0x91,0xaa,0x9a,0xcd,0x66,0xcc,0x76,0x4c,0xde,0xfd,0x56,0x03,0x9f,0x10,0x67,0xae,0x15,0xe6,0x9c,0x6f,0xb4,0x2d,0x7b,0x55,0x33,0x0e,0x3f,0xda,0xac,0x52,0x9c,0x07,0x92,0xfd,0x73,0x40,0xa6,0xaa,0x21,0xab,0xa8,0xa4,0x89,0xfd,0xae,0xa4,0x4a,0x39,0xbf,0x2d,0x00,0x65,0x9a,0xc9,0xc8,0x18,0xeb,0xbf,0xfd,0xd5,0x32,0xf7,0x15,0x6e,0x02,0x6f,0xb9,0x01,0x0d,0xb5,0x7b,0x04,0xd8,0x3a,0xc5,0x17,0x39,0x04,0x36,0xfd,0x9d,0xc6,0x3d,0xa8,0xf3,0x8e,0x79,0xe7,0xc8,0x77,0x8d,0xcc,0x79,0xb8,0xab,0xc6,0x98,0x7c,0x9f,0x34,0x25,0x14,0xe1,0x2f,0xd7,0x97,0x11,0xec,0x34,0x4c,0x9f,0x0f,0xb4,0x85,0x0d,0x9b,0x11,0xd1,0xc2,0xce,0x00,0xc4,0x0a,0x13,0x4b,0xcb,0xc3,0xae,0x2e,0x16,0x00,0x4b,0xdc,0x90,0x5e,0x7e,0x9b,0x44,0x07,0x15,0x36,0x61,0x3c,0x64,0xaa,0xe9,0x46,0x78,0x3c,0xa7,0x18,0xc8,0xd8,0x02,0x9d,0x21,0x90,0x39,0xf3,0x00,0x01,0xf0,0x92,0x2a,0x98,0xe3,0xb3,0x4e,0xbc,0xbf,0xf3,0x33,0x26,0x9d,0xc2,0x65,0xd7,0xa0,0x20,0xaa,0xb6,0x9d,0x72,0xbe,0x4d,0x4a,0xcc,0x9c,0x8c,0x92,0x94,0x78,0x57,0x71,0x25,0x6c,0xd1,0xd9,0x42,0xa9,0x0d,0x1b,0xd1,0xd2,0xdc,0xa3,0xea,0x84,0xef,0x7d,0x85,0xaf,0xe6,0x61,0x1f,0xb4,0x3f,0xf0,0xb7,0x41,0x26,0xd9,0x0a,0x6e,0x00,0x0c,0x04,0xbc,0xa6,0x5e,0xb1,0x27,0x09,0x06,0x2a,0x03,0xb0,0xc0,0x00,0x02,0x00,0xd0,0x00,0x7d,0x00,0x01,0x00,0x00,0x00,0x00,0x27,0x09,0x04,0x9a,0x42,0xc5,0x21,0x27,0x09,0x06,0x2c,0x0f,0xf8,0x50,0x01,0x54,0x01,0x97,0x00,0x33,0xcc,0x08,0xf8,0xfa,0xcc,0x08,0x27,0x09,0x04,0x9f,0xcb,0x61,0xab,0x27,0x09,0x06,0x26,0x04,0xa8,0x80,0x08,0x00,0x00,0xa1,0x00,0x54,0x60,0x01,0x00,0xfc,0xcc,0x08,0x27,0x09,0x04,0x83,0xff,0x06,0x10,0x27,0x09,0x06,0x28,0x03,0xeb,0x80,0x00,0x00,0x00,0x0e,0x00,0x02,0x60,0x01,0x00,0xfc,0xcc,0x08,0x27,0x09,0x04,0x6b,0xaa,0xc5,0x0e,0x27,0x09,0x06,0x26,0x04,0xa8,0x80,0x00,0x01,0x00,0x20,0x02,0x00,0xe0,0x01,0x08,0xfe,0xcc,0x08,0x27,0x09,0x04,0x80,0xc7,0xc5,0xd9,0x27,0x09,0x06,0x24,0x00,0x61,0x80,0x00,0x00,0x00,0xd0,0x00,0xb7,0x40,0x01,0x08,0xfe,0xcc,0x08,0x27,0x09,0x88,0x41,0x40,0x8a,0x2e,0x00,0xbb,0x1d,0x31,0xf2,0xc3,0x23,0xe2,0x64,0xe9,0xe6,0x41,0x72,0xc1,0xa7,0x4f,0x77,0x89,0x95,0x55,0xed,0x10,0x75,0x1c,0xd5,0x6e,0x86,0x40,0x5c,0xde,0x11,0x8d,0x02,0xdf,0xfe,0x55,0x5d,0x46,0x2c,0xcf,0x6a,0x85,0xb5,0x63,0x1c,0x12,0x35,0x0c,0x8d,0x5d,0xc4,0x09,0xba,0x10,0xb9,0x02,0x5d,0x0f,0x44,0x5c,0xf4,0x49,0xd9,0x2b,0x1c,0x00,0x0c,0x04,0x2d,0x20,0xc6,0x82,0x27,0x09,0x06,0x20,0x01,0x19,0xf0,0x64,0x00,0x81,0xc3,0x54,0x00,0x00,0xff,0xfe,0x18,0x1d,0x61,0x27,0x09,0x04,0x2e,0x65,0xa0,0xf9,0x27,0x09,0x06,0x2a,0x03,0xb0,0xc0,0x00,0x03,0x00,0xd0,0x00,0x6a,0x30,0x01,0x78,0x00,0xcd,0x08,0x27,0x09,0x04,0x6b,0xbf,0x2e,0xd2,0x27,0x09,0x06,0x20,0x01,0x19,0xf0,0x68,0x00,0x83,0xa4,0x00,0x64,0xcd,0x08,0x80,0x01,0xcd,0x08,0x27,0x09,0x04,0x2d,0x20,0xf6,0xb3,0x27,0x09,0x06,0x20,0x01,0x19,0xf0,0x58,0x00,0x8b,0xf8,0x54,0x00,0x00,0xff,0xfe,0x15,0xb3,0x9a,0x27,0x09,0x04,0x2d,0x20,0xf8,0x57,0x27,0x09,0x06,0x20,0x01,0x19,0xf0,0x70,0x00,0x9b,0xc9,0x54,0x00,0x00,0xff,0xfe,0x15,0xc4,0xf5,0x27,0x09,0x04,0x9f,0xcb,0x02,0x9a,0x27,0x09,0x06,0x26,0x04,0xa8,0x80,0x0c,0xad,0x00,0xd0,0x00,0x26,0x70,0x01,0xfe,0x15,0xc4,0xf5,0x27,0x09};
 
+// Orders upstreams by relay quality only, so equally good ones keep their configured order
+struct _UpstreamQualityLess
+{
+	inline bool operator()(const std::pair< unsigned int,SharedPtr<Peer> > &a,const std::pair< unsigned int,SharedPtr<Peer> > &b) const { return (a.first < b.first); }
+};
+
 Topology::Topology(const RuntimeEnvironment *renv,void *tPtr) :
 	RR(renv),
 	_numConfiguredPhysicalPaths(0),
+	_peerMemoryBudget(0),
+	_peerTimers(ZT_CORE_TIMER_WHEEL_GRANULARITY),
+	_peerLoadsPending(0),
 	_amUpstream(false)
 {
 	uint8_t tmp[ZT_WORLD_MAX_SERIALIZED_LENGTH];
@@ -107,6 +116,11 @@ SharedPtr<Peer> Topology::addPeer(void *tPtr,const SharedPtr<Peer> &peer)
 			hp = peer;
 		np = hp;
 	}
+	{
+		Mutex::Lock _l(_peerLoads_m);
+		_peerCacheMisses.erase(peer->address());
+	}
+	schedulePeerTasks(np->address(),RR->node->now());
 	return np;
 }
 
@@ -115,34 +129,144 @@ SharedPtr<Peer> Topology::getPeer(void *tPtr,const Address &zta)
 	if (zta == RR->identity.address())
 		return SharedPtr<Peer>();
 
+	_ColdPeer cold;
+	bool promote = false;
 	{
 		Mutex::Lock _l(_peers_m);
 		const SharedPtr<Peer> *const ap = _peers.get(zta);
 		if (ap)
 			return *ap;
+		const _ColdPeer *const cp = _coldPeers.get(zta);
+		if (cp) {
+			cold = *cp;
+			promote = true;
+		}
 	}
 
-	try {
-		Buffer<ZT_PEER_MAX_SERIALIZED_STATE_SIZE> buf;
-		uint64_t idbuf[2]; idbuf[0] = zta.toInt(); idbuf[1] = 0;
-		int len = RR->node->stateObjectGet(tPtr,ZT_STATE_OBJECT_PEER,idbuf,buf.unsafeData(),ZT_PEER_MAX_SERIALIZED_STATE_SIZE);
-		if (len > 0) {
-			buf.setSize(len);
-			Mutex::Lock _l(_peers_m);
-			SharedPtr<Peer> &ap = _peers[zta];
-			if (ap)
-				return ap;
-			ap = Peer::deserializeFromCache(RR->node->now(),tPtr,buf,RR);
-			if (!ap) {
-				_peers.erase(zta);
+	if (promote) {
+		// Promote a demoted peer: no key agreement and no cache lookup needed. The
+		// peer is built before its cold entry is dropped so concurrent lookups find
+		// one or the other, and the cold entry survives if building it throws.
+		try {
+			SharedPtr<Peer> p(new Peer(RR,RR->identity,_coldIdentity(zta,cold),cold.key));
+			Utils::burn(cold.key,sizeof(cold.key));
+			p->setRemoteVersion(cold.vProto,cold.vMajor,cold.vMinor,cold.vRevision);
+			if (cold.ipLength)
+				p->restorePath(getPath(cold.localSocket,InetAddress(cold.ip,cold.ipLength,cold.port)),cold.lastReceive,RR->node->now());
+			SharedPtr<Peer> np;
+			{
+				Mutex::Lock _l(_peers_m);
+				SharedPtr<Peer> &hp = _peers[zta];
+				if (!hp)
+					hp = p;
+				np = hp;
+				_coldPeers.erase(zta);
 			}
+			return addPeer(tPtr,np);
+		} catch ( ... ) {
+			Utils::burn(cold.key,sizeof(cold.key));
+		}
+	}
+
+	{
+		Mutex::Lock _l(_peerLoads_m);
+		const int64_t *const missed = _peerCacheMisses.get(zta);
+		if ((missed)&&((RR->node->now() - *missed) < ZT_PEER_CACHE_MISS_TTL))
 			return SharedPtr<Peer>();
+		if ((!_peerLoadQueue.contains(zta))&&(_peerLoadQueue.size() < ZT_PEER_CACHE_MAX_PENDING_LOADS)) {
+			_peerLoadQueue.set(zta,false);
+			_peerLoadsPending = _peerLoadQueue.size();
 		}
-	} catch ( ... ) {} // ignore invalid identities or other strange failures
+	}
 
 	return SharedPtr<Peer>();
 }
 
+bool Topology::deferWhois(const Address &zta)
+{
+	Mutex::Lock _l(_peerLoads_m);
+	bool *const wantWhois = _peerLoadQueue.get(zta);
+	if (!wantWhois)
+		return false;
+	*wantWhois = true;
+	return true;
+}
+
+bool Topology::loadPendingPeers(void *tPtr,const int64_t now)
+{
+	std::vector< std::pair<Address,bool> > todo;
+	{
+		Mutex::Lock _l(_peerLoads_m);
+		Hashtable< Address,bool >::Iterator i(_peerLoadQueue);
+		Address *a = (Address *)0;
+		bool *wantWhois = (bool *)0;
+		while ((todo.size() < ZT_PEER_CACHE_LOADS_PER_RUN)&&(i.next(a,wantWhois))) {
+			todo.push_back(std::pair<Address,bool>(*a,*wantWhois));
+			_peerLoadQueue.erase(*a);
+		}
+		_peerLoadsPending = _peerLoadQueue.size();
+	}
+
+	for(std::vector< std::pair<Address,bool> >::const_iterator l(todo.begin());l!=todo.end();++l) {
+		const Address &a = l->first;
+		if (getPeerNoCache(a))
+			continue;
+
+		SharedPtr<Peer> p;
+		try {
+			Buffer<ZT_PEER_MAX_SERIALIZED_STATE_SIZE> buf;
+			uint64_t idbuf[2]; idbuf[0] = a.toInt(); idbuf[1] = 0;
+			const int len = RR->node->stateObjectGet(tPtr,ZT_STATE_OBJECT_PEER,idbuf,buf.unsafeData(),ZT_PEER_MAX_SERIALIZED_STATE_SIZE);
+			if (len > 0) {
+				buf.setSize(len);
+				p = Peer::deserializeFromCache(now,tPtr,buf,RR);
+			}
+		} catch ( ... ) {} // ignore invalid identities or other strange failures
+
+		if ((!p)||(p->address() != a)) {
+			{
+				Mutex::Lock _l(_peerLoads_m);
+				if (_peerCacheMisses.size() >= ZT_PEER_CACHE_MISS_MAX) {
+					Hashtable< Address,int64_t >::Iterator i(_peerCacheMisses);
+					Address *k = (Address *)0;
+					int64_t *t = (int64_t *)0;
+					while (i.next(k,t)) {
+						if ((now - *t) >= ZT_PEER_CACHE_MISS_TTL)
+							_peerCacheMisses.erase(*k);
+					}
+					if (_peerCacheMisses.size() >= ZT_PEER_CACHE_MISS_MAX)
+						_peerCacheMisses.clear();
+				}
+				_peerCacheMisses.set(a,now);
+			}
+			if (l->second) // a WHOIS was held back for this load, so send it now
+				RR->sw->requestWhois(tPtr,now,a);
+			continue;
+		}
+
+		RR->sw->doAnythingWaitingForPeer(tPtr,addPeer(tPtr,p));
+	}
+
+	return (_peerLoadsPending != 0);
+}
+
+void Topology::getPeersWithDueTasks(const int64_t now,std::vector< SharedPtr<Peer> > &due)
+{
+	std::vector<Address> a;
+	{
+		Mutex::Lock _l(_peerTimers_m);
+		_peerTimers.expire(now,a);
+	}
+	if (!a.empty()) {
+		Mutex::Lock _l(_peers_m);
+		for(std::vector<Address>::const_iterator i(a.begin());i!=a.end();++i) {
+			const SharedPtr<Peer> *const p = _peers.get(*i);
+			if (p)
+				due.push_back(*p);
+		}
+	}
+}
+
 Identity Topology::getIdentity(void *tPtr,const Address &zta)
 {
 	if (zta == RR->identity.address()) {
@@ -152,33 +276,26 @@ Identity Topology::getIdentity(void *tPtr,const Address &zta)
 		const SharedPtr<Peer> *const ap = _peers.get(zta);
 		if (ap)
 			return (*ap)->identity();
+		const _ColdPeer *const cp = _coldPeers.get(zta);
+		if (cp)
+			return _coldIdentity(zta,*cp);
 	}
 	return Identity();
 }
 
-SharedPtr<Peer> Topology::getUpstreamPeer()
+SharedPtr<Peer> Topology::getUpstreamPeer(const unsigned int rank)
 {
 	const int64_t now = RR->node->now();
-	unsigned int bestq = ~((unsigned int)0);
-	const SharedPtr<Peer> *best = (const SharedPtr<Peer> *)0;
-
-	Mutex::Lock _l2(_peers_m);
-	Mutex::Lock _l1(_upstreams_m);
-
-	for(std::vector<Address>::const_iterator a(_upstreamAddresses.begin());a!=_upstreamAddresses.end();++a) {
-		const SharedPtr<Peer> *p = _peers.get(*a);
-		if (p) {
-			const unsigned int q = (*p)->relayQuality(now);
-			if (q <= bestq) {
-				bestq = q;
-				best = p;
-			}
-		}
+	{
+		Published<_UpstreamRanking>::Reader r(_upstreamRanking);
+		if ((r)&&(now < r->expires))
+			return (rank < r->peers.size()) ? r->peers[rank] : SharedPtr<Peer>();
 	}
-
-	if (!best)
-		return SharedPtr<Peer>();
-	return *best;
+	_rankUpstreams(now);
+	Published<_UpstreamRanking>::Reader r(_upstreamRanking);
+	if ((r)&&(rank < r->peers.size()))
+		return r->peers[rank];
+	return SharedPtr<Peer>();
 }
 
 bool Topology::isUpstream(const Identity &id) const
@@ -368,6 +485,7 @@ void Topology::removeMoon(void *tPtr,const uint64_t id)
 
 void Topology::doPeriodicTasks(void *tPtr,int64_t now)
 {
+	std::vector< SharedPtr<Peer> > expired,demoted;
 	{
 		Mutex::Lock _l1(_peers_m);
 		Mutex::Lock _l2(_upstreams_m);
@@ -376,10 +494,91 @@ void Topology::doPeriodicTasks(void *tPtr,int64_t now)
 		SharedPtr<Peer> *p = (SharedPtr<Peer> *)0;
 		while (i.next(a,p)) {
 			if ( (!(*p)->isAlive(now)) && (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),*a) == _upstreamAddresses.end()) ) {
-				_savePeer(tPtr,*p);
+				expired.push_back(*p);
 				_peers.erase(*a);
 			}
 		}
+
+		// Cold peers were saved when demoted, so expired ones are just dropped
+		Hashtable< Address,_ColdPeer >::Iterator ci(_coldPeers);
+		_ColdPeer *c = (_ColdPeer *)0;
+		while (ci.next(a,c)) {
+			if ((now - c->lastReceive) >= ZT_PEER_ACTIVITY_TIMEOUT) {
+				Utils::burn(c->key,sizeof(c->key));
+				_coldPeers.erase(*a);
+			}
+		}
+
+		// Demote least recently heard from peers beyond the memory budget
+		const uint64_t budget = _peerMemoryBudget;
+		if (budget) {
+			const unsigned long maxPeers = (unsigned long)(budget / (uint64_t)(sizeof(Peer) + sizeof(SharedPtr<Peer>) + sizeof(Address) + sizeof(void *)));
+			if (_peers.size() > maxPeers) {
+				std::vector< std::pair<int64_t,Address> > lru;
+				Hashtable< Address,SharedPtr<Peer> >::Iterator li(_peers);
+				while (li.next(a,p)) {
+					if ( (p->references() <= 1) && (std::find(_upstreamAddresses.begin(),_upstreamAddresses.end(),*a) == _upstreamAddresses.end()) )
+						lru.push_back(std::pair<int64_t,Address>((*p)->lastReceive(),*a));
+				}
+				const unsigned long n = std::min((unsigned long)(_peers.size() - maxPeers),(unsigned long)lru.size());
+				if (n < (unsigned long)lru.size())
+					std::nth_element(lru.begin(),lru.begin() + n,lru.end());
+				for(unsigned long k=0;k<n;++k) {
+					demoted.push_back(_peers[lru[k].second]);
+					_peers.erase(lru[k].second);
+				}
+			}
+		}
+	}
+	// Saved outside _peers_m since the state object callback may do I/O
+	for(std::vector< SharedPtr<Peer> >::const_iterator p(expired.begin());p!=expired.end();++p)
+		_savePeer(tPtr,*p);
+
+	if (!demoted.empty()) {
+		std::vector< std::pair<Address,_ColdPeer> > cold;
+		cold.reserve(demoted.size());
+		for(std::vector< SharedPtr<Peer> >::const_iterator p(demoted.begin());p!=demoted.end();++p) {
+			_savePeer(tPtr,*p);
+			cold.push_back(std::pair<Address,_ColdPeer>((*p)->address(),_ColdPeer()));
+			_ColdPeer &c = cold.back().second;
+			c.publicKey = (*p)->identity().publicKey();
+			memcpy(c.key,(*p)->key(),sizeof(c.key));
+			c.lastReceive = (*p)->lastReceive();
+			c.localSocket = -1;
+			c.port = 0;
+			c.ipLength = 0;
+			const SharedPtr<Path> bp((*p)->getAppropriatePath(now,false));
+			if (bp) {
+				const InetAddress &ba = bp->address();
+				c.localSocket = bp->localSocket();
+				c.port = (uint16_t)ba.port();
+				c.ipLength = (ba.ss_family == AF_INET6) ? 16 : 4;
+				memcpy(c.ip,ba.rawIpData(),c.ipLength);
+			}
+			c.vProto = (uint8_t)(*p)->remoteVersionProtocol();
+			c.vMajor = (uint8_t)(*p)->remoteVersionMajor();
+			c.vMinor = (uint8_t)(*p)->remoteVersionMinor();
+			c.vRevision = (uint16_t)(*p)->remoteVersionRevision();
+		}
+		Mutex::Lock _l(_peers_m);
+		for(std::vector< std::pair<Address,_ColdPeer> >::iterator c(cold.begin());c!=cold.end();++c) {
+			if (!_peers.contains(c->first)) // skip any re-added while unlocked
+				_coldPeers.set(c->first,c->second);
+			Utils::burn(c->second.key,sizeof(c->second.key));
+		}
+	}
+
+	{
+		Mutex::Lock _l(_peerLoads_m);
+		Hashtable< Address,int64_t >::Iterator i(_peerCacheMisses);
+		Address *a = (Address *)0;
+		int64_t *t = (int64_t *)0;
+		while (i.next(a,t)) {
+			if ((now - *t) >= ZT_PEER_CACHE_MISS_TTL)
+				_peerCacheMisses.erase(*a);
+		}
+		for(std::vector< SharedPtr<Peer> >::const_iterator p(expired.begin());p!=expired.end();++p)
+			_peerCacheMisses.erase((*p)->address());
 	}
 
 	{
@@ -394,9 +593,57 @@ void Topology::doPeriodicTasks(void *tPtr,int64_t now)
 	}
 }
 
+void Topology::peerTableStats(unsigned long &peers,unsigned long &coldPeers,unsigned long &bytesPerPeer,unsigned long &bytesPerColdPeer,uint64_t &budget)
+{
+	Mutex::Lock _l(_peers_m);
+	peers = _peers.size();
+	coldPeers = _coldPeers.size();
+	// Object plus Hashtable bucket (key, value, next pointer)
+	bytesPerPeer = (unsigned long)(sizeof(Peer) + sizeof(SharedPtr<Peer>) + sizeof(Address) + sizeof(void *));
+	bytesPerColdPeer = (unsigned long)(sizeof(_ColdPeer) + sizeof(Address) + sizeof(void *));
+	budget = _peerMemoryBudget;
+}
+
+Identity Topology::_coldIdentity(const Address &zta,const _ColdPeer &cold)
+{
+	Buffer<ZT_ADDRESS_LENGTH + 2 + ZT_C25519_PUBLIC_KEY_LEN> b;
+	zta.appendTo(b);
+	b.append((uint8_t)0); // C25519
+	b.append(cold.publicKey.data,ZT_C25519_PUBLIC_KEY_LEN);
+	b.append((uint8_t)0); // no private key
+	return Identity(b);
+}
+
+void Topology::_rankUpstreams(const int64_t now)
+{
+	Mutex::Lock _l2(_peers_m);
+	Mutex::Lock _l1(_upstreams_m);
+
+	{
+		Published<_UpstreamRanking>::Reader r(_upstreamRanking);
+		if ((r)&&(now < r->expires))
+			return; // someone else just ranked them
+	}
+
+	std::vector< std::pair< unsigned int,SharedPtr<Peer> > > q;
+	for(std::vector<Address>::const_iterator a(_upstreamAddresses.begin());a!=_upstreamAddresses.end();++a) {
+		const SharedPtr<Peer> *p = _peers.get(*a);
+		if (p)
+			q.push_back(std::pair< unsigned int,SharedPtr<Peer> >((*p)->relayQuality(now),*p));
+	}
+	std::stable_sort(q.begin(),q.end(),_UpstreamQualityLess());
+
+	_UpstreamRanking *const r = new _UpstreamRanking();
+	for(std::vector< std::pair< unsigned int,SharedPtr<Peer> > >::const_iterator i(q.begin());i!=q.end();++i)
+		r->peers.push_back(i->second);
+	r->expires = now + ZT_UPSTREAM_RANKING_TTL;
+	_upstreamRanking.publish(r);
+}
+
 void Topology::_memoizeUpstreams(void *tPtr)
 {
 	// assumes _upstreams_m and _peers_m are locked
+	_upstreamRanking.publish((_UpstreamRanking *)0); // re-rank on next use
 	_upstreamAddresses.clear();
 	_amUpstream = false;
 
@@ -40,12 +40,15 @@
 
 #include "Address.hpp"
 #include "Identity.hpp"
+#include "C25519.hpp"
 #include "Peer.hpp"
 #include "Path.hpp"
 #include "Mutex.hpp"
 #include "InetAddress.hpp"
 #include "Hashtable.hpp"
+#include "TimerWheel.hpp"
 #include "World.hpp"
+#include "Published.hpp"
 
 namespace ZeroTier {
 
@@ -75,12 +78,44 @@ public:
 	/**
 	 * Get a peer from its address
 	 *
+	 * A peer demoted to cold form is rebuilt and returned. If the peer is not
+	 * in memory at all it is queued to be loaded from the peer cache by
+	 * loadPendingPeers() and NULL is returned. Callers then park whatever
+	 * needed the peer exactly as they do while waiting on WHOIS.
+	 *
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param zta ZeroTier address of peer
 	 * @return Peer or NULL if not found
 	 */
 	SharedPtr<Peer> getPeer(void *tPtr,const Address &zta);
 
+	/**
+	 * Load peers queued by getPeer() misses from the peer cache
+	 *
+	 * State object reads and key agreement happen here without holding the
+	 * peer table lock. Anything waiting for a loaded peer is then retried.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param now Current time
+	 * @return True if loads are still pending after this call
+	 */
+	bool loadPendingPeers(void *tPtr,const int64_t now);
+
+	/**
+	 * @return True if getPeer() has queued peer cache loads
+	 */
+	inline bool peerLoadsPending() const { return (_peerLoadsPending != 0); }
+
+	/**
+	 * Hold off a WHOIS for a peer queued to be loaded from the peer cache
+	 *
+	 * If the load misses, loadPendingPeers() requests the WHOIS instead.
+	 *
+	 * @param zta ZeroTier address of peer
+	 * @return True if a load is pending and the WHOIS should not be sent now
+	 */
+	bool deferWhois(const Address &zta);
+
 	/**
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
 	 * @param zta ZeroTier address of peer
@@ -107,6 +142,16 @@ public:
 		return SharedPtr<Peer>();
 	}
 
+	/**
+	 * @param zta ZeroTier address
+	 * @return True if peer is in memory, either in full or demoted to cold form
+	 */
+	inline bool peerInMemory(const Address &zta)
+	{
+		Mutex::Lock _l(_peers_m);
+		return ((_peers.contains(zta))||(_coldPeers.contains(zta)));
+	}
+
 	/**
 	 * Get a Path object for a given local and remote physical address, creating if needed
 	 *
@@ -124,11 +169,15 @@ public:
 	}
 
 	/**
-	 * Get the current best upstream peer
+	 * Get an upstream peer by its rank in relay quality
 	 *
-	 * @return Upstream or NULL if none available
+	 * The ranking is cached for ZT_UPSTREAM_RANKING_TTL and read without
+	 * locks, so this is cheap enough to call for every relayed packet.
+	 *
+	 * @param rank 0 for the best upstream, 1 for the next best, etc.
+	 * @return Upstream or NULL if none available at this rank
 	 */
-	SharedPtr<Peer> getUpstreamPeer();
+	SharedPtr<Peer> getUpstreamPeer(const unsigned int rank = 0);
 
 	/**
 	 * @param id Identity to check
@@ -287,6 +336,15 @@ public:
 	 */
 	void doPeriodicTasks(void *tPtr,int64_t now);
 
+	/**
+	 * @return Number of full peers in memory
+	 */
+	inline unsigned long countPeers() const
+	{
+		Mutex::Lock _l(_peers_m);
+		return _peers.size();
+	}
+
 	/**
 	 * @param now Current time
 	 * @return Number of peers with active direct paths
@@ -324,6 +382,41 @@ public:
 		}
 	}
 
+	/**
+	 * Schedule a peer's background tasks (pings, keepalives, path expiration)
+	 *
+	 * If the peer is already scheduled earlier than this the earlier deadline is kept.
+	 *
+	 * @param a Peer address
+	 * @param deadline Time at which the peer should next be visited
+	 */
+	inline void schedulePeerTasks(const Address &a,const int64_t deadline)
+	{
+		Mutex::Lock _l(_peerTimers_m);
+		_peerTimers.schedule(a,deadline,true);
+	}
+
+	/**
+	 * Get peers whose scheduled background tasks are due
+	 *
+	 * Returned peers are no longer scheduled and must be rescheduled with
+	 * schedulePeerTasks() if they still need attention.
+	 *
+	 * @param now Current time
+	 * @param due Vector to which due peers are appended
+	 */
+	void getPeersWithDueTasks(const int64_t now,std::vector< SharedPtr<Peer> > &due);
+
+	/**
+	 * @param now Current time
+	 * @return Time at which peer tasks should next be checked or -1 if none are scheduled
+	 */
+	inline int64_t nextPeerTasksDeadline(const int64_t now) const
+	{
+		Mutex::Lock _l(_peerTimers_m);
+		return _peerTimers.nextDeadline(now);
+	}
+
 	/**
 	 * @return All currently active peers by address (unsorted)
 	 */
@@ -333,6 +426,28 @@ public:
 		return _peers.entries();
 	}
 
+	/**
+	 * Set a memory budget for full peers
+	 *
+	 * When there are more full peers than fit in the budget, doPeriodicTasks()
+	 * demotes those heard from least recently to a compact cold form: public
+	 * key, agreed key, remote version and last-known path. Upstreams and peers
+	 * referenced elsewhere are never demoted. getPeer() rebuilds a cold peer
+	 * without key agreement or a cache lookup.
+	 *
+	 * @param bytes Budget in bytes or 0 for no limit (default)
+	 */
+	inline void setPeerMemoryBudget(const uint64_t bytes) { _peerMemoryBudget = bytes; }
+
+	/**
+	 * @param peers Result: full peers in memory
+	 * @param coldPeers Result: peers demoted to cold form
+	 * @param bytesPerPeer Result: approximate memory used by a full peer
+	 * @param bytesPerColdPeer Result: approximate memory used by a cold peer
+	 * @param budget Result: memory budget for full peers (0 for none)
+	 */
+	void peerTableStats(unsigned long &peers,unsigned long &coldPeers,unsigned long &bytesPerPeer,unsigned long &bytesPerColdPeer,uint64_t &budget);
+
 	/**
 	 * @return True if I am a root server in a planet or moon
 	 */
@@ -444,14 +559,43 @@ private:
 	Identity _getIdentity(void *tPtr,const Address &zta);
 	void _memoizeUpstreams(void *tPtr);
 	void _savePeer(void *tPtr,const SharedPtr<Peer> &peer);
+	void _rankUpstreams(const int64_t now);
 
 	const RuntimeEnvironment *const RR;
 
 	std::pair<InetAddress,ZT_PhysicalPathConfiguration> _physicalPathConfig[ZT_MAX_CONFIGURABLE_PATHS];
 	volatile unsigned int _numConfiguredPhysicalPaths;
 
+	// Compact form of a demoted peer (the address is its key in _coldPeers)
+	struct _ColdPeer
+	{
+		C25519::Public publicKey;
+		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+		int64_t lastReceive;
+		int64_t localSocket; // of last-known path
+		uint8_t ip[16]; // of last-known path
+		uint16_t port;
+		uint8_t ipLength; // 4, 16 or 0 if there is no last-known path
+		uint8_t vProto,vMajor,vMinor;
+		uint16_t vRevision;
+	};
+	static Identity _coldIdentity(const Address &zta,const _ColdPeer &cold);
+
 	Hashtable< Address,SharedPtr<Peer> > _peers;
-	Mutex _peers_m;
+	Hashtable< Address,_ColdPeer > _coldPeers;
+	volatile uint64_t _peerMemoryBudget;
+	Mutex _peers_m; // also locks _coldPeers
+
+	TimerWheel< Address > _peerTimers;
+	Mutex _peerTimers_m;
+
+	// Peer cache lookups: recent misses (address to time of miss) and
+	// addresses waiting for loadPendingPeers() (to whether a WHOIS was
+	// deferred until the load is done). Never held with _peers_m.
+	Hashtable< Address,int64_t > _peerCacheMisses;
+	Hashtable< Address,bool > _peerLoadQueue;
+	volatile unsigned long _peerLoadsPending;
+	Mutex _peerLoads_m;
 
 	Hashtable< Path::HashKey,SharedPtr<Path> > _paths;
 	Mutex _paths_m;
@@ -462,6 +606,14 @@ private:
 	std::vector<Address> _upstreamAddresses;
 	bool _amUpstream;
 	Mutex _upstreams_m; // locks worlds, upstream info, moon info, etc.
+
+	// Upstreams sorted by relayQuality(), best first (published under _upstreams_m)
+	struct _UpstreamRanking
+	{
+		std::vector< SharedPtr<Peer> > peers;
+		int64_t expires;
+	};
+	Published<_UpstreamRanking> _upstreamRanking;
 };
 
 } // namespace ZeroTier
@@ -128,6 +128,35 @@ void Trace::peerLinkAggregateStatistics(void *const tPtr,Peer &peer)
 		peer.computeAggregateLinkMeanLatency());
 }
 
+void Trace::peerActivePathChanged(void *const tPtr,Peer &peer,const SharedPtr<Path> &oldPath,const SharedPtr<Path> &newPath)
+{
+	char tmp[128],tmp2[128];
+	if ((!oldPath)||(!newPath)) return; // sanity check
+
+	const bool failover = oldPath->failed();
+	if (failover) {
+		ZT_LOCAL_TRACE(tPtr,RR,"active path to %.10llx failed over from %s to %s (dead path detected after %u ms)",peer.address().toInt(),oldPath->address().toString(tmp),newPath->address().toString(tmp2),oldPath->lastDetectionTime());
+	} else {
+		ZT_LOCAL_TRACE(tPtr,RR,"active path to %.10llx changed from %s to %s",peer.address().toInt(),oldPath->address().toString(tmp),newPath->address().toString(tmp2));
+	}
+
+	if (_globalTarget) {
+		Dictionary<ZT_MAX_REMOTE_TRACE_SIZE> d;
+		d.add(ZT_REMOTE_TRACE_FIELD__EVENT,ZT_REMOTE_TRACE_EVENT__PEER_ACTIVE_PATH_CHANGED_S);
+		d.add(ZT_REMOTE_TRACE_FIELD__REMOTE_ZTADDR,peer.address());
+		d.add(ZT_REMOTE_TRACE_FIELD__REMOTE_PHYADDR,newPath->address().toString(tmp));
+		d.add(ZT_REMOTE_TRACE_FIELD__LOCAL_SOCKET,newPath->localSocket());
+		d.add(ZT_REMOTE_TRACE_FIELD__OLD_REMOTE_PHYADDR,oldPath->address().toString(tmp2));
+		if (failover) {
+			d.add(ZT_REMOTE_TRACE_FIELD__DETECTION_TIME,(uint64_t)oldPath->lastDetectionTime());
+			d.add(ZT_REMOTE_TRACE_FIELD__REASON,"failover");
+		} else {
+			d.add(ZT_REMOTE_TRACE_FIELD__REASON,"failback");
+		}
+		_send(tPtr,d,_globalTarget);
+	}
+}
+
 void Trace::peerLearnedNewPath(void *const tPtr,const uint64_t networkId,Peer &peer,const SharedPtr<Path> &newPath,const uint64_t packetId)
 {
 	char tmp[128];
@@ -529,11 +558,11 @@ void Trace::updateMemoizedSettings()
 		Mutex::Lock l(_byNet_m);
 		_byNet.clear();
 		for(std::vector< SharedPtr<Network> >::const_iterator n(nws.begin());n!=nws.end();++n) {
-			const Address dest((*n)->config().remoteTraceTarget);
+			const Address dest((*n)->config()->remoteTraceTarget);
 			if (dest) {
 				std::pair<Address,Trace::Level> &m = _byNet[(*n)->id()];
 				m.first = dest;
-				m.second = (*n)->config().remoteTraceLevel;
+				m.second = (*n)->config()->remoteTraceLevel;
 			}
 		}
 	}
@@ -126,6 +126,7 @@ public:
 	void peerLinkNoLongerRedundant(void *const tPtr,Peer &peer);
 
 	void peerLinkAggregateStatistics(void *const tPtr,Peer &peer);
+	void peerActivePathChanged(void *const tPtr,Peer &peer,const SharedPtr<Path> &oldPath,const SharedPtr<Path> &newPath);
 
 	void peerLearnedNewPath(void *const tPtr,const uint64_t networkId,Peer &peer,const SharedPtr<Path> &newPath,const uint64_t packetId);
 	void peerRedirected(void *const tPtr,const uint64_t networkId,Peer &peer,const SharedPtr<Path> &newPath);
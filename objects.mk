@@ -1,13 +1,16 @@
 CORE_OBJS=\
+	node/AdaptiveCompression.o \
 	node/C25519.o \
 	node/Capability.o \
 	node/CertificateOfMembership.o \
 	node/CertificateOfOwnership.o \
+	node/CompiledRules.o \
 	node/Identity.o \
 	node/IncomingPacket.o \
 	node/InetAddress.o \
 	node/Membership.o \
 	node/Multicaster.o \
+	node/NeighborCache.o \
 	node/Network.o \
 	node/NetworkConfig.o \
 	node/Node.o \
@@ -38,6 +41,7 @@ ONE_OBJS=\
 	osdep/ManagedRoute.o \
 	osdep/Http.o \
 	osdep/OSUtils.o \
+	osdep/PeerStore.o \
 	service/SoftwareUpdater.o \
 	service/OneService.o
 
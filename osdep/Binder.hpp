@@ -73,6 +73,9 @@
 // Max number of bindings
 #define ZT_BINDER_MAX_BINDINGS 256
 
+// Number of locks UDP sockets are spread over for per-packet socket options
+#define ZT_BINDER_SEND_LOCKS 16
+
 namespace ZeroTier {
 
 /**
@@ -421,6 +424,7 @@ public:
 		bool r = false;
 		Mutex::Lock _l(_lock);
 		for(unsigned int b=0,c=_bindingCount;b<c;++b) {
+			Mutex::Lock _l2(_sendLock(_bindings[b].udpSock));
 			if (ttl) phy.setIp4UdpTtl(_bindings[b].udpSock,ttl);
 			if (phy.udpSend(_bindings[b].udpSock,(const struct sockaddr *)addr,data,len)) r = true;
 			if (ttl) phy.setIp4UdpTtl(_bindings[b].udpSock,255);
@@ -428,6 +432,34 @@ public:
 		return r;
 	}
 
+	/**
+	 * Send from one bound UDP socket with an IPv4 TTL and don't fragment bit for this packet only
+	 *
+	 * Socket options are set and restored around the send while holding a lock
+	 * that every send through this class takes, so concurrent sends on the same
+	 * socket from other threads never go out with them.
+	 *
+	 * @param phy Phy instance that owns the socket
+	 * @param udpSock Bound UDP socket
+	 * @param addr Destination address
+	 * @param data Packet data
+	 * @param len Packet length
+	 * @param ttl IPv4 TTL or 0 for default
+	 * @param dontFragment If true, set the don't fragment bit
+	 * @return True if the packet was sent
+	 */
+	template<typename PHY_HANDLER_TYPE>
+	inline bool udpSend(Phy<PHY_HANDLER_TYPE> &phy,PhySocket *const udpSock,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl,bool dontFragment)
+	{
+		Mutex::Lock _l(_sendLock(udpSock));
+		if ((ttl)&&(addr->ss_family == AF_INET)) phy.setIp4UdpTtl(udpSock,ttl);
+		if (dontFragment) phy.setUdpDontFragment(udpSock,true);
+		const bool r = phy.udpSend(udpSock,(const struct sockaddr *)addr,data,len);
+		if (dontFragment) phy.setUdpDontFragment(udpSock,false);
+		if ((ttl)&&(addr->ss_family == AF_INET)) phy.setIp4UdpTtl(udpSock,255);
+		return r;
+	}
+
 	/**
 	 * @param addr Address to check
 	 * @return True if this is a bound local interface address
@@ -458,9 +490,12 @@ public:
 	}
 
 private:
+	inline Mutex &_sendLock(PhySocket *const udpSock) { return _sendLocks[(unsigned int)(((uintptr_t)udpSock >> 4) % ZT_BINDER_SEND_LOCKS)]; }
+
 	_Binding _bindings[ZT_BINDER_MAX_BINDINGS];
 	std::atomic<unsigned int> _bindingCount;
 	Mutex _lock;
+	Mutex _sendLocks[ZT_BINDER_SEND_LOCKS];
 };
 
 } // namespace ZeroTier
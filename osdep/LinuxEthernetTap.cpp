@@ -484,10 +484,26 @@ void LinuxEthernetTap::threadMain()
 	nfds = (int)std::max(_shutdownSignalPipe[0],_fd) + 1;
 
 	r = 0;
+	bool batchEnd = false;
 	for(;;) {
 		FD_SET(_shutdownSignalPipe[0],&readfds);
 		FD_SET(_fd,&readfds);
-		select(nfds,&readfds,&nullfds,&nullfds,(struct timeval *)0);
+		if (batchEnd) {
+			// Poll first: if nothing else is waiting this batch of frames is done,
+			// so tell the handler (zero length frame) before blocking again.
+			struct timeval noWait;
+			noWait.tv_sec = 0;
+			noWait.tv_usec = 0;
+			if (select(nfds,&readfds,(fd_set *)0,(fd_set *)0,&noWait) <= 0) {
+				batchEnd = false;
+				_handler(_arg,(void *)0,_nwid,from,to,0,0,(const void *)0,0);
+				FD_SET(_shutdownSignalPipe[0],&readfds);
+				FD_SET(_fd,&readfds);
+				select(nfds,&readfds,(fd_set *)0,(fd_set *)0,(struct timeval *)0);
+			}
+		} else {
+			select(nfds,&readfds,&nullfds,&nullfds,(struct timeval *)0);
+		}
 
 		if (FD_ISSET(_shutdownSignalPipe[0],&readfds)) // writes to shutdown pipe terminate thread
 			break;
@@ -512,6 +528,7 @@ void LinuxEthernetTap::threadMain()
 						unsigned int etherType = ntohs(((const uint16_t *)getBuf)[6]);
 						// TODO: VLAN support
 						_handler(_arg,(void *)0,_nwid,from,to,etherType,0,(const void *)(getBuf + 14),r - 14);
+						batchEnd = true;
 					}
 
 					r = 0;
@@ -0,0 +1,544 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2019  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __WINDOWS__
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#include <vector>
+
+#include "PeerStore.hpp"
+#include "OSUtils.hpp"
+#include "../node/Utils.hpp"
+
+#define ZT_PEER_STORE_HEADER_SIZE 8
+#define ZT_PEER_STORE_RECORD_HEADER_SIZE 24
+
+namespace ZeroTier {
+
+static const char ZT_PEER_STORE_MAGIC[ZT_PEER_STORE_HEADER_SIZE] = { 'Z','T','P','E','E','R','S',0x01 };
+
+static uint32_t _fnv1a(const void *data,unsigned int len)
+{
+	uint32_t h = 0x811c9dc5;
+	for(unsigned int i=0;i<len;++i) {
+		h ^= (uint32_t)reinterpret_cast<const uint8_t *>(data)[i];
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+static inline void _put32(std::string &s,uint32_t v)
+{
+	v = Utils::hton(v);
+	s.append(reinterpret_cast<const char *>(&v),4);
+}
+
+static inline void _put64(std::string &s,uint64_t v)
+{
+	v = Utils::hton(v);
+	s.append(reinterpret_cast<const char *>(&v),8);
+}
+
+static inline uint32_t _get32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v,p,4);
+	return Utils::ntoh(v);
+}
+
+static inline uint64_t _get64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v,p,8);
+	return Utils::ntoh(v);
+}
+
+static void _appendRecord(std::string &s,const uint64_t id,const int64_t timestamp,const void *data,const unsigned int len)
+{
+	_put64(s,id);
+	_put64(s,(uint64_t)timestamp);
+	_put32(s,(uint32_t)len);
+	_put32(s,_fnv1a(data,len));
+	if (len)
+		s.append(reinterpret_cast<const char *>(data),len);
+}
+
+// Write a file and make sure it's on disk before it replaces anything
+static bool _writeSynced(const char *path,const std::string &data)
+{
+#ifdef __WINDOWS__
+	FILE *const f = fopen(path,"wb");
+	if (!f)
+		return false;
+	bool ok = ((data.length() == 0)||(fwrite(data.data(),data.length(),1,f) == 1));
+	ok &= (fflush(f) == 0);
+	ok &= (_commit(_fileno(f)) == 0);
+	ok &= (fclose(f) == 0);
+	return ok;
+#else
+	const int fd = ::open(path,O_WRONLY|O_CREAT|O_TRUNC,0644);
+	if (fd < 0)
+		return false;
+	size_t written = 0;
+	while (written < data.length()) {
+		const ssize_t n = ::write(fd,data.data() + written,data.length() - written);
+		if (n <= 0) {
+			::close(fd);
+			return false;
+		}
+		written += (size_t)n;
+	}
+	bool ok = (fsync(fd) == 0);
+	ok &= (::close(fd) == 0);
+	return ok;
+#endif
+}
+
+PeerStore::PeerStore() :
+	_flushed(0),
+	_live(0),
+#ifdef __WINDOWS__
+	_f((FILE *)0)
+#else
+	_fd(-1),
+	_mapped((const uint8_t *)0),
+	_mappedLength(0)
+#endif
+{
+}
+
+PeerStore::~PeerStore()
+{
+	Mutex::Lock _l(_lock);
+	_close();
+}
+
+bool PeerStore::open(const char *path)
+{
+	Mutex::Lock _l(_lock);
+	return _open(path);
+}
+
+void PeerStore::close()
+{
+	Mutex::Lock _l(_lock);
+	_close();
+}
+
+unsigned long PeerStore::importDirectory(const char *path,const int64_t now)
+{
+	unsigned long n = 0;
+	const std::vector<std::string> files(OSUtils::listDirectory(path));
+	for(std::vector<std::string>::const_iterator f(files.begin());f!=files.end();++f) {
+		if ((f->length() != 15)||(f->substr(10) != ".peer"))
+			continue;
+		const std::string fp(std::string(path) + ZT_PATH_SEPARATOR_S + *f);
+		std::string buf;
+		if ((OSUtils::readFile(fp.c_str(),buf))&&(buf.length() > 0)) {
+			const int64_t lm = (int64_t)OSUtils::getLastModified(fp.c_str());
+			put(Utils::hexStrToU64(f->substr(0,10).c_str()),buf.data(),(unsigned int)buf.length(),(lm > 0) ? lm : now);
+			++n;
+		}
+	}
+	return n;
+}
+
+int PeerStore::get(const uint64_t id,void *data,const unsigned int maxlen)
+{
+	Mutex::Lock _l(_lock);
+	const _Entry *const e = _index.get(id);
+	if ((!e)||(e->length > maxlen))
+		return -1;
+	const uint8_t *const p = _at(e->offset);
+	if (!p)
+		return -1;
+	memcpy(data,p,e->length);
+	return (int)e->length;
+}
+
+void PeerStore::put(const uint64_t id,const void *data,const unsigned int len,const int64_t now)
+{
+	if (!len) {
+		remove(id,now);
+		return;
+	}
+	Mutex::Lock _l(_lock);
+	const _Entry *const e = _index.get(id);
+	if ((e)&&(e->length == len)) {
+		const uint8_t *const p = _at(e->offset);
+		if ((p)&&(memcmp(p,data,len) == 0))
+			return;
+	}
+	_append(id,now,data,len);
+	if (_pending.length() >= ZT_PEER_STORE_FLUSH_SIZE)
+		_flush();
+}
+
+void PeerStore::remove(const uint64_t id,const int64_t now)
+{
+	Mutex::Lock _l(_lock);
+	if (_index.contains(id))
+		_append(id,now,(const void *)0,0);
+}
+
+unsigned long PeerStore::expire(const int64_t olderThan,const int64_t now)
+{
+	Mutex::Lock _l(_lock);
+	std::vector<uint64_t> old;
+	Hashtable< uint64_t,_Entry >::Iterator i(_index);
+	uint64_t *id = (uint64_t *)0;
+	_Entry *e = (_Entry *)0;
+	while (i.next(id,e)) {
+		if (e->timestamp < olderThan)
+			old.push_back(*id);
+	}
+	for(std::vector<uint64_t>::const_iterator o(old.begin());o!=old.end();++o)
+		_append(*o,now,(const void *)0,0);
+	return (unsigned long)old.size();
+}
+
+void PeerStore::flush()
+{
+	Mutex::Lock _l(_lock);
+	_flush();
+}
+
+bool PeerStore::compact(const bool force)
+{
+	Mutex::Lock _l(_lock);
+	if (!_path.length())
+		return false;
+	const uint64_t total = _flushed + (uint64_t)_pending.length();
+	if ((!force)&&((total < ZT_PEER_STORE_COMPACT_MIN_SIZE)||((total - _live) < _live)))
+		return false;
+
+	std::string image;
+	image.reserve((size_t)(_live + ZT_PEER_STORE_HEADER_SIZE));
+	image.append(ZT_PEER_STORE_MAGIC,ZT_PEER_STORE_HEADER_SIZE);
+	Hashtable< uint64_t,_Entry >::Iterator i(_index);
+	uint64_t *id = (uint64_t *)0;
+	_Entry *e = (_Entry *)0;
+	while (i.next(id,e)) {
+		const uint8_t *const p = _at(e->offset);
+		if (p)
+			_appendRecord(image,*id,e->timestamp,p,e->length);
+	}
+
+	const std::string tmp(_path + ".tmp");
+	if (!_writeSynced(tmp.c_str(),image)) {
+		OSUtils::rm(tmp.c_str());
+		return false;
+	}
+
+	const std::string path(_path);
+#ifdef __WINDOWS__
+	// An open file can't be replaced here, so close the old one first with
+	// everything buffered flushed to it in case the rename fails
+	// everything buffered flushed to it in case the rename fails. Unlike
+	// OSUtils::rename() this replaces the old file in one step.
+	_close();
+	if (!MoveFileExA(tmp.c_str(),path.c_str(),MOVEFILE_REPLACE_EXISTING|MOVEFILE_WRITE_THROUGH)) {
+		// Never delete the new file unless the old one is still there
+		if (OSUtils::fileExists(path.c_str(),false))
+			OSUtils::rm(tmp.c_str());
+		else fprintf(stderr,"WARNING: unable to replace file: %s (compacted copy left in %s)" ZT_EOL_S,path.c_str(),tmp.c_str());
+		_open(path.c_str());
+		return false;
+	}
+#else
+	// If the old file can't be replaced keep everything buffered so it is
+	// appended to the old file as usual
+	if (!OSUtils::rename(tmp.c_str(),path.c_str())) {
+		// Never delete the new file unless the old one is still there
+		if (OSUtils::fileExists(path.c_str(),false))
+			OSUtils::rm(tmp.c_str());
+		else fprintf(stderr,"WARNING: unable to replace file: %s (compacted copy left in %s)" ZT_EOL_S,path.c_str(),tmp.c_str());
+		return false;
+	}
+
+	// Everything buffered is in the new file, so drop it rather than append it to the old one
+	_pending.clear();
+	_close();
+#endif
+	return _open(path.c_str());
+}
+
+bool PeerStore::_open(const char *path)
+{
+	_close();
+	_path = path;
+
+#ifdef __WINDOWS__
+	_f = fopen(path,"r+b");
+	if (!_f)
+		_f = fopen(path,"w+b");
+	if (!_f)
+		return false;
+	{
+		char buf[16384];
+		fseek(_f,0,SEEK_SET);
+		for(;;) {
+			const size_t n = fread(buf,1,sizeof(buf),_f);
+			if (n == 0)
+				break;
+			_image.append(buf,n);
+		}
+	}
+	if ((_image.length() < ZT_PEER_STORE_HEADER_SIZE)||(memcmp(_image.data(),ZT_PEER_STORE_MAGIC,ZT_PEER_STORE_HEADER_SIZE) != 0)) {
+		_chsize(_fileno(_f),0);
+		fseek(_f,0,SEEK_SET);
+		fwrite(ZT_PEER_STORE_MAGIC,ZT_PEER_STORE_HEADER_SIZE,1,_f);
+		fflush(_f);
+		_image.assign(ZT_PEER_STORE_MAGIC,ZT_PEER_STORE_HEADER_SIZE);
+	}
+	_flushed = _image.length();
+#else
+	_fd = ::open(path,O_RDWR|O_CREAT,0644);
+	if (_fd < 0)
+		return false;
+	::fcntl(_fd,F_SETFD,::fcntl(_fd,F_GETFD) | FD_CLOEXEC);
+	struct stat st;
+	if (fstat(_fd,&st) != 0) {
+		_close();
+		return false;
+	}
+	char magic[ZT_PEER_STORE_HEADER_SIZE];
+	if ((st.st_size < ZT_PEER_STORE_HEADER_SIZE)||(pread(_fd,magic,ZT_PEER_STORE_HEADER_SIZE,0) != ZT_PEER_STORE_HEADER_SIZE)||(memcmp(magic,ZT_PEER_STORE_MAGIC,ZT_PEER_STORE_HEADER_SIZE) != 0)) {
+		if ((ftruncate(_fd,0) != 0)||(pwrite(_fd,ZT_PEER_STORE_MAGIC,ZT_PEER_STORE_HEADER_SIZE,0) != ZT_PEER_STORE_HEADER_SIZE)) {
+			_close();
+			return false;
+		}
+		st.st_size = ZT_PEER_STORE_HEADER_SIZE;
+	}
+	_flushed = (uint64_t)st.st_size;
+	if (!_map()) {
+		_close();
+		return false;
+	}
+#endif
+
+	return _indexFile();
+}
+
+bool PeerStore::_indexFile()
+{
+	// Index all records, stopping at the first torn or corrupt one
+	uint64_t ptr = ZT_PEER_STORE_HEADER_SIZE;
+	while ((ptr + ZT_PEER_STORE_RECORD_HEADER_SIZE) <= _flushed) {
+		const uint8_t *const h = _at(ptr);
+		const uint64_t id = _get64(h);
+		const int64_t timestamp = (int64_t)_get64(h + 8);
+		const uint32_t len = _get32(h + 16);
+		if ((ptr + ZT_PEER_STORE_RECORD_HEADER_SIZE + (uint64_t)len) > _flushed)
+			break;
+		if (_fnv1a(h + ZT_PEER_STORE_RECORD_HEADER_SIZE,len) != _get32(h + 20))
+			break;
+
+		const _Entry *const old = _index.get(id);
+		if (old)
+			_live -= ZT_PEER_STORE_RECORD_HEADER_SIZE + old->length;
+		if (len) {
+			_Entry &e = _index[id];
+			e.offset = ptr + ZT_PEER_STORE_RECORD_HEADER_SIZE;
+			e.timestamp = timestamp;
+			e.length = len;
+			_live += ZT_PEER_STORE_RECORD_HEADER_SIZE + len;
+		} else {
+			_index.erase(id);
+		}
+
+		ptr += ZT_PEER_STORE_RECORD_HEADER_SIZE + len;
+	}
+
+	if (ptr < _flushed) {
+		// Drop the torn tail so new records are appended after the last good one
+#ifdef __WINDOWS__
+		_chsize(_fileno(_f),(long)ptr);
+		_image.resize((size_t)ptr);
+		_flushed = ptr;
+#else
+		_unmap();
+		if (ftruncate(_fd,(off_t)ptr) != 0) {
+			_close();
+			return false;
+		}
+		_flushed = ptr;
+		if (!_map()) {
+			_close();
+			return false;
+		}
+#endif
+	}
+
+	return true;
+}
+
+const uint8_t *PeerStore::_at(const uint64_t offset) const
+{
+	if (offset >= _flushed)
+		return reinterpret_cast<const uint8_t *>(_pending.data()) + (offset - _flushed);
+#ifdef __WINDOWS__
+	return reinterpret_cast<const uint8_t *>(_image.data()) + offset;
+#else
+	return (_mapped) ? (_mapped + offset) : (const uint8_t *)0;
+#endif
+}
+
+void PeerStore::_append(const uint64_t id,const int64_t timestamp,const void *data,const unsigned int len)
+{
+	const uint64_t offset = _flushed + (uint64_t)_pending.length();
+	_appendRecord(_pending,id,timestamp,data,len);
+
+	const _Entry *const old = _index.get(id);
+	if (old)
+		_live -= ZT_PEER_STORE_RECORD_HEADER_SIZE + old->length;
+	if (len) {
+		_Entry &e = _index[id];
+		e.offset = offset + ZT_PEER_STORE_RECORD_HEADER_SIZE;
+		e.timestamp = timestamp;
+		e.length = len;
+		_live += ZT_PEER_STORE_RECORD_HEADER_SIZE + len;
+	} else {
+		_index.erase(id);
+	}
+}
+
+void PeerStore::_flush()
+{
+	if (!_pending.length())
+		return;
+#ifdef __WINDOWS__
+	if (!_f)
+		return;
+	fseek(_f,0,SEEK_END);
+	if ((fwrite(_pending.data(),_pending.length(),1,_f) != 1)||(fflush(_f) != 0)) {
+		// Cut off anything partially written so the retry lands in the right place
+		_chsize(_fileno(_f),(long)_flushed);
+		_writeFailed();
+		return;
+	}
+	_image.append(_pending);
+#else
+	if (_fd < 0)
+		return;
+	uint64_t written = 0;
+	while (written < (uint64_t)_pending.length()) {
+		const ssize_t n = pwrite(_fd,_pending.data() + written,_pending.length() - (size_t)written,(off_t)(_flushed + written));
+		if (n <= 0) {
+			// Records stay in the append buffer and are retried on the next flush,
+			// which rewrites anything partially written here from the same offset
+			if ((written)&&(ftruncate(_fd,(off_t)_flushed) != 0))
+				fprintf(stderr,"WARNING: unable to truncate partial write to file: %s (I/O error)" ZT_EOL_S,_path.c_str());
+			_writeFailed();
+			return;
+		}
+		written += (uint64_t)n;
+	}
+	_unmap();
+#endif
+	_flushed += (uint64_t)_pending.length();
+	_pending.clear();
+#ifndef __WINDOWS__
+	_map();
+#endif
+}
+
+void PeerStore::_writeFailed()
+{
+	fprintf(stderr,"WARNING: unable to write to file: %s (I/O error)" ZT_EOL_S,_path.c_str());
+	if (_pending.length() < ZT_PEER_STORE_MAX_PENDING)
+		return;
+
+	// Give up on buffered records rather than grow without bound, and go back
+	// to the last state on disk since the index may point into the buffer
+	fprintf(stderr,"WARNING: dropping %lu bytes of records that could not be written to file: %s" ZT_EOL_S,(unsigned long)_pending.length(),_path.c_str());
+	_pending.clear();
+	_index.clear();
+	_live = 0;
+	_indexFile();
+}
+
+bool PeerStore::_map()
+{
+#ifndef __WINDOWS__
+	_unmap();
+	if ((_fd < 0)||(!_flushed))
+		return false;
+	void *const m = mmap((void *)0,(size_t)_flushed,PROT_READ,MAP_SHARED,_fd,0);
+	if (m == MAP_FAILED)
+		return false;
+	_mapped = reinterpret_cast<const uint8_t *>(m);
+	_mappedLength = _flushed;
+#endif
+	return true;
+}
+
+void PeerStore::_unmap()
+{
+#ifndef __WINDOWS__
+	if (_mapped) {
+		munmap(const_cast<uint8_t *>(_mapped),(size_t)_mappedLength);
+		_mapped = (const uint8_t *)0;
+		_mappedLength = 0;
+	}
+#endif
+}
+
+void PeerStore::_close()
+{
+	_flush();
+#ifdef __WINDOWS__
+	if (_f) {
+		fclose(_f);
+		_f = (FILE *)0;
+	}
+	_image.clear();
+#else
+	_unmap();
+	if (_fd >= 0) {
+		::close(_fd);
+		_fd = -1;
+	}
+#endif
+	_index.clear();
+	_pending.clear();
+	_flushed = 0;
+	_live = 0;
+}
+
+} // namespace ZeroTier
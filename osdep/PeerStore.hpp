@@ -0,0 +1,230 @@
+/*
+ * ZeroTier One - Network Virtualization Everywhere
+ * Copyright (C) 2011-2019  ZeroTier, Inc.  https://www.zerotier.com/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * --
+ *
+ * You can be released from the requirements of the license by purchasing
+ * a commercial license. Buying such a license is mandatory as soon as you
+ * develop commercial closed-source software that incorporates or links
+ * directly against ZeroTier software without disclosing the source code
+ * of your own application.
+ */
+
+#ifndef ZT_PEERSTORE_HPP
+#define ZT_PEERSTORE_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "../node/Constants.hpp"
+#include "../node/Hashtable.hpp"
+#include "../node/Mutex.hpp"
+
+/**
+ * Buffered appends are written to the file once this many bytes are pending
+ */
+#define ZT_PEER_STORE_FLUSH_SIZE 65536
+
+/**
+ * Interval in ms at which the service writes buffered appends
+ */
+#define ZT_PEER_STORE_FLUSH_INTERVAL 10000
+
+/**
+ * Files smaller than this are never compacted
+ */
+#define ZT_PEER_STORE_COMPACT_MIN_SIZE 1048576
+
+/**
+ * Buffered appends are dropped if this many bytes can't be written
+ */
+#define ZT_PEER_STORE_MAX_PENDING (ZT_PEER_STORE_FLUSH_SIZE * 16)
+
+namespace ZeroTier {
+
+/**
+ * Append-only single file store for cached peer state objects
+ *
+ * This replaces one file per peer under peers.d. Records are only ever
+ * appended (a newer record for the same ID replaces an older one and a
+ * zero length record deletes it) and an in-memory index maps each ID to
+ * its latest record. On Unix-like systems the file is memory mapped, so
+ * get() is an index lookup and a copy out of the mapping. Records written
+ * since the last flush() are served from the append buffer.
+ *
+ * When more than half the file is superseded records it is rewritten with
+ * only live records by compact(). A torn record at the end of the file,
+ * e.g. after a crash, is detected by its checksum and dropped on open().
+ * If writes keep failing, buffered records beyond ZT_PEER_STORE_MAX_PENDING
+ * are dropped and the index reverts to what is on disk.
+ *
+ * File format:
+ *   <[8] "ZTPEERS" and format version 0x01>
+ *   [... records ...]
+ *
+ * Record format:
+ *   <[8] ID (big-endian)>
+ *   <[8] timestamp of put() in ms (big-endian)>
+ *   <[4] length of data or 0 if deleted (big-endian)>
+ *   <[4] FNV-1a hash of data (big-endian)>
+ *   <[...] data>
+ *
+ * All methods are thread safe.
+ */
+class PeerStore
+{
+public:
+	PeerStore();
+	~PeerStore();
+
+	/**
+	 * Open (creating if necessary) and index a store file
+	 *
+	 * @param path Path to store file
+	 * @return True on success
+	 */
+	bool open(const char *path);
+
+	/**
+	 * Flush any buffered records and close the store
+	 */
+	void close();
+
+	/**
+	 * Import all XXXXXXXXXX.peer files in an old style peers.d directory
+	 *
+	 * @param path Directory path
+	 * @param now Current time
+	 * @return Number of peers imported
+	 */
+	unsigned long importDirectory(const char *path,const int64_t now);
+
+	/**
+	 * @param id Object ID
+	 * @param data Buffer to fill
+	 * @param maxlen Size of buffer
+	 * @return Length of object or -1 if not found or too large for buffer
+	 */
+	int get(const uint64_t id,void *data,const unsigned int maxlen);
+
+	/**
+	 * Store an object (does nothing if the stored copy is identical)
+	 *
+	 * @param id Object ID
+	 * @param data Object data
+	 * @param len Length of object data (must be non-zero)
+	 * @param now Current time
+	 */
+	void put(const uint64_t id,const void *data,const unsigned int len,const int64_t now);
+
+	/**
+	 * @param id Object ID to delete
+	 * @param now Current time
+	 */
+	void remove(const uint64_t id,const int64_t now);
+
+	/**
+	 * Delete all objects last stored before a given time
+	 *
+	 * @param olderThan Time before which objects are deleted
+	 * @param now Current time
+	 * @return Number of objects deleted
+	 */
+	unsigned long expire(const int64_t olderThan,const int64_t now);
+
+	/**
+	 * Write buffered records to the file
+	 */
+	void flush();
+
+	/**
+	 * Rewrite the file with only live records if enough of it is superseded
+	 *
+	 * @param force If true, compact even if the file is small or mostly live
+	 * @return True if the file was rewritten
+	 */
+	bool compact(const bool force = false);
+
+	/**
+	 * @return Number of objects in store
+	 */
+	inline unsigned long size() const
+	{
+		Mutex::Lock _l(_lock);
+		return _index.size();
+	}
+
+	/**
+	 * @return Total size of store including buffered records in bytes
+	 */
+	inline uint64_t totalBytes() const
+	{
+		Mutex::Lock _l(_lock);
+		return (_flushed + (uint64_t)_pending.length());
+	}
+
+	/**
+	 * @return Bytes taken by live records
+	 */
+	inline uint64_t liveBytes() const
+	{
+		Mutex::Lock _l(_lock);
+		return _live;
+	}
+
+private:
+	struct _Entry
+	{
+		_Entry() : offset(0),timestamp(0),length(0) {}
+		uint64_t offset; // offset of record data within file (or append buffer if >= _flushed)
+		int64_t timestamp;
+		uint32_t length;
+	};
+
+	bool _open(const char *path);
+	bool _indexFile();
+	void _writeFailed();
+	const uint8_t *_at(const uint64_t offset) const;
+	void _append(const uint64_t id,const int64_t timestamp,const void *data,const unsigned int len);
+	void _flush();
+	bool _map();
+	void _unmap();
+	void _close();
+
+	std::string _path;
+	Hashtable< uint64_t,_Entry > _index;
+	std::string _pending; // appended records not yet written
+	uint64_t _flushed; // bytes of file on disk (and mapped)
+	uint64_t _live; // bytes of live records including headers
+
+#ifdef __WINDOWS__
+	FILE *_f;
+	std::string _image; // copy of file contents (no mmap on Windows)
+#else
+	int _fd;
+	const uint8_t *_mapped;
+	uint64_t _mappedLength;
+#endif
+
+	Mutex _lock;
+};
+
+} // namespace ZeroTier
+
+#endif
@@ -505,6 +505,46 @@ public:
 #endif
 	}
 
+	/**
+	 * Set or clear the don't fragment bit for outgoing packets (UDP sockets only)
+	 *
+	 * Where the platform allows it the kernel's path MTU cache is bypassed too,
+	 * since this is meant for path MTU probes that must go out exactly as given.
+	 * Clearing it restores the default of letting packets be fragmented.
+	 *
+	 * @param sock UDP socket
+	 * @param df True to set don't fragment
+	 * @return True on success
+	 */
+	inline bool setUdpDontFragment(PhySocket *sock,bool df)
+	{
+		PhySocketImpl &sws = *(reinterpret_cast<PhySocketImpl *>(sock));
+		bool ok = false;
+#if defined(_WIN32) || defined(_WIN64)
+		DWORD f = (df) ? 1 : 0;
+		if (sws.saddr.ss_family == AF_INET6)
+			ok = (::setsockopt(sws.sock,IPPROTO_IPV6,IPV6_DONTFRAG,(const char *)&f,sizeof(f)) == 0);
+		else ok = (::setsockopt(sws.sock,IPPROTO_IP,IP_DONTFRAGMENT,(const char *)&f,sizeof(f)) == 0);
+#else
+		int f;
+		if (sws.saddr.ss_family == AF_INET6) {
+#if defined(IPV6_MTU_DISCOVER) && defined(IPV6_PMTUDISC_PROBE)
+			f = (df) ? IPV6_PMTUDISC_PROBE : 0; ok = (::setsockopt(sws.sock,IPPROTO_IPV6,IPV6_MTU_DISCOVER,&f,sizeof(f)) == 0);
+#endif
+#ifdef IPV6_DONTFRAG
+			f = (df) ? 1 : 0; ok |= (::setsockopt(sws.sock,IPPROTO_IPV6,IPV6_DONTFRAG,&f,sizeof(f)) == 0);
+#endif
+		} else {
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+			f = (df) ? IP_PMTUDISC_PROBE : 0; ok = (::setsockopt(sws.sock,IPPROTO_IP,IP_MTU_DISCOVER,&f,sizeof(f)) == 0);
+#elif defined(IP_DONTFRAG)
+			f = (df) ? 1 : 0; ok = (::setsockopt(sws.sock,IPPROTO_IP,IP_DONTFRAG,&f,sizeof(f)) == 0);
+#endif
+		}
+#endif
+		return ok;
+	}
+
 	/**
 	 * Send a UDP packet
 	 *
@@ -33,10 +33,14 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <map>
 #include <thread>
 
+#include "version.h"
+
 #include "node/Constants.hpp"
 #include "node/Hashtable.hpp"
+#include "node/TimerWheel.hpp"
 #include "node/RuntimeEnvironment.hpp"
 #include "node/InetAddress.hpp"
 #include "node/Utils.hpp"
@@ -46,16 +50,31 @@
 #include "node/Salsa20.hpp"
 #include "node/MAC.hpp"
 #include "node/NetworkConfig.hpp"
+#include "node/CompiledRules.hpp"
+#include "node/Switch.hpp"
+#include "node/Multicaster.hpp"
+#include "node/NeighborCache.hpp"
+#include "node/AdaptiveCompression.hpp"
+#include "node/CertificateOfOwnership.hpp"
 #include "node/Peer.hpp"
+#include "node/RingBuffer.hpp"
+#include "node/Published.hpp"
 #include "node/Dictionary.hpp"
 #include "node/SHA512.hpp"
 #include "node/C25519.hpp"
 #include "node/Poly1305.hpp"
 #include "node/CertificateOfMembership.hpp"
 #include "node/Node.hpp"
+#include "node/World.hpp"
 #include "node/IncomingPacket.hpp"
+#include "node/Membership.hpp"
+#include "node/Revocation.hpp"
+#include "node/Tag.hpp"
+#include "node/Topology.hpp"
+#include "node/Trace.hpp"
 
 #include "osdep/OSUtils.hpp"
+#include "osdep/PeerStore.hpp"
 #include "osdep/Phy.hpp"
 #include "osdep/PortMapper.hpp"
 #include "osdep/Thread.hpp"
@@ -69,6 +88,9 @@
 
 #ifdef __WINDOWS__
 #include <tchar.h>
+#else
+#include <signal.h>
+#include <sys/resource.h>
 #endif
 
 using namespace ZeroTier;
@@ -597,6 +619,109 @@ static int testCertificate()
 	return 0;
 }
 
+// Host for the relay benchmark: a fixed identity, one moon naming it as a root, and a wire that counts sends
+struct _RelayBenchHost
+{
+	std::string identity;
+	std::string moon;
+	uint64_t moonId;
+	unsigned long sent;
+	uint64_t lastHelloPacketId;
+	unsigned long userMessages;
+	std::string lastUserMessage;
+	std::map< uint64_t,std::string > peers;
+	unsigned long peerReads;
+	std::map< uint64_t,std::string > upstreamKeys; // WHOIS and OK(ECHO) sent to these peers are recorded
+	std::vector< std::pair<uint64_t,uint64_t> > whois; // upstream, address looked up
+	std::vector<InetAddress> echoReplies; // where each OK(ECHO) was sent
+};
+static int _relayBenchStateGet(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],void *data,unsigned int maxlen)
+{
+	const _RelayBenchHost *const h = reinterpret_cast<const _RelayBenchHost *>(uptr);
+	const std::string *obj = (const std::string *)0;
+	if (type == ZT_STATE_OBJECT_IDENTITY_SECRET)
+		obj = &(h->identity);
+	else if ((type == ZT_STATE_OBJECT_MOON)&&(id[0] == h->moonId))
+		obj = &(h->moon);
+	else if (type == ZT_STATE_OBJECT_PEER) {
+		++const_cast<_RelayBenchHost *>(h)->peerReads;
+		std::map< uint64_t,std::string >::const_iterator p(h->peers.find(id[0]));
+		if (p != h->peers.end())
+			obj = &(p->second);
+	}
+	if ((!obj)||(obj->length() > maxlen))
+		return -1;
+	memcpy(data,obj->data(),obj->length());
+	return (int)obj->length();
+}
+static void _relayBenchStatePut(ZT_Node *node,void *uptr,void *tptr,enum ZT_StateObjectType type,const uint64_t id[2],const void *data,int len)
+{
+	_RelayBenchHost *const h = reinterpret_cast<_RelayBenchHost *>(uptr);
+	if ((type == ZT_STATE_OBJECT_PEER)&&(len > 0))
+		h->peers[id[0]].assign(reinterpret_cast<const char *>(data),(unsigned long)len);
+}
+static int _relayBenchWireSend(ZT_Node *node,void *uptr,void *tptr,int64_t localSocket,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl)
+{
+	_RelayBenchHost *const h = reinterpret_cast<_RelayBenchHost *>(uptr);
+	++h->sent;
+	if (len >= ZT_PROTO_MIN_PACKET_LENGTH) {
+		const Packet p(data,len);
+		if ((p.cipher() == ZT_PROTO_CIPHER_SUITE__C25519_POLY1305_NONE)&&(p.verb() == Packet::VERB_HELLO))
+			h->lastHelloPacketId = p.packetId();
+		std::map< uint64_t,std::string >::const_iterator k(h->upstreamKeys.find(p.destination().toInt()));
+		if (k != h->upstreamKeys.end()) {
+			Packet q(data,len);
+			if ((q.dearmor(k->second.data()))&&(q.uncompress())) {
+				if (q.verb() == Packet::VERB_WHOIS) {
+					for(unsigned int ptr=ZT_PACKET_IDX_PAYLOAD;(ptr + ZT_ADDRESS_LENGTH)<=q.size();ptr+=ZT_ADDRESS_LENGTH)
+						h->whois.push_back(std::pair<uint64_t,uint64_t>(k->first,Address(q.field(ptr,ZT_ADDRESS_LENGTH),ZT_ADDRESS_LENGTH).toInt()));
+				} else if ((q.verb() == Packet::VERB_OK)&&(q.size() > ZT_PACKET_IDX_PAYLOAD)&&(q[ZT_PACKET_IDX_PAYLOAD] == Packet::VERB_ECHO)) {
+					h->echoReplies.push_back(*reinterpret_cast<const InetAddress *>(addr));
+				}
+			}
+		}
+	}
+	return 0;
+}
+static unsigned long _relayBenchWhoisCount(const _RelayBenchHost &h,const Address &upstream,const Address &addr)
+{
+	unsigned long n = 0;
+	for(std::vector< std::pair<uint64_t,uint64_t> >::const_iterator w(h.whois.begin());w!=h.whois.end();++w) {
+		if ((w->first == upstream.toInt())&&(w->second == addr.toInt()))
+			++n;
+	}
+	return n;
+}
+static void _relayBenchFrame(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,uint64_t sourceMac,uint64_t destMac,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len) {}
+static int _relayBenchConfig(ZT_Node *node,void *uptr,void *tptr,uint64_t nwid,void **nuptr,enum ZT_VirtualNetworkConfigOperation op,const ZT_VirtualNetworkConfig *nwconf) { return 0; }
+static void _relayBenchEvent(ZT_Node *node,void *uptr,void *tptr,enum ZT_Event event,const void *metaData)
+{
+	_RelayBenchHost *const h = reinterpret_cast<_RelayBenchHost *>(uptr);
+	if (event == ZT_EVENT_USER_MESSAGE) {
+		const ZT_UserMessage *const um = reinterpret_cast<const ZT_UserMessage *>(metaData);
+		++h->userMessages;
+		h->lastUserMessage.assign(reinterpret_cast<const char *>(um->data),um->length);
+	}
+}
+
+// Delivers an OK to a peer over a direct path at a given time, as IncomingPacket would
+static void _multipathReceive(Node *node,const SharedPtr<Peer> &peer,const SharedPtr<Path> &path,const int64_t now)
+{
+	volatile int64_t deadline = 0;
+	const InetAddress nowhere("10.255.255.255/9993");
+	uint8_t junk = 0;
+	node->processWirePacket((void *)0,now,0,reinterpret_cast<const struct sockaddr_storage *>(&nowhere),&junk,1,&deadline); // only advances the node's clock
+	path->received((uint64_t)now);
+	peer->received((void *)0,path,0,(uint64_t)now,0,Packet::VERB_OK,0,Packet::VERB_NOP,false,0);
+}
+
+// Sends a packet to a peer via a path at a given time, as Switch would
+static void _multipathSend(const SharedPtr<Peer> &peer,const SharedPtr<Path> &path,const int64_t now)
+{
+	path->sent(now);
+	peer->recordOutgoingPacket((void *)0,path,(uint64_t)now,1000,Packet::VERB_FRAME,now);
+}
+
 static int testPacket()
 {
 	unsigned char salsaKey[32];
@@ -636,10 +761,1038 @@ static int testPacket()
 		return -1;
 	}
 
+	for(int enc=0;enc<2;++enc) {
+		b.setDestination(Address(0x3333333333ULL));
+		Packet c(b);
+		c.armor(salsaKey,(enc != 0));
+		Packet d(b.data(),ZT_PACKET_IDX_VERB);
+		d.armorFrom(b,salsaKey,(enc != 0));
+		if ((c != d)||(!d.dearmor(salsaKey))||(d.size() != b.size())||(memcmp(d.field(ZT_PACKET_IDX_VERB,0),b.field(ZT_PACKET_IDX_VERB,0),b.size() - ZT_PACKET_IDX_VERB) != 0)) {
+			std::cout << "FAIL (armor from prototype)" << std::endl;
+			return -1;
+		}
+	}
+
+	{
+		// Repair itself is tested through the receive path, see below
+		const unsigned int unitLength = 400;
+		const unsigned int total = (b.size() + unitLength - 1) / unitLength;
+		Packet::Fragment parity;
+		parity.initParity(b,unitLength,total);
+		if ((parity.fragmentNumber() != ZT_PACKET_FRAGMENT_PARITY_NO)||(parity.totalFragments() != total)||(parity.at<uint16_t>(ZT_PACKET_FRAGMENT_IDX_PAYLOAD) != b.size())) {
+			std::cout << "FAIL (parity header)" << std::endl;
+			return -1;
+		}
+	}
+
 	std::cout << "PASS" << std::endl;
+
+	std::cout << "[packet] Testing VERB_MULTI_FRAME pack/unpack and HELLO capabilities... ";
+	{
+		uint8_t frames[3][300];
+		const unsigned int frameLens[3] = { 60,0,300 };
+		const unsigned int etherTypes[3] = { ZT_ETHERTYPE_IPV4,ZT_ETHERTYPE_ARP,ZT_ETHERTYPE_IPV6 };
+		for(unsigned int f=0;f<3;++f) {
+			for(unsigned int i=0;i<sizeof(frames[f]);++i)
+				frames[f][i] = (uint8_t)(f + i);
+		}
+
+		Packet mf(Address(0x1111111111ULL),Address(0x2222222222ULL),Packet::VERB_MULTI_FRAME);
+		mf.append((uint64_t)0x8056c2e21c000001ULL);
+		mf.append((uint8_t)0);
+		for(unsigned int f=0;f<3;++f)
+			mf.appendMultiFrame(etherTypes[f],frames[f],frameLens[f]);
+
+		unsigned int ptr = ZT_PROTO_VERB_MULTI_FRAME_IDX_FRAMES;
+		unsigned int etherType = 0,frameLen = 0,count = 0;
+		const uint8_t *frameData = (const uint8_t *)0;
+		while (mf.nextMultiFrame(ptr,etherType,frameData,frameLen)) {
+			if ((count >= 3)||(etherType != etherTypes[count])||(frameLen != frameLens[count])||(memcmp(frameData,frames[count],frameLen) != 0)) {
+				std::cout << "FAIL (round trip, frame " << count << ")" << std::endl;
+				return -1;
+			}
+			++count;
+		}
+		if ((count != 3)||(ptr != mf.size())) {
+			std::cout << "FAIL (round trip, got " << count << " frames)" << std::endl;
+			return -1;
+		}
+
+		// Truncated last frame: only the two complete frames come out
+		Packet trunc(mf);
+		trunc.setSize(trunc.size() - 1);
+		ptr = ZT_PROTO_VERB_MULTI_FRAME_IDX_FRAMES;
+		count = 0;
+		while (trunc.nextMultiFrame(ptr,etherType,frameData,frameLen))
+			++count;
+		if (count != 2) {
+			std::cout << "FAIL (truncated frame)" << std::endl;
+			return -1;
+		}
+
+		// Truncated tuple header and a length running past the end of the packet
+		Packet bad(mf.data(),ZT_PROTO_VERB_MULTI_FRAME_IDX_FRAMES);
+		bad.append((uint16_t)ZT_ETHERTYPE_IPV4);
+		ptr = ZT_PROTO_VERB_MULTI_FRAME_IDX_FRAMES;
+		if (bad.nextMultiFrame(ptr,etherType,frameData,frameLen)) {
+			std::cout << "FAIL (truncated header)" << std::endl;
+			return -1;
+		}
+		bad.append((uint16_t)0xffff);
+		bad.append(frames[0],sizeof(frames[0]));
+		if ((bad.nextMultiFrame(ptr,etherType,frameData,frameLen))||(ptr != ZT_PROTO_VERB_MULTI_FRAME_IDX_FRAMES)) {
+			std::cout << "FAIL (oversize frame length)" << std::endl;
+			return -1;
+		}
+
+		// HELLO tail as sent by older nodes (moon list only) and by newer nodes (moons then capabilities)
+		Packet hello(Address(0x1111111111ULL),Address(0x2222222222ULL),Packet::VERB_HELLO);
+		hello.append((uint16_t)0); // no moons
+		const unsigned int capsAt = hello.size();
+		if (hello.capabilitiesAt(capsAt) != 0) {
+			std::cout << "FAIL (HELLO without capabilities)" << std::endl;
+			return -1;
+		}
+		hello.append((uint64_t)ZT_PROTO_CAPABILITIES);
+		if (hello.capabilitiesAt(capsAt) != ZT_PROTO_CAPABILITIES) {
+			std::cout << "FAIL (HELLO with capabilities)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[packet] Testing OK(WHOIS) with several identities... ";
+	{
+		Identity ids[3];
+		ids[0].fromString(KNOWN_GOOD_IDENTITY);
+		ids[1].fromString(KNOWN_BAD_IDENTITY); // not validated when parsed, only distinct
+		ids[2].generate();
+
+		Packet ok(Address(0x1111111111ULL),ids[0].address(),Packet::VERB_OK);
+		ok.append((unsigned char)Packet::VERB_WHOIS);
+		ok.append((uint64_t)0x0123456789abcdefULL);
+		for(unsigned int i=0;i<3;++i)
+			ids[i].serialize(ok,false);
+
+		std::vector<Identity> got;
+		IncomingPacket whole(ok.data(),ok.size(),SharedPtr<Path>(),0);
+		if ((whole.whoisReplyIdentities(got) != 3)||(got.size() != 3)||(got[0] != ids[0])||(got[1] != ids[1])||(got[2] != ids[2])) {
+			std::cout << "FAIL (got " << got.size() << " of 3)" << std::endl;
+			return -1;
+		}
+
+		got.clear();
+		IncomingPacket truncated(ok.data(),ok.size() - 10,SharedPtr<Path>(),0);
+		if ((truncated.whoisReplyIdentities(got) != 2)||(got.size() != 2)||(got[1] != ids[1])) {
+			std::cout << "FAIL (truncated, got " << got.size() << " of 2)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[packet] Benchmarking broadcast ARP/ND fan-out to 1000 members... "; std::cout.flush();
+	{
+		// Frames from the tap go out through Switch, Multicaster and OutboundMulticast to
+		// 1000 members of a public network. The members are in the peer cache, so their
+		// identities need no proof of work. Each says HELLO once to get itself loaded from
+		// the cache and again once it is, answers the node's HELLO over its own direct path,
+		// and subscribes to the groups the ARP and ND frames go to.
+		_RelayBenchHost host;
+		host.identity = KNOWN_GOOD_IDENTITY;
+		host.moonId = 0;
+		host.sent = 0;
+		host.lastHelloPacketId = 0;
+		host.userMessages = 0;
+		host.peerReads = 0;
+		ZT_Node_Callbacks cb;
+		memset(&cb,0,sizeof(cb));
+		cb.version = 0;
+		cb.stateGetFunction = _relayBenchStateGet;
+		cb.statePutFunction = _relayBenchStatePut;
+		cb.wirePacketSendFunction = _relayBenchWireSend;
+		cb.virtualNetworkFrameFunction = _relayBenchFrame;
+		cb.virtualNetworkConfigFunction = _relayBenchConfig;
+		cb.eventCallback = _relayBenchEvent;
+		Node *const node = new Node(&host,(void *)0,&cb,OSUtils::now());
+		Identity self;
+		self.fromString(KNOWN_GOOD_IDENTITY);
+		volatile int64_t deadline = 0;
+
+		const uint64_t nwid = 0x8056c2e21c000001ULL;
+		node->join(nwid,(void *)0,(void *)0);
+		SharedPtr<Network> network(node->network(nwid));
+		const MAC tapMac(self.address(),nwid);
+
+		// Default rule set: drop not ethertype ipv4 and not ethertype arp and not ethertype ipv6; accept;
+		// The second configuration first drops anything to one address, so each member's copy is filtered.
+		NetworkConfig *const nconf = new NetworkConfig();
+		nconf->networkId = nwid;
+		nconf->timestamp = OSUtils::now();
+		nconf->revision = 1;
+		nconf->issuedTo = self.address();
+		nconf->type = ZT_NETWORK_TYPE_PUBLIC;
+		nconf->flags = ZT_NETWORKCONFIG_FLAG_ENABLE_BROADCAST;
+		nconf->mtu = ZT_DEFAULT_MTU;
+		nconf->multicastLimit = 1000;
+		nconf->ruleCount = 5;
+		nconf->rules[0].t = 0x80 | ZT_NETWORK_RULE_MATCH_ETHERTYPE; nconf->rules[0].v.etherType = ZT_ETHERTYPE_IPV4;
+		nconf->rules[1].t = 0x80 | ZT_NETWORK_RULE_MATCH_ETHERTYPE; nconf->rules[1].v.etherType = ZT_ETHERTYPE_ARP;
+		nconf->rules[2].t = 0x80 | ZT_NETWORK_RULE_MATCH_ETHERTYPE; nconf->rules[2].v.etherType = ZT_ETHERTYPE_IPV6;
+		nconf->rules[3].t = ZT_NETWORK_RULE_ACTION_DROP;
+		nconf->rules[4].t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+		network->setConfiguration((void *)0,*nconf,false);
+
+		uint8_t arp[28],nd[72];
+		Utils::getSecureRandom(arp,sizeof(arp));
+		Utils::getSecureRandom(nd,sizeof(nd));
+		arp[0] = 0x00; arp[1] = 0x01; arp[2] = 0x08; arp[3] = 0x00; arp[4] = 6; arp[5] = 4; arp[6] = 0x00; arp[7] = 0x01; // ARP request
+		arp[24] = 10; arp[25] = 0; arp[26] = 0; arp[27] = 1; // for 10.0.0.1
+		nd[6] = 0x3a; nd[40] = 0x87; // ICMPv6 neighbor solicitation
+		const MulticastGroup groups[2] = { MulticastGroup::deriveMulticastGroupForAddressResolution(InetAddress("10.0.0.1/0")),MulticastGroup(MAC(0x3333ff000001ULL),0) };
+
+		for(unsigned int m=0;m<1000;++m) {
+			const Address ma(0x1000000000ULL + (uint64_t)m);
+			const C25519::Pair kp(C25519::generate());
+			Buffer<256> ib;
+			ma.appendTo(ib);
+			ib.append((uint8_t)0);
+			ib.append(kp.pub.data,ZT_C25519_PUBLIC_KEY_LEN);
+			ib.append((uint8_t)ZT_C25519_PRIVATE_KEY_LEN);
+			ib.append(kp.priv.data,ZT_C25519_PRIVATE_KEY_LEN);
+			Identity member;
+			member.deserialize(ib,0);
+
+			Buffer<ZT_PEER_MAX_SERIALIZED_STATE_SIZE> cached;
+			cached.append((uint8_t)1);
+			member.serialize(cached,false);
+			cached.append((uint16_t)ZT_PROTO_VERSION);
+			cached.append((uint16_t)ZEROTIER_ONE_VERSION_MAJOR);
+			cached.append((uint16_t)ZEROTIER_ONE_VERSION_MINOR);
+			cached.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+			cached.append((uint16_t)0); // no paths
+			host.peers[ma.toInt()].assign((const char *)cached.data(),cached.size());
+
+			uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+			member.agree(self,key,ZT_PEER_SECRET_KEY_LENGTH);
+			InetAddress memberPath;
+			const uint8_t ip[4] = { 10,(uint8_t)(m >> 8),(uint8_t)m,2 };
+			memberPath.set(ip,4,9993);
+
+			Packet hello(self.address(),ma,Packet::VERB_HELLO);
+			hello.append((unsigned char)ZT_PROTO_VERSION);
+			hello.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+			hello.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+			hello.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+			hello.append((uint64_t)OSUtils::now());
+			member.serialize(hello,false);
+			InetAddress("10.9.9.9/9993").serialize(hello);
+			hello.armor(key,false);
+			for(int h=0;h<2;++h) {
+				node->processWirePacket((void *)0,OSUtils::now(),0,reinterpret_cast<const struct sockaddr_storage *>(&memberPath),hello.unsafeData(),hello.size(),&deadline);
+				if (h == 0)
+					node->processBackgroundTasks((void *)0,OSUtils::now(),&deadline);
+			}
+
+			Packet ok(self.address(),ma,Packet::VERB_OK);
+			ok.append((unsigned char)Packet::VERB_HELLO);
+			ok.append(host.lastHelloPacketId);
+			ok.append((uint64_t)OSUtils::now());
+			ok.append((unsigned char)ZT_PROTO_VERSION);
+			ok.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+			ok.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+			ok.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+			ok.armor(key,true);
+			node->processWirePacket((void *)0,OSUtils::now(),0,reinterpret_cast<const struct sockaddr_storage *>(&memberPath),ok.unsafeData(),ok.size(),&deadline);
+
+			Packet like(self.address(),ma,Packet::VERB_MULTICAST_LIKE);
+			for(unsigned int g=0;g<2;++g) {
+				like.append(nwid);
+				groups[g].mac().appendTo(like);
+				like.append((uint32_t)groups[g].adi());
+			}
+			like.armor(key,true);
+			node->processWirePacket((void *)0,OSUtils::now(),0,reinterpret_cast<const struct sockaddr_storage *>(&memberPath),like.unsafeData(),like.size(),&deadline);
+		}
+
+		int64_t elapsed[2][2];
+		unsigned long sent[2][2];
+		for(int mode=0;mode<2;++mode) {
+			if (mode == 1) {
+				memmove(nconf->rules + 2,nconf->rules,sizeof(ZT_VirtualNetworkRule) * 5);
+				memset(nconf->rules,0,sizeof(ZT_VirtualNetworkRule) * 2);
+				nconf->rules[0].t = ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS; nconf->rules[0].v.zt = 0x0fffffffffULL;
+				nconf->rules[1].t = ZT_NETWORK_RULE_ACTION_DROP;
+				nconf->ruleCount = 7;
+				nconf->revision = 2;
+				network->setConfiguration((void *)0,*nconf,false);
+			}
+			for(int t=0;t<2;++t) {
+				const uint8_t *const frame = (t == 0) ? arp : nd;
+				const unsigned int frameLen = (t == 0) ? (unsigned int)sizeof(arp) : (unsigned int)sizeof(nd);
+				const unsigned int etherType = (t == 0) ? ZT_ETHERTYPE_ARP : ZT_ETHERTYPE_IPV6;
+				const uint64_t macDest = (t == 0) ? 0xffffffffffffULL : 0x3333ff000001ULL;
+				node->processVirtualNetworkFrame((void *)0,OSUtils::now(),nwid,tapMac.toInt(),macDest,etherType,0,frame,frameLen,&deadline); // pushes credentials and probes MTUs on first use
+				const unsigned long sentBefore = host.sent;
+				const int64_t start = OSUtils::now();
+				for(int k=0;k<200;++k)
+					node->processVirtualNetworkFrame((void *)0,OSUtils::now(),nwid,tapMac.toInt(),macDest,etherType,0,frame,frameLen,&deadline);
+				elapsed[mode][t] = OSUtils::now() - start;
+				sent[mode][t] = host.sent - sentBefore;
+			}
+		}
+
+		network.zero();
+		delete nconf;
+		delete node;
+		for(int mode=0;mode<2;++mode) {
+			for(int t=0;t<2;++t) {
+				if (sent[mode][t] != (200 * 1000)) {
+					std::cout << "FAIL (" << ((t == 0) ? "ARP" : "ND") << " fan-out sent " << sent[mode][t] << " of " << (200 * 1000) << " packets)" << std::endl;
+					return -1;
+				}
+			}
+		}
+		for(int t=0;t<2;++t)
+			std::cout << ((t == 0) ? "ARP " : "ND ") << ((double)elapsed[0][t] * 1000.0 / 200.0) << "us per 1000 member fan-out filtered once, " << ((double)elapsed[1][t] * 1000.0 / 200.0) << "us filtered per member" << ((t == 0) ? "; " : "");
+		std::cout << std::endl;
+	}
+
+	std::cout << "[packet] Benchmarking relay fast path... "; std::cout.flush();
+	{
+		// The node under test is a root of a moon, so it relays for anyone. The
+		// destination becomes a known peer with a direct path by saying HELLO
+		// and answering the node's own HELLO.
+		_RelayBenchHost host;
+		host.identity = KNOWN_GOOD_IDENTITY;
+		host.moonId = 0x8e4df28b72000001ULL;
+		host.sent = 0;
+		host.lastHelloPacketId = 0;
+		host.userMessages = 0;
+		host.peerReads = 0;
+
+		Identity self;
+		self.fromString(KNOWN_GOOD_IDENTITY);
+		std::vector<World::Root> roots;
+		roots.push_back(World::Root());
+		roots.back().identity = self;
+		const C25519::Pair moonKey(C25519::generate());
+		Buffer<ZT_WORLD_MAX_SERIALIZED_LENGTH> moon;
+		World::make(World::TYPE_MOON,host.moonId,1,moonKey.pub,roots,moonKey).serialize(moon,false);
+		host.moon.assign((const char *)moon.data(),moon.size());
+
+		ZT_Node_Callbacks cb;
+		memset(&cb,0,sizeof(cb));
+		cb.version = 0;
+		cb.stateGetFunction = _relayBenchStateGet;
+		cb.statePutFunction = _relayBenchStatePut;
+		cb.wirePacketSendFunction = _relayBenchWireSend;
+		cb.virtualNetworkFrameFunction = _relayBenchFrame;
+		cb.virtualNetworkConfigFunction = _relayBenchConfig;
+		cb.eventCallback = _relayBenchEvent;
+		Node *const node = new Node(&host,(void *)0,&cb,OSUtils::now());
+		node->orbit((void *)0,host.moonId,0);
+
+		Identity dest;
+		dest.generate();
+		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+		dest.agree(self,key,ZT_PEER_SECRET_KEY_LENGTH);
+		const InetAddress destPath("10.1.2.3/9993"),srcPath("10.4.5.6/9993");
+		volatile int64_t deadline = 0;
+
+		Packet hello(self.address(),dest.address(),Packet::VERB_HELLO);
+		hello.append((unsigned char)ZT_PROTO_VERSION);
+		hello.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+		hello.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+		hello.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+		hello.append((uint64_t)OSUtils::now());
+		dest.serialize(hello,false);
+		InetAddress("10.9.9.9/9993").serialize(hello);
+		hello.armor(key,false);
+		node->processWirePacket((void *)0,OSUtils::now(),0,reinterpret_cast<const struct sockaddr_storage *>(&destPath),hello.unsafeData(),hello.size(),&deadline);
+
+		Packet ok(self.address(),dest.address(),Packet::VERB_OK);
+		ok.append((unsigned char)Packet::VERB_HELLO);
+		ok.append(host.lastHelloPacketId);
+		ok.append((uint64_t)OSUtils::now());
+		ok.append((unsigned char)ZT_PROTO_VERSION);
+		ok.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+		ok.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+		ok.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+		ok.armor(key,true);
+		node->processWirePacket((void *)0,OSUtils::now(),0,reinterpret_cast<const struct sockaddr_storage *>(&destPath),ok.unsafeData(),ok.size(),&deadline);
+
+		// A 1400 byte packet from some other node to the destination
+		Packet relayed(dest.address(),Address(0x1122334455ULL),Packet::VERB_FRAME);
+		for(unsigned int i=0;i<1400 - ZT_PACKET_IDX_PAYLOAD;++i)
+			relayed.append((uint8_t)rand());
+		relayed.armor(key,true);
+		uint8_t buf[ZT_MAX_PHYSPAYLOAD];
+		const unsigned int len = relayed.size();
+		memcpy(buf,relayed.data(),len);
+
+		const unsigned long n = 1000000;
+		const unsigned long sentBefore = host.sent;
+		const int64_t start = OSUtils::now();
+		for(unsigned long k=0;k<n;++k) {
+			buf[ZT_PACKET_IDX_FLAGS] &= 0xf8; // relayed in place, so reset the hop count
+			node->processWirePacket((void *)0,OSUtils::now(),0,reinterpret_cast<const struct sockaddr_storage *>(&srcPath),buf,len,&deadline);
+		}
+		const int64_t elapsed = OSUtils::now() - start;
+		const unsigned long relayedCount = host.sent - sentBefore;
+
+		if ((relayedCount != n)||((buf[ZT_PACKET_IDX_FLAGS] & 0x07) != 1)) {
+			std::cout << "FAIL (relayed " << relayedCount << " of " << n << " packets)" << std::endl;
+			delete node;
+			return -1;
+		}
+		std::cout << (unsigned long)((double)n / ((double)((elapsed > 0) ? elapsed : 1) / 1000.0)) << " packets/second on one core" << std::endl;
+
+		std::cout << "[packet] Testing parity repair in the receive path... "; std::cout.flush();
+		// A USER_MESSAGE from the destination is sent as a head, two fragments and a
+		// parity fragment, with each unit lost in turn and then arriving late. The
+		// last unit is short, and the head and fragments are marked as relayed once
+		// since parity does not cover hops. The head is rebuilt from parity too.
+		const unsigned int unitLength = 400;
+		for(unsigned int missing=0;missing<=3;++missing) { // 3 loses nothing, parity arrives late
+			Packet um(self.address(),dest.address(),Packet::VERB_USER_MESSAGE);
+			um.append((uint64_t)0x8056c2e21c000001ULL);
+			std::string msg;
+			for(unsigned int i=0;i<900;++i)
+				msg.push_back((char)rand());
+			um.append(msg.data(),(unsigned int)msg.length());
+			um.setFragmented(true);
+			um.armor(key,true);
+			const unsigned int total = (um.size() + unitLength - 1) / unitLength;
+			if ((total != 3)||((um.size() % unitLength) == 0)) {
+				std::cout << "FAIL (test packet is " << um.size() << " bytes)" << std::endl;
+				delete node;
+				return -1;
+			}
+
+			Buffer<ZT_PROTO_MAX_PACKET_LENGTH> units[4];
+			units[0].append(um.data(),unitLength);
+			units[0][ZT_PACKET_IDX_FLAGS] = (char)((units[0][ZT_PACKET_IDX_FLAGS] & 0xf8) | 1);
+			for(unsigned int fno=1;fno<total;++fno) {
+				const unsigned int fragStart = fno * unitLength;
+				Packet::Fragment frag(um,fragStart,std::min(unitLength,um.size() - fragStart),fno,total);
+				frag.incrementHops();
+				units[fno] = frag;
+			}
+			Packet::Fragment parity;
+			parity.initParity(um,unitLength,total);
+			units[3] = parity;
+
+			const unsigned long before = host.userMessages;
+			for(unsigned int u=0;u<4;++u) {
+				if (u != missing)
+					node->processWirePacket((void *)0,OSUtils::now(),0,reinterpret_cast<const struct sockaddr_storage *>(&destPath),units[u].unsafeData(),units[u].size(),&deadline);
+			}
+			const bool repaired = ((host.userMessages == (before + 1))&&(host.lastUserMessage == msg));
+			node->processWirePacket((void *)0,OSUtils::now(),0,reinterpret_cast<const struct sockaddr_storage *>(&destPath),units[missing].unsafeData(),units[missing].size(),&deadline);
+			if ((!repaired)||(host.userMessages != (before + 1))) {
+				std::cout << "FAIL (" << (host.userMessages - before) << " messages with unit " << missing << " lost)" << std::endl;
+				delete node;
+				return -1;
+			}
+		}
+		delete node; // saves the destination to the peer cache
+		std::cout << "PASS" << std::endl;
+
+		std::cout << "[packet] Testing deferred peer cache loads... "; std::cout.flush();
+		// A fresh node has no peers in memory. A packet from a peer in the cache
+		// is parked until background tasks load the peer, and a peer that is not
+		// in the cache is only looked for once while the miss is remembered.
+		if (host.peers.find(dest.address().toInt()) == host.peers.end()) {
+			std::cout << "FAIL (destination not saved to the peer cache)" << std::endl;
+			return -1;
+		}
+		Node *const node2 = new Node(&host,(void *)0,&cb,OSUtils::now());
+
+		Packet cached(self.address(),dest.address(),Packet::VERB_USER_MESSAGE);
+		cached.append((uint64_t)0x8056c2e21c000001ULL);
+		cached.append("loaded",6);
+		cached.armor(key,true);
+		const unsigned long messagesBefore = host.userMessages;
+		deadline = OSUtils::now() + 60000;
+		node2->processWirePacket((void *)0,OSUtils::now(),0,reinterpret_cast<const struct sockaddr_storage *>(&destPath),cached.unsafeData(),cached.size(),&deadline);
+		const bool parked = ((host.userMessages == messagesBefore)&&(deadline <= OSUtils::now()));
+		node2->processBackgroundTasks((void *)0,OSUtils::now(),&deadline);
+		if ((!parked)||(host.userMessages != (messagesBefore + 1))||(host.lastUserMessage != "loaded")) {
+			std::cout << "FAIL (cached peer " << (parked ? "not loaded" : "not parked") << ")" << std::endl;
+			delete node2;
+			return -1;
+		}
+
+		Identity stranger;
+		stranger.generate();
+		uint8_t strangerKey[ZT_PEER_SECRET_KEY_LENGTH];
+		stranger.agree(self,strangerKey,ZT_PEER_SECRET_KEY_LENGTH);
+		unsigned long strangerReads[3];
+		for(unsigned int k=0;k<3;++k) {
+			Packet unknown(self.address(),stranger.address(),Packet::VERB_NOP);
+			unknown.armor(strangerKey,true);
+			const unsigned long readsBefore = host.peerReads;
+			node2->processWirePacket((void *)0,OSUtils::now(),0,reinterpret_cast<const struct sockaddr_storage *>(&srcPath),unknown.unsafeData(),unknown.size(),&deadline);
+			node2->processBackgroundTasks((void *)0,OSUtils::now(),&deadline);
+			strangerReads[k] = host.peerReads - readsBefore;
+		}
+		delete node2;
+		if ((strangerReads[0] != 1)||(strangerReads[1] != 0)||(strangerReads[2] != 0)) {
+			std::cout << "FAIL (unknown peer looked up " << strangerReads[0] << "/" << strangerReads[1] << "/" << strangerReads[2] << " times)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+
+		std::cout << "[packet] Testing credential digests and incremental pushes... "; std::cout.flush();
+		// Tags are issued by a network whose controller is this identity, so they verify
+		// without any lookups. The node is only here for the topology's state callbacks.
+		Node *const node3 = new Node(&host,(void *)0,&cb,OSUtils::now());
+		RuntimeEnvironment rr(node3);
+		rr.identity = self;
+		Trace trace(&rr);
+		rr.t = &trace;
+		Topology *const topology = new Topology(&rr,(void *)0); // saves its peers on destruction, so goes before the node
+		rr.topology = topology;
+
+		const uint64_t nwid = (self.address().toInt() << 24) | 1ULL;
+		const int64_t ts = OSUtils::now();
+		NetworkConfig *const nconf = new NetworkConfig();
+		nconf->networkId = nwid;
+		for(unsigned int t=0;t<3;++t) {
+			nconf->tags[t] = Tag(nwid,ts,dest.address(),t + 1,t * 10);
+			nconf->tags[t].sign(self);
+		}
+		nconf->tagCount = 2;
+
+		Membership sender;
+		const Capability *caps[ZT_MAX_NETWORK_CAPABILITIES];
+		const Tag *tags[ZT_MAX_NETWORK_TAGS];
+		const CertificateOfOwnership *coos[ZT_MAX_CERTIFICATES_OF_OWNERSHIP];
+		unsigned int capCount = 0,tagCount[3],cooCount = 0;
+		std::vector<uint64_t> digests;
+		sender.selectCredentials(*nconf,false,caps,capCount,tags,tagCount[0],coos,cooCount,digests);
+		sender.selectCredentials(*nconf,true,caps,capCount,tags,tagCount[1],coos,cooCount,digests);
+		nconf->tagCount = 3;
+		sender.selectCredentials(*nconf,true,caps,capCount,tags,tagCount[2],coos,cooCount,digests);
+		if ((tagCount[0] != 2)||(tagCount[1] != 0)||(tagCount[2] != 1)||(tags[0] != &(nconf->tags[2]))||(digests.size() != 3)) {
+			std::cout << "FAIL (pushed " << tagCount[0] << "/" << tagCount[1] << "/" << tagCount[2] << " tags)" << std::endl;
+			delete nconf;
+			delete topology;
+			delete node3;
+			return -1;
+		}
+
+		uint8_t packed[3 * 8];
+		for(unsigned int d=0;d<3;++d) {
+			for(unsigned int k=0;k<8;++k)
+				packed[(d * 8) + k] = (uint8_t)(digests[d] >> (56 - (k * 8)));
+		}
+
+		// One receiver has every tag, one is missing the last, and one revoked the last
+		Membership all,partial,revoked;
+		for(unsigned int t=0;t<3;++t) {
+			all.addCredential(&rr,(void *)0,*nconf,nconf->tags[t]);
+			if (t < 2) {
+				partial.addCredential(&rr,(void *)0,*nconf,nconf->tags[t]);
+				revoked.addCredential(&rr,(void *)0,*nconf,nconf->tags[t]);
+			}
+		}
+		Revocation rev(1,nwid,nconf->tags[2].id(),(uint64_t)ts,0,dest.address(),Credential::CREDENTIAL_TYPE_TAG);
+		rev.sign(self);
+		const Membership::AddCredentialResult revResult = revoked.addCredential(&rr,(void *)0,*nconf,rev);
+		const Membership::AddCredentialResult tagResult = revoked.addCredential(&rr,(void *)0,*nconf,nconf->tags[2]);
+		const unsigned int missing[3] = { all.missingCredentials(packed,3),partial.missingCredentials(packed,3),revoked.missingCredentials(packed,3) };
+		delete nconf;
+		delete topology;
+		delete node3;
+		if ((missing[0] != 0)||(missing[1] != 1)||(revResult != Membership::ADD_ACCEPTED_NEW)||(tagResult != Membership::ADD_REJECTED)||(missing[2] != 0)) {
+			std::cout << "FAIL (missing " << missing[0] << "/" << missing[1] << "/" << missing[2] << ")" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[packet] Testing peer demotion under a memory budget... "; std::cout.flush();
+	{
+		// The node is a moon root and the destination a known peer with a direct
+		// path, as in the relay benchmark. With almost no budget the destination
+		// (the only peer that is not an upstream) is demoted, then rebuilt with
+		// its key and path by the next packet relayed to it.
+		_RelayBenchHost host;
+		host.identity = KNOWN_GOOD_IDENTITY;
+		host.moonId = 0x8e4df28b72000003ULL;
+		host.sent = 0;
+		host.lastHelloPacketId = 0;
+		host.userMessages = 0;
+		host.peerReads = 0;
+
+		Identity self;
+		self.fromString(KNOWN_GOOD_IDENTITY);
+		std::vector<World::Root> roots;
+		roots.push_back(World::Root());
+		roots.back().identity = self;
+		const C25519::Pair moonKey(C25519::generate());
+		Buffer<ZT_WORLD_MAX_SERIALIZED_LENGTH> moon;
+		World::make(World::TYPE_MOON,host.moonId,1,moonKey.pub,roots,moonKey).serialize(moon,false);
+		host.moon.assign((const char *)moon.data(),moon.size());
+
+		ZT_Node_Callbacks cb;
+		memset(&cb,0,sizeof(cb));
+		cb.version = 0;
+		cb.stateGetFunction = _relayBenchStateGet;
+		cb.statePutFunction = _relayBenchStatePut;
+		cb.wirePacketSendFunction = _relayBenchWireSend;
+		cb.virtualNetworkFrameFunction = _relayBenchFrame;
+		cb.virtualNetworkConfigFunction = _relayBenchConfig;
+		cb.eventCallback = _relayBenchEvent;
+		Node *const node = new Node(&host,(void *)0,&cb,OSUtils::now());
+		node->orbit((void *)0,host.moonId,0);
+
+		Identity dest;
+		dest.generate();
+		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+		dest.agree(self,key,ZT_PEER_SECRET_KEY_LENGTH);
+		const InetAddress destPath("10.1.2.3/9993"),srcPath("10.4.5.6/9993");
+		volatile int64_t deadline = 0;
+
+		Packet hello(self.address(),dest.address(),Packet::VERB_HELLO);
+		hello.append((unsigned char)ZT_PROTO_VERSION);
+		hello.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+		hello.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+		hello.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+		hello.append((uint64_t)OSUtils::now());
+		dest.serialize(hello,false);
+		InetAddress("10.9.9.9/9993").serialize(hello);
+		hello.armor(key,false);
+		node->processWirePacket((void *)0,OSUtils::now(),0,reinterpret_cast<const struct sockaddr_storage *>(&destPath),hello.unsafeData(),hello.size(),&deadline);
+
+		Packet ok(self.address(),dest.address(),Packet::VERB_OK);
+		ok.append((unsigned char)Packet::VERB_HELLO);
+		ok.append(host.lastHelloPacketId);
+		ok.append((uint64_t)OSUtils::now());
+		ok.append((unsigned char)ZT_PROTO_VERSION);
+		ok.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+		ok.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+		ok.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+		ok.armor(key,true);
+		node->processWirePacket((void *)0,OSUtils::now(),0,reinterpret_cast<const struct sockaddr_storage *>(&destPath),ok.unsafeData(),ok.size(),&deadline);
+
+		// A 1400 byte packet from some other node to the destination
+		Packet relayed(dest.address(),Address(0x1122334455ULL),Packet::VERB_FRAME);
+		for(unsigned int i=0;i<1400 - ZT_PACKET_IDX_PAYLOAD;++i)
+			relayed.append((uint8_t)rand());
+		relayed.armor(key,true);
+		uint8_t buf[ZT_MAX_PHYSPAYLOAD];
+		const unsigned int len = relayed.size();
+		memcpy(buf,relayed.data(),len);
+
+		node->setPeerMemoryBudget(1);
+		node->processBackgroundTasks((void *)0,OSUtils::now(),&deadline);
+		ZT_NodeStatus demotedStatus,promotedStatus;
+		node->status(&demotedStatus);
+		const unsigned long sentBeforePromotion = host.sent;
+		node->processWirePacket((void *)0,OSUtils::now(),0,reinterpret_cast<const struct sockaddr_storage *>(&srcPath),buf,len,&deadline);
+		node->status(&promotedStatus);
+		const unsigned long sentAfterPromotion = host.sent - sentBeforePromotion;
+		delete node;
+
+		if ((demotedStatus.coldPeers != 1)||(promotedStatus.coldPeers != 0)||(promotedStatus.peers != (demotedStatus.peers + 1))||(sentAfterPromotion != 1)) {
+			std::cout << "FAIL (" << demotedStatus.coldPeers << " demoted, " << promotedStatus.coldPeers << " still cold, " << sentAfterPromotion << " relayed)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << demotedStatus.bytesPerPeer << " bytes per peer, " << demotedStatus.bytesPerColdPeer << " per cold peer)" << std::endl;
+	}
+
+	std::cout << "[packet] Testing WHOIS hedging and upstream ranking... "; std::cout.flush();
+	{
+		// The node orbits a moon with two roots that have both said HELLO. Only
+		// the first has answered the node's HELLO, with a latency of 100ms, so
+		// it is asked first and the second is asked after twice that latency.
+		_RelayBenchHost host;
+		host.identity = KNOWN_GOOD_IDENTITY;
+		host.moonId = 0x8e4df28b72000002ULL;
+		host.sent = 0;
+		host.lastHelloPacketId = 0;
+		host.userMessages = 0;
+		host.peerReads = 0;
+
+		Identity self;
+		self.fromString(KNOWN_GOOD_IDENTITY);
+		Identity roots[2];
+		uint8_t keys[2][ZT_PEER_SECRET_KEY_LENGTH];
+		std::vector<World::Root> moonRoots;
+		for(unsigned int r=0;r<2;++r) {
+			roots[r].generate();
+			roots[r].agree(self,keys[r],ZT_PEER_SECRET_KEY_LENGTH);
+			host.upstreamKeys[roots[r].address().toInt()].assign((const char *)keys[r],ZT_PEER_SECRET_KEY_LENGTH);
+			moonRoots.push_back(World::Root());
+			moonRoots.back().identity = roots[r];
+		}
+		const C25519::Pair moonKey(C25519::generate());
+		Buffer<ZT_WORLD_MAX_SERIALIZED_LENGTH> moon;
+		World::make(World::TYPE_MOON,host.moonId,1,moonKey.pub,moonRoots,moonKey).serialize(moon,false);
+		host.moon.assign((const char *)moon.data(),moon.size());
+
+		ZT_Node_Callbacks cb;
+		memset(&cb,0,sizeof(cb));
+		cb.version = 0;
+		cb.stateGetFunction = _relayBenchStateGet;
+		cb.statePutFunction = _relayBenchStatePut;
+		cb.wirePacketSendFunction = _relayBenchWireSend;
+		cb.virtualNetworkFrameFunction = _relayBenchFrame;
+		cb.virtualNetworkConfigFunction = _relayBenchConfig;
+		cb.eventCallback = _relayBenchEvent;
+		const int64_t start = OSUtils::now();
+		Node *const node = new Node(&host,(void *)0,&cb,start);
+		node->orbit((void *)0,host.moonId,0);
+
+		const InetAddress rootPaths[2] = { InetAddress("10.7.0.1/9993"),InetAddress("10.7.0.2/9993") };
+		uint64_t helloIds[2];
+		volatile int64_t deadline = 0;
+		for(unsigned int r=0;r<2;++r) {
+			Packet hello(self.address(),roots[r].address(),Packet::VERB_HELLO);
+			hello.append((unsigned char)ZT_PROTO_VERSION);
+			hello.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+			hello.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+			hello.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+			hello.append((uint64_t)start);
+			roots[r].serialize(hello,false);
+			InetAddress("10.9.9.9/9993").serialize(hello);
+			hello.armor(keys[r],false);
+			host.lastHelloPacketId = 0;
+			node->processWirePacket((void *)0,start,0,reinterpret_cast<const struct sockaddr_storage *>(&rootPaths[r]),hello.unsafeData(),hello.size(),&deadline);
+			helloIds[r] = host.lastHelloPacketId;
+		}
+
+		// Answers the node's HELLO to a root as if it had taken the given latency
+		Packet ok[2];
+		for(unsigned int r=0;r<2;++r) {
+			ok[r] = Packet(self.address(),roots[r].address(),Packet::VERB_OK);
+			ok[r].append((unsigned char)Packet::VERB_HELLO);
+			ok[r].append(helloIds[r]);
+		}
+		ok[0].append((uint64_t)(start - 100));
+		ok[0].append((unsigned char)ZT_PROTO_VERSION);
+		ok[0].append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+		ok[0].append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+		ok[0].append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+		ok[0].armor(keys[0],true);
+		node->processWirePacket((void *)0,start,0,reinterpret_cast<const struct sockaddr_storage *>(&rootPaths[0]),ok[0].unsafeData(),ok[0].size(),&deadline);
+
+		// Start once the ranking made while the roots said HELLO has expired
+		const Address strangers[3] = { Address(0x1a2b3c4d01ULL),Address(0x1a2b3c4d02ULL),Address(0x1a2b3c4d03ULL) };
+		const int64_t t0 = start + ZT_UPSTREAM_RANKING_TTL + 1000;
+		node->processBackgroundTasks((void *)0,t0,&deadline);
+		node->sendUserMessage((void *)0,strangers[0].toInt(),1,"x",1);
+		node->processBackgroundTasks((void *)0,t0,&deadline); // misses the peer cache, so asks upstream
+		const bool askedFirst = ((_relayBenchWhoisCount(host,roots[0].address(),strangers[0]) == 1)&&(_relayBenchWhoisCount(host,roots[1].address(),strangers[0]) == 0));
+		const int64_t firstDeadline = deadline;
+		int64_t hedgedAt = t0;
+		for(unsigned int k=0;(k<16)&&(!_relayBenchWhoisCount(host,roots[1].address(),strangers[0]));++k) {
+			hedgedAt = std::max(hedgedAt,(int64_t)deadline);
+			node->processBackgroundTasks((void *)0,hedgedAt,&deadline);
+		}
+		if ((!askedFirst)||(firstDeadline >= (t0 + ZT_CORE_TIMER_TASK_GRANULARITY))||(!_relayBenchWhoisCount(host,roots[1].address(),strangers[0]))||((hedgedAt - t0) >= ZT_WHOIS_RETRY_DELAY)) {
+			std::cout << "FAIL (hedged after " << (hedgedAt - t0) << "ms, next deadline was " << (firstDeadline - t0) << "ms)" << std::endl;
+			delete node;
+			return -1;
+		}
+
+		// The second root now measures 10ms, but the ranking made at t0 is used until it expires
+		const int64_t t1 = t0 + 300;
+		ok[1].append((uint64_t)(t1 - 10));
+		ok[1].append((unsigned char)ZT_PROTO_VERSION);
+		ok[1].append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+		ok[1].append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+		ok[1].append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+		ok[1].armor(keys[1],true);
+		node->processWirePacket((void *)0,t1,0,reinterpret_cast<const struct sockaddr_storage *>(&rootPaths[1]),ok[1].unsafeData(),ok[1].size(),&deadline);
+		node->sendUserMessage((void *)0,strangers[1].toInt(),1,"x",1);
+		node->processBackgroundTasks((void *)0,t1,&deadline);
+		const bool cached = ((_relayBenchWhoisCount(host,roots[0].address(),strangers[1]) == 1)&&(_relayBenchWhoisCount(host,roots[1].address(),strangers[1]) == 0));
+
+		const int64_t t2 = t1 + ZT_UPSTREAM_RANKING_TTL;
+		node->processBackgroundTasks((void *)0,t2,&deadline);
+		node->sendUserMessage((void *)0,strangers[2].toInt(),1,"x",1);
+		node->processBackgroundTasks((void *)0,t2,&deadline);
+		const bool reranked = ((_relayBenchWhoisCount(host,roots[0].address(),strangers[2]) == 0)&&(_relayBenchWhoisCount(host,roots[1].address(),strangers[2]) == 1));
+		delete node;
+		if ((!cached)||(!reranked)) {
+			std::cout << "FAIL (ranking " << ((cached) ? "not refreshed after its TTL" : "refreshed before its TTL") << ")" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (hedged after " << (hedgedAt - t0) << "ms)" << std::endl;
+	}
+
+	std::cout << "[packet] Testing flow pinning... "; std::cout.flush();
+	{
+		// A peer reachable over an IPv4 and an IPv6 path. There is no Phy here to name
+		// interfaces, so both use no local socket and differ by address family.
+		_RelayBenchHost host;
+		host.identity = KNOWN_GOOD_IDENTITY;
+		host.moonId = 0;
+		host.sent = 0;
+		host.lastHelloPacketId = 0;
+		host.userMessages = 0;
+		host.peerReads = 0;
+		ZT_Node_Callbacks cb;
+		memset(&cb,0,sizeof(cb));
+		cb.version = 0;
+		cb.stateGetFunction = _relayBenchStateGet;
+		cb.statePutFunction = _relayBenchStatePut;
+		cb.wirePacketSendFunction = _relayBenchWireSend;
+		cb.virtualNetworkFrameFunction = _relayBenchFrame;
+		cb.virtualNetworkConfigFunction = _relayBenchConfig;
+		cb.eventCallback = _relayBenchEvent;
+		const int64_t t0 = OSUtils::now();
+		Node *const node = new Node(&host,(void *)0,&cb,t0);
+		node->setMultipathMode(ZT_MULTIPATH_FLOW_PINNED);
+		RuntimeEnvironment rr(node);
+		rr.identity.fromString(KNOWN_GOOD_IDENTITY);
+		Trace trace(&rr);
+		rr.t = &trace;
+		Topology topology(&rr,(void *)0);
+		rr.topology = &topology;
+
+		Identity other;
+		other.generate();
+		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+		Utils::getSecureRandom(key,sizeof(key));
+		SharedPtr<Peer> peer(new Peer(&rr,rr.identity,other,key));
+		peer->setRemoteVersion(ZT_PROTO_VERSION,ZEROTIER_ONE_VERSION_MAJOR,ZEROTIER_ONE_VERSION_MINOR,ZEROTIER_ONE_VERSION_REVISION);
+		const SharedPtr<Path> paths[2] = { SharedPtr<Path>(new Path(-1,InetAddress("10.8.0.1/9993"))),SharedPtr<Path>(new Path(-1,InetAddress("fd00::1/9993"))) };
+		for(unsigned int i=0;i<2;++i)
+			_multipathReceive(node,peer,paths[i],t0);
+		peer->doPingAndKeepalive((void *)0,t0); // notices there are several paths
+
+		// Every flow keeps its path across sends while all paths stay up
+		SharedPtr<Path> pinned[8];
+		for(int32_t f=0;f<8;++f)
+			pinned[f] = peer->getAppropriatePath(t0,false,f + 1);
+		int64_t now = t0;
+		bool stable = true;
+		for(;now<(t0 + 10000);now+=500) {
+			for(unsigned int i=0;i<2;++i)
+				_multipathReceive(node,peer,paths[i],now);
+			for(int32_t f=0;f<8;++f)
+				stable &= (peer->getAppropriatePath(now,false,f + 1) == pinned[f]);
+		}
+		unsigned int used = 0;
+		for(unsigned int i=0;i<2;++i)
+			used += (peer->pinnedFlows(paths[i]) > 0) ? 1 : 0;
+
+		// The first flow's path stops answering, so once it is no longer alive the flow moves
+		// to one that is and stays there
+		const SharedPtr<Path> dead(pinned[0]);
+		for(;now<(t0 + 10000 + ZT_PATH_HEARTBEAT_PERIOD + 6000);now+=500) {
+			for(unsigned int i=0;i<2;++i) {
+				if (paths[i] != dead)
+					_multipathReceive(node,peer,paths[i],now);
+			}
+		}
+		const SharedPtr<Path> moved(peer->getAppropriatePath(now,false,1));
+		bool settled = ((moved)&&(moved != dead)&&(moved->alive(now)));
+		for(unsigned int k=0;k<8;++k) {
+			now += 500;
+			for(unsigned int i=0;i<2;++i) {
+				if (paths[i] != dead)
+					_multipathReceive(node,peer,paths[i],now);
+			}
+			settled &= (peer->getAppropriatePath(now,false,1) == moved);
+		}
+		peer.zero();
+		delete node;
+		if ((!pinned[0])||(!stable)||(used < 2)) {
+			std::cout << "FAIL (flows " << ((stable) ? "not spread over paths" : "moved between live paths") << ")" << std::endl;
+			return -1;
+		}
+		if (!settled) {
+			std::cout << "FAIL (flow not moved off dead path)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[packet] Testing active-backup failover... "; std::cout.flush();
+	{
+		// The same peer as above, with traffic on the active path going unanswered
+		_RelayBenchHost host;
+		host.identity = KNOWN_GOOD_IDENTITY;
+		host.moonId = 0;
+		host.sent = 0;
+		host.lastHelloPacketId = 0;
+		host.userMessages = 0;
+		host.peerReads = 0;
+		ZT_Node_Callbacks cb;
+		memset(&cb,0,sizeof(cb));
+		cb.version = 0;
+		cb.stateGetFunction = _relayBenchStateGet;
+		cb.statePutFunction = _relayBenchStatePut;
+		cb.wirePacketSendFunction = _relayBenchWireSend;
+		cb.virtualNetworkFrameFunction = _relayBenchFrame;
+		cb.virtualNetworkConfigFunction = _relayBenchConfig;
+		cb.eventCallback = _relayBenchEvent;
+		const int64_t t0 = OSUtils::now();
+		Node *const node = new Node(&host,(void *)0,&cb,t0);
+		node->setMultipathMode(ZT_MULTIPATH_ACTIVE_BACKUP);
+		RuntimeEnvironment rr(node);
+		rr.identity.fromString(KNOWN_GOOD_IDENTITY);
+		Trace trace(&rr);
+		rr.t = &trace;
+		Topology topology(&rr,(void *)0);
+		rr.topology = &topology;
+
+		Identity other;
+		other.generate();
+		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+		Utils::getSecureRandom(key,sizeof(key));
+		SharedPtr<Peer> peer(new Peer(&rr,rr.identity,other,key));
+		peer->setRemoteVersion(ZT_PROTO_VERSION,ZEROTIER_ONE_VERSION_MAJOR,ZEROTIER_ONE_VERSION_MINOR,ZEROTIER_ONE_VERSION_REVISION);
+		const SharedPtr<Path> paths[2] = { SharedPtr<Path>(new Path(-1,InetAddress("10.8.0.1/9993"))),SharedPtr<Path>(new Path(-1,InetAddress("fd00::1/9993"))) };
+		for(unsigned int i=0;i<2;++i)
+			_multipathReceive(node,peer,paths[i],t0);
+		peer->doPingAndKeepalive((void *)0,t0);
+		int64_t now = t0 + 100;
+		for(unsigned int i=0;i<2;++i)
+			_multipathReceive(node,peer,paths[i],now); // answers the pings
+
+		// The active path stops answering while the backup keeps answering
+		const SharedPtr<Path> active(peer->getAppropriatePath(now,false));
+		const SharedPtr<Path> backup((active == paths[0]) ? paths[1] : paths[0]);
+		const int64_t t1 = now;
+		int64_t failedOverAt = 0;
+		for(now=t1;(now<(t1 + 2000))&&(!failedOverAt);now+=20) {
+			_multipathReceive(node,peer,backup,now);
+			const SharedPtr<Path> p(peer->getAppropriatePath(now,false));
+			if (p)
+				_multipathSend(peer,p,now);
+			if (p == backup)
+				failedOverAt = now;
+		}
+
+		// It answers again, but traffic only fails back once it has kept answering for a while
+		const int64_t t2 = now;
+		int64_t failedBackAt = 0;
+		for(;(now<(t2 + ZT_MULTIPATH_AB_FAILBACK_DELAY + 2000))&&(!failedBackAt);now+=100) {
+			_multipathReceive(node,peer,active,now);
+			_multipathReceive(node,peer,backup,now);
+			const SharedPtr<Path> p(peer->getAppropriatePath(now,false));
+			if (p)
+				_multipathSend(peer,p,now);
+			if (p == active)
+				failedBackAt = now;
+		}
+		peer.zero();
+		delete node;
+		if ((!active)||(!failedOverAt)||((failedOverAt - t1) > (ZT_MULTIPATH_AB_FAILOVER_BUDGET + 20))) {
+			std::cout << "FAIL (no failover within " << ZT_MULTIPATH_AB_FAILOVER_BUDGET << "ms)" << std::endl;
+			return -1;
+		}
+		if ((!failedBackAt)||((failedBackAt - t2) < ZT_MULTIPATH_AB_FAILBACK_DELAY)) {
+			std::cout << "FAIL (failed back " << ((failedBackAt) ? "too early" : "never") << ")" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (failed over after " << (failedOverAt - t1) << "ms)" << std::endl;
+	}
+
+	std::cout << "[packet] Testing dead path probe replies... "; std::cout.flush();
+	{
+		// Probes (empty ECHOs) via a confirmed path are answered at the per-path rate,
+		// while probes from anywhere else get one reply per second per peer
+		_RelayBenchHost host;
+		host.identity = KNOWN_GOOD_IDENTITY;
+		host.moonId = 0;
+		host.sent = 0;
+		host.lastHelloPacketId = 0;
+		host.userMessages = 0;
+		host.peerReads = 0;
+		Identity self;
+		self.fromString(KNOWN_GOOD_IDENTITY);
+		Identity remote;
+		remote.generate();
+		uint8_t key[ZT_PEER_SECRET_KEY_LENGTH];
+		remote.agree(self,key,ZT_PEER_SECRET_KEY_LENGTH);
+		host.upstreamKeys[remote.address().toInt()].assign((const char *)key,ZT_PEER_SECRET_KEY_LENGTH);
+		ZT_Node_Callbacks cb;
+		memset(&cb,0,sizeof(cb));
+		cb.version = 0;
+		cb.stateGetFunction = _relayBenchStateGet;
+		cb.statePutFunction = _relayBenchStatePut;
+		cb.wirePacketSendFunction = _relayBenchWireSend;
+		cb.virtualNetworkFrameFunction = _relayBenchFrame;
+		cb.virtualNetworkConfigFunction = _relayBenchConfig;
+		cb.eventCallback = _relayBenchEvent;
+		int64_t now = OSUtils::now();
+		Node *const node = new Node(&host,(void *)0,&cb,now);
+
+		// The remote says HELLO and answers the node's HELLO back, which confirms its path
+		const InetAddress confirmed("10.7.1.1/9993"),spoofed("10.7.1.2/9993");
+		volatile int64_t deadline = 0;
+		Packet hello(self.address(),remote.address(),Packet::VERB_HELLO);
+		hello.append((unsigned char)ZT_PROTO_VERSION);
+		hello.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+		hello.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+		hello.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+		hello.append((uint64_t)now);
+		remote.serialize(hello,false);
+		confirmed.serialize(hello);
+		hello.armor(key,false);
+		node->processWirePacket((void *)0,now,0,reinterpret_cast<const struct sockaddr_storage *>(&confirmed),hello.unsafeData(),hello.size(),&deadline);
+		Packet ok(self.address(),remote.address(),Packet::VERB_OK);
+		ok.append((unsigned char)Packet::VERB_HELLO);
+		ok.append(host.lastHelloPacketId);
+		ok.append((uint64_t)now);
+		ok.append((unsigned char)ZT_PROTO_VERSION);
+		ok.append((unsigned char)ZEROTIER_ONE_VERSION_MAJOR);
+		ok.append((unsigned char)ZEROTIER_ONE_VERSION_MINOR);
+		ok.append((uint16_t)ZEROTIER_ONE_VERSION_REVISION);
+		ok.armor(key,true);
+		node->processWirePacket((void *)0,now,0,reinterpret_cast<const struct sockaddr_storage *>(&confirmed),ok.unsafeData(),ok.size(),&deadline);
+
+		unsigned long replies[2] = { 0,0 };
+		for(unsigned int k=0;k<20;++k) {
+			now += ZT_PATH_PROBE_RATE_LIMIT + 5;
+			const InetAddress &from = (k < 10) ? confirmed : spoofed;
+			Packet probe(self.address(),remote.address(),Packet::VERB_ECHO);
+			probe.armor(key,true);
+			node->processWirePacket((void *)0,now,0,reinterpret_cast<const struct sockaddr_storage *>(&from),probe.unsafeData(),probe.size(),&deadline);
+		}
+		for(std::vector<InetAddress>::const_iterator r(host.echoReplies.begin());r!=host.echoReplies.end();++r) {
+			if (*r == confirmed)
+				++replies[0];
+			else if (*r == spoofed)
+				++replies[1];
+		}
+		delete node;
+		if ((replies[0] != 10)||(replies[1] != 1)) {
+			std::cout << "FAIL (" << replies[0] << " replies via confirmed path, " << replies[1] << " via other address)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
 	return 0;
 }
 
+struct _PublishedTestValue
+{
+	_PublishedTestValue(uint64_t x) : a(x),b(~x) { ++live; }
+	~_PublishedTestValue() { a = 0; b = 0; --live; }
+	volatile uint64_t a,b;
+	static AtomicCounter live;
+};
+AtomicCounter _PublishedTestValue::live;
+
+// Learns from a frame the way Network::learnNeighbors() does, with authorization decided by the caller
+static void _neighborLearn(NeighborCache &nc,const uint64_t nwid,const Address &peer,const bool authorized,const MAC &from,const unsigned int etherType,const uint8_t *frame,const unsigned int len,const int64_t now)
+{
+	const uint8_t *ip = (const uint8_t *)0;
+	unsigned int ipLen = 0;
+	MAC mac;
+	if (NeighborCache::announcement(etherType,frame,len,ip,ipLen,mac))
+		nc.learn(nwid,peer,false,authorized,from,ip,ipLen,mac,now);
+}
+
 static int testOther()
 {
 	char buf[1024];
@@ -835,6 +1988,936 @@ static int testOther()
 	std::cout << "PASS" << std::endl;
 #endif
 
+	std::cout << "[other] Testing/fuzzing TimerWheel... "; std::cout.flush();
+	{
+		TimerWheel<uint64_t> tw(100);
+		std::map<uint64_t,int64_t> ref;
+		int64_t now = 1000000 + (int64_t)(rand() % 100000);
+		std::vector<uint64_t> expired;
+		for(int k=0;k<100000;++k) {
+			const uint64_t key = (uint64_t)(rand() % 1000);
+			switch(rand() % 4) {
+				case 0:
+					tw.cancel(key);
+					ref.erase(key);
+					break;
+				default: {
+					// mostly short deadlines with the occasional one far beyond the lowest level's range
+					const int64_t d = now + ((rand() % 16) ? (int64_t)(rand() % 10000) : (int64_t)rand() % 100000000LL);
+					tw.schedule(key,d);
+					ref[key] = d;
+				}	break;
+			}
+			if ((rand() % 8) == 0) {
+				if (!ref.empty()) {
+					int64_t earliest = ref.begin()->second;
+					for(std::map<uint64_t,int64_t>::const_iterator i(ref.begin());i!=ref.end();++i)
+						earliest = std::min(earliest,i->second);
+					const int64_t nd = tw.nextDeadline(now);
+					if ((nd < 0)||(nd > (std::max(earliest,now) + 100))) {
+						std::cout << "FAILED! (nextDeadline " << nd << " later than earliest deadline " << earliest << ")" << std::endl;
+						return -1;
+					}
+				}
+				now += ((rand() % 64) == 0) ? (int64_t)(rand() % 1000000) : (int64_t)(rand() % 500);
+				expired.clear();
+				tw.expire(now,expired);
+				for(std::vector<uint64_t>::const_iterator i(expired.begin());i!=expired.end();++i) {
+					std::map<uint64_t,int64_t>::iterator r(ref.find(*i));
+					if ((r == ref.end())||(r->second > now)) {
+						std::cout << "FAILED! (key expired early or twice)" << std::endl;
+						return -1;
+					}
+					ref.erase(r);
+				}
+				for(std::map<uint64_t,int64_t>::const_iterator i(ref.begin());i!=ref.end();++i) {
+					if (i->second <= (now - 100)) {
+						std::cout << "FAILED! (key did not expire)" << std::endl;
+						return -1;
+					}
+				}
+			}
+		}
+		if (tw.size() != ref.size()) {
+			std::cout << "FAILED! (size mismatch)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing/fuzzing Multicaster membership... "; std::cout.flush();
+	{
+		RuntimeEnvironment rr((Node *)0);
+		rr.identity.fromString(KNOWN_GOOD_IDENTITY);
+		Multicaster mc(&rr);
+		const uint64_t nwid = 0x8056c2e21c000001ULL;
+		const MulticastGroup mg(MAC(0xffffffffffffULL),0);
+		std::map<Address,int64_t> ref;
+		int64_t now = 1000000;
+		for(int k=0;k<100000;++k) {
+			now += (int64_t)(rand() % 100);
+			const Address a((uint64_t)(0x1000000000ULL + (uint64_t)(rand() % 2000)));
+			switch(rand() % 8) {
+				case 0:
+					mc.remove(nwid,mg,a);
+					ref.erase(a);
+					break;
+				case 1:
+					if ((rand() % 100) == 0) {
+						mc.clean(now);
+						for(std::map<Address,int64_t>::iterator r(ref.begin());r!=ref.end();) {
+							if ((now - r->second) >= ZT_MULTICAST_LIKE_EXPIRE)
+								ref.erase(r++);
+							else ++r;
+						}
+					}
+					break;
+				default:
+					mc.add((void *)0,now,nwid,mg,a);
+					ref[a] = now;
+					break;
+			}
+			if ((k % 1000) == 0) {
+				const std::vector<Address> ls(mc.getMembers(nwid,mg,0xffffffff));
+				if (ls.size() != ref.size()) {
+					std::cout << "FAILED! (size mismatch)" << std::endl;
+					return -1;
+				}
+				for(unsigned long i=0;i<ls.size();++i) {
+					std::map<Address,int64_t>::const_iterator r(ref.find(ls[i]));
+					if ((r == ref.end())||((i > 0)&&(r->second > ref.find(ls[i-1])->second))) {
+						std::cout << "FAILED! (member or refresh order mismatch)" << std::endl;
+						return -1;
+					}
+				}
+			}
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing Path dead path detection... "; std::cout.flush();
+	{
+		Path p;
+		p.sent(1000);
+		p.sent(1100);
+		if ((p.unansweredFor(1200) != 200)||(p.failed(1200,300))||(!p.needsProbe(1200,100))||(p.needsProbe(1250,100))) {
+			std::cout << "FAILED! (unanswered traffic not tracked)" << std::endl;
+			return -1;
+		}
+		if ((!p.failed(1300,300))||(!p.fail(1300))||(p.fail(1350))||(p.lastDetectionTime() != 300)||(p.failures() != 1)) {
+			std::cout << "FAILED! (dead path not detected once)" << std::endl;
+			return -1;
+		}
+		p.received(2000);
+		if ((p.failed())||(p.failed(2000,300))||(p.unansweredFor(2000) != 0)||(p.upFor(2500) != 500)) {
+			std::cout << "FAILED! (recovery not noticed)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing Path MTU discovery... "; std::cout.flush();
+	{
+		Path p;
+		unsigned int pathMtu = 8972; // 9000 byte IPv4 LAN
+		uint64_t probeId = 1;
+		int64_t now = 1000;
+		for(int phase=0;phase<3;++phase) {
+			for(int k=0;k<2000;++k,now+=500) {
+				if (p.mtuProbeDue(now)) {
+					const unsigned int size = p.nextMtuProbe(now,ZT_DEFAULT_PHYSMTU,ZT_PATH_MTU_MAX);
+					if (size) {
+						p.mtuProbeSent(++probeId);
+						if (size <= pathMtu)
+							p.mtuProbeAnswered(probeId);
+					}
+				}
+			}
+			const unsigned int m = p.mtu(ZT_DEFAULT_PHYSMTU);
+			if ( ((pathMtu >= ZT_MIN_PHYSMTU)&&((m > pathMtu)||((pathMtu - m) >= ZT_PATH_MTU_SEARCH_GRANULARITY))) || ((pathMtu < ZT_MIN_PHYSMTU)&&(m != ZT_MIN_PHYSMTU)) ) {
+				std::cout << "FAILED! (path MTU " << pathMtu << " discovered as " << m << ")" << std::endl;
+				return -1;
+			}
+			now += ZT_PATH_MTU_RAISE_INTERVAL;
+			pathMtu = (phase == 0) ? 1464 : 1300; // path moved behind PPPoE, then into a tunnel that black-holes the default
+		}
+	}
+	{
+		// A host that ignores don't fragment answers every probe, so without
+		// discovery enabled the search must stop at the base
+		Path p;
+		uint64_t probeId = 1;
+		for(int64_t now=1000;now<1000000;now+=500) {
+			if ((p.mtuProbeDue(now))&&(p.nextMtuProbe(now,ZT_DEFAULT_PHYSMTU,ZT_DEFAULT_PHYSMTU))) {
+				p.mtuProbeSent(++probeId);
+				p.mtuProbeAnswered(probeId);
+			}
+		}
+		if (p.mtu(ZT_DEFAULT_PHYSMTU) != ZT_DEFAULT_PHYSMTU) {
+			std::cout << "FAILED! (MTU raised to " << p.mtu(ZT_DEFAULT_PHYSMTU) << " without discovery)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing Path fragment loss reports... "; std::cout.flush();
+	{
+		// Loss is only seen by the receiving end, which reports it to the sending end
+		Path rx,tx;
+		unsigned int loss = 0;
+		for(int k=0;k<20;++k)
+			rx.recordFragments(3,3);
+		const bool quietWhenClean = !rx.fragmentLossReportDue(1000,loss);
+		for(int k=0;k<20;++k)
+			rx.recordFragments(2,3);
+		const bool reported = rx.fragmentLossReportDue(1000,loss);
+		unsigned int again = 0;
+		const bool rateLimited = !rx.fragmentLossReportDue(1000 + (ZT_PATH_FRAGMENT_LOSS_REPORT_INTERVAL / 2),again);
+		tx.recordFragmentLossReport(loss,1000);
+		if ((!quietWhenClean)||(!reported)||(!loss)||(!rateLimited)||(fabs(tx.outboundLossRatio(1000) - rx.packetLossRatio()) > 0.001f)||(tx.packetLossRatio() != 0.0f)) {
+			std::cout << "FAILED! (loss of " << rx.packetLossRatio() << " reported as " << tx.outboundLossRatio(1000) << ")" << std::endl;
+			return -1;
+		}
+		for(int k=0;k<1000;++k)
+			rx.recordFragments(3,3);
+		const bool clearedReported = ((rx.fragmentLossReportDue(1000 + ZT_PATH_FRAGMENT_LOSS_REPORT_INTERVAL,loss))&&(loss == 0));
+		const bool clearedOnce = !rx.fragmentLossReportDue(1000 + (ZT_PATH_FRAGMENT_LOSS_REPORT_INTERVAL * 2),loss);
+		if ((!clearedReported)||(!clearedOnce)||(tx.outboundLossRatio(1000 + ZT_PATH_FRAGMENT_LOSS_REPORT_TIMEOUT) != 0.0f)) {
+			std::cout << "FAILED! (end of loss not reported once, or stale report used)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing RingBuffer statistics... "; std::cout.flush();
+	{
+		RingBuffer<uint32_t,64> rb;
+		std::vector<uint32_t> ref;
+		uint32_t tmp[8];
+		for(unsigned int k=0;k<100000;++k) {
+			const unsigned int op = (unsigned int)rand() % 16;
+			if (op == 0) {
+				const size_t n = rb.consume((size_t)rand() % 8);
+				ref.erase(ref.begin(),ref.begin() + n);
+			} else if (op == 1) {
+				const size_t n = rb.read(tmp,(size_t)rand() % 8);
+				if ((n > ref.size())||(memcmp(tmp,ref.data(),n * sizeof(uint32_t)) != 0)) {
+					std::cout << "FAILED! (read mismatch)" << std::endl;
+					return -1;
+				}
+				ref.erase(ref.begin(),ref.begin() + n);
+			} else {
+				const uint32_t v = ((rand() % 4) == 0) ? 0 : (uint32_t)rand() % 100000;
+				rb.push(v);
+				if (ref.size() == 64)
+					ref.erase(ref.begin());
+				ref.push_back(v);
+			}
+			if ((k % 97) == 0) {
+				double sum = 0.0;
+				size_t zeros = 0;
+				for(unsigned long i=0;i<ref.size();++i) {
+					sum += (double)ref[i];
+					if (!ref[i])
+						++zeros;
+				}
+				const double mean = ref.size() ? sum / (double)ref.size() : 0.0;
+				double m2 = 0.0;
+				for(unsigned long i=0;i<ref.size();++i)
+					m2 += ((double)ref[i] - mean) * ((double)ref[i] - mean);
+				const double variance = (ref.size() > 1) ? m2 / (double)(ref.size() - 1) : 0.0;
+				double recent = 0.0;
+				for(unsigned long i=(ref.size() > 8) ? (ref.size() - 8) : 0;i<ref.size();++i)
+					recent += (double)ref[i];
+				recent /= (double)std::max((size_t)1,std::min((size_t)8,ref.size()));
+				if ((rb.count() != ref.size())||(rb.zeroCount() != zeros)||(fabs(rb.sum() - sum) > 0.5)||(fabs(rb.mean() - mean) > 0.01)||(fabs(rb.variance() - variance) > (variance * 0.0001 + 0.01))||(fabs(rb.mean(8) - recent) > 0.01)) {
+					std::cout << "FAILED! (aggregates diverged from window contents)" << std::endl;
+					return -1;
+				}
+			}
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing Published<> under concurrent readers... "; std::cout.flush();
+	{
+		AtomicCounter bad,done;
+		{
+			Published<_PublishedTestValue> pv;
+			pv.publish(new _PublishedTestValue(1));
+			std::vector<std::thread> readers;
+			for(int t=0;t<3;++t) {
+				readers.push_back(std::thread([&pv,&bad,&done]() {
+					while (!done.load()) {
+						Published<_PublishedTestValue>::Reader r(pv);
+						if ((!r)||(r->a == 0)||(r->b != ~r->a))
+							++bad;
+					}
+				}));
+			}
+			for(uint64_t k=2;k<20000;++k)
+				pv.publish(new _PublishedTestValue(k));
+			++done;
+			for(unsigned long t=0;t<readers.size();++t)
+				readers[t].join();
+			if (_PublishedTestValue::live.load() != 1) {
+				std::cout << "FAILED! (retired objects not freed)" << std::endl;
+				return -1;
+			}
+		}
+		if ((bad.load() != 0)||(_PublishedTestValue::live.load() != 0)) {
+			std::cout << "FAILED! (reader saw a freed or torn object)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing NeighborCache... "; std::cout.flush();
+	{
+		const uint64_t nwid = 0x8056c2e21c000001ULL;
+		const Address peer(0x1122334455ULL),other(0x5544332211ULL);
+		const MAC peerMac(peer,nwid),hostMac(0x32aabbccddeeULL);
+		const int64_t now = 1000000;
+		NeighborCache nc;
+		uint8_t reply[ZT_NEIGHBOR_CACHE_REPLY_BUF_LENGTH];
+		MAC replyFrom;
+
+		const uint8_t arpHeader[6] = { 0x00,0x01,0x08,0x00,0x06,0x04 };
+		uint8_t arp[28];
+		memcpy(arp,arpHeader,6);
+
+		// ARP reply from peer for 10.1.2.3, and a spoofed one from another member claiming peer's MAC
+		arp[6] = 0x00; arp[7] = 0x02;
+		peerMac.copyTo(arp + 8,6);
+		arp[14] = 10; arp[15] = 1; arp[16] = 2; arp[17] = 3;
+		hostMac.copyTo(arp + 18,6);
+		arp[24] = 10; arp[25] = 1; arp[26] = 2; arp[27] = 4;
+		_neighborLearn(nc,nwid,other,true,peerMac,ZT_ETHERTYPE_ARP,arp,28,now);
+		if (nc.size() != 0) {
+			std::cout << "FAILED! (learned spoofed ARP reply)" << std::endl;
+			return -1;
+		}
+		_neighborLearn(nc,nwid,peer,true,peerMac,ZT_ETHERTYPE_ARP,arp,28,now);
+
+		// ARP request from host for 10.1.2.3
+		arp[7] = 0x01;
+		hostMac.copyTo(arp + 8,6);
+		arp[14] = 10; arp[15] = 1; arp[16] = 2; arp[17] = 4;
+		memset(arp + 18,0,6);
+		arp[24] = 10; arp[25] = 1; arp[26] = 2; arp[27] = 3;
+		if ((nc.answer(ZT_ETHERTYPE_ARP,arp,28,now,reply,replyFrom) != 28)||(replyFrom != peerMac)||(reply[7] != 0x02)||(memcmp(reply + 14,arp + 24,4) != 0)||(memcmp(reply + 18,arp + 8,10) != 0)) {
+			std::cout << "FAILED! (ARP request not answered)" << std::endl;
+			return -1;
+		}
+		arp[14] = 0; arp[15] = 0; arp[16] = 0; arp[17] = 0;
+		if (nc.answer(ZT_ETHERTYPE_ARP,arp,28,now,reply,replyFrom) != 0) {
+			std::cout << "FAILED! (answered ARP probe)" << std::endl;
+			return -1;
+		}
+		arp[14] = 10; arp[15] = 1; arp[16] = 2; arp[17] = 4;
+
+		// Gratuitous ARPs for 10.1.2.3 from members not authorized for it are never learned. One
+		// repeating the cached MAC leaves the entry alone, and one claiming it for another MAC
+		// expires it. A member that is authorized takes the IP over.
+		uint8_t garp[28];
+		memcpy(garp,arpHeader,6);
+		garp[6] = 0x00; garp[7] = 0x01;
+		peerMac.copyTo(garp + 8,6);
+		garp[14] = 10; garp[15] = 1; garp[16] = 2; garp[17] = 3;
+		memset(garp + 18,0,6);
+		memcpy(garp + 24,garp + 14,4);
+		_neighborLearn(nc,nwid,peer,false,peerMac,ZT_ETHERTYPE_ARP,garp,28,now);
+		if ((nc.answer(ZT_ETHERTYPE_ARP,arp,28,now,reply,replyFrom) != 28)||(replyFrom != peerMac)) {
+			std::cout << "FAILED! (unauthorized gratuitous ARP from owner expired its entry)" << std::endl;
+			return -1;
+		}
+		MAC(other,nwid).copyTo(garp + 8,6);
+		_neighborLearn(nc,nwid,other,false,MAC(other,nwid),ZT_ETHERTYPE_ARP,garp,28,now);
+		if ((nc.size() != 0)||(nc.answer(ZT_ETHERTYPE_ARP,arp,28,now,reply,replyFrom) != 0)) {
+			std::cout << "FAILED! (unauthorized gratuitous ARP learned or left conflicting entry)" << std::endl;
+			return -1;
+		}
+		_neighborLearn(nc,nwid,other,true,MAC(other,nwid),ZT_ETHERTYPE_ARP,garp,28,now);
+		if ((nc.answer(ZT_ETHERTYPE_ARP,arp,28,now,reply,replyFrom) != 28)||(replyFrom != MAC(other,nwid))) {
+			std::cout << "FAILED! (authorized gratuitous ARP not learned)" << std::endl;
+			return -1;
+		}
+
+		nc.clean(now + ZT_NEIGHBOR_CACHE_OBSERVED_TTL);
+		if ((nc.size() != 0)||(nc.answer(ZT_ETHERTYPE_ARP,arp,28,now + ZT_NEIGHBOR_CACHE_OBSERVED_TTL,reply,replyFrom) != 0)) {
+			std::cout << "FAILED! (observed entry did not expire)" << std::endl;
+			return -1;
+		}
+
+		// Certificate of ownership entries win over observed replies and are forgotten on revocation
+		CertificateOfOwnership coo(nwid,now,peer,1);
+		coo.addThing(InetAddress("10.1.2.3/0"));
+		coo.addThing(InetAddress("fd00::1234/0"));
+		nc.learn(nwid,coo,now);
+		arp[7] = 0x02;
+		MAC(other,nwid).copyTo(arp + 8,6);
+		arp[14] = 10; arp[15] = 1; arp[16] = 2; arp[17] = 3;
+		_neighborLearn(nc,nwid,other,true,MAC(other,nwid),ZT_ETHERTYPE_ARP,arp,28,now);
+		arp[7] = 0x01;
+		hostMac.copyTo(arp + 8,6);
+		arp[14] = 10; arp[15] = 1; arp[16] = 2; arp[17] = 4;
+		if ((nc.answer(ZT_ETHERTYPE_ARP,arp,28,now,reply,replyFrom) != 28)||(replyFrom != peerMac)) {
+			std::cout << "FAILED! (observed reply overrode certificate of ownership)" << std::endl;
+			return -1;
+		}
+
+		// Neighbor solicitation from host for fd00::1234
+		uint8_t ns[72];
+		memset(ns,0,sizeof(ns));
+		ns[0] = 0x60; ns[5] = 32; ns[6] = 0x3a; ns[7] = 0xff;
+		ns[8] = 0xfd; ns[23] = 0x01; // source fd00::1
+		ns[40] = 0x87;
+		ns[48] = 0xfd; ns[62] = 0x12; ns[63] = 0x34; // target fd00::1234
+		if ((nc.answer(ZT_ETHERTYPE_IPV6,ns,72,now,reply,replyFrom) != 72)||(replyFrom != peerMac)||(reply[40] != 0x88)||(memcmp(reply + 8,ns + 48,16) != 0)||(memcmp(reply + 24,ns + 8,16) != 0)) {
+			std::cout << "FAILED! (neighbor solicitation not answered)" << std::endl;
+			return -1;
+		}
+
+		nc.forget(peer);
+		if ((nc.size() != 0)||(nc.answer(ZT_ETHERTYPE_IPV6,ns,72,now,reply,replyFrom) != 0)) {
+			std::cout << "FAILED! (entries survived forget)" << std::endl;
+			return -1;
+		}
+		if ((nc.answered() != 5)||(nc.misses() != 3)) {
+			std::cout << "FAILED! (answered/missed counters wrong)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Fuzzing compiled rules against the rule interpreter... "; std::cout.flush();
+	{
+		// Credentials are issued by a network whose controller is this identity, so they
+		// verify without any lookups. The node is only here for the topology's state callbacks.
+		_RelayBenchHost host;
+		host.identity = KNOWN_GOOD_IDENTITY;
+		host.moonId = 0;
+		host.sent = 0;
+		host.lastHelloPacketId = 0;
+		host.userMessages = 0;
+		host.peerReads = 0;
+		ZT_Node_Callbacks cb;
+		memset(&cb,0,sizeof(cb));
+		cb.version = 0;
+		cb.stateGetFunction = _relayBenchStateGet;
+		cb.statePutFunction = _relayBenchStatePut;
+		cb.wirePacketSendFunction = _relayBenchWireSend;
+		cb.virtualNetworkFrameFunction = _relayBenchFrame;
+		cb.virtualNetworkConfigFunction = _relayBenchConfig;
+		cb.eventCallback = _relayBenchEvent;
+		Node *const node = new Node(&host,(void *)0,&cb,OSUtils::now());
+		RuntimeEnvironment rr(node);
+		rr.identity.fromString(KNOWN_GOOD_IDENTITY);
+		Trace trace(&rr);
+		rr.t = &trace;
+		Topology *const topology = new Topology(&rr,(void *)0); // saves its peers on destruction, so goes before the node
+		rr.topology = topology;
+		const Address self(rr.identity.address());
+		const uint64_t nwid = (self.toInt() << 24) | 1ULL;
+		const int64_t ts = 1000000;
+
+		NetworkConfig *const nconf = new NetworkConfig();
+		nconf->networkId = nwid;
+		nconf->issuedTo = self;
+		nconf->timestamp = ts;
+		nconf->credentialTimeMaxDelta = 1000;
+		nconf->tagCount = 2;
+		nconf->tags[0] = Tag(nwid,ts,self,1,5);
+		nconf->tags[1] = Tag(nwid,ts,self,7,100);
+
+		static const uint16_t etherTypes[4] = { ZT_ETHERTYPE_IPV4,ZT_ETHERTYPE_IPV6,ZT_ETHERTYPE_ARP,0x88cc };
+		static const uint8_t ipProtocols[5] = { 0x06,0x11,0x01,0x3a,0x00 };
+		static const uint16_t ports[6] = { 0,22,53,80,443,8080 };
+		static const uint8_t ip4s[3][4] = { { 10,0,0,1 },{ 10,0,0,0 },{ 192,168,1,1 } };
+		static const uint8_t ip6s[2][16] = { { 0xfd,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1 },{ 0xfd,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 } };
+		const uint64_t ztAddrs[4] = { self.toInt(),0x1111111111ULL,0x2222222222ULL,0x3333333333ULL };
+		static const uint8_t actionTypes[8] = { ZT_NETWORK_RULE_ACTION_DROP,ZT_NETWORK_RULE_ACTION_ACCEPT,ZT_NETWORK_RULE_ACTION_TEE,ZT_NETWORK_RULE_ACTION_WATCH,ZT_NETWORK_RULE_ACTION_REDIRECT,ZT_NETWORK_RULE_ACTION_BREAK,ZT_NETWORK_RULE_ACTION_PRIORITY,9 };
+		static const uint8_t ip4Masks[6] = { 0,8,16,24,31,32 };
+		static const uint8_t ip6Masks[5] = { 0,8,64,120,128 };
+
+		// Senders holding random tags and certificates of ownership for the addresses the
+		// frames use, some of them too old or new for the config and so ignored
+		nconf->certificateOfOwnershipCount = 1;
+		nconf->certificatesOfOwnership[0] = CertificateOfOwnership(nwid,ts,self,1);
+		nconf->certificatesOfOwnership[0].addThing(InetAddress(ip4s[0],4,0));
+		nconf->certificatesOfOwnership[0].addThing(InetAddress(ip6s[0],16,0));
+		Membership members[8];
+		unsigned long memberTags = 0,memberCoos = 0;
+		for(unsigned int m=0;m<8;++m) {
+			for(uint32_t id=1;id<=7;id+=3) {
+				if (rand() % 4) {
+					Tag t(nwid,ts + (((rand() % 4) == 0) ? 5000 : (rand() % 500)),Address(ztAddrs[m % 4]),id,(uint32_t)(rand() % 128));
+					t.sign(rr.identity);
+					if (members[m].addCredential(&rr,(void *)0,*nconf,t) == Membership::ADD_ACCEPTED_NEW)
+						++memberTags;
+				}
+			}
+			for(uint32_t id=1,n=(uint32_t)(rand() % 3);id<=n;++id) {
+				CertificateOfOwnership c(nwid,ts - (((rand() % 4) == 0) ? 5000 : (rand() % 500)),Address(ztAddrs[m % 4]),id);
+				for(int t=(rand() % 3) + 1;t>0;--t) {
+					switch(rand() % 3) {
+						case 0: c.addThing(InetAddress(ip4s[rand() % 3],4,0)); break;
+						case 1: c.addThing(InetAddress(ip6s[rand() % 2],16,0)); break;
+						default: {
+							const uint8_t mb[6] = { 0x02,0,0,0,0,(uint8_t)(rand() % 3) };
+							c.addThing(MAC(mb,6));
+						}	break;
+					}
+				}
+				c.sign(rr.identity);
+				if (members[m].addCredential(&rr,(void *)0,*nconf,c) == Membership::ADD_ACCEPTED_NEW)
+					++memberCoos;
+			}
+		}
+		if ((!memberTags)||(!memberCoos)) {
+			std::cout << "FAILED! (credentials not accepted)" << std::endl;
+			delete nconf;
+			delete topology;
+			delete node;
+			return -1;
+		}
+
+		ZT_VirtualNetworkRule rules[128];
+		uint8_t frame[256];
+		unsigned long indexedSets = 0;
+		unsigned long flowKeyTwins = 0;
+
+		for(int k=0;k<3000;++k) {
+			const unsigned int ruleCount = (unsigned int)(rand() % ((k & 1) ? 128 : 16)) + 1;
+			const bool perPort = ((k % 4) == 3); // mostly "protocol, port range, action" blocks as in per-port microsegmentation
+			for(unsigned int rn=0;rn<ruleCount;++rn) {
+				ZT_VirtualNetworkRule &r = rules[rn];
+				memset(&r,0,sizeof(r));
+				if ((perPort)&&(rand() % 8)) {
+					switch(rn % 3) {
+						case 0: r.t = ZT_NETWORK_RULE_MATCH_IP_PROTOCOL; r.v.ipProtocol = ipProtocols[rand() % 2]; break;
+						case 1:
+							r.t = (uint8_t)((rand() % 4) ? ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE : ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE);
+							r.v.port[0] = ports[rand() % 6];
+							r.v.port[1] = ports[rand() % 6];
+							break;
+						default: r.t = actionTypes[rand() % 2]; break;
+					}
+					continue;
+				}
+				if ((rand() % 4) == 0) {
+					r.t = actionTypes[rand() % 8];
+					if (r.t == ZT_NETWORK_RULE_ACTION_PRIORITY) {
+						r.v.qosBucket = (uint8_t)(rand() % 9);
+					} else {
+						r.v.fwd.address = ztAddrs[rand() % 4];
+						r.v.fwd.length = (rand() % 3) ? 0 : (uint16_t)(rand() % 100);
+					}
+					continue;
+				}
+
+				r.t = (uint8_t)(ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS + (rand() % 29)); // through 52, one past the last supported MATCH
+				if (r.t == ZT_NETWORK_RULE_MATCH_RANDOM)
+					r.t = ZT_NETWORK_RULE_MATCH_ETHERTYPE; // compiled rules interpret sets using the PRNG
+				switch(r.t) {
+					case ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS:
+					case ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS: r.v.zt = ztAddrs[rand() % 4]; break;
+					case ZT_NETWORK_RULE_MATCH_VLAN_ID: r.v.vlanId = (uint16_t)(rand() % 3); break;
+					case ZT_NETWORK_RULE_MATCH_VLAN_PCP: r.v.vlanPcp = (uint8_t)(rand() % 2); break;
+					case ZT_NETWORK_RULE_MATCH_VLAN_DEI: r.v.vlanDei = (uint8_t)(rand() % 2); break;
+					case ZT_NETWORK_RULE_MATCH_MAC_SOURCE:
+					case ZT_NETWORK_RULE_MATCH_MAC_DEST: r.v.mac[0] = 0x02; r.v.mac[5] = (uint8_t)(rand() % 3); break;
+					case ZT_NETWORK_RULE_MATCH_IPV4_SOURCE:
+					case ZT_NETWORK_RULE_MATCH_IPV4_DEST: memcpy(&(r.v.ipv4.ip),ip4s[rand() % 3],4); r.v.ipv4.mask = ip4Masks[rand() % 6]; break;
+					case ZT_NETWORK_RULE_MATCH_IPV6_SOURCE:
+					case ZT_NETWORK_RULE_MATCH_IPV6_DEST: memcpy(r.v.ipv6.ip,ip6s[rand() % 2],16); r.v.ipv6.mask = ip6Masks[rand() % 5]; break;
+					case ZT_NETWORK_RULE_MATCH_IP_TOS: r.v.ipTos.mask = (uint8_t)rand(); r.v.ipTos.value[0] = (uint8_t)(rand() % 64); r.v.ipTos.value[1] = (uint8_t)(r.v.ipTos.value[0] + (rand() % 64)); break;
+					case ZT_NETWORK_RULE_MATCH_IP_PROTOCOL: r.v.ipProtocol = ipProtocols[rand() % 5]; break;
+					case ZT_NETWORK_RULE_MATCH_ETHERTYPE: r.v.etherType = etherTypes[rand() % 4]; break;
+					case ZT_NETWORK_RULE_MATCH_ICMP: r.v.icmp.type = (uint8_t)((rand() % 2) ? 8 : 0); r.v.icmp.code = (uint8_t)(rand() % 2); r.v.icmp.flags = (uint8_t)(rand() % 2); break;
+					case ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE:
+					case ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE:
+						r.v.port[0] = ports[rand() % 6];
+						r.v.port[1] = (rand() % 2) ? r.v.port[0] : ports[rand() % 6];
+						break;
+					case ZT_NETWORK_RULE_MATCH_CHARACTERISTICS:
+						r.v.characteristics = (1ULL << (rand() % 12)) | (((rand() % 4) == 0) ? (0x0800000000000000ULL << (rand() % 5)) : 0ULL);
+						break;
+					case ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE: r.v.frameSize[0] = (uint16_t)(rand() % 100); r.v.frameSize[1] = (uint16_t)(r.v.frameSize[0] + (rand() % 200)); break;
+					case ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE:
+					case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND:
+					case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR:
+					case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR:
+					case ZT_NETWORK_RULE_MATCH_TAGS_EQUAL:
+					case ZT_NETWORK_RULE_MATCH_TAG_SENDER:
+					case ZT_NETWORK_RULE_MATCH_TAG_RECEIVER: r.v.tag.id = (uint32_t)((rand() % 3) * 3 + 1); r.v.tag.value = (uint32_t)(rand() % 128); break;
+					case ZT_NETWORK_RULE_MATCH_INTEGER_RANGE: r.v.intRange.start = (uint64_t)(rand() % 256); r.v.intRange.end = (uint32_t)(rand() % 16); r.v.intRange.idx = (uint16_t)(rand() % 64); r.v.intRange.format = (uint8_t)rand(); break;
+					default: break;
+				}
+				if ((rand() % 5) == 0) r.t |= 0x80; // NOT
+				if ((rand() % 5) == 0) r.t |= 0x40; // OR
+			}
+
+			CompiledRules cr;
+			cr.compile(self,rules,ruleCount);
+			if (cr.indexed())
+				++indexedSets;
+			nconf->flags = (rand() % 2) ? ZT_NETWORKCONFIG_FLAG_RULES_RESULT_OF_UNSUPPORTED_MATCH : 0;
+
+			for(int f=0;f<64;++f) {
+				const unsigned int etherType = ((rand() % 16) == 0) ? (unsigned int)(rand() & 0xffff) : (unsigned int)etherTypes[rand() % 4];
+				Utils::getSecureRandom(frame,sizeof(frame));
+				unsigned int l4 = 0;
+				if (etherType == ZT_ETHERTYPE_IPV4) {
+					frame[0] = ((rand() % 8) == 0) ? frame[0] : 0x45;
+					frame[9] = ipProtocols[rand() % 5];
+					memcpy(frame + 12,ip4s[rand() % 3],4);
+					memcpy(frame + 16,ip4s[rand() % 3],4);
+					l4 = 20;
+				} else if (etherType == ZT_ETHERTYPE_IPV6) {
+					frame[6] = ipProtocols[rand() % 5]; // 0 is hop-by-hop options, followed by a random next header
+					memcpy(frame + 8,ip6s[rand() % 2],16);
+					memcpy(frame + 24,ip6s[rand() % 2],16);
+					l4 = 40;
+				} else if ((etherType == ZT_ETHERTYPE_ARP)&&(rand() % 4)) {
+					memcpy(frame + 14,ip4s[rand() % 3],4); // sender protocol address
+				}
+				if ((l4)&&(rand() % 4)) {
+					for(unsigned int pi=0;pi<4;pi+=2) {
+						const uint16_t p = (uint16_t)(ports[rand() % 6] + ((rand() % 3) - 1)); // on and either side of range bounds
+						frame[l4 + pi] = (uint8_t)(p >> 8);
+						frame[l4 + pi + 1] = (uint8_t)p;
+					}
+				}
+				const unsigned int frameLen = ((rand() % 8) == 0) ? (unsigned int)(rand() % 64) : (unsigned int)(40 + (rand() % 216));
+
+				const bool inbound = ((rand() % 2) == 0);
+				const Address ztSource(ztAddrs[rand() % 4]);
+				const Address ztDest(ztAddrs[rand() % 4]);
+				uint8_t mb[6] = { 0x02,0,0,0,0,(uint8_t)(rand() % 3) };
+				const MAC macSource(mb,6);
+				mb[5] = (uint8_t)(rand() % 3);
+				const MAC macDest(((rand() % 4) == 0) ? MAC(0xffffffffffffULL) : MAC(mb,6));
+				const unsigned int vlanId = (unsigned int)(rand() % 3);
+				const Membership *const membership = ((rand() % 8) == 0) ? (const Membership *)0 : &(members[rand() % 8]);
+
+				Trace::RuleResultLog rrl;
+				Address d1(ztDest),d2(ztDest),cc1,cc2;
+				unsigned int l1 = 0,l2 = 0;
+				bool w1 = false,w2 = false;
+				uint8_t q1 = 0,q2 = 0;
+				const CompiledRules::Result r1 = CompiledRules::interpret(&rr,rrl,*nconf,membership,inbound,ztSource,d1,macSource,macDest,frame,frameLen,etherType,vlanId,rules,ruleCount,cc1,l1,w1,q1);
+				const CompiledRules::Result r2 = cr.filter(&rr,*nconf,membership,inbound,ztSource,d2,macSource,macDest,frame,frameLen,etherType,vlanId,cc2,l2,w2,q2);
+				if ((r1 != r2)||(d1 != d2)||(cc1 != cc2)||(l1 != l2)||(w1 != w2)||(q1 != q2)) {
+					std::cout << "FAILED! (rule set " << k << " frame " << f << ": interpreter " << (int)r1 << " compiled " << (int)r2 << ")" << std::endl;
+					delete nconf;
+					delete topology;
+					delete node;
+					return -1;
+				}
+
+				// Rule sets that don't look at the destination must give any destination the same outbound result
+				if ((!inbound)&&(cr.destinationIndependent())) {
+					Address d4(ztAddrs[rand() % 4]),cc4;
+					unsigned int l4d = 0;
+					bool w4 = false;
+					uint8_t q4 = 0;
+					if (cr.filter(&rr,*nconf,membership,false,ztSource,d4,macSource,macDest,frame,frameLen,etherType,vlanId,cc4,l4d,w4,q4) != r1) {
+						std::cout << "FAILED! (rule set " << k << " frame " << f << ": destination independent result differs by destination)" << std::endl;
+						delete nconf;
+						delete topology;
+						delete node;
+						return -1;
+					}
+				}
+
+				// A frame differing only outside its flow key must get the same decision
+				CompiledRules::FlowKey fk1,fk2;
+				if ((cr.cacheable())&&(CompiledRules::flowKey(fk1,inbound,ztSource,ztDest,macSource,macDest,frame,frameLen,etherType,vlanId,0))) {
+					uint8_t twin[256];
+					memcpy(twin,frame,sizeof(twin));
+					twin[rand() % (l4 + 4)] = (uint8_t)rand(); // headers, where most bytes are part of the key
+					for(int m=0;m<3;++m)
+						twin[(l4 + 4) + (rand() % (256 - (l4 + 4)))] = (uint8_t)rand();
+					const unsigned int twinLen = ((rand() % 2) == 0) ? frameLen : (unsigned int)(rand() % 256);
+					if ((CompiledRules::flowKey(fk2,inbound,ztSource,ztDest,macSource,macDest,twin,twinLen,etherType,vlanId,0))&&(fk1 == fk2)) {
+						Address d3(ztDest),cc3;
+						unsigned int l3 = 0;
+						bool w3 = false;
+						uint8_t q3 = 0;
+						const CompiledRules::Result r3 = CompiledRules::interpret(&rr,rrl,*nconf,membership,inbound,ztSource,d3,macSource,macDest,twin,twinLen,etherType,vlanId,rules,ruleCount,cc3,l3,w3,q3);
+						if ((r1 != r3)||(d1 != d3)||(cc1 != cc3)||(w1 != w3)||(q1 != q3)||((cc3)&&(l3 != twinLen))) {
+							std::cout << "FAILED! (rule set " << k << " frame " << f << ": same flow key, results " << (int)r1 << " and " << (int)r3 << ")" << std::endl;
+							delete nconf;
+							delete topology;
+							delete node;
+							return -1;
+						}
+						++flowKeyTwins;
+					}
+				}
+			}
+		}
+
+		delete nconf;
+		delete topology;
+		delete node;
+		if (!indexedSets) {
+			std::cout << "FAILED! (no rule set was indexed)" << std::endl;
+			return -1;
+		}
+		if (!flowKeyTwins) {
+			std::cout << "FAILED! (no frames shared a flow key)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing delta network configs... "; std::cout.flush();
+	{
+		const Address self(0x1234567890ULL);
+		const uint64_t nwid = 0x8056c2e21c000001ULL;
+		NetworkConfig *const sent = new NetworkConfig();
+		sent->networkId = nwid;
+		sent->issuedTo = self;
+		sent->timestamp = 1000;
+		sent->revision = 7;
+		sent->tagCount = 1;
+		sent->tags[0] = Tag(nwid,1000,self,1,5);
+		sent->staticIps[sent->staticIpCount++] = InetAddress("10.1.2.3/24");
+		for(unsigned int i=0;i<512;++i) {
+			sent->rules[sent->ruleCount].t = ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE;
+			sent->rules[sent->ruleCount].v.port[0] = sent->rules[sent->ruleCount].v.port[1] = (uint16_t)(i + 1);
+			++sent->ruleCount;
+			sent->rules[sent->ruleCount++].t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+		}
+
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> *const d = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+		NetworkConfig *const held = new NetworkConfig();
+		NetworkConfig *const applied = new NetworkConfig();
+		NetworkConfig *const full = new NetworkConfig();
+		NetworkConfig::DeltaBase base,next;
+		sent->toDictionary(*d,false,&base);
+		const unsigned int fullSize = d->sizeBytes();
+		held->fromDictionary(*d);
+
+		// Controller regenerates: new timestamp, revision, credentials, and one static IP
+		sent->timestamp = 2000;
+		sent->revision = 8;
+		sent->tags[0] = Tag(nwid,2000,self,1,5);
+		sent->staticIps[0] = InetAddress("10.1.2.4/24");
+		sent->toDictionary(*d,false,&next);
+		full->fromDictionary(*d);
+		sent->toDictionary(*d,false,(NetworkConfig::DeltaBase *)0,&base);
+		Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY> *const blob = new Buffer<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+		const bool isDelta = NetworkConfig::isDelta(*d);
+		const bool hasRules = d->get(ZT_NETWORKCONFIG_DICT_KEY_RULES,*blob);
+		const unsigned int deltaSize = d->sizeBytes();
+		const bool noBase = applied->fromDictionary(*d);
+		const bool wrongBase = applied->fromDictionary(*d,full); // a member holding some other config
+		const bool ok = applied->fromDictionary(*d,held);
+		const bool same = ((ok)&&(*applied == *full));
+		delete blob;
+		delete full;
+		delete applied;
+		delete held;
+		delete d;
+		delete sent;
+		if ((!isDelta)||(hasRules)||(deltaSize >= fullSize)) {
+			std::cout << "FAILED! (delta of " << deltaSize << " bytes vs. " << fullSize << " full includes unchanged sections)" << std::endl;
+			return -1;
+		}
+		if ((noBase)||(wrongBase)) {
+			std::cout << "FAILED! (delta applied to wrong base)" << std::endl;
+			return -1;
+		}
+		if (!same) {
+			std::cout << "FAILED! (delta applied to base differs from full config)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS (" << deltaSize << " of " << fullSize << " bytes)" << std::endl;
+	}
+
+	std::cout << "[other] Testing flow hashing... "; std::cout.flush();
+	{
+		uint8_t f1[64],f2[64];
+		memset(f1,0,sizeof(f1));
+		f1[0] = 0x45; // IPv4, 20 byte header
+		f1[9] = 0x06; // TCP
+		f1[12] = 10; f1[15] = 1; // 10.0.0.1
+		f1[16] = 10; f1[19] = 2; // 10.0.0.2
+		f1[20] = 0x1f; f1[21] = 0x90; // 8080
+		f1[22] = 0xc3; f1[23] = 0x50; // 50000
+		memcpy(f2,f1,sizeof(f2));
+		f2[40] = 0xff; // payload does not matter
+		const int32_t h1 = CompiledRules::flowHash(f1,sizeof(f1),ZT_ETHERTYPE_IPV4);
+		if ((h1 < 0)||(CompiledRules::flowHash(f2,sizeof(f2),ZT_ETHERTYPE_IPV4) != h1)) {
+			std::cout << "FAILED! (same flow hashed differently)" << std::endl;
+			return -1;
+		}
+		f2[23] = 0x51;
+		if (CompiledRules::flowHash(f2,sizeof(f2),ZT_ETHERTYPE_IPV4) == h1) {
+			std::cout << "FAILED! (port not hashed)" << std::endl;
+			return -1;
+		}
+		f1[6] = 0x20; // more fragments, offset 0
+		f2[6] = 0x00; f2[7] = 0x10; // last fragment, ports field is really payload
+		if (CompiledRules::flowHash(f1,sizeof(f1),ZT_ETHERTYPE_IPV4) != CompiledRules::flowHash(f2,sizeof(f2),ZT_ETHERTYPE_IPV4)) {
+			std::cout << "FAILED! (fragments of one datagram hashed differently)" << std::endl;
+			return -1;
+		}
+		if (CompiledRules::flowHash(f1,sizeof(f1),ZT_ETHERTYPE_ARP) != ZT_MULTIPATH_NO_FLOW) {
+			std::cout << "FAILED! (non-IP frame has a flow)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing adaptive compression... "; std::cout.flush();
+	{
+		const Address src((uint64_t)0x1111111111ULL),dst((uint64_t)0x2222222222ULL);
+		uint8_t noise[1024],text[1024];
+		Utils::getSecureRandom(noise,sizeof(noise));
+		for(unsigned int i=0;i<sizeof(text);++i)
+			text[i] = (uint8_t)("compressible "[i % 13]);
+		AdaptiveCompression ac;
+		int64_t now = 1000;
+		unsigned int tried = 0;
+		for(int k=0;k<100;++k,now+=10) { // 1s of incompressible traffic
+			Packet p(dst,src,Packet::VERB_FRAME);
+			p.append(noise,sizeof(noise));
+			const uint64_t before = ac.attempts();
+			if (ac.compress(p,dst,443,now)) {
+				std::cout << "FAILED! (random data compressed)" << std::endl;
+				return -1;
+			}
+			tried += (unsigned int)(ac.attempts() - before);
+		}
+		if ((tried < ZT_COMPRESSION_FAILURES_BEFORE_BACKOFF)||(tried > (ZT_COMPRESSION_FAILURES_BEFORE_BACKOFF + 3))||(ac.skipped() != (100 - tried))) {
+			std::cout << "FAILED! (no back-off on incompressible traffic, " << tried << " attempts)" << std::endl;
+			return -1;
+		}
+		for(int k=0;k<10;++k) {
+			Packet p(dst,src,Packet::VERB_FRAME);
+			p.append(text,sizeof(text));
+			if (!ac.compress(p,dst,80,now)) {
+				std::cout << "FAILED! (compressible traffic class held back)" << std::endl;
+				return -1;
+			}
+		}
+		now += ZT_COMPRESSION_BACKOFF_MAX;
+		Packet p(dst,src,Packet::VERB_FRAME);
+		p.append(text,sizeof(text));
+		if ((!ac.compress(p,dst,443,now))||(ac.bytesSaved() == 0)) {
+			std::cout << "FAILED! (traffic class not re-probed after back-off)" << std::endl;
+			return -1;
+		}
+		ac.clean(now + ZT_COMPRESSION_ENTRY_TIMEOUT);
+		if (ac.size() != 0) {
+			std::cout << "FAILED! (idle entries not cleaned)" << std::endl;
+			return -1;
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing peer store... "; std::cout.flush();
+	{
+		const char *const path = "zt-selftest-peers.db";
+		OSUtils::rm(path);
+		std::map< uint64_t,std::string > ref;
+		char buf[2048];
+		{
+			PeerStore ps;
+			if (!ps.open(path)) {
+				std::cout << "FAILED! (unable to open " << path << ")" << std::endl;
+				return -1;
+			}
+			for(unsigned int k=0;k<20000;++k) {
+				const uint64_t id = (uint64_t)((unsigned int)rand() % 500) + 1;
+				if (((unsigned int)rand() % 10) == 0) {
+					ps.remove(id,k);
+					ref.erase(id);
+				} else {
+					std::string v((size_t)((unsigned int)rand() % 200) + 1,(char)('a' + (k % 26)));
+					ps.put(id,v.data(),(unsigned int)v.length(),k);
+					ref[id] = v;
+				}
+				if ((k % 5000) == 4999)
+					ps.compact(true);
+			}
+		} // closing flushes buffered records
+		PeerStore ps;
+		if ((!ps.open(path))||(ps.size() != ref.size())) {
+			std::cout << "FAILED! (wrong number of records after reopen)" << std::endl;
+			return -1;
+		}
+		for(uint64_t id=1;id<=500;++id) {
+			const int n = ps.get(id,buf,sizeof(buf));
+			std::map< uint64_t,std::string >::const_iterator r(ref.find(id));
+			if ((r == ref.end()) ? (n != -1) : ((n != (int)r->second.length())||(memcmp(buf,r->second.data(),n) != 0))) {
+				std::cout << "FAILED! (record " << id << " does not match)" << std::endl;
+				return -1;
+			}
+		}
+		ps.close();
+		FILE *f = fopen(path,"ab"); // torn record at the end of the file, as after a crash
+		if (f) {
+			fwrite("\0\0\0\0\0\0\0\1\0\0",10,1,f);
+			fclose(f);
+		}
+		if ((!ps.open(path))||(ps.size() != ref.size())) {
+			std::cout << "FAILED! (torn record not dropped)" << std::endl;
+			return -1;
+		}
+		ps.close();
+		OSUtils::rm(path);
+
+#ifndef __WINDOWS__
+		// Writes that keep failing (here past a file size limit) must not buffer without bound
+		if (!ps.open(path)) {
+			std::cout << "FAILED! (unable to reopen " << path << ")" << std::endl;
+			return -1;
+		}
+		const std::string v(1000,'x');
+		for(uint64_t id=1;id<=10;++id)
+			ps.put(id,v.data(),(unsigned int)v.length(),0);
+		ps.flush();
+		const uint64_t onDisk = ps.totalBytes();
+		struct rlimit oldLimit,limit;
+		getrlimit(RLIMIT_FSIZE,&oldLimit);
+		limit = oldLimit;
+		limit.rlim_cur = (rlim_t)(onDisk + 100);
+		void (*const oldSigxfsz)(int) = signal(SIGXFSZ,SIG_IGN);
+		setrlimit(RLIMIT_FSIZE,&limit);
+		uint64_t maxBuffered = 0;
+		for(uint64_t id=11;id<=3000;++id) {
+			ps.put(id,v.data(),(unsigned int)v.length(),0);
+			maxBuffered = std::max(maxBuffered,ps.totalBytes() - onDisk);
+		}
+		setrlimit(RLIMIT_FSIZE,&oldLimit);
+		signal(SIGXFSZ,oldSigxfsz);
+		if (maxBuffered > (ZT_PEER_STORE_MAX_PENDING + 2048)) {
+			std::cout << "FAILED! (" << maxBuffered << " bytes buffered after failed writes)" << std::endl;
+			return -1;
+		}
+		for(uint64_t id=1;id<=10;++id) {
+			if (ps.get(id,buf,sizeof(buf)) != (int)v.length()) {
+				std::cout << "FAILED! (record " << id << " on disk lost after failed writes)" << std::endl;
+				return -1;
+			}
+		}
+		ps.put(5000,v.data(),(unsigned int)v.length(),0);
+		ps.close();
+		if ((!ps.open(path))||(ps.get(5000,buf,sizeof(buf)) != (int)v.length())||(ps.get(1,buf,sizeof(buf)) != (int)v.length())) {
+			std::cout << "FAILED! (store unusable after failed writes)" << std::endl;
+			return -1;
+		}
+		ps.close();
+		OSUtils::rm(path);
+#endif
+	}
+	std::cout << "PASS" << std::endl;
+
 	std::cout << "[other] Testing/fuzzing Dictionary... "; std::cout.flush();
 	for(int k=0;k<1000;++k) {
 		Dictionary<8194> *test = new Dictionary<8194>();
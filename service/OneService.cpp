@@ -46,6 +46,8 @@
 #include "../node/Node.hpp"
 #include "../node/Utils.hpp"
 #include "../node/InetAddress.hpp"
+#include "../node/Address.hpp"
+#include "../node/Packet.hpp"
 #include "../node/MAC.hpp"
 #include "../node/Identity.hpp"
 #include "../node/World.hpp"
@@ -61,6 +63,7 @@
 #include "../osdep/Binder.hpp"
 #include "../osdep/ManagedRoute.hpp"
 #include "../osdep/BlockingQueue.hpp"
+#include "../osdep/PeerStore.hpp"
 
 #include "OneService.hpp"
 #include "SoftwareUpdater.hpp"
@@ -140,6 +143,12 @@ using json = nlohmann::json;
 // TCP activity timeout
 #define ZT_TCP_ACTIVITY_TIMEOUT 60000
 
+// Maximum number of relay worker threads
+#define ZT_RELAY_MAX_THREADS 64
+
+// Packets a relay worker can have queued before further packets for it are dropped
+#define ZT_RELAY_WORKER_QUEUE_SIZE 256
+
 #if ZT_VAULT_SUPPORT
 size_t curlResponseWrite(void *ptr, size_t size, size_t nmemb, std::string *data)
 {
@@ -213,6 +222,28 @@ static void _networkToJson(nlohmann::json &nj,const ZT_VirtualNetworkConfig *nc,
 	nj["allowGlobal"] = localSettings.allowGlobal;
 	nj["allowDefault"] = localSettings.allowDefault;
 
+	nlohmann::json fc;
+	fc["size"] = nc->flowCacheSize;
+	fc["hits"] = nc->flowCacheHits;
+	fc["misses"] = nc->flowCacheMisses;
+	fc["bypasses"] = nc->flowCacheBypasses;
+	nj["flowCache"] = fc;
+
+	nlohmann::json nbc;
+	nbc["enabled"] = (bool)(nc->neighborCacheEnabled != 0);
+	nbc["size"] = nc->neighborCacheSize;
+	nbc["answered"] = nc->neighborCacheAnswered;
+	nbc["misses"] = nc->neighborCacheMisses;
+	nj["neighborCache"] = nbc;
+
+	nlohmann::json cmp;
+	cmp["attempts"] = nc->compressionAttempts;
+	cmp["skipped"] = nc->compressionSkipped;
+	cmp["bytesIn"] = nc->compressionBytesIn;
+	cmp["bytesSaved"] = nc->compressionBytesSaved;
+	cmp["cpuTime"] = nc->compressionCpuTime;
+	nj["compression"] = cmp;
+
 	nlohmann::json aa = nlohmann::json::array();
 	for(unsigned int i=0;i<nc->assignedAddressCount;++i) {
 		aa.push_back(reinterpret_cast<const InetAddress *>(&(nc->assignedAddresses[i]))->toString(tmp));
@@ -275,6 +306,11 @@ static void _peerToJson(nlohmann::json &pj,const ZT_Peer *peer)
 		j["active"] = (bool)(peer->paths[i].expired == 0);
 		j["expired"] = (bool)(peer->paths[i].expired != 0);
 		j["preferred"] = (bool)(peer->paths[i].preferred != 0);
+		j["failed"] = (bool)(peer->paths[i].failed != 0);
+		j["failures"] = peer->paths[i].failures;
+		j["lastDetectionTime"] = peer->paths[i].lastDetectionTime;
+		j["unansweredBytes"] = peer->paths[i].unansweredBytes;
+		j["mtu"] = peer->paths[i].mtu;
 		pa.push_back(j);
 	}
 	pj["paths"] = pa;
@@ -307,6 +343,7 @@ static void _peerAggregateLinkToJson(nlohmann::json &pj,const ZT_Peer *peer)
 		j["throughput"] = peer->paths[i].throughput;
 		//j["maxThroughput"] = peer->paths[i].maxThroughput;
 		j["allocation"] = peer->paths[i].allocation;
+		j["flows"] = peer->paths[i].flows;
 		j["ifname"] = peer->paths[i].ifname;
 		pa.push_back(j);
 	}
@@ -437,6 +474,7 @@ public:
 	EmbeddedNetworkController *_controller;
 	Phy<OneServiceImpl *> _phy;
 	Node *_node;
+	PeerStore _peerStore;
 	SoftwareUpdater *_updater;
 	PhySocket *_localControlSocket4;
 	PhySocket *_localControlSocket6;
@@ -444,6 +482,12 @@ public:
 	bool _allowTcpFallbackRelay;
 	bool _allowSecondaryPort;
 	unsigned int _multipathMode;
+	unsigned int _multipathFailoverBudget;
+	bool _frameAggregation;
+	unsigned int _fecLossThreshold;
+	bool _pathMtuDiscovery;
+	unsigned int _relayThreads;
+	uint64_t _peerMemoryBudget;
 	unsigned int _primaryPort;
 	unsigned int _secondaryPort;
 	unsigned int _tertiaryPort;
@@ -489,6 +533,26 @@ public:
 	// Deadline for the next background task service function
 	volatile int64_t _nextBackgroundTaskDeadline;
 
+	// Relay worker threads, each of which relays packets for a shard of destination addresses
+	struct RelayPacket
+	{
+		int64_t sock;
+		struct sockaddr_storage from;
+		unsigned int len;
+		uint8_t data[ZT_MAX_PHYSPAYLOAD];
+	};
+	struct RelayWorker
+	{
+		RelayWorker() : pool(new RelayPacket[ZT_RELAY_WORKER_QUEUE_SIZE]) {}
+		~RelayWorker() { delete [] pool; }
+		RelayPacket *const pool;
+		std::vector<RelayPacket *> idle;
+		std::mutex idle_l;
+		BlockingQueue<RelayPacket *> queue;
+		std::thread thread;
+	};
+	std::vector<RelayWorker *> _relayWorkers;
+
 	// Configured networks
 	struct NetworkState
 	{
@@ -554,6 +618,11 @@ public:
 		,_localControlSocket4((PhySocket *)0)
 		,_localControlSocket6((PhySocket *)0)
 		,_updateAutoApply(false)
+		,_frameAggregation(false)
+		,_fecLossThreshold(0)
+		,_pathMtuDiscovery(true)
+		,_relayThreads(0)
+		,_peerMemoryBudget(0)
 		,_primaryPort(port)
 		,_udpPortPickerCounter(0)
 		,_lastDirectReceiveFromGlobal(0)
@@ -626,6 +695,19 @@ public:
 				_authToken = _trimString(_authToken);
 			}
 
+			// Peer cache (peers.db), importing any old one file per peer peers.d
+			{
+				const std::string peersDb(_homePath + ZT_PATH_SEPARATOR_S "peers.db");
+				const std::string peersDir(_homePath + ZT_PATH_SEPARATOR_S "peers.d");
+				if (!_peerStore.open(peersDb.c_str())) {
+					fprintf(stderr,"WARNING: unable to open peer cache: %s" ZT_EOL_S,peersDb.c_str());
+				} else if (OSUtils::fileExists(peersDir.c_str())) {
+					_peerStore.importDirectory(peersDir.c_str(),OSUtils::now());
+					_peerStore.flush();
+					OSUtils::rmDashRf(peersDir.c_str());
+				}
+			}
+
 			{
 				struct ZT_Node_Callbacks cb;
 				cb.version = 0;
@@ -644,6 +726,8 @@ public:
 			readLocalSettings();
 			applyLocalConfig();
 
+			_startRelayThreads();
+
 			// Make sure we can use the primary port, and hunt for one if configured to do so
 			const int portTrials = (_primaryPort == 0) ? 256 : 1; // if port is 0, pick random
 			for(int k=0;k<portTrials;++k) {
@@ -766,6 +850,7 @@ public:
 			int64_t lastUpdateCheck = clockShouldBe;
 			int64_t lastMultipathModeUpdate = 0;
 			int64_t lastCleanedPeersDb = 0;
+			int64_t lastFlushedPeersDb = 0;
 			int64_t lastLocalInterfaceAddressCheck = (clockShouldBe - ZT_LOCAL_INTERFACE_CHECK_INTERVAL) + 15000; // do this in 15s to give portmapper time to configure and other things time to settle
 			int64_t lastLocalConfFileCheck = OSUtils::now();
 			for(;;) {
@@ -831,6 +916,11 @@ public:
 				if (((now - lastMultipathModeUpdate) >= ZT_BINDER_REFRESH_PERIOD / 8)||(restarted)) {
 					lastMultipathModeUpdate = now;
 					_node->setMultipathMode(_multipathMode);
+					_node->setMultipathFailoverBudget(_multipathFailoverBudget);
+					_node->setFrameAggregation(_frameAggregation);
+					_node->setFecLossThreshold((float)_fecLossThreshold / 100.0f);
+					_node->setPathMtuDiscovery(_pathMtuDiscovery);
+					_node->setPeerMemoryBudget(_peerMemoryBudget);
 				}
 
 				// Run background task processor in core if it's time to do so
@@ -885,10 +975,15 @@ public:
 						_node->addLocalInterfaceAddress(reinterpret_cast<const struct sockaddr_storage *>(&(*i)));
 				}
 
-				// Clean peers.d periodically
+				// Write buffered peer cache records, and expire and compact the peer cache hourly
+				if ((now - lastFlushedPeersDb) >= ZT_PEER_STORE_FLUSH_INTERVAL) {
+					lastFlushedPeersDb = now;
+					_peerStore.flush();
+				}
 				if ((now - lastCleanedPeersDb) >= 3600000) {
 					lastCleanedPeersDb = now;
-					OSUtils::cleanDirectory((_homePath + ZT_PATH_SEPARATOR_S "peers.d").c_str(),now - 2592000000LL); // delete older than 30 days
+					_peerStore.expire(now - 2592000000LL,now); // delete older than 30 days
+					_peerStore.compact();
 				}
 
 				const unsigned long delay = (dl > now) ? (unsigned long)(dl - now) : 100;
@@ -916,14 +1011,47 @@ public:
 			_nets.clear();
 		}
 
+		_stopRelayThreads();
+
 		delete _updater;
 		_updater = (SoftwareUpdater *)0;
 		delete _node;
 		_node = (Node *)0;
+		_peerStore.close(); // after the node, which saves its peers on delete
 
 		return _termReason;
 	}
 
+	void _startRelayThreads()
+	{
+		for(unsigned int t=0;t<_relayThreads;++t) {
+			RelayWorker *const w = new RelayWorker();
+			for(unsigned int i=0;i<ZT_RELAY_WORKER_QUEUE_SIZE;++i)
+				w->idle.push_back(w->pool + i);
+			w->thread = std::thread([this,w]() {
+				for(;;) {
+					RelayPacket *p = (RelayPacket *)0;
+					if (!w->queue.get(p))
+						break;
+					_node->processWirePacket((void *)0,OSUtils::now(),p->sock,&(p->from),p->data,p->len,&_nextBackgroundTaskDeadline);
+					std::lock_guard<std::mutex> l(w->idle_l);
+					w->idle.push_back(p);
+				}
+			});
+			_relayWorkers.push_back(w);
+		}
+	}
+
+	void _stopRelayThreads()
+	{
+		for(std::vector<RelayWorker *>::iterator w(_relayWorkers.begin());w!=_relayWorkers.end();++w) {
+			(*w)->queue.stop();
+			(*w)->thread.join();
+			delete *w;
+		}
+		_relayWorkers.clear();
+	}
+
 	void readLocalSettings()
 	{
 		// Read local configuration
@@ -1213,6 +1341,30 @@ public:
 					res["publicIdentity"] = status.publicIdentity;
 					res["online"] = (bool)(status.online != 0);
 					res["tcpFallbackActive"] = (_tcpFallbackTunnel != (TcpConnection *)0);
+					{
+						json &pendingSend = res["pendingSend"];
+						pendingSend["destinations"] = (uint64_t)status.pendingSendDestinations;
+						pendingSend["packets"] = (uint64_t)status.pendingSendPackets;
+						pendingSend["maxDepth"] = (uint64_t)status.pendingSendMaxDepth;
+						pendingSend["dropped"] = status.pendingSendDropped;
+						pendingSend["expired"] = status.pendingSendExpired;
+					}
+					{
+						json &peerTable = res["peerTable"];
+						peerTable["peers"] = (uint64_t)status.peers;
+						peerTable["coldPeers"] = (uint64_t)status.coldPeers;
+						peerTable["bytesPerPeer"] = (uint64_t)status.bytesPerPeer;
+						peerTable["bytesPerColdPeer"] = (uint64_t)status.bytesPerColdPeer;
+						peerTable["bytes"] = ((uint64_t)status.peers * (uint64_t)status.bytesPerPeer) + ((uint64_t)status.coldPeers * (uint64_t)status.bytesPerColdPeer);
+						peerTable["budget"] = status.peerMemoryBudget;
+					}
+					{
+						json &pings = res["pings"];
+						pings["sent"] = status.pingsSent;
+						pings["deferred"] = status.pingsDeferred;
+						pings["perSecond"] = (uint64_t)status.pingRate;
+						pings["burst"] = (uint64_t)status.pingBurst;
+					}
 					res["versionMajor"] = ZEROTIER_ONE_VERSION_MAJOR;
 					res["versionMinor"] = ZEROTIER_ONE_VERSION_MINOR;
 					res["versionRev"] = ZEROTIER_ONE_VERSION_REVISION;
@@ -1580,10 +1732,23 @@ public:
 			fprintf(stderr,"WARNING: using manually-specified ports. This can cause NAT issues." ZT_EOL_S);
 		}
 		_multipathMode = (unsigned int)OSUtils::jsonInt(settings["multipathMode"],0);
+		_multipathFailoverBudget = (unsigned int)OSUtils::jsonInt(settings["multipathFailoverBudget"],ZT_MULTIPATH_AB_FAILOVER_BUDGET);
 		if (_multipathMode != 0 && _allowTcpFallbackRelay) {
 			fprintf(stderr,"WARNING: multipathMode cannot be used with allowTcpFallbackRelay. Disabling allowTcpFallbackRelay" ZT_EOL_S);
 			_allowTcpFallbackRelay = false;
 		}
+		_frameAggregation = OSUtils::jsonBool(settings["frameAggregation"],false);
+#ifndef __LINUX__
+		// Only the Linux tap reports the end of each batch of frames it reads
+		if (_frameAggregation) {
+			fprintf(stderr,"WARNING: frameAggregation is not supported on this platform. Disabling frameAggregation" ZT_EOL_S);
+			_frameAggregation = false;
+		}
+#endif
+		_fecLossThreshold = std::min((unsigned int)OSUtils::jsonInt(settings["fecLossThreshold"],0),100U);
+		_pathMtuDiscovery = OSUtils::jsonBool(settings["pathMtuDiscovery"],true);
+		_peerMemoryBudget = OSUtils::jsonInt(settings["peerMemoryBudget"],0) * 1048576ULL;
+		_relayThreads = std::min((unsigned int)OSUtils::jsonInt(settings["relayThreads"],0),(unsigned int)ZT_RELAY_MAX_THREADS);
 		_portMappingEnabled = OSUtils::jsonBool(settings["portMappingEnabled"],true);
 
 #ifndef ZT_SDK
@@ -1836,6 +2001,31 @@ public:
 		const uint64_t now = OSUtils::now();
 		if ((len >= 16)&&(reinterpret_cast<const InetAddress *>(from)->ipScope() == InetAddress::IP_SCOPE_GLOBAL))
 			_lastDirectReceiveFromGlobal = now;
+
+		if ((!_relayWorkers.empty())&&(len > ZT_PROTO_MIN_FRAGMENT_LENGTH)&&(len <= ZT_MAX_PHYSPAYLOAD)) {
+			// Packets for other nodes go to the relay worker for their destination, which keeps them in order
+			const Address destination(reinterpret_cast<const uint8_t *>(data) + 8,ZT_ADDRESS_LENGTH);
+			if (destination.toInt() != _node->address()) {
+				RelayWorker *const w = _relayWorkers[(unsigned int)(destination.toInt() % (uint64_t)_relayWorkers.size())];
+				RelayPacket *p = (RelayPacket *)0;
+				{
+					std::lock_guard<std::mutex> l(w->idle_l);
+					if (!w->idle.empty()) {
+						p = w->idle.back();
+						w->idle.pop_back();
+					}
+				}
+				if (p) { // else the worker is a full queue behind, so drop as a full socket buffer would
+					p->sock = reinterpret_cast<int64_t>(sock);
+					memcpy(&(p->from),from,sizeof(struct sockaddr_storage));
+					p->len = (unsigned int)len;
+					memcpy(p->data,data,len);
+					w->queue.post(p);
+				}
+				return;
+			}
+		}
+
 		const ZT_ResultCode rc = _node->processWirePacket(nullptr,now,reinterpret_cast<int64_t>(sock),reinterpret_cast<const struct sockaddr_storage *>(from),data,len,&_nextBackgroundTaskDeadline);
 		if (ZT_ResultCode_isFatal(rc)) {
 			char tmp[256];
@@ -1975,7 +2165,7 @@ public:
 				case TcpConnection::TCP_TUNNEL_OUTGOING:
 					tc->readq.append((const char *)data,len);
 					while (tc->readq.length() >= 5) {
-						const char *data = tc->readq.data();
+						char *data = &(tc->readq[0]);
 						const unsigned long mlen = ( ((((unsigned long)data[3]) & 0xff) << 8) | (((unsigned long)data[4]) & 0xff) );
 						if (tc->readq.length() >= (mlen + 5)) {
 							InetAddress from;
@@ -2353,9 +2543,10 @@ public:
 				secure = true;
 				break;
 			case ZT_STATE_OBJECT_PEER:
-				OSUtils::ztsnprintf(dirname,sizeof(dirname),"%s" ZT_PATH_SEPARATOR_S "peers.d",_homePath.c_str());
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "%.10llx.peer",dirname,(unsigned long long)id[0]);
-				break;
+				if ((len > 0)&&(data))
+					_peerStore.put(id[0],data,(unsigned int)len,OSUtils::now());
+				else _peerStore.remove(id[0],OSUtils::now());
+				return;
 			default:
 				return;
 		}
@@ -2502,8 +2693,7 @@ public:
 				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "networks.d" ZT_PATH_SEPARATOR_S "%.16llx.conf",_homePath.c_str(),(unsigned long long)id[0]);
 				break;
 			case ZT_STATE_OBJECT_PEER:
-				OSUtils::ztsnprintf(p,sizeof(p),"%s" ZT_PATH_SEPARATOR_S "peers.d" ZT_PATH_SEPARATOR_S "%.10llx.peer",_homePath.c_str(),(unsigned long long)id[0]);
-				break;
+				return _peerStore.get(id[0],data,maxlen);
 			default:
 				return -1;
 		}
@@ -2530,8 +2720,12 @@ public:
 
 	inline int nodeWirePacketSendFunction(const int64_t localSocket,const struct sockaddr_storage *addr,const void *data,unsigned int len,unsigned int ttl)
 	{
+		// Path MTU probes must not be fragmented, or tunneled since that would hide the path's real MTU
+		const bool dontFragment = ((ttl & ZT_WIRE_PACKET_DONT_FRAGMENT) != 0);
+		ttl &= ~((unsigned int)ZT_WIRE_PACKET_DONT_FRAGMENT);
+
 #ifdef ZT_TCP_FALLBACK_RELAY
-		if(_allowTcpFallbackRelay) {
+		if((_allowTcpFallbackRelay)&&(!dontFragment)) {
 			if (addr->ss_family == AF_INET) {
 				// TCP fallback tunnel support, currently IPv4 only
 				if ((len >= 16)&&(reinterpret_cast<const InetAddress *>(addr)->ipScope() == InetAddress::IP_SCOPE_GLOBAL)) {
@@ -2593,10 +2787,7 @@ public:
 		// proxy fallback, which is slow.
 
 		if ((localSocket != -1)&&(localSocket != 0)&&(_binder.isUdpSocketValid((PhySocket *)((uintptr_t)localSocket)))) {
-			if ((ttl)&&(addr->ss_family == AF_INET)) _phy.setIp4UdpTtl((PhySocket *)((uintptr_t)localSocket),ttl);
-			const bool r = _phy.udpSend((PhySocket *)((uintptr_t)localSocket),(const struct sockaddr *)addr,data,len);
-			if ((ttl)&&(addr->ss_family == AF_INET)) _phy.setIp4UdpTtl((PhySocket *)((uintptr_t)localSocket),255);
-			return ((r) ? 0 : -1);
+			return ((_binder.udpSend(_phy,(PhySocket *)((uintptr_t)localSocket),addr,data,len,ttl,dontFragment)) ? 0 : -1);
 		} else {
 			return ((_binder.udpSendAll(_phy,addr,data,len,ttl)) ? 0 : -1);
 		}
@@ -2681,6 +2872,11 @@ public:
 
 	inline void tapFrameHandler(uint64_t nwid,const MAC &from,const MAC &to,unsigned int etherType,unsigned int vlanId,const void *data,unsigned int len)
 	{
+		if (!len) { // end of a batch of frames read from the tap
+			if (_frameAggregation)
+				_node->flushVirtualNetworkFrames((void *)0,nwid);
+			return;
+		}
 		_node->processVirtualNetworkFrame((void *)0,OSUtils::now(),nwid,from.toInt(),to.toInt(),etherType,vlanId,data,len,&_nextBackgroundTaskDeadline);
 	}
 